@@ -0,0 +1,146 @@
+#include "AreaPortals.h"
+#include <algorithm>
+
+void AreaPortals::BoxAreas(const BSPMap& map, int nodeIndex, const glm::vec3& mins, const glm::vec3& maxs, std::vector<int>& areas) const {
+    const std::vector<Node>& nodes = map.GetNodes();
+    const std::vector<Plane>& planes = map.GetPlanes();
+
+    while (nodeIndex >= 0) {
+        const Node& node = nodes[nodeIndex];
+        const Plane& plane = planes[node.plane];
+
+        // Distances of the box corners nearest and furthest along the plane normal
+        float nearDist = -plane.distance;
+        float farDist = -plane.distance;
+        for (int i = 0; i < 3; ++i) {
+            float a = plane.normal[i] * mins[i];
+            float b = plane.normal[i] * maxs[i];
+            nearDist += std::min(a, b);
+            farDist += std::max(a, b);
+        }
+
+        if (nearDist >= 0.0f) {
+            nodeIndex = node.children[0];
+        }
+        else if (farDist < 0.0f) {
+            nodeIndex = node.children[1];
+        }
+        else {
+            BoxAreas(map, node.children[0], mins, maxs, areas);
+            nodeIndex = node.children[1];
+        }
+    }
+
+    int area = map.GetLeafs()[-nodeIndex - 1].area;
+    if (area >= 0 && std::find(areas.begin(), areas.end(), area) == areas.end()) {
+        areas.push_back(area);
+    }
+}
+
+void AreaPortals::Build(const BSPMap& map, const MoverSystem& movers) {
+    // Without a node tree there is nothing to link, every area stays reachable
+    numAreas = 0;
+    if (!map.GetNodes().empty()) {
+        for (const Leaf& leaf : map.GetLeafs()) {
+            numAreas = std::max(numAreas, leaf.area + 1);
+        }
+    }
+
+    portals.clear();
+    const std::vector<Mover>& moverList = movers.GetMovers();
+
+    for (int i = 0; i < static_cast<int>(moverList.size()) && numAreas > 0; ++i) {
+        const Mover& mover = moverList[i];
+
+        // Doors drive their own portal, a func_areaportal is driven by the door targeting it
+        int driver = -1;
+        if (mover.type == MoverType::Door) {
+            driver = i;
+        }
+        else if (mover.classname == "func_areaportal") {
+            for (int j = 0; j < static_cast<int>(moverList.size()); ++j) {
+                if (moverList[j].type == MoverType::Door && !mover.targetname.empty() && moverList[j].target == mover.targetname) {
+                    driver = j;
+                    break;
+                }
+            }
+        }
+        else {
+            continue;
+        }
+
+        // Like Q3's SV_LinkEntity, a portal exists when the bounds touch exactly two areas
+        std::vector<int> areas;
+        glm::vec3 mins = mover.mins + mover.origin;
+        glm::vec3 maxs = mover.maxs + mover.origin;
+        BoxAreas(map, 0, mins, maxs, areas);
+        if (areas.size() != 2) {
+            continue;
+        }
+
+        Portal portal;
+        portal.areas[0] = areas[0];
+        portal.areas[1] = areas[1];
+        portal.mover = driver;
+        portal.open = true;
+        portals.push_back(portal);
+    }
+
+    areaPortalCounts.assign(numAreas * numAreas, 0);
+    reachable.assign(numAreas, 1);
+    allReachable = true;
+}
+
+void AreaPortals::Update(const MoverSystem& movers, int startArea) {
+    const std::vector<Mover>& moverList = movers.GetMovers();
+
+    std::fill(areaPortalCounts.begin(), areaPortalCounts.end(), 0);
+    openPortals = 0;
+    for (Portal& portal : portals) {
+        // An areaportal nothing controls stays open
+        portal.open = portal.mover < 0 || moverList[portal.mover].state != MoverState::Closed;
+        if (portal.open) {
+            ++areaPortalCounts[portal.areas[0] * numAreas + portal.areas[1]];
+            ++areaPortalCounts[portal.areas[1] * numAreas + portal.areas[0]];
+            ++openPortals;
+        }
+    }
+
+    bool wasAllReachable = allReachable;
+    previousReachable = reachable;
+
+    allReachable = startArea < 0 || startArea >= numAreas;
+    if (allReachable) {
+        if (!wasAllReachable) {
+            ++version;
+        }
+        return;
+    }
+
+    std::fill(reachable.begin(), reachable.end(), 0);
+    floodStack.clear();
+    floodStack.push_back(startArea);
+    reachable[startArea] = 1;
+    while (!floodStack.empty()) {
+        int area = floodStack.back();
+        floodStack.pop_back();
+        const int* counts = &areaPortalCounts[area * numAreas];
+        for (int other = 0; other < numAreas; ++other) {
+            if (counts[other] > 0 && !reachable[other]) {
+                reachable[other] = 1;
+                floodStack.push_back(other);
+            }
+        }
+    }
+
+    if (wasAllReachable || reachable != previousReachable) {
+        ++version;
+    }
+}
+
+bool AreaPortals::IsAreaReachable(int area) const {
+    if (allReachable || area < 0 || area >= numAreas) {
+        return true;
+    }
+    return reachable[area] != 0;
+}
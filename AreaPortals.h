@@ -0,0 +1,52 @@
+#ifndef AREAPORTALS_H
+#define AREAPORTALS_H
+
+#include <glm/glm.hpp>
+#include <vector>
+#include "BSPMap.h"
+#include "Movers.h"
+
+/*
+Area connectivity. Leafs are grouped into areas that only connect through area portals, which in practice
+sit inside doors. A door (or a func_areaportal triggered by one) joins the two areas its bounds touch,
+the same way Q3 links door entities to portals. Each frame the areas reachable from the camera's area
+through open portals are flood filled, and leafs in any other area can be rejected before PVS or frustum tests.
+*/
+
+class AreaPortals {
+public:
+    // Finds the portals of every mover, must be called after MoverSystem::Spawn
+    void Build(const BSPMap& map, const MoverSystem& movers);
+
+    // Opens or closes portals from the current mover states and floods from startArea.
+    // An area below zero (camera outside the map) makes every area reachable.
+    void Update(const MoverSystem& movers, int startArea);
+
+    bool IsAreaReachable(int area) const;
+    int GetAreaCount() const { return numAreas; }
+    int GetPortalCount() const { return static_cast<int>(portals.size()); }
+    int GetOpenPortalCount() const { return openPortals; }
+    // Changes whenever the set of reachable areas changes, lets callers keep results built from it
+    unsigned int GetVersion() const { return version; }
+
+private:
+    struct Portal {
+        int areas[2];
+        int mover;     // Mover whose state opens and closes the portal
+        bool open;
+    };
+
+    void BoxAreas(const BSPMap& map, int nodeIndex, const glm::vec3& mins, const glm::vec3& maxs, std::vector<int>& areas) const;
+
+    int numAreas = 0;
+    std::vector<Portal> portals;
+    std::vector<int> areaPortalCounts;     // numAreas * numAreas count of open portals between two areas
+    std::vector<unsigned char> reachable;  // Per area, result of the last flood fill
+    std::vector<unsigned char> previousReachable;
+    std::vector<int> floodStack;
+    bool allReachable = true;
+    unsigned int version = 0;
+    int openPortals = 0;
+};
+
+#endif // AREAPORTALS_H
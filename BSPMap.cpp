@@ -2,6 +2,8 @@
 #include <iostream>
 #include <vector>
 #include <fstream>
+#include <cstring>
+#include <cstdio>
 
 BSPMap::BSPMap() {
     // Constructor initialization if needed
@@ -51,6 +53,61 @@ bool BSPMap::LoadAllLumps(const std::string& filename)
         return false;
     }
 
+    if (!LoadLeafs()) {
+        std::cerr << "Failed to load leafs from BSP file." << std::endl;
+        return false;
+    }
+
+    if (!LoadLeafFaces()) {
+        std::cerr << "Failed to load leaf faces from BSP file." << std::endl;
+        return false;
+    }
+
+    if (!LoadLeafBrushes()) {
+        std::cerr << "Failed to load leaf brushes from BSP file." << std::endl;
+        return false;
+    }
+
+    if (!LoadBrushes()) {
+        std::cerr << "Failed to load brushes from BSP file." << std::endl;
+        return false;
+    }
+
+    if (!LoadBrushSides()) {
+        std::cerr << "Failed to load brush sides from BSP file." << std::endl;
+        return false;
+    }
+
+    if (!LoadVisData()) {
+        std::cerr << "Failed to load vis data from BSP file." << std::endl;
+        return false;
+    }
+
+    if (!LoadLightmaps()) {
+        std::cerr << "Failed to load lightmaps from BSP file." << std::endl;
+        return false;
+    }
+
+    if (!LoadLightVolumes()) {
+        std::cerr << "Failed to load light volumes from BSP file." << std::endl;
+        return false;
+    }
+
+    if (!LoadMeshVerts()) {
+        std::cerr << "Failed to load mesh verts from BSP file." << std::endl;
+        return false;
+    }
+
+    if (!LoadModels()) {
+        std::cerr << "Failed to load models from BSP file." << std::endl;
+        return false;
+    }
+
+    if (!ParseEntities()) {
+        std::cerr << "Failed to parse entities from BSP file." << std::endl;
+        return false;
+    }
+
     return true;
 }
 
@@ -111,18 +168,22 @@ bool BSPMap::LoadTextures() {
     // Move to the start of the textures lump in the file
     fileStream.seekg(texturesLump.offset);
 
-    char textureName[64]; // Assuming a fixed size for texture names
-    int numberOfTextures = texturesLump.length / sizeof(textureName);
+    int numberOfTextures = texturesLump.length / sizeof(BSPTexture);
     for (int i = 0; i < numberOfTextures; ++i) {
-        fileStream.read(textureName, sizeof(textureName));
+        BSPTexture texture;
+        fileStream.read(reinterpret_cast<char*>(&texture), sizeof(BSPTexture));
         // Ensure the string is null-terminated
-        textureName[sizeof(textureName) - 1] = '\0';
+        texture.name[sizeof(texture.name) - 1] = '\0';
+
+        // We don't parse shader scripts, so "cull none" is guessed from the contents:
+        // liquids, fog and translucent surfaces are seen from both sides
+        bool twoSided = (texture.contents & (CONTENTS_WATER | CONTENTS_SLIME | CONTENTS_LAVA | CONTENTS_FOG | CONTENTS_TRANSLUCENT)) != 0;
 
         // Add the texture information to the textures vector
-        textures.emplace_back(TextureInfo{ std::string(textureName) });
+        textures.emplace_back(TextureInfo{ std::string(texture.name), texture.flags, texture.contents, twoSided });
 
         // Print the name of the texture
-        std::cout << "Loaded Texture: " << textureName << std::endl;
+        std::cout << "Loaded Texture: " << texture.name << std::endl;
     }
 
     // Textures have been loaded and names printed to console.
@@ -342,7 +403,7 @@ bool BSPMap::LoadFaces() {
     fileStream.read(reinterpret_cast<char*>(faces.data()), facesLump.length);
 
     // Optional: Print details of each face for verification
-    for (const auto& face : faces) {
+    /*for (const auto& face : faces) {
         std::cout << "Face: Type " << face.type << ", Texture Index " << face.texture
             << ", Num Vertices " << face.numVertices << std::endl;
 
@@ -351,7 +412,7 @@ bool BSPMap::LoadFaces() {
             std::cout << "\tVertex " << i << ": Position(" << vertex.position[0] << ", "
                 << vertex.position[1] << ", " << vertex.position[2] << ")" << std::endl;
         }
-    }
+    }*/
     return true;
 }
 
@@ -416,6 +477,36 @@ bool BSPMap::LoadBrushSides() {
     return true;
 }
 
+bool BSPMap::LoadModels() {
+    if (!fileStream.is_open()) {
+        std::cerr << "File stream is not open for reading models." << std::endl;
+        return false;
+    }
+
+    auto& modelsLump = lumps[static_cast<int>(LumpType::Models)];
+    if (modelsLump.length <= 0) {
+        std::cerr << "Models lump is empty or not present." << std::endl;
+        return false;
+    }
+
+    int numModels = modelsLump.length / sizeof(Model);
+    models.resize(numModels); // Prepare the vector to hold all the models
+
+    // Move to the start of the models lump in the file
+    fileStream.seekg(modelsLump.offset);
+
+    // Read the models data directly into the vector
+    fileStream.read(reinterpret_cast<char*>(models.data()), modelsLump.length);
+
+    // Optional: Print each model's data for verification
+    /*for (const auto& model : models) {
+        std::cout << "Model: Faces (" << model.firstFace << ", " << model.numFaces << ")"
+            << ", Brushes (" << model.firstBrush << ", " << model.numBrushes << ")" << std::endl;
+    }*/
+
+    return true;
+}
+
 bool BSPMap::LoadMeshVerts() {
     if (!fileStream.is_open()) {
         std::cerr << "File stream is not open for reading mesh verts." << std::endl;
@@ -451,32 +542,228 @@ bool BSPMap::LoadLightmaps() {
         return false;
     }
 
+    lightmaps.clear();
+
+    // Vertex lit maps have no lightmaps, their faces use the vertex colors
     auto& lightmapsLump = lumps[static_cast<int>(LumpType::Lightmaps)];
     if (lightmapsLump.length <= 0) {
-        std::cerr << "Lightmaps lump is empty or not present." << std::endl;
+        std::cout << "Lightmaps lump is empty, using vertex lighting." << std::endl;
+        return true;
+    }
+    if (lightmapsLump.length % LIGHTMAP_BYTES != 0) {
+        std::cerr << "Lightmaps lump size is not a multiple of " << LIGHTMAP_BYTES << " bytes." << std::endl;
         return false;
     }
 
-    // Example: Assuming each lightmap is of a fixed size for simplicity
-    // In practice, you'll need to adjust based on your lightmap data's specifics
-    const int lightmapSize = 128 * 128; // Common lightmap size in bytes for grayscale; adjust for RGB(A)
-    int numLightmaps = lightmapsLump.length / lightmapSize;
-    // Prepare storage for lightmap data; actual implementation depends on your rendering system
-
     // Move to the start of the lightmaps lump in the file
     fileStream.seekg(lightmapsLump.offset);
 
-    // Example: Read lightmap data
-    // This is highly dependent on how you plan to use the lightmaps in your rendering system
-    for (int i = 0; i < numLightmaps; ++i) {
-        std::vector<unsigned char> lightmapData(lightmapSize);
-        fileStream.read(reinterpret_cast<char*>(lightmapData.data()), lightmapSize);
-        // Process or store the lightmap data as needed for your application
+    lightmaps.resize(lightmapsLump.length);
+    fileStream.read(reinterpret_cast<char*>(lightmaps.data()), lightmapsLump.length);
+    std::cout << "Loaded " << GetLightmapCount() << " lightmaps." << std::endl;
+
+    return true;
+}
+
+bool BSPMap::LoadLightVolumes() {
+    if (!fileStream.is_open()) {
+        std::cerr << "File stream is not open for reading light volumes." << std::endl;
+        return false;
+    }
+
+    lightVolumes.clear();
+
+    // Maps compiled without light have no grid, dynamic objects then get no baked lighting
+    auto& lightVolumesLump = lumps[static_cast<int>(LumpType::LightVolumes)];
+    if (lightVolumesLump.length <= 0) {
+        std::cout << "LightVolumes lump is empty, no light grid." << std::endl;
+        return true;
+    }
+
+    fileStream.seekg(lightVolumesLump.offset);
+    lightVolumes.resize(lightVolumesLump.length);
+    fileStream.read(reinterpret_cast<char*>(lightVolumes.data()), lightVolumesLump.length);
+
+    return true;
+}
+
+bool BSPMap::LoadVisData() {
+    if (!fileStream.is_open()) {
+        std::cerr << "File stream is not open for reading vis data." << std::endl;
+        return false;
+    }
+
+    visData = VisData();
+
+    // Maps compiled without -vis have no vis data, everything is then considered visible
+    auto& visDataLump = lumps[static_cast<int>(LumpType::VisData)];
+    if (visDataLump.length <= 0) {
+        std::cout << "VisData lump is empty, PVS culling disabled." << std::endl;
+        return true;
+    }
+
+    int header[2]; // Number of clusters, bytes per cluster
+    if (visDataLump.length < static_cast<int>(sizeof(header))) {
+        std::cerr << "VisData lump is too small." << std::endl;
+        return false;
+    }
+
+    fileStream.seekg(visDataLump.offset);
+    fileStream.read(reinterpret_cast<char*>(header), sizeof(header));
+
+    long long size = static_cast<long long>(header[0]) * header[1];
+    if (header[0] < 0 || header[1] < 0 || size > visDataLump.length - static_cast<int>(sizeof(header))) {
+        std::cerr << "VisData lump is corrupt." << std::endl;
+        return false;
+    }
+
+    visData.numClusters = header[0];
+    visData.bytesPerCluster = header[1];
+    visData.bits.resize(static_cast<size_t>(size));
+    fileStream.read(reinterpret_cast<char*>(visData.bits.data()), size);
+
+    return true;
+}
+
+bool BSPMap::Save(const std::string& filename, const std::map<LumpType, std::vector<char>>& replacements) {
+    if (!fileStream.is_open()) {
+        std::cerr << "File stream is not open for saving." << std::endl;
+        return false;
+    }
+
+    // Read everything we keep before opening the output, it may be the same file
+    std::vector<char> lumpData[static_cast<int>(LumpType::Count)];
+    fileStream.clear();
+    for (int i = 0; i < static_cast<int>(LumpType::Count); ++i) {
+        auto replacement = replacements.find(static_cast<LumpType>(i));
+        if (replacement != replacements.end()) {
+            lumpData[i] = replacement->second;
+            continue;
+        }
+        lumpData[i].resize(lumps[i].length > 0 ? lumps[i].length : 0);
+        fileStream.seekg(lumps[i].offset);
+        fileStream.read(lumpData[i].data(), lumpData[i].size());
+        if (!fileStream) {
+            std::cerr << "Failed to read lump " << i << " for saving." << std::endl;
+            return false;
+        }
+    }
+
+    // Lumps are written in order, each starting on a 4 byte boundary
+    BSPLump newLumps[static_cast<int>(LumpType::Count)];
+    int offset = sizeof(BSPHeader) + sizeof(newLumps);
+    for (int i = 0; i < static_cast<int>(LumpType::Count); ++i) {
+        newLumps[i].offset = offset;
+        newLumps[i].length = static_cast<int>(lumpData[i].size());
+        offset += (newLumps[i].length + 3) & ~3;
+    }
+
+    // Written next to the target and renamed over it, so a failed write leaves the old file alone
+    std::string tempName = filename + ".tmp";
+    std::ofstream out(tempName, std::ios::binary | std::ios::trunc);
+    if (!out.is_open()) {
+        std::cerr << "Failed to open " << tempName << " for writing." << std::endl;
+        return false;
+    }
+    out.write(reinterpret_cast<const char*>(&header), sizeof(BSPHeader));
+    out.write(reinterpret_cast<const char*>(newLumps), sizeof(newLumps));
+    const char padding[4] = { 0, 0, 0, 0 };
+    for (int i = 0; i < static_cast<int>(LumpType::Count); ++i) {
+        out.write(lumpData[i].data(), lumpData[i].size());
+        out.write(padding, ((newLumps[i].length + 3) & ~3) - newLumps[i].length);
+    }
+    out.close();
+    if (!out) {
+        std::cerr << "Failed to write " << tempName << "." << std::endl;
+        std::remove(tempName.c_str());
+        return false;
+    }
+
+    // The map reads from the new file from now on, its lumps may have moved
+    fileStream.close();
+    std::remove(filename.c_str());
+    if (std::rename(tempName.c_str(), filename.c_str()) != 0) {
+        std::cerr << "Failed to rename " << tempName << " to " << filename << "." << std::endl;
+        return false;
+    }
+    std::memcpy(lumps, newLumps, sizeof(lumps));
+    fileStream.clear();
+    fileStream.open(filename, std::ios::binary);
+    if (!fileStream.is_open()) {
+        std::cerr << "Failed to reopen the BSP file: " << filename << std::endl;
+        return false;
     }
 
     return true;
 }
 
+void BSPMap::SetVisData(const VisData& data) {
+    visData = data;
+}
+
+void BSPMap::SetLeafCluster(int leaf, int cluster) {
+    leafs[leaf].cluster = cluster;
+}
+
+void BSPMap::SetTree(const std::vector<Node>& newNodes, const std::vector<Leaf>& newLeafs) {
+    nodes = newNodes;
+    leafs = newLeafs;
+}
+
+bool BSPMap::ParseEntities() {
+    // The entity lump is plain text: a list of { "key" "value" ... } blocks
+    parsedEntities.clear();
+
+    Entity current;
+    bool inEntity = false;
+    std::string key;
+    bool haveKey = false;
+
+    for (size_t i = 0; i < entities.size(); ++i) {
+        char c = entities[i];
+        if (c == '{') {
+            if (inEntity) {
+                std::cerr << "Unexpected '{' inside entity." << std::endl;
+                return false;
+            }
+            current = Entity();
+            inEntity = true;
+            haveKey = false;
+        }
+        else if (c == '}') {
+            if (!inEntity) {
+                std::cerr << "Unexpected '}' outside entity." << std::endl;
+                return false;
+            }
+            parsedEntities.push_back(current);
+            inEntity = false;
+        }
+        else if (c == '"') {
+            size_t end = entities.find('"', i + 1);
+            if (end == std::string::npos || !inEntity) {
+                std::cerr << "Malformed entity string." << std::endl;
+                return false;
+            }
+            std::string token = entities.substr(i + 1, end - i - 1);
+            if (!haveKey) {
+                key = token;
+                haveKey = true;
+            }
+            else {
+                current.properties[key] = token;
+                haveKey = false;
+            }
+            i = end;
+        }
+    }
+
+    return !inEntity;
+}
+
+const std::vector<TextureInfo>& BSPMap::GetTextures() const {
+    return textures;
+}
+
 const std::vector<Face>& BSPMap::GetFaces() const {
     return faces;
 }
@@ -485,3 +772,60 @@ const std::vector<Vertex>& BSPMap::GetVertex() const {
     return vertices;
 }
 
+
+
+const std::vector<int>& BSPMap::GetMeshVerts() const {
+    return meshVerts;
+}
+
+const std::vector<Model>& BSPMap::GetModels() const {
+    return models;
+}
+
+const std::vector<Entity>& BSPMap::GetEntities() const {
+    return parsedEntities;
+}
+
+const std::vector<Plane>& BSPMap::GetPlanes() const {
+    return planes;
+}
+
+const std::vector<Node>& BSPMap::GetNodes() const {
+    return nodes;
+}
+
+const std::vector<Leaf>& BSPMap::GetLeafs() const {
+    return leafs;
+}
+
+const std::vector<int>& BSPMap::GetLeafFaces() const {
+    return leafFaces;
+}
+
+const VisData& BSPMap::GetVisData() const {
+    return visData;
+}
+
+const std::vector<unsigned char>& BSPMap::GetLightmaps() const {
+    return lightmaps;
+}
+
+const std::vector<unsigned char>& BSPMap::GetLightVolumes() const {
+    return lightVolumes;
+}
+
+int BSPMap::GetLightmapCount() const {
+    return static_cast<int>(lightmaps.size()) / LIGHTMAP_BYTES;
+}
+
+const std::vector<int>& BSPMap::GetLeafBrushes() const {
+    return leafBrushes;
+}
+
+const std::vector<Brush>& BSPMap::GetBrushes() const {
+    return brushes;
+}
+
+const std::vector<BrushSide>& BSPMap::GetBrushSides() const {
+    return brushSides;
+}
@@ -3,8 +3,10 @@
 
 #include <string>
 #include <vector>
+#include <map>
 #include <fstream>
 #include <GL/glew.h> // Make sure you have GLEW or an equivalent loader for OpenGL functions
+#include <glm/glm.hpp>
 #include "Renderer.h"
 #include "Shader.h"
 
@@ -44,12 +46,48 @@ struct BSPLump {
     int length;
 };
 
+// Content flags of textures and brushes (same values as Q3's surfaceflags.h)
+enum ContentFlags {
+    CONTENTS_SOLID = 0x1,
+    CONTENTS_LAVA = 0x8,
+    CONTENTS_SLIME = 0x10,
+    CONTENTS_WATER = 0x20,
+    CONTENTS_FOG = 0x40,
+    CONTENTS_AREAPORTAL = 0x8000,
+    CONTENTS_PLAYERCLIP = 0x10000,
+    CONTENTS_MONSTERCLIP = 0x20000,
+    CONTENTS_BODY = 0x2000000,
+    CONTENTS_CORPSE = 0x4000000,
+    CONTENTS_TRANSLUCENT = 0x20000000,
+    CONTENTS_TRIGGER = 0x40000000
+};
+
+// Surface flags of textures
+enum SurfaceFlags {
+    SURF_NODAMAGE = 0x1,
+    SURF_SLICK = 0x2,
+    SURF_SKY = 0x4,
+    SURF_LADDER = 0x8,
+    SURF_NOIMPACT = 0x10,
+    SURF_NOMARKS = 0x20,
+    SURF_NODRAW = 0x80,
+    SURF_NOLIGHTMAP = 0x400,
+    SURF_NONSOLID = 0x4000
+};
+
+// Texture record as stored in the file
+struct BSPTexture {
+    char name[64];
+    int flags;
+    int contents;
+};
+
 //Struct for the textures
 struct TextureInfo {
     std::string name; // Texture name
-    // You can add other texture-related properties here, such as:
-    // int flags;
-    // int contents;
+    int flags;        // Surface flags
+    int contents;     // Content flags
+    bool twoSided;    // Visible from both sides, backface culling must keep it
 };
 
 struct Plane {
@@ -72,7 +110,23 @@ struct Leaf {
     int maxs[3];       // Maximum coordinates of the leaf's bounding box
     int firstLeafFace; // Index of the first face in this leaf
     int numLeafFaces;  // Number of faces in this leaf
-    // Add additional fields as necessary based on your BSP format
+    int firstLeafBrush; // Index of the first brush in this leaf
+    int numLeafBrushes; // Number of brushes in this leaf
+};
+
+struct Model {
+    float mins[3];   // Bounding box min coordinate
+    float maxs[3];   // Bounding box max coordinate
+    int firstFace;   // Index of the first face in this model
+    int numFaces;    // Number of faces
+    int firstBrush;  // Index of the first brush in this model
+    int numBrushes;  // Number of brushes
+};
+
+// A submodel placed in the world, e.g. a door at its current position
+struct ModelInstance {
+    int model;           // Index into the models lump
+    glm::mat4 transform; // Model to map space transform
 };
 
 struct Brush {
@@ -111,6 +165,27 @@ struct Face {
     int size[2]; // Patch dimensions
 };
 
+// Lightmaps are LIGHTMAP_SIZE x LIGHTMAP_SIZE RGB pixels, stored one after the other
+static const int LIGHTMAP_SIZE = 128;
+static const int LIGHTMAP_BYTES = LIGHTMAP_SIZE * LIGHTMAP_SIZE * 3;
+
+// Cluster to cluster visibility. Each cluster has bytesPerCluster bytes, bit n set means cluster n is visible
+struct VisData {
+    int numClusters = 0;
+    int bytesPerCluster = 0;
+    std::vector<unsigned char> bits;
+};
+
+//Entities are parsed out of the entity lump into key/value pairs
+struct Entity {
+    std::map<std::string, std::string> properties;
+
+    std::string Get(const std::string& key, const std::string& defaultValue = "") const {
+        auto it = properties.find(key);
+        return it != properties.end() ? it->second : defaultValue;
+    }
+};
+
 
 
 class BSPMap {
@@ -130,16 +205,42 @@ public:
     bool LoadLeafBrushes();
     bool LoadBrushes();
     bool LoadBrushSides();
-    //Models here
+    bool LoadModels();
     bool LoadVertices();
     bool LoadMeshVerts();
     bool LoadFaces();
     bool LoadLightmaps();
+    bool LoadLightVolumes();
+    bool LoadVisData();
 
     bool LoadAllLumps(const std::string& filename);
+    bool ParseEntities();
+
+    // Writes a copy of the loaded file, lumps found in replacements are written instead of the originals. The map
+    // reads from the new file afterwards, so it can be saved over itself again with other replacements.
+    bool Save(const std::string& filename, const std::map<LumpType, std::vector<char>>& replacements);
+    void SetVisData(const VisData& data);
+    void SetLeafCluster(int leaf, int cluster);
+    // Replaces the node tree, for synthetic maps built by the benchmarks
+    void SetTree(const std::vector<Node>& newNodes, const std::vector<Leaf>& newLeafs);
 
+    const std::vector<TextureInfo>& GetTextures() const;
     const std::vector<Face>& GetFaces() const;
     const std::vector<Vertex>& GetVertex() const;
+    const std::vector<int>& GetMeshVerts() const;
+    const std::vector<Model>& GetModels() const;
+    const std::vector<Entity>& GetEntities() const;
+    const std::vector<Plane>& GetPlanes() const;
+    const std::vector<Node>& GetNodes() const;
+    const std::vector<Leaf>& GetLeafs() const;
+    const std::vector<int>& GetLeafFaces() const;
+    const std::vector<int>& GetLeafBrushes() const;
+    const std::vector<Brush>& GetBrushes() const;
+    const std::vector<BrushSide>& GetBrushSides() const;
+    const VisData& GetVisData() const;
+    const std::vector<unsigned char>& GetLightmaps() const; // Raw RGB as stored in the map
+    int GetLightmapCount() const;
+    const std::vector<unsigned char>& GetLightVolumes() const; // Raw light grid, 8 bytes per cell
 
 
 private:
@@ -157,12 +258,16 @@ private:
     std::vector<Leaf> leafs;
     std::vector<int> leafFaces;
     std::vector<int> leafBrushes;
-    //Models here
+    std::vector<Model> models; // Model 0 is the static world, the rest are brush entities (doors, platforms...)
     std::vector<Brush> brushes;
     std::vector<BrushSide> brushSides;
     std::vector<Vertex> vertices;
     std::vector<int> meshVerts;
     std::vector<Face> faces; // Vector to store loaded face information
+    std::vector<Entity> parsedEntities; // Entities split into key/value pairs
+    VisData visData;
+    std::vector<unsigned char> lightmaps;
+    std::vector<unsigned char> lightVolumes;
 
 
 
@@ -0,0 +1,472 @@
+#include "BSPRenderer.h"
+#include "ColorShift.h"
+#include <glm/gtc/matrix_transform.hpp>
+#include <algorithm>
+#include <cstddef>
+#include <iostream>
+
+BSPRenderer::BSPRenderer(const BSPMap& map, Shader worldShader, Shader modelShader, Camera* camera, bool vertexLit)
+    : worldShader(worldShader), modelShader(modelShader), camera(camera), map(map), vertexLit(vertexLit) {
+    BuildBuffers();
+    if (!vertexLit) {
+        BuildLightmaps();
+    }
+    SetSamplerUnits(this->worldShader);
+    SetSamplerUnits(this->modelShader);
+}
+
+BSPRenderer::~BSPRenderer() {
+    glDeleteVertexArrays(1, &worldVAO);
+    glDeleteVertexArrays(1, &modelVAO);
+    glDeleteBuffers(1, &vbo);
+    glDeleteBuffers(1, &ebo);
+    glDeleteBuffers(1, &instanceVBO);
+    glDeleteBuffers(1, &lightmapLayerVBO);
+    glDeleteTextures(1, &lightmapArray);
+}
+
+// Sets up the per-vertex attributes of the map vertex buffer on the currently bound VAO
+static void SetupVertexAttributes(GLuint vbo, GLuint lightmapLayerVBO) {
+    glBindBuffer(GL_ARRAY_BUFFER, vbo);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, position));
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, texCoord));
+    glEnableVertexAttribArray(1);
+    glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, lmCoord));
+    glEnableVertexAttribArray(2);
+    glVertexAttribPointer(3, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(Vertex), (void*)offsetof(Vertex, color));
+    glEnableVertexAttribArray(3);
+    glVertexAttribPointer(9, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, normal));
+    glEnableVertexAttribArray(9);
+    // Locations 4-7 are the model instance matrix
+    glBindBuffer(GL_ARRAY_BUFFER, lightmapLayerVBO);
+    glVertexAttribPointer(8, 1, GL_FLOAT, GL_FALSE, sizeof(float), (void*)0);
+    glEnableVertexAttribArray(8);
+}
+
+void BSPRenderer::BuildBuffers() {
+    const std::vector<Face>& faces = map.GetFaces();
+    const std::vector<Vertex>& vertices = map.GetVertex();
+    const std::vector<int>& meshVerts = map.GetMeshVerts();
+    const std::vector<Model>& models = map.GetModels();
+
+    // Faces are stored model by model, so building the index buffer in face order
+    // leaves every model's faces in one contiguous range
+    std::vector<unsigned int> indices;
+    faceRanges.assign(faces.size(), IndexRange{ 0, 0 });
+    for (size_t i = 0; i < faces.size(); ++i) {
+        const Face& face = faces[i];
+        faceRanges[i].firstIndex = static_cast<GLuint>(indices.size());
+        // Polygons (1) and meshes (3) come with triangle indices, patches (2) and billboards (4) are not drawn yet
+        if (face.type != 1 && face.type != 3) {
+            continue;
+        }
+        for (int j = 0; j < face.numMeshVertices; ++j) {
+            indices.push_back(face.vertex + meshVerts[face.meshVertex + j]);
+        }
+        faceRanges[i].numIndices = static_cast<GLsizei>(indices.size() - faceRanges[i].firstIndex);
+    }
+
+    modelRanges.assign(models.size(), IndexRange{ 0, 0 });
+    for (size_t i = 0; i < models.size(); ++i) {
+        const Model& model = models[i];
+        if (model.numFaces <= 0) {
+            continue;
+        }
+        const IndexRange& first = faceRanges[model.firstFace];
+        const IndexRange& last = faceRanges[model.firstFace + model.numFaces - 1];
+        modelRanges[i].firstIndex = first.firstIndex;
+        modelRanges[i].numIndices = static_cast<GLsizei>(last.firstIndex + last.numIndices - first.firstIndex);
+    }
+
+    glGenVertexArrays(1, &worldVAO);
+    glGenVertexArrays(1, &modelVAO);
+    glGenBuffers(1, &vbo);
+    glGenBuffers(1, &ebo);
+    glGenBuffers(1, &instanceVBO);
+    glGenBuffers(1, &lightmapLayerVBO);
+
+    // Faces don't share vertices, so the layer of a vertex is its face's lightmap
+    std::vector<float> lightmapLayers(vertices.size(), -1.0f);
+    int lightmapCount = map.GetLightmapCount();
+    for (const Face& face : faces) {
+        if (face.lm_index < 0 || face.lm_index >= lightmapCount) {
+            continue;
+        }
+        for (int j = 0; j < face.numVertices; ++j) {
+            if (face.vertex + j >= 0 && face.vertex + j < static_cast<int>(lightmapLayers.size())) {
+                lightmapLayers[face.vertex + j] = static_cast<float>(face.lm_index);
+            }
+        }
+    }
+
+    std::vector<Vertex> shiftedVertices(vertices);
+    ColorShiftVertexColors(shiftedVertices.data(), static_cast<int>(shiftedVertices.size()), MAP_OVERBRIGHT_BITS, LIGHTING_GAMMA);
+
+    glBindBuffer(GL_ARRAY_BUFFER, vbo);
+    glBufferData(GL_ARRAY_BUFFER, shiftedVertices.size() * sizeof(Vertex), shiftedVertices.data(), GL_STATIC_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, lightmapLayerVBO);
+    glBufferData(GL_ARRAY_BUFFER, lightmapLayers.size() * sizeof(float), lightmapLayers.data(), GL_STATIC_DRAW);
+
+    glBindVertexArray(worldVAO);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), indices.data(), GL_STATIC_DRAW);
+    SetupVertexAttributes(vbo, lightmapLayerVBO);
+
+    // The model VAO shares the same buffers and adds a mat4 per instance in locations 4-7
+    glBindVertexArray(modelVAO);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
+    SetupVertexAttributes(vbo, lightmapLayerVBO);
+    glBindBuffer(GL_ARRAY_BUFFER, instanceVBO);
+    for (int i = 0; i < 4; ++i) {
+        glEnableVertexAttribArray(4 + i);
+        glVertexAttribDivisor(4 + i, 1);
+    }
+
+    glBindVertexArray(0);
+}
+
+static int MaxLightmapLayers() {
+    GLint maxLayers = 0;
+    glGetIntegerv(GL_MAX_ARRAY_TEXTURE_LAYERS, &maxLayers);
+    return maxLayers;
+}
+
+bool BSPRenderer::LightmapsFit(const BSPMap& map) {
+    int maxLayers = MaxLightmapLayers();
+    if (map.GetLightmapCount() > maxLayers) {
+        std::cerr << "Map has " << map.GetLightmapCount() << " lightmaps but the driver allows " << maxLayers
+            << " array texture layers, using vertex lighting" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+void BSPRenderer::BuildLightmaps() {
+    // Even without lightmaps the shaders get a valid array to sample, a single white layer. So do lightmaps
+    // that don't fit the driver's array, when the caller didn't check LightmapsFit
+    int count = map.GetLightmapCount();
+    std::vector<unsigned char> pixels;
+    if (count > MaxLightmapLayers()) {
+        std::cerr << "Map has " << count << " lightmaps, more than the driver's array texture layers, drawing it fully lit" << std::endl;
+        count = 0;
+    }
+    if (count > 0) {
+        pixels = map.GetLightmaps();
+        ColorShiftLighting(pixels.data(), count * LIGHTMAP_SIZE * LIGHTMAP_SIZE, MAP_OVERBRIGHT_BITS, LIGHTING_GAMMA);
+    }
+    else {
+        count = 1;
+        pixels.assign(LIGHTMAP_BYTES, 255);
+    }
+
+    glGenTextures(1, &lightmapArray);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, lightmapArray);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGB8, LIGHTMAP_SIZE, LIGHTMAP_SIZE, count, 0, GL_RGB, GL_UNSIGNED_BYTE, pixels.data());
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+    worldShader.use();
+    worldShader.setInt("lightmaps", 0);
+    modelShader.use();
+    modelShader.setInt("lightmaps", 0);
+}
+
+void BSPRenderer::SetSamplerUnits(Shader& shader) {
+    // Every sampler gets its own unit even when nothing is bound to it, two sampler types on one unit fail the draw
+    shader.use();
+    shader.setInt("dynamicLights", 1);
+    shader.setInt("lightClusters", 2);
+    shader.setInt("lightIndices", 3);
+    shader.setInt("shadowAtlas", 4);
+}
+
+void BSPRenderer::BindDynamicLights(const Shader& shader) const {
+    // Units after the lightmap array, shaders skip the clusters entirely when there are no lights
+    if (clusteredLights) {
+        clusteredLights->Bind(shader, 1);
+    }
+    else {
+        shader.setInt("dynamicLightCount", 0);
+    }
+    if (shadowAtlas) {
+        shadowAtlas->Bind(shader, 4);
+    }
+}
+
+void BSPRenderer::EnableShadows(ShadowAtlas* atlas, const char* vertexPath, const char* fragmentPath) {
+    shadowAtlas = atlas;
+    shadowAtlas->CreateTargets();
+    shadowShader.reset(new Shader(vertexPath, fragmentPath));
+}
+
+void BSPRenderer::DrawModelRange(int model) const {
+    const IndexRange& range = modelRanges[model];
+    glDrawElements(GL_TRIANGLES, range.numIndices, GL_UNSIGNED_INT, (const void*)(range.firstIndex * sizeof(unsigned int)));
+}
+
+void BSPRenderer::RenderShadows(const std::vector<ModelInstance>& instances) {
+    if (!shadowAtlas || shadowAtlas->GetShadows().empty() || modelRanges.empty()) {
+        return;
+    }
+    const std::vector<ShadowAtlas::Shadow>& shadows = shadowAtlas->GetShadows();
+
+    GLint viewport[4];
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    shadowShader->use();
+    shadowShader->setMat4("projection", glm::mat4(1.0f));
+    glBindVertexArray(worldVAO);
+    // Clears and copies have to stay inside the tile being drawn
+    glEnable(GL_SCISSOR_TEST);
+    glEnable(GL_POLYGON_OFFSET_FILL);
+    glPolygonOffset(1.5f, 4.0f);
+
+    // The whole static world goes into the cache, for lights that moved or just got their tiles
+    glBindFramebuffer(GL_FRAMEBUFFER, shadowAtlas->GetStaticFramebuffer());
+    shadowShader->setMat4("model", glm::mat4(1.0f));
+    for (const ShadowAtlas::Shadow& shadow : shadows) {
+        if (!shadow.updateCache) {
+            continue;
+        }
+        for (int face = 0; face < 6; ++face) {
+            const glm::ivec3& tile = shadow.faces[face];
+            glViewport(tile.x, tile.y, tile.z, tile.z);
+            glScissor(tile.x, tile.y, tile.z, tile.z);
+            glClear(GL_DEPTH_BUFFER_BIT);
+            shadowShader->setMat4("view", ShadowAtlas::FaceMatrix(shadow.origin, shadow.radius, face));
+            DrawModelRange(0);
+        }
+    }
+
+    // The sampled atlas gets the cached world back and the moving models near the light on top
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, shadowAtlas->GetStaticFramebuffer());
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, shadowAtlas->GetFramebuffer());
+    for (const ShadowAtlas::Shadow& shadow : shadows) {
+        if (!shadow.updateAtlas) {
+            continue;
+        }
+        for (int face = 0; face < 6; ++face) {
+            const glm::ivec3& tile = shadow.faces[face];
+            glViewport(tile.x, tile.y, tile.z, tile.z);
+            glScissor(tile.x, tile.y, tile.z, tile.z);
+            glBlitFramebuffer(tile.x, tile.y, tile.x + tile.z, tile.y + tile.z, tile.x, tile.y, tile.x + tile.z, tile.y + tile.z,
+                GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+            shadowShader->setMat4("view", ShadowAtlas::FaceMatrix(shadow.origin, shadow.radius, face));
+            for (int caster : shadow.casters) {
+                const ModelInstance& instance = instances[caster];
+                if (modelRanges[instance.model].numIndices == 0) {
+                    continue;
+                }
+                shadowShader->setMat4("model", instance.transform);
+                DrawModelRange(instance.model);
+            }
+        }
+    }
+
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glDisable(GL_POLYGON_OFFSET_FILL);
+    glDisable(GL_SCISSOR_TEST);
+    glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+    glBindVertexArray(0);
+}
+
+void BSPRenderer::SetViewportSize(int width, int height) {
+    // A minimized window reports a zero size, keep the last aspect
+    if (width > 0 && height > 0) {
+        aspect = static_cast<float>(width) / static_cast<float>(height);
+    }
+}
+
+glm::mat4 BSPRenderer::GetProjectionMatrix() const {
+    // Map units are roughly inches, so the clip range is much larger than the test scene's
+    return glm::perspective(glm::radians(camera->Zoom), aspect, 4.0f, 8192.0f);
+}
+
+glm::mat4 BSPRenderer::GetViewMatrix() const {
+    // Fold the map to camera conversion into the view so everything works in map space
+    return camera->GetViewMatrix() * Camera::GetMapMatrix();
+}
+
+void BSPRenderer::Render(const std::vector<int>& visibleFaces, const std::vector<ModelInstance>& instances) {
+    glm::mat4 projection = GetProjectionMatrix();
+    glm::mat4 view = GetViewMatrix();
+    frustum.Extract(projection * view);
+
+    RenderShadows(instances);
+    RenderWorld(visibleFaces, projection, view);
+    if (hiZCuller) {
+        hiZCuller->Capture(projection * view, camera->GetMapPosition());
+    }
+    RenderModels(instances, projection, view);
+}
+
+bool BSPRenderer::EnableGPUCulling(const char* computePath) {
+    if (!GPUCuller::IsSupported()) {
+        std::cerr << "GPU culling needs OpenGL 4.3, using CPU culling." << std::endl;
+        return false;
+    }
+
+    // Only the static world is culled on the GPU, submodels keep their instanced draws
+    std::vector<GLuint> firstIndices(faceRanges.size());
+    std::vector<GLsizei> indexCounts(faceRanges.size(), 0);
+    const std::vector<Model>& models = map.GetModels();
+    int worldFaces = models.empty() ? static_cast<int>(faceRanges.size()) : models[0].firstFace + models[0].numFaces;
+    for (int i = models.empty() ? 0 : models[0].firstFace; i < worldFaces; ++i) {
+        firstIndices[i] = faceRanges[i].firstIndex;
+        indexCounts[i] = faceRanges[i].numIndices;
+    }
+    gpuCuller.reset(new GPUCuller(map, firstIndices, indexCounts, computePath));
+    return true;
+}
+
+void BSPRenderer::RenderGPUCulled(const std::vector<unsigned int>& clusterMask, const std::vector<ModelInstance>& instances) {
+    glm::mat4 projection = GetProjectionMatrix();
+    glm::mat4 view = GetViewMatrix();
+    frustum.Extract(projection * view);
+
+    RenderShadows(instances);
+    if (gpuCuller) {
+        gpuCuller->Cull(frustum, clusterMask);
+
+        worldShader.use();
+        worldShader.setMat4("projection", projection);
+        worldShader.setMat4("view", view);
+        worldShader.setMat4("model", glm::mat4(1.0f));
+        BindDynamicLights(worldShader);
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, lightmapArray);
+        glBindVertexArray(worldVAO);
+        gpuCuller->Draw();
+        glBindVertexArray(0);
+    }
+    if (hiZCuller) {
+        hiZCuller->Capture(projection * view, camera->GetMapPosition());
+    }
+    RenderModels(instances, projection, view);
+}
+
+void BSPRenderer::RenderWorld(const std::vector<int>& visibleFaces, const glm::mat4& projection, const glm::mat4& view) {
+    drawCounts.clear();
+    drawOffsets.clear();
+    if (modelRanges.empty() || modelRanges[0].numIndices == 0) {
+        return;
+    }
+
+    // Faces are sorted, so a face whose indices start where the previous range ends extends it
+    GLuint rangeStart = 0;
+    GLuint rangeEnd = 0;
+    for (int face : visibleFaces) {
+        const IndexRange& range = faceRanges[face];
+        if (range.numIndices == 0) {
+            continue;
+        }
+        if (range.firstIndex != rangeEnd) {
+            if (rangeEnd > rangeStart) {
+                drawCounts.push_back(static_cast<GLsizei>(rangeEnd - rangeStart));
+                drawOffsets.push_back((const void*)(rangeStart * sizeof(unsigned int)));
+            }
+            rangeStart = range.firstIndex;
+        }
+        rangeEnd = range.firstIndex + range.numIndices;
+    }
+    if (rangeEnd > rangeStart) {
+        drawCounts.push_back(static_cast<GLsizei>(rangeEnd - rangeStart));
+        drawOffsets.push_back((const void*)(rangeStart * sizeof(unsigned int)));
+    }
+    if (drawCounts.empty()) {
+        return;
+    }
+
+    worldShader.use();
+    worldShader.setMat4("projection", projection);
+    worldShader.setMat4("view", view);
+    worldShader.setMat4("model", glm::mat4(1.0f));
+    BindDynamicLights(worldShader);
+
+    // The static world never moves, all visible ranges go out in one call
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, lightmapArray);
+    glBindVertexArray(worldVAO);
+    glMultiDrawElements(GL_TRIANGLES, drawCounts.data(), GL_UNSIGNED_INT, drawOffsets.data(), static_cast<GLsizei>(drawCounts.size()));
+    glBindVertexArray(0);
+}
+
+void BSPRenderer::RenderModels(const std::vector<ModelInstance>& instances, const glm::mat4& projection, const glm::mat4& view) {
+    const std::vector<Model>& models = map.GetModels();
+
+    // Cull each instance by its submodel bounds moved into map space
+    visibleInstances.clear();
+    culledModelCount = 0;
+    for (const ModelInstance& instance : instances) {
+        if (instance.model <= 0 || instance.model >= static_cast<int>(models.size()) || modelRanges[instance.model].numIndices == 0) {
+            continue;
+        }
+        const Model& model = models[instance.model];
+        glm::vec3 mins, maxs;
+        TransformBounds(instance.transform, glm::vec3(model.mins[0], model.mins[1], model.mins[2]),
+            glm::vec3(model.maxs[0], model.maxs[1], model.maxs[2]), mins, maxs);
+        if (!frustum.IntersectsBox(mins, maxs) || (occlusionCuller && !occlusionCuller->IsBoxVisible(mins, maxs)) ||
+            (hiZCuller && !hiZCuller->IsBoxVisible(mins, maxs))) {
+            ++culledModelCount;
+            continue;
+        }
+        visibleInstances.push_back(instance);
+    }
+
+    modelDrawCount = 0;
+    if (visibleInstances.empty()) {
+        return;
+    }
+
+    // Group instances sharing a submodel so each group is one instanced draw
+    std::stable_sort(visibleInstances.begin(), visibleInstances.end(),
+        [](const ModelInstance& a, const ModelInstance& b) { return a.model < b.model; });
+
+    instanceMatrices.clear();
+    for (const ModelInstance& instance : visibleInstances) {
+        instanceMatrices.push_back(instance.transform);
+    }
+
+    glBindBuffer(GL_ARRAY_BUFFER, instanceVBO);
+    GLsizeiptr size = static_cast<GLsizeiptr>(instanceMatrices.size() * sizeof(glm::mat4));
+    if (size > instanceCapacity) {
+        instanceCapacity = size * 2;
+        glBufferData(GL_ARRAY_BUFFER, instanceCapacity, nullptr, GL_STREAM_DRAW);
+    }
+    glBufferSubData(GL_ARRAY_BUFFER, 0, size, instanceMatrices.data());
+
+    modelShader.use();
+    modelShader.setMat4("projection", projection);
+    modelShader.setMat4("view", view);
+    BindDynamicLights(modelShader);
+
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, lightmapArray);
+    glBindVertexArray(modelVAO);
+    size_t start = 0;
+    while (start < visibleInstances.size()) {
+        size_t end = start;
+        int modelIndex = visibleInstances[start].model;
+        while (end < visibleInstances.size() && visibleInstances[end].model == modelIndex) {
+            ++end;
+        }
+
+        // No base instance in GL 3.3, so point the instance attributes at this group's matrices
+        for (int i = 0; i < 4; ++i) {
+            glVertexAttribPointer(4 + i, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4),
+                (void*)(start * sizeof(glm::mat4) + i * sizeof(glm::vec4)));
+        }
+
+        const IndexRange& range = modelRanges[modelIndex];
+        glDrawElementsInstanced(GL_TRIANGLES, range.numIndices, GL_UNSIGNED_INT,
+            (void*)(range.firstIndex * sizeof(unsigned int)), static_cast<GLsizei>(end - start));
+        ++modelDrawCount;
+        start = end;
+    }
+    glBindVertexArray(0);
+}
@@ -0,0 +1,122 @@
+#ifndef BSPRENDERER_H
+#define BSPRENDERER_H
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include "Camera.h"
+#include "Shader.h"
+#include "BSPMap.h"
+#include "Frustum.h"
+#include "OcclusionCuller.h"
+#include "GPUCuller.h"
+#include "HiZCuller.h"
+#include "ClusteredLights.h"
+#include "ShadowAtlas.h"
+#include <memory>
+#include <vector>
+
+/*
+Draws the geometry of a BSPMap. All faces share one vertex and index buffer, ordered by model so that the
+static world (model 0) is drawn in one batched call and every submodel is one contiguous index range.
+The world draw only covers the faces that survived visibility culling, neighbouring faces are merged
+into larger index ranges and submitted with a single glMultiDrawElements.
+Brush models (doors, platforms...) are drawn instanced with a per-instance transform.
+With GPU culling enabled the world faces are culled by a compute shader instead and drawn indirectly.
+Models can also be tested against a HiZ pyramid of the world depth, captured between the world and model draws.
+All lightmaps live in one texture array and every vertex carries its face's layer, so faces with different
+lightmaps still go out in the same draw. A vertex lit renderer skips the lightmaps altogether and lights every face
+with its vertex colors, for weak machines and software GL. Dynamic lights are added on top per pixel from the
+clustered light lists. Shadowed lights get their cube faces drawn into a shadow atlas before the frame, the world
+only when a light has moved.
+*/
+
+class BSPRenderer {
+public:
+    Shader worldShader;
+    Shader modelShader;
+    Camera* camera;
+
+    // False with a message when the map has more lightmaps than the driver allows array texture layers, the
+    // renderer should then be vertex lit
+    static bool LightmapsFit(const BSPMap& map);
+
+    // vertexLit never loads the lightmaps, the shaders must be built with VERTEX_LIT to match
+    BSPRenderer(const BSPMap& map, Shader worldShader, Shader modelShader, Camera* camera, bool vertexLit = false);
+    ~BSPRenderer();
+
+    // visibleFaces must be sorted, as produced by Visibility
+    void Render(const std::vector<int>& visibleFaces, const std::vector<ModelInstance>& instances);
+
+    // Culls the world on the GPU from a PVS cluster mask (see Visibility::GetClusterMask), GPU culling must be enabled
+    void RenderGPUCulled(const std::vector<unsigned int>& clusterMask, const std::vector<ModelInstance>& instances);
+
+    // Switches to GPU culling when the driver has GL 4.3, returns false and keeps the CPU path otherwise
+    bool EnableGPUCulling(const char* computePath);
+    bool IsGPUCullingEnabled() const { return gpuCuller != nullptr; }
+    bool IsVertexLit() const { return vertexLit; }
+
+    // Optional software occlusion test for brush models, its depth buffer must be rendered before Render
+    void SetOcclusionCuller(const OcclusionCuller* culler) { occlusionCuller = culler; }
+
+    // Optional test of brush models against the depth of earlier frames, the world depth is captured every Render
+    void SetHiZCuller(HiZCuller* culler) { hiZCuller = culler; }
+
+    // Optional dynamic lights, they must be built and uploaded for this frame's view before Render
+    void SetClusteredLights(const ClusteredLights* lights) { clusteredLights = lights; }
+
+    // Optional shadows for the dynamic lights, the atlas must be updated with this frame's instances before Render.
+    // Faces are drawn with the world vertex shader and a depth only fragment shader.
+    void EnableShadows(ShadowAtlas* atlas, const char* vertexPath, const char* fragmentPath);
+
+    // Size of the framebuffer being drawn to, the projection follows its aspect
+    void SetViewportSize(int width, int height);
+    glm::mat4 GetProjectionMatrix() const;
+    glm::mat4 GetViewMatrix() const; // Camera view including the map space conversion
+    int GetWorldRangeCount() const { return static_cast<int>(drawCounts.size()); }
+    int GetModelDrawCount() const { return modelDrawCount; }
+    int GetCulledModelCount() const { return culledModelCount; }
+
+private:
+    void BuildBuffers();
+    void BuildLightmaps();
+    void RenderWorld(const std::vector<int>& visibleFaces, const glm::mat4& projection, const glm::mat4& view);
+    void RenderModels(const std::vector<ModelInstance>& instances, const glm::mat4& projection, const glm::mat4& view);
+    void BindDynamicLights(const Shader& shader) const;
+    void SetSamplerUnits(Shader& shader);
+    void RenderShadows(const std::vector<ModelInstance>& instances);
+    void DrawModelRange(int model) const;
+
+    struct IndexRange {
+        GLuint firstIndex;
+        GLsizei numIndices;
+    };
+
+    const BSPMap& map;
+    bool vertexLit;
+    Frustum frustum;
+    const OcclusionCuller* occlusionCuller = nullptr;
+    HiZCuller* hiZCuller = nullptr;
+    const ClusteredLights* clusteredLights = nullptr;
+    ShadowAtlas* shadowAtlas = nullptr;
+    std::unique_ptr<Shader> shadowShader;
+    std::unique_ptr<GPUCuller> gpuCuller;
+
+    std::vector<IndexRange> faceRanges;  // Index range of each face, empty for faces we don't draw
+    std::vector<IndexRange> modelRanges; // Index range covering all faces of each model
+
+    std::vector<GLsizei> drawCounts;            // Merged world index ranges for glMultiDrawElements
+    std::vector<const void*> drawOffsets;
+    std::vector<ModelInstance> visibleInstances; // Scratch list, sorted by model
+    std::vector<glm::mat4> instanceMatrices;
+
+    GLuint worldVAO = 0, modelVAO = 0, vbo = 0, ebo = 0, instanceVBO = 0;
+    GLuint lightmapLayerVBO = 0; // Lightmap layer of every vertex, -1 for vertex lit faces
+    GLuint lightmapArray = 0;  // Stays 0 when vertex lit
+    GLsizeiptr instanceCapacity = 0;
+
+    float aspect = 4.0f / 3.0f;
+    int modelDrawCount = 0;
+    int culledModelCount = 0;
+};
+
+#endif // BSPRENDERER_H
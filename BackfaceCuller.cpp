@@ -0,0 +1,65 @@
+#include "BackfaceCuller.h"
+#include <emmintrin.h>
+
+BackfaceCuller::BackfaceCuller(const BSPMap& map) : lastEye(0.0f) {
+    const std::vector<Face>& faces = map.GetFaces();
+    const std::vector<Vertex>& vertices = map.GetVertex();
+    const std::vector<TextureInfo>& textures = map.GetTextures();
+
+    size_t padded = (faces.size() + 3) & ~static_cast<size_t>(3);
+    // Padding faces use the always visible plane: zero normal, distance below -epsilon
+    normalX.assign(padded, 0.0f);
+    normalY.assign(padded, 0.0f);
+    normalZ.assign(padded, 0.0f);
+    distance.assign(padded, -2.0f * BACKFACE_EPSILON);
+    facing.assign(padded, 1);
+
+    for (size_t i = 0; i < faces.size(); ++i) {
+        const Face& face = faces[i];
+        bool twoSided = face.texture >= 0 && face.texture < static_cast<int>(textures.size()) && textures[face.texture].twoSided;
+        if (face.type != 1 || twoSided || face.numVertices <= 0) {
+            continue;
+        }
+        // The plane goes through the face's first vertex
+        const float* point = vertices[face.vertex].position;
+        normalX[i] = face.normal[0];
+        normalY[i] = face.normal[1];
+        normalZ[i] = face.normal[2];
+        distance[i] = face.normal[0] * point[0] + face.normal[1] * point[1] + face.normal[2] * point[2];
+    }
+}
+
+void BackfaceCuller::Update(const glm::vec3& eye) {
+    if (valid && eye == lastEye) {
+        return;
+    }
+    valid = true;
+    lastEye = eye;
+
+    __m128 eyeX = _mm_set1_ps(eye.x);
+    __m128 eyeY = _mm_set1_ps(eye.y);
+    __m128 eyeZ = _mm_set1_ps(eye.z);
+    __m128 epsilon = _mm_set1_ps(-BACKFACE_EPSILON);
+
+    backfaces = 0;
+    for (size_t i = 0; i < normalX.size(); i += 4) {
+        __m128 d = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_loadu_ps(&normalX[i]), eyeX), _mm_mul_ps(_mm_loadu_ps(&normalY[i]), eyeY)),
+            _mm_mul_ps(_mm_loadu_ps(&normalZ[i]), eyeZ));
+        // Seen when the eye is in front of the plane, or at most epsilon behind it
+        int mask = _mm_movemask_ps(_mm_cmpge_ps(_mm_sub_ps(d, _mm_loadu_ps(&distance[i])), epsilon));
+        facing[i] = mask & 1;
+        facing[i + 1] = (mask >> 1) & 1;
+        facing[i + 2] = (mask >> 2) & 1;
+        facing[i + 3] = (mask >> 3) & 1;
+        backfaces += 4 - ((mask & 1) + ((mask >> 1) & 1) + ((mask >> 2) & 1) + ((mask >> 3) & 1));
+    }
+}
+
+void BackfaceCuller::Filter(const std::vector<int>& faces, std::vector<int>& frontFaces) const {
+    frontFaces.clear();
+    for (int face : faces) {
+        if (facing[face]) {
+            frontFaces.push_back(face);
+        }
+    }
+}
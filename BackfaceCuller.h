@@ -0,0 +1,38 @@
+#ifndef BACKFACECULLER_H
+#define BACKFACECULLER_H
+
+#include <glm/glm.hpp>
+#include <vector>
+#include "BSPMap.h"
+
+/*
+CPU backface rejection of planar faces. The planes of all faces are copied once into structure of arrays
+form, then every time the eye moves one SSE pass classifies four faces per instruction. Faces that are not
+planar, or use a two-sided texture, get a plane that always passes so the pass stays branch free.
+*/
+
+class BackfaceCuller {
+public:
+    BackfaceCuller(const BSPMap& map);
+
+    // Reclassifies every face for an eye position in map space, does nothing if the eye hasn't moved
+    void Update(const glm::vec3& eye);
+
+    // Copies the faces that can be seen from the eye given to the last Update
+    void Filter(const std::vector<int>& faces, std::vector<int>& frontFaces) const;
+
+    bool IsFrontFacing(int face) const { return facing[face] != 0; }
+    int GetBackfaceCount() const { return backfaces; }
+
+private:
+    // Like Q3's R_CullSurface, a face is only rejected once the eye is this far behind its plane
+    static constexpr float BACKFACE_EPSILON = 8.0f;
+
+    std::vector<float> normalX, normalY, normalZ, distance; // Padded to a multiple of 4
+    std::vector<unsigned char> facing;                      // 1 if the face is seen from the last eye
+    glm::vec3 lastEye;
+    bool valid = false;
+    int backfaces = 0;
+};
+
+#endif // BACKFACECULLER_H
@@ -0,0 +1,126 @@
+#include "BatchTracer.h"
+#include <algorithm>
+
+static const int BATCH_RAYS = 64; // Rays handed to a thread at a time, a multiple of the packet size
+static const int RADIX_BITS = 10;  // Sort key bits per radix pass
+static const unsigned int RADIX_MASK = (1u << RADIX_BITS) - 1;
+
+// Spreads the low 9 bits of v out to every third bit
+static unsigned int SpreadBits(unsigned int v) {
+    v &= 0x1FF;
+    v = (v | (v << 16)) & 0x030000FF;
+    v = (v | (v << 8)) & 0x0300F00F;
+    v = (v | (v << 4)) & 0x030C30C3;
+    v = (v | (v << 2)) & 0x09249249;
+    return v;
+}
+
+BatchTracer::BatchTracer(const CollisionModel& model, ThreadPool& pool) : model(model), pool(pool) {
+    contexts.resize(pool.GetThreadCount());
+}
+
+void BatchTracer::Trace(const std::vector<RayQuery>& rays, std::vector<TraceResult>& results) {
+    results.resize(rays.size());
+    Trace(rays.data(), static_cast<int>(rays.size()), results.data());
+}
+
+void BatchTracer::Trace(const RayQuery* rays, int count, TraceResult* results) {
+    stats = BatchTraceStats();
+    if (count <= 0) {
+        return;
+    }
+
+    // Sorted rays are gathered into trace order first and their results scattered back at the end, the traces
+    // then read and write memory front to back instead of jumping around large batches
+    const RayQuery* traceRays = rays;
+    TraceResult* traceResults = results;
+    if (sortRays) {
+        SortRays(rays, count);
+        sortedRays.resize(count);
+        sortedResults.resize(count);
+        for (int i = 0; i < count; ++i) {
+            sortedRays[i] = rays[order[i]];
+        }
+        traceRays = sortedRays.data();
+        traceResults = sortedResults.data();
+    }
+    if (static_cast<int>(identity.size()) < count) {
+        int first = static_cast<int>(identity.size());
+        identity.resize(count);
+        for (int i = first; i < count; ++i) {
+            identity[i] = i;
+        }
+    }
+
+    for (TraceContext& context : contexts) {
+        context.brushTests = 0;
+        context.leafVisits = 0;
+    }
+
+    const int batchCount = (count + BATCH_RAYS - 1) / BATCH_RAYS;
+    pool.ParallelFor(batchCount, [&](int batch, int threadIndex) {
+        TraceContext& context = contexts[threadIndex];
+        int first = batch * BATCH_RAYS;
+        int last = std::min(first + BATCH_RAYS, count);
+        for (int i = first; i < last; i += CollisionModel::PACKET_SIZE) {
+            int packetCount = std::min(last - i, static_cast<int>(CollisionModel::PACKET_SIZE));
+            model.TracePacket(context, traceRays, &identity[i], packetCount, traceResults);
+        }
+    });
+    if (sortRays) {
+        for (int i = 0; i < count; ++i) {
+            results[order[i]] = sortedResults[i];
+        }
+    }
+
+    stats.rays = count;
+    stats.packets = (count + CollisionModel::PACKET_SIZE - 1) / CollisionModel::PACKET_SIZE;
+    for (const TraceContext& context : contexts) {
+        stats.brushTests += context.brushTests;
+        stats.leafVisits += context.leafVisits;
+    }
+}
+
+void BatchTracer::SortRays(const RayQuery* rays, int count) {
+    // Starts are placed on a 512^3 grid over the batch's own bounds
+    glm::vec3 mins(1e30f), maxs(-1e30f);
+    for (int i = 0; i < count; ++i) {
+        mins = glm::min(mins, rays[i].start);
+        maxs = glm::max(maxs, rays[i].start);
+    }
+    glm::vec3 size = glm::max(maxs - mins, glm::vec3(1e-3f));
+    glm::vec3 scale = glm::vec3(511.0f) / size;
+
+    // The direction octant goes above the Morton code of the start, a packet then shares both
+    sortKeys.resize(count);
+    order.resize(count);
+    for (int i = 0; i < count; ++i) {
+        const RayQuery& ray = rays[i];
+        glm::vec3 cell = (ray.start - mins) * scale;
+        glm::vec3 dir = ray.end - ray.start;
+        unsigned int octant = (dir.x < 0.0f ? 1u : 0u) | (dir.y < 0.0f ? 2u : 0u) | (dir.z < 0.0f ? 4u : 0u);
+        unsigned int morton = SpreadBits(static_cast<unsigned int>(cell.x)) | (SpreadBits(static_cast<unsigned int>(cell.y)) << 1) | (SpreadBits(static_cast<unsigned int>(cell.z)) << 2);
+        sortKeys[i] = (octant << 27) | morton;
+        order[i] = i;
+    }
+
+    // Keys are 30 bits, sorted 10 bits at a time from the lowest. Every pass is stable, so ties keep their input
+    // order and the trace order is the same every run.
+    sortedOrder.resize(count);
+    for (int shift = 0; shift < 30; shift += RADIX_BITS) {
+        int offsets[1 << RADIX_BITS] = {};
+        for (int i = 0; i < count; ++i) {
+            ++offsets[(sortKeys[order[i]] >> shift) & RADIX_MASK];
+        }
+        int total = 0;
+        for (int& offset : offsets) {
+            int bucketCount = offset;
+            offset = total;
+            total += bucketCount;
+        }
+        for (int i = 0; i < count; ++i) {
+            sortedOrder[offsets[(sortKeys[order[i]] >> shift) & RADIX_MASK]++] = order[i];
+        }
+        order.swap(sortedOrder);
+    }
+}
@@ -0,0 +1,53 @@
+#ifndef BATCHTRACER_H
+#define BATCHTRACER_H
+
+#include <vector>
+#include "CollisionModel.h"
+#include "ThreadPool.h"
+
+/*
+Traces large arrays of rays at once, for line of sight, hitscan and sound occlusion queries. Rays are sorted so
+that rays starting close together and heading the same general way end up next to each other, then the sorted
+list is cut into batches that the thread pool spreads over its threads. Each batch is traced in packets that go
+down the node tree together. Every thread has its own TraceContext, so the collision model and the map are only
+read. Results are written by the index of the ray, so the answer doesn't depend on how batches were spread.
+*/
+
+struct BatchTraceStats {
+    int rays = 0;
+    int packets = 0;
+    int brushTests = 0;
+    int leafVisits = 0;
+};
+
+class BatchTracer {
+public:
+    BatchTracer(const CollisionModel& model, ThreadPool& pool);
+
+    // results[i] is the trace of rays[i]
+    void Trace(const RayQuery* rays, int count, TraceResult* results);
+    void Trace(const std::vector<RayQuery>& rays, std::vector<TraceResult>& results);
+
+    // Totals of the last Trace call
+    const BatchTraceStats& GetStats() const { return stats; }
+
+    // Rays are sorted by default, without sorting they are traced in the order given (for comparing the two)
+    void SetSortRays(bool sort) { sortRays = sort; }
+
+private:
+    void SortRays(const RayQuery* rays, int count);
+
+    const CollisionModel& model;
+    ThreadPool& pool;
+    std::vector<TraceContext> contexts;  // One per pool thread
+    std::vector<unsigned int> sortKeys;
+    std::vector<int> order;              // Ray indices in trace order
+    std::vector<int> sortedOrder;        // Radix sort scratch
+    std::vector<RayQuery> sortedRays;    // Rays in trace order
+    std::vector<TraceResult> sortedResults;
+    std::vector<int> identity;           // 0, 1, 2... for tracing rays in the order they are stored
+    bool sortRays = true;
+    BatchTraceStats stats;
+};
+
+#endif // BATCHTRACER_H
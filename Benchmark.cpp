@@ -0,0 +1,353 @@
+#include "Benchmark.h"
+#include "BatchTracer.h"
+#include "BSPMap.h"
+#include "CollisionModel.h"
+#include "Frustum.h"
+#include "FrustumCuller.h"
+#include <glm/gtc/matrix_transform.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+
+// Half the size of the synthetic world, about a large Q3 map
+static const int SYNTHETIC_WORLD_EXTENT = 16384;
+
+// Splits the box along its longest axis until every part holds one leaf. Leafs shrink a little inside their part
+// like real ones do, nodes get the bounds of their children so a node box always holds its children's.
+static int BuildSyntheticNode(std::vector<Node>& nodes, std::vector<Leaf>& leafs, const glm::ivec3& mins, const glm::ivec3& maxs,
+    int leafCount, std::mt19937& random) {
+    if (leafCount == 1) {
+        Leaf leaf = {};
+        std::uniform_real_distribution<float> shrink(0.0f, 0.25f);
+        for (int i = 0; i < 3; ++i) {
+            int size = maxs[i] - mins[i];
+            leaf.mins[i] = mins[i] + static_cast<int>(size * shrink(random));
+            leaf.maxs[i] = maxs[i] - static_cast<int>(size * shrink(random));
+        }
+        leafs.push_back(leaf);
+        return -static_cast<int>(leafs.size());
+    }
+
+    int index = static_cast<int>(nodes.size());
+    nodes.push_back(Node{});
+    glm::ivec3 size = maxs - mins;
+    int axis = size.x >= size.y && size.x >= size.z ? 0 : (size.y >= size.z ? 1 : 2);
+    std::uniform_real_distribution<float> fraction(0.35f, 0.65f);
+    int split = mins[axis] + static_cast<int>(size[axis] * fraction(random));
+    glm::ivec3 frontMaxs = maxs;
+    glm::ivec3 backMins = mins;
+    frontMaxs[axis] = split;
+    backMins[axis] = split;
+    int front = BuildSyntheticNode(nodes, leafs, mins, frontMaxs, leafCount / 2, random);
+    int back = BuildSyntheticNode(nodes, leafs, backMins, maxs, leafCount - leafCount / 2, random);
+
+    Node& node = nodes[index];
+    node.children[0] = front;
+    node.children[1] = back;
+    for (int i = 0; i < 3; ++i) {
+        const int* frontMins = front >= 0 ? nodes[front].mins : leafs[-front - 1].mins;
+        const int* frontMaxsBox = front >= 0 ? nodes[front].maxs : leafs[-front - 1].maxs;
+        const int* backMinsBox = back >= 0 ? nodes[back].mins : leafs[-back - 1].mins;
+        const int* backMaxs = back >= 0 ? nodes[back].maxs : leafs[-back - 1].maxs;
+        node.mins[i] = std::min(frontMins[i], backMinsBox[i]);
+        node.maxs[i] = std::max(frontMaxsBox[i], backMaxs[i]);
+    }
+    return index;
+}
+
+// True if the box is outside a frustum plane, with the same arithmetic in the same order as a FrustumCuller lane
+static bool ScalarBoxOutside(const Frustum& frustum, const int* mins, const int* maxs) {
+    for (int p = 0; p < FRUSTUM_PLANE_COUNT; ++p) {
+        const glm::vec4& plane = frustum.planes[p];
+        float x = std::max(plane.x * static_cast<float>(mins[0]), plane.x * static_cast<float>(maxs[0]));
+        float y = std::max(plane.y * static_cast<float>(mins[1]), plane.y * static_cast<float>(maxs[1]));
+        float z = std::max(plane.z * static_cast<float>(mins[2]), plane.z * static_cast<float>(maxs[2]));
+        if ((x + y) + (z + plane.w) < 0.0f) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Frustum of a camera circling through the synthetic world and turning slowly, like someone walking a map. Extra
+// views either look the same way as view 0 turned by a fraction of a full circle, like the faces of a cube map, or
+// look the same way from a few units to the side, like split screen players walking together.
+static Frustum BenchmarkFrustum(int frame, int viewIndex = 0, int viewCount = 1, bool turned = true) {
+    float angle = frame * 0.01f;
+    glm::vec3 eye(std::cos(angle) * SYNTHETIC_WORLD_EXTENT * 0.5f, std::sin(angle) * SYNTHETIC_WORLD_EXTENT * 0.5f, 0.0f);
+    float yaw = angle * 3.0f;
+    if (turned) {
+        yaw += viewIndex * glm::radians(360.0f) / viewCount;
+    }
+    else {
+        eye += glm::vec3(-std::sin(yaw), std::cos(yaw), 0.0f) * (viewIndex * 48.0f);
+    }
+    glm::vec3 target = eye + glm::vec3(std::cos(yaw), std::sin(yaw), 0.1f * std::sin(angle * 7.0f));
+    glm::mat4 view = glm::lookAt(eye, target, glm::vec3(0.0f, 0.0f, 1.0f));
+    glm::mat4 projection = glm::perspective(glm::radians(90.0f), 4.0f / 3.0f, 4.0f, 8192.0f);
+    Frustum frustum;
+    frustum.Extract(projection * view);
+    return frustum;
+}
+
+// Several views in one CullViews traversal against one Cull per view, each view with a culler of its own so its
+// cache follows that view. Prints both times and returns the number of frames where they found different leafs.
+static int BenchmarkViews(const BSPMap& map, FrustumCuller& culler, const std::vector<int>& pvsLeafs, int frames,
+    int viewCount, bool turned) {
+    std::vector<std::unique_ptr<FrustumCuller>> viewCullers;
+    for (int v = 0; v < viewCount; ++v) {
+        viewCullers.emplace_back(new FrustumCuller(map));
+    }
+    std::vector<std::vector<int>> viewLeafs(viewCount);
+    std::vector<std::vector<int>> perViewLeafs(viewCount);
+    std::vector<Frustum> frusta(viewCount);
+    double viewsSeconds = 0.0;
+    double perViewSeconds = 0.0;
+    long long viewBoxTests = 0;
+    int mismatchedFrames = 0;
+    for (int frame = 0; frame < frames; ++frame) {
+        for (int v = 0; v < viewCount; ++v) {
+            frusta[v] = BenchmarkFrustum(frame, v, viewCount, turned);
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        culler.CullViews(frusta.data(), viewCount, pvsLeafs, frame == 0, viewLeafs.data());
+        auto middle = std::chrono::steady_clock::now();
+        for (int v = 0; v < viewCount; ++v) {
+            viewCullers[v]->Cull(frusta[v], pvsLeafs, frame == 0, perViewLeafs[v]);
+        }
+        auto end = std::chrono::steady_clock::now();
+        viewsSeconds += std::chrono::duration<double>(middle - start).count();
+        perViewSeconds += std::chrono::duration<double>(end - middle).count();
+        viewBoxTests += culler.GetViewBoxTestCount();
+
+        bool matches = true;
+        for (int v = 0; v < viewCount; ++v) {
+            std::sort(viewLeafs[v].begin(), viewLeafs[v].end());
+            std::sort(perViewLeafs[v].begin(), perViewLeafs[v].end());
+            matches &= viewLeafs[v] == perViewLeafs[v];
+        }
+        if (!matches) {
+            if (mismatchedFrames == 0) {
+                std::cerr << "Cull benchmark: frame " << frame << " culled differently by CullViews and Cull" << std::endl;
+            }
+            ++mismatchedFrames;
+        }
+    }
+
+    const char* layout = turned ? "turned apart" : "side by side";
+    std::cout << viewCount << " views " << layout << ", one traversal: " << viewsSeconds * 1e6 / frames << " us per frame, "
+        << viewBoxTests / frames << " box tests" << std::endl;
+    std::cout << viewCount << " views " << layout << ", one Cull each:  " << perViewSeconds * 1e6 / frames << " us per frame" << std::endl;
+    return mismatchedFrames;
+}
+
+int RunCullBenchmark(int argc, char** argv) {
+    int leafCount = 1 << 16;
+    int frames = 500;
+    int viewCount = 4;
+    for (int i = 2; i < argc; ++i) {
+        if (std::strcmp(argv[i], "-leafs") == 0 && i + 1 < argc) {
+            leafCount = std::max(std::atoi(argv[++i]), 1);
+        }
+        else if (std::strcmp(argv[i], "-frames") == 0 && i + 1 < argc) {
+            frames = std::max(std::atoi(argv[++i]), 1);
+        }
+        else if (std::strcmp(argv[i], "-views") == 0 && i + 1 < argc) {
+            viewCount = std::min(std::max(std::atoi(argv[++i]), 1), FrustumCuller::MAX_VIEWS);
+        }
+        else {
+            std::cerr << "Usage: -cullbench [-leafs n] [-frames n] [-views n]" << std::endl;
+            return -1;
+        }
+    }
+
+    std::vector<Node> nodes;
+    std::vector<Leaf> leafs;
+    std::mt19937 random(1);
+    glm::ivec3 worldMins(-SYNTHETIC_WORLD_EXTENT, -SYNTHETIC_WORLD_EXTENT, -SYNTHETIC_WORLD_EXTENT / 8);
+    glm::ivec3 worldMaxs(SYNTHETIC_WORLD_EXTENT, SYNTHETIC_WORLD_EXTENT, SYNTHETIC_WORLD_EXTENT / 8);
+    // A single leaf has no node above it, the culler needs a root node
+    BuildSyntheticNode(nodes, leafs, worldMins, worldMaxs, std::max(leafCount, 2), random);
+    BSPMap map;
+    map.SetTree(nodes, leafs);
+    std::cout << "Cull benchmark: " << nodes.size() << " nodes, " << leafs.size() << " leafs, " << frames << " frames" << std::endl;
+
+    // Every leaf is in the PVS, so the frustum does all the work
+    std::vector<int> pvsLeafs(leafs.size());
+    for (size_t i = 0; i < leafs.size(); ++i) {
+        pvsLeafs[i] = static_cast<int>(i);
+    }
+
+    FrustumCuller culler(map);
+    std::vector<int> visibleLeafs;
+    std::vector<int> referenceLeafs;
+    double cullSeconds = 0.0;
+    double referenceSeconds = 0.0;
+    long long boxTests = 0;
+    long long cacheHits = 0;
+    long long visibleTotal = 0;
+    int mismatchedFrames = 0;
+    for (int frame = 0; frame < frames; ++frame) {
+        Frustum frustum = BenchmarkFrustum(frame);
+
+        auto start = std::chrono::steady_clock::now();
+        culler.Cull(frustum, pvsLeafs, frame == 0, visibleLeafs);
+        auto middle = std::chrono::steady_clock::now();
+        referenceLeafs.clear();
+        for (int leaf : pvsLeafs) {
+            if (!ScalarBoxOutside(frustum, leafs[leaf].mins, leafs[leaf].maxs)) {
+                referenceLeafs.push_back(leaf);
+            }
+        }
+        auto end = std::chrono::steady_clock::now();
+        cullSeconds += std::chrono::duration<double>(middle - start).count();
+        referenceSeconds += std::chrono::duration<double>(end - middle).count();
+        boxTests += culler.GetBoxTestCount();
+        cacheHits += culler.GetCacheHitCount();
+        visibleTotal += static_cast<long long>(visibleLeafs.size());
+
+        // Node boxes hold their children, so the tree can only reject what the leaf test rejects as well
+        std::sort(visibleLeafs.begin(), visibleLeafs.end());
+        if (visibleLeafs != referenceLeafs) {
+            if (mismatchedFrames == 0) {
+                std::cerr << "Cull benchmark: frame " << frame << " found " << visibleLeafs.size() << " leafs, the reference "
+                    << referenceLeafs.size() << std::endl;
+            }
+            ++mismatchedFrames;
+        }
+    }
+
+    std::cout << "Hierarchical: " << cullSeconds * 1e6 / frames << " us per frame, " << boxTests / frames << " box tests, "
+        << cacheHits / frames << " cache hits" << std::endl;
+    std::cout << "Every leaf:   " << referenceSeconds * 1e6 / frames << " us per frame, " << leafs.size() << " box tests" << std::endl;
+    std::cout << "Visible leafs per frame: " << visibleTotal / frames << ", frames differing from the reference: "
+        << mismatchedFrames << std::endl;
+
+    int mismatchedViewFrames = BenchmarkViews(map, culler, pvsLeafs, frames, viewCount, true);
+    mismatchedViewFrames += BenchmarkViews(map, culler, pvsLeafs, frames, viewCount, false);
+    std::cout << "Frames differing between the two: " << mismatchedViewFrames << std::endl;
+    return mismatchedFrames == 0 && mismatchedViewFrames == 0 ? 0 : 1;
+}
+
+static bool SameTrace(const TraceResult& a, const TraceResult& b) {
+    return a.fraction == b.fraction && a.endPos == b.endPos && a.startSolid == b.startSolid && a.allSolid == b.allSolid &&
+        a.contents == b.contents && a.surfaceFlags == b.surfaceFlags && (a.fraction == 1.0f || a.normal == b.normal);
+}
+
+// Traces rays with and without sorting, prints the rate of both and returns how many results differ from TraceRay
+static int BenchmarkRays(const char* name, CollisionModel& model, BatchTracer& tracer, const std::vector<RayQuery>& rays, int repeat) {
+    int rayCount = static_cast<int>(rays.size());
+    std::vector<TraceResult> reference(rayCount);
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < rayCount; ++i) {
+        reference[i] = model.TraceRay(rays[i].start, rays[i].end, rays[i].contentMask);
+    }
+    double referenceSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << name << std::endl;
+    std::cout << "  TraceRay, one thread: " << rayCount / referenceSeconds * 1e-6 << " Mrays/s" << std::endl;
+
+    int differing = 0;
+    std::vector<TraceResult> results;
+    for (int sorted = 1; sorted >= 0; --sorted) {
+        tracer.SetSortRays(sorted != 0);
+        double seconds = 0.0;
+        for (int run = 0; run < repeat; ++run) {
+            start = std::chrono::steady_clock::now();
+            tracer.Trace(rays, results);
+            seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        }
+        int mismatches = 0;
+        for (int i = 0; i < rayCount; ++i) {
+            mismatches += SameTrace(results[i], reference[i]) ? 0 : 1;
+        }
+        differing += mismatches;
+
+        const BatchTraceStats& stats = tracer.GetStats();
+        std::cout << (sorted ? "  Batch, sorted:   " : "  Batch, unsorted: ") << static_cast<double>(rayCount) * repeat / seconds * 1e-6
+            << " Mrays/s, " << static_cast<double>(stats.brushTests) / rayCount << " brush tests and "
+            << static_cast<double>(stats.leafVisits) / rayCount << " leafs per ray, " << mismatches
+            << " rays differing from TraceRay" << std::endl;
+    }
+    return differing;
+}
+
+int RunTraceBenchmark(int argc, char** argv) {
+    int rayCount = 1 << 18;
+    int repeat = 5;
+    unsigned int threads = 0;
+    std::string mapFile = "MYFIRSTMAP.bsp";
+    for (int i = 2; i < argc; ++i) {
+        if (std::strcmp(argv[i], "-rays") == 0 && i + 1 < argc) {
+            rayCount = std::max(std::atoi(argv[++i]), 1);
+        }
+        else if (std::strcmp(argv[i], "-repeat") == 0 && i + 1 < argc) {
+            repeat = std::max(std::atoi(argv[++i]), 1);
+        }
+        else if (std::strcmp(argv[i], "-threads") == 0 && i + 1 < argc) {
+            threads = static_cast<unsigned int>(std::atoi(argv[++i]));
+        }
+        else if (argv[i][0] != '-') {
+            mapFile = argv[i];
+        }
+        else {
+            std::cerr << "Usage: -tracebench [-rays n] [-repeat n] [-threads n] [map.bsp]" << std::endl;
+            return -1;
+        }
+    }
+
+    BSPMap map;
+    if (!map.LoadAllLumps(mapFile) || map.GetModels().empty()) {
+        std::cerr << "Trace benchmark: could not load " << mapFile << std::endl;
+        return -1;
+    }
+    CollisionModel model(map);
+    ThreadPool pool(threads);
+    BatchTracer tracer(model, pool);
+    std::cout << "Trace benchmark: " << rayCount << " rays, " << pool.GetThreadCount() << " threads, " << repeat
+        << " runs each" << std::endl;
+
+    const Model& world = map.GetModels()[0];
+    glm::vec3 worldMins(world.mins[0], world.mins[1], world.mins[2]);
+    glm::vec3 worldMaxs(world.maxs[0], world.maxs[1], world.maxs[2]);
+    glm::vec3 margin = (worldMaxs - worldMins) * 0.05f;
+    std::mt19937 random(1);
+    std::uniform_real_distribution<float> x(worldMins.x - margin.x, worldMaxs.x + margin.x);
+    std::uniform_real_distribution<float> y(worldMins.y - margin.y, worldMaxs.y + margin.y);
+    std::uniform_real_distribution<float> z(worldMins.z - margin.z, worldMaxs.z + margin.z);
+    std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+
+    // Between random points in the world's bounds (and a little past them), the worst case for sorting. Every
+    // other ray also hits bodies.
+    std::vector<RayQuery> rays(rayCount);
+    for (int i = 0; i < rayCount; ++i) {
+        rays[i].start = glm::vec3(x(random), y(random), z(random));
+        rays[i].end = glm::vec3(x(random), y(random), z(random));
+        rays[i].contentMask = (i & 1) ? MASK_SHOT : MASK_SOLID;
+    }
+    int differing = BenchmarkRays("Scattered rays", model, tracer, rays, repeat);
+
+    // Spreads of shots from a few hundred shooters, shuffled so the input order gives no coherence away
+    const int shooters = 256;
+    std::vector<glm::vec3> origins(shooters);
+    std::vector<glm::vec3> aims(shooters);
+    for (int i = 0; i < shooters; ++i) {
+        origins[i] = glm::vec3(x(random), y(random), z(random));
+        aims[i] = glm::normalize(glm::vec3(unit(random), unit(random), unit(random) * 0.25f) + glm::vec3(1e-3f));
+    }
+    for (int i = 0; i < rayCount; ++i) {
+        int shooter = i % shooters;
+        glm::vec3 spread(unit(random), unit(random), unit(random));
+        rays[i].start = origins[shooter] + spread * 8.0f;
+        rays[i].end = rays[i].start + glm::normalize(aims[shooter] + spread * 0.1f) * 2048.0f;
+        rays[i].contentMask = (i & 1) ? MASK_SHOT : MASK_SOLID;
+    }
+    std::shuffle(rays.begin(), rays.end(), random);
+    differing += BenchmarkRays("Clustered rays", model, tracer, rays, repeat);
+    return differing == 0 ? 0 : 1;
+}
@@ -0,0 +1,21 @@
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+/*
+Timing runs started from the command line, no window is opened. Each one also compares what it timed against a
+plain reference (one box or one ray at a time) and returns non-zero when any result differs, so a change that
+speeds something up can be checked for both at once.
+*/
+
+// Waves4 -cullbench [-leafs n] [-frames n] [-views n]
+// Culls a synthetic BSP tree from a camera flying through it, hierarchical SIMD culling against testing every
+// leaf box on its own, then several views in one CullViews traversal against one Cull per view, with the views
+// turned apart like cube map faces and side by side like split screen players
+int RunCullBenchmark(int argc, char** argv);
+
+// Waves4 -tracebench [-rays n] [-repeat n] [-threads n] [map.bsp]
+// Traces scattered and clustered rays through a map with BatchTracer, with and without sorting the rays, against
+// one TraceRay per ray. Loads MYFIRSTMAP.bsp unless another map is given.
+int RunTraceBenchmark(int argc, char** argv);
+
+#endif // BENCHMARK_H
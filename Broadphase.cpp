@@ -0,0 +1,278 @@
+#include "Broadphase.h"
+#include <algorithm>
+#include <cmath>
+
+// Buckets are kept at least this many and grown so there are about two links per bucket at most
+static const int MIN_BUCKETS = 1024;
+
+Broadphase::Broadphase(const glm::vec3& worldMins, const glm::vec3& worldMaxs, float cellSize)
+    : worldMins(worldMins), cellSize(cellSize > 0.0f ? cellSize : 128.0f) {
+    for (int axis = 0; axis < 3; ++axis) {
+        float size = std::max(worldMaxs[axis] - worldMins[axis], 0.0f);
+        gridSize[axis] = static_cast<int>(std::ceil(size / this->cellSize)) + 1;
+    }
+    buckets.resize(MIN_BUCKETS);
+}
+
+int Broadphase::Add(const glm::vec3& mins, const glm::vec3& maxs, int contents) {
+    int entity;
+    if (!freeEntities.empty()) {
+        entity = freeEntities.back();
+        freeEntities.pop_back();
+    }
+    else {
+        entity = static_cast<int>(entities.size());
+        entities.push_back(GridEntity());
+    }
+
+    GridEntity& gridEntity = entities[entity];
+    gridEntity.mins = mins;
+    gridEntity.maxs = maxs;
+    gridEntity.contents = contents;
+    gridEntity.linked = false;
+    gridEntity.queryMark = 0;
+    Link(entity);
+    return entity;
+}
+
+void Broadphase::Move(int entity, const glm::vec3& mins, const glm::vec3& maxs) {
+    GridEntity& gridEntity = entities[entity];
+    gridEntity.mins = mins;
+    gridEntity.maxs = maxs;
+
+    // Moving inside the same cells only changes the box
+    glm::ivec3 cellMins = CellFor(mins);
+    glm::ivec3 cellMaxs = CellFor(maxs);
+    if (cellMins.x == gridEntity.cellMins.x && cellMins.y == gridEntity.cellMins.y && cellMins.z == gridEntity.cellMins.z &&
+        cellMaxs.x == gridEntity.cellMaxs.x && cellMaxs.y == gridEntity.cellMaxs.y && cellMaxs.z == gridEntity.cellMaxs.z) {
+        return;
+    }
+    Unlink(entity);
+    Link(entity);
+}
+
+void Broadphase::Remove(int entity) {
+    if (!entities[entity].linked) {
+        return;
+    }
+    Unlink(entity);
+    entities[entity].contents = 0;
+    freeEntities.push_back(entity);
+}
+
+glm::ivec3 Broadphase::CellFor(const glm::vec3& point) const {
+    glm::ivec3 cell;
+    for (int axis = 0; axis < 3; ++axis) {
+        float position = std::floor((point[axis] - worldMins[axis]) / cellSize);
+        position = std::min(std::max(position, 0.0f), static_cast<float>(gridSize[axis] - 1));
+        cell[axis] = static_cast<int>(position);
+    }
+    return cell;
+}
+
+int Broadphase::Bucket(const glm::ivec3& cell) const {
+    unsigned int hash = static_cast<unsigned int>(cell.x) * 73856093u ^ static_cast<unsigned int>(cell.y) * 19349663u ^ static_cast<unsigned int>(cell.z) * 83492791u;
+    return static_cast<int>(hash & static_cast<unsigned int>(buckets.size() - 1));
+}
+
+void Broadphase::Link(int entity) {
+    GridEntity& gridEntity = entities[entity];
+    gridEntity.cellMins = CellFor(gridEntity.mins);
+    gridEntity.cellMaxs = CellFor(gridEntity.maxs);
+    gridEntity.linked = true;
+
+    const glm::ivec3& cellMins = gridEntity.cellMins;
+    const glm::ivec3& cellMaxs = gridEntity.cellMaxs;
+    for (int z = cellMins.z; z <= cellMaxs.z; ++z) {
+        for (int y = cellMins.y; y <= cellMaxs.y; ++y) {
+            for (int x = cellMins.x; x <= cellMaxs.x; ++x) {
+                glm::ivec3 cell(x, y, z);
+                buckets[Bucket(cell)].push_back(GridLink{ entity, cell });
+                ++linkCount;
+            }
+        }
+    }
+
+    if (linkCount > static_cast<int>(buckets.size()) * 2) {
+        Rehash(static_cast<int>(buckets.size()) * 2);
+    }
+}
+
+void Broadphase::Unlink(int entity) {
+    GridEntity& gridEntity = entities[entity];
+    if (!gridEntity.linked) {
+        return;
+    }
+    gridEntity.linked = false;
+
+    const glm::ivec3& cellMins = gridEntity.cellMins;
+    const glm::ivec3& cellMaxs = gridEntity.cellMaxs;
+    for (int z = cellMins.z; z <= cellMaxs.z; ++z) {
+        for (int y = cellMins.y; y <= cellMaxs.y; ++y) {
+            for (int x = cellMins.x; x <= cellMaxs.x; ++x) {
+                glm::ivec3 cell(x, y, z);
+                std::vector<GridLink>& bucket = buckets[Bucket(cell)];
+                for (size_t i = 0; i < bucket.size(); ++i) {
+                    const GridLink& link = bucket[i];
+                    if (link.entity == entity && link.cell.x == x && link.cell.y == y && link.cell.z == z) {
+                        bucket[i] = bucket.back();
+                        bucket.pop_back();
+                        --linkCount;
+                        break;
+                    }
+                }
+            }
+        }
+    }
+}
+
+void Broadphase::Rehash(int bucketCount) {
+    std::vector<std::vector<GridLink>> oldBuckets(bucketCount);
+    oldBuckets.swap(buckets);
+    for (const std::vector<GridLink>& bucket : oldBuckets) {
+        for (const GridLink& link : bucket) {
+            buckets[Bucket(link.cell)].push_back(link);
+        }
+    }
+}
+
+void Broadphase::QueryBox(const glm::vec3& mins, const glm::vec3& maxs, int contentMask, std::vector<int>& result) {
+    result.clear();
+    ++queryMark;
+
+    glm::ivec3 cellMins = CellFor(mins);
+    glm::ivec3 cellMaxs = CellFor(maxs);
+    for (int z = cellMins.z; z <= cellMaxs.z; ++z) {
+        for (int y = cellMins.y; y <= cellMaxs.y; ++y) {
+            for (int x = cellMins.x; x <= cellMaxs.x; ++x) {
+                for (const GridLink& link : buckets[Bucket(glm::ivec3(x, y, z))]) {
+                    if (link.cell.x != x || link.cell.y != y || link.cell.z != z) {
+                        continue; // Another cell hashed to the same bucket
+                    }
+                    GridEntity& gridEntity = entities[link.entity];
+                    if (gridEntity.queryMark == queryMark) {
+                        continue;
+                    }
+                    gridEntity.queryMark = queryMark;
+                    if (!(gridEntity.contents & contentMask)) {
+                        continue;
+                    }
+                    if (gridEntity.mins.x > maxs.x || gridEntity.mins.y > maxs.y || gridEntity.mins.z > maxs.z ||
+                        gridEntity.maxs.x < mins.x || gridEntity.maxs.y < mins.y || gridEntity.maxs.z < mins.z) {
+                        continue;
+                    }
+                    result.push_back(link.entity);
+                }
+            }
+        }
+    }
+    std::sort(result.begin(), result.end());
+}
+
+EntityTrace Broadphase::SweepBox(const glm::vec3& start, const glm::vec3& end, const glm::vec3& mins, const glm::vec3& maxs, int contentMask, int ignore) {
+    EntityTrace trace;
+    glm::vec3 sweepMins = glm::min(start, end) + mins;
+    glm::vec3 sweepMaxs = glm::max(start, end) + maxs;
+    glm::vec3 delta = end - start;
+
+    // Long sweeps cover more cells than there are entities, then testing every entity is cheaper
+    std::vector<int> candidates;
+    glm::ivec3 cellMins = CellFor(sweepMins);
+    glm::ivec3 cellMaxs = CellFor(sweepMaxs);
+    double cellCount = static_cast<double>(cellMaxs.x - cellMins.x + 1) * (cellMaxs.y - cellMins.y + 1) * (cellMaxs.z - cellMins.z + 1);
+    if (cellCount > static_cast<double>(entities.size())) {
+        for (int i = 0; i < static_cast<int>(entities.size()); ++i) {
+            if (entities[i].linked && (entities[i].contents & contentMask)) {
+                candidates.push_back(i);
+            }
+        }
+    }
+    else {
+        QueryBox(sweepMins, sweepMaxs, contentMask, candidates);
+    }
+
+    for (int entity : candidates) {
+        if (entity == ignore) {
+            continue;
+        }
+        const GridEntity& gridEntity = entities[entity];
+
+        // Ray against the entity box grown by the moving box
+        glm::vec3 boxMins = gridEntity.mins - maxs;
+        glm::vec3 boxMaxs = gridEntity.maxs - mins;
+        float enterFraction = -1.0f;
+        float leaveFraction = 1.0f;
+        glm::vec3 normal(0.0f);
+        bool missed = false;
+        bool startInside = true;
+        for (int axis = 0; axis < 3 && !missed; ++axis) {
+            if (start[axis] < boxMins[axis] || start[axis] > boxMaxs[axis]) {
+                startInside = false;
+            }
+            if (delta[axis] == 0.0f) {
+                missed = start[axis] < boxMins[axis] || start[axis] > boxMaxs[axis];
+                continue;
+            }
+            float nearFraction = ((delta[axis] > 0.0f ? boxMins[axis] : boxMaxs[axis]) - start[axis]) / delta[axis];
+            float farFraction = ((delta[axis] > 0.0f ? boxMaxs[axis] : boxMins[axis]) - start[axis]) / delta[axis];
+            if (nearFraction > enterFraction) {
+                enterFraction = nearFraction;
+                normal = glm::vec3(0.0f);
+                normal[axis] = delta[axis] > 0.0f ? -1.0f : 1.0f;
+            }
+            leaveFraction = std::min(leaveFraction, farFraction);
+            missed = enterFraction > leaveFraction;
+        }
+        if (missed) {
+            continue;
+        }
+
+        if (startInside) {
+            if (!trace.startSolid || entity < trace.entity) {
+                trace.startSolid = true;
+                trace.fraction = 0.0f;
+                trace.entity = entity;
+                trace.normal = glm::vec3(0.0f);
+            }
+            continue;
+        }
+        if (trace.startSolid || enterFraction < 0.0f) {
+            continue;
+        }
+        // Ties go to the lower handle so the result doesn't depend on the order candidates were found in
+        if (enterFraction < trace.fraction || (enterFraction == trace.fraction && trace.entity >= 0 && entity < trace.entity)) {
+            trace.fraction = enterFraction;
+            trace.entity = entity;
+            trace.normal = normal;
+        }
+    }
+    return trace;
+}
+
+void Broadphase::FindPairs(std::vector<std::pair<int, int>>& pairs) {
+    pairs.clear();
+    for (const std::vector<GridLink>& bucket : buckets) {
+        for (size_t i = 0; i < bucket.size(); ++i) {
+            const GridLink& first = bucket[i];
+            const GridEntity& a = entities[first.entity];
+            for (size_t j = i + 1; j < bucket.size(); ++j) {
+                const GridLink& second = bucket[j];
+                if (second.cell.x != first.cell.x || second.cell.y != first.cell.y || second.cell.z != first.cell.z) {
+                    continue;
+                }
+                const GridEntity& b = entities[second.entity];
+                if (a.mins.x > b.maxs.x || a.mins.y > b.maxs.y || a.mins.z > b.maxs.z ||
+                    a.maxs.x < b.mins.x || a.maxs.y < b.mins.y || a.maxs.z < b.mins.z) {
+                    continue;
+                }
+                // Boxes sharing several cells are reported only from the first cell they share
+                if (first.cell.x != std::max(a.cellMins.x, b.cellMins.x) || first.cell.y != std::max(a.cellMins.y, b.cellMins.y) ||
+                    first.cell.z != std::max(a.cellMins.z, b.cellMins.z)) {
+                    continue;
+                }
+                pairs.push_back(std::make_pair(std::min(first.entity, second.entity), std::max(first.entity, second.entity)));
+            }
+        }
+    }
+    std::sort(pairs.begin(), pairs.end());
+}
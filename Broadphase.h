@@ -0,0 +1,82 @@
+#ifndef BROADPHASE_H
+#define BROADPHASE_H
+
+#include <glm/glm.hpp>
+#include <utility>
+#include <vector>
+
+/*
+Finds which dynamic entities are near each other without testing every entity against every other one.
+Entity boxes are linked into the cells of a uniform grid laid over the world bounds, and cells are hashed into
+buckets so only cells that hold something take any memory. Moving an entity only relinks it when the range of
+cells it covers changes, which for most moves it doesn't.
+
+Area queries, sweeps and pair generation only look at the cells their boxes touch, so the cost grows with the
+number of entities and not with its square. Queries mark visited entities, so only one can run at a time.
+*/
+
+// Closest entity a swept box touched
+struct EntityTrace {
+    float fraction = 1.0f;  // Part of the move done before touching it, 1 if nothing was touched
+    int entity = -1;
+    glm::vec3 normal = glm::vec3(0.0f);
+    bool startSolid = false;
+};
+
+class Broadphase {
+public:
+    // Boxes outside the world bounds still work, they just share the border cells
+    Broadphase(const glm::vec3& worldMins, const glm::vec3& worldMaxs, float cellSize = 128.0f);
+
+    // Links a box in map space and returns its handle, contents is matched against the masks of queries
+    int Add(const glm::vec3& mins, const glm::vec3& maxs, int contents);
+    void Move(int entity, const glm::vec3& mins, const glm::vec3& maxs);
+    void Remove(int entity);
+
+    // Entities whose boxes overlap mins/maxs, in handle order
+    void QueryBox(const glm::vec3& mins, const glm::vec3& maxs, int contentMask, std::vector<int>& entities);
+
+    // Sweeps the box mins/maxs (relative to the moving point) from start to end, skipping the entity ignore
+    EntityTrace SweepBox(const glm::vec3& start, const glm::vec3& end, const glm::vec3& mins, const glm::vec3& maxs, int contentMask, int ignore = -1);
+
+    // Every pair of overlapping entities once, first < second, sorted
+    void FindPairs(std::vector<std::pair<int, int>>& pairs);
+
+    const glm::vec3& GetMins(int entity) const { return entities[entity].mins; }
+    const glm::vec3& GetMaxs(int entity) const { return entities[entity].maxs; }
+    int GetEntityCount() const { return static_cast<int>(entities.size()); }
+
+private:
+    struct GridEntity {
+        glm::vec3 mins;
+        glm::vec3 maxs;
+        int contents;
+        glm::ivec3 cellMins;  // Cells the box is linked into
+        glm::ivec3 cellMaxs;
+        bool linked;
+        int queryMark;        // Last query that visited it
+    };
+
+    // One entity in one cell, buckets hold the links of every cell hashed to them
+    struct GridLink {
+        int entity;
+        glm::ivec3 cell;
+    };
+
+    glm::ivec3 CellFor(const glm::vec3& point) const;
+    int Bucket(const glm::ivec3& cell) const;
+    void Link(int entity);
+    void Unlink(int entity);
+    void Rehash(int bucketCount);
+
+    glm::vec3 worldMins;
+    glm::ivec3 gridSize;
+    float cellSize;
+    std::vector<GridEntity> entities;
+    std::vector<int> freeEntities;  // Removed handles, reused by Add
+    std::vector<std::vector<GridLink>> buckets;
+    int linkCount = 0;
+    int queryMark = 0;
+};
+
+#endif // BROADPHASE_H
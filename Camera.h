@@ -36,6 +36,29 @@ public:
         return glm::lookAt(Position, Position + Front, Up);
     }
 
+    // Quake 3 maps are Z-up while the camera is Y-up. This matrix takes map coordinates
+    // into camera space, (x, y, z) -> (x, z, -y), so map data can be used untouched.
+    static glm::mat4 GetMapMatrix() {
+        return glm::mat4(
+            glm::vec4(1.0f, 0.0f, 0.0f, 0.0f),
+            glm::vec4(0.0f, 0.0f, -1.0f, 0.0f),
+            glm::vec4(0.0f, 1.0f, 0.0f, 0.0f),
+            glm::vec4(0.0f, 0.0f, 0.0f, 1.0f));
+    }
+
+    static glm::vec3 ToMapSpace(const glm::vec3& v) {
+        return glm::vec3(v.x, -v.z, v.y);
+    }
+
+    static glm::vec3 FromMapSpace(const glm::vec3& v) {
+        return glm::vec3(v.x, v.z, -v.y);
+    }
+
+    // Camera position in map coordinates, used for all BSP queries
+    glm::vec3 GetMapPosition() const {
+        return ToMapSpace(Position);
+    }
+
     void updateCameraVectors() {
         glm::vec3 front;
         front.x = cos(glm::radians(Yaw)) * cos(glm::radians(Pitch));
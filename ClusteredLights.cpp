@@ -0,0 +1,261 @@
+#include "ClusteredLights.h"
+#include <emmintrin.h>
+#include <algorithm>
+#include <cmath>
+
+ClusteredLights::ClusteredLights(ThreadPool& pool) : pool(pool), scratch(pool.GetThreadCount()) {
+    rowIndices.resize(CLUSTERS_Y * CLUSTERS_Z);
+    rowCounts.assign(CLUSTER_COUNT, 0);
+    clusterRanges.assign(CLUSTER_COUNT * 2, 0);
+}
+
+ClusteredLights::~ClusteredLights() {
+    // Buffers are only made by the first Upload
+    if (lightBuffer) {
+        glDeleteTextures(1, &lightTexture);
+        glDeleteTextures(1, &clusterTexture);
+        glDeleteTextures(1, &indexTexture);
+        glDeleteBuffers(1, &lightBuffer);
+        glDeleteBuffers(1, &clusterBuffer);
+        glDeleteBuffers(1, &indexBuffer);
+    }
+}
+
+void ClusteredLights::BuildClusterBounds(const glm::mat4& projection) {
+    clusterProjection = projection;
+
+    // A GL perspective keeps the near and far planes in its third column
+    float a = projection[2][2];
+    float b = projection[3][2];
+    nearPlane = b / (a - 1.0f);
+    farPlane = b / (a + 1.0f);
+    depthScale = CLUSTERS_Z / std::log(farPlane / nearPlane);
+    depthBias = -std::log(nearPlane) * depthScale;
+
+    // Tiles are straight cuts through NDC, so at depth d a tile edge is at ndc * d / scale in view space
+    float scaleX = projection[0][0];
+    float scaleY = projection[1][1];
+    clusterMins.resize(CLUSTER_COUNT);
+    clusterMaxs.resize(CLUSTER_COUNT);
+    for (int z = 0; z < CLUSTERS_Z; ++z) {
+        float sliceNear = nearPlane * std::pow(farPlane / nearPlane, static_cast<float>(z) / CLUSTERS_Z);
+        float sliceFar = nearPlane * std::pow(farPlane / nearPlane, static_cast<float>(z + 1) / CLUSTERS_Z);
+        for (int y = 0; y < CLUSTERS_Y; ++y) {
+            float bottom = -1.0f + 2.0f * y / CLUSTERS_Y;
+            float top = -1.0f + 2.0f * (y + 1) / CLUSTERS_Y;
+            for (int x = 0; x < CLUSTERS_X; ++x) {
+                float left = -1.0f + 2.0f * x / CLUSTERS_X;
+                float right = -1.0f + 2.0f * (x + 1) / CLUSTERS_X;
+                int cluster = (z * CLUSTERS_Y + y) * CLUSTERS_X + x;
+                clusterMins[cluster] = glm::vec3(std::min(left * sliceNear, left * sliceFar) / scaleX,
+                    std::min(bottom * sliceNear, bottom * sliceFar) / scaleY, -sliceFar);
+                clusterMaxs[cluster] = glm::vec3(std::max(right * sliceNear, right * sliceFar) / scaleX,
+                    std::max(top * sliceNear, top * sliceFar) / scaleY, -sliceNear);
+            }
+        }
+    }
+}
+
+void ClusteredLights::Build(const std::vector<DynamicLight>& newLights, const glm::mat4& view, const glm::mat4& projection) {
+    if (projection != clusterProjection) {
+        BuildClusterBounds(projection);
+    }
+
+    // Slices and tiles each light can reach, from its depth range and the screen bounds of the box around it
+    lights = newLights;
+    int count = static_cast<int>(lights.size());
+    viewLights.resize(count);
+    lightMins.resize(count);
+    lightMaxs.resize(count);
+    float scaleX = projection[0][0];
+    float scaleY = projection[1][1];
+    for (int i = 0; i < count; ++i) {
+        const DynamicLight& light = lights[i];
+        glm::vec4 center = view * glm::vec4(light.origin, 1.0f);
+        float radius = light.radius;
+        viewLights[i] = glm::vec4(center.x, center.y, center.z, radius);
+        lightMins[i] = glm::ivec3(1, 1, 1);
+        lightMaxs[i] = glm::ivec3(0, 0, 0);
+
+        float depthMin = -center.z - radius;
+        float depthMax = -center.z + radius;
+        if (radius <= 0.0f || depthMax <= nearPlane || depthMin >= farPlane) {
+            continue;
+        }
+        int sliceMin = depthMin <= nearPlane ? 0 : static_cast<int>(std::floor(std::log(depthMin) * depthScale + depthBias));
+        int sliceMax = static_cast<int>(std::floor(std::log(std::min(depthMax, farPlane)) * depthScale + depthBias));
+
+        // Lights crossing the near plane can cover any tile
+        glm::ivec3 mins(0, 0, std::max(sliceMin, 0));
+        glm::ivec3 maxs(CLUSTERS_X - 1, CLUSTERS_Y - 1, std::min(sliceMax, CLUSTERS_Z - 1));
+        if (depthMin > nearPlane) {
+            const int tiles[2] = { CLUSTERS_X, CLUSTERS_Y };
+            const float scales[2] = { scaleX, scaleY };
+            bool outside = false;
+            for (int axis = 0; axis < 2; ++axis) {
+                float low = (center[axis] - radius) * scales[axis];
+                float high = (center[axis] + radius) * scales[axis];
+                float ndcMin = std::min(low / depthMin, low / depthMax);
+                float ndcMax = std::max(high / depthMin, high / depthMax);
+                if (ndcMax < -1.0f || ndcMin > 1.0f) {
+                    outside = true;
+                    break;
+                }
+                mins[axis] = std::max(static_cast<int>(std::floor((ndcMin + 1.0f) * 0.5f * tiles[axis])), 0);
+                maxs[axis] = std::min(static_cast<int>(std::floor((ndcMax + 1.0f) * 0.5f * tiles[axis])), tiles[axis] - 1);
+            }
+            if (outside) {
+                continue;
+            }
+        }
+        lightMins[i] = mins;
+        lightMaxs[i] = maxs;
+    }
+
+    pool.ParallelFor(CLUSTERS_Y * CLUSTERS_Z, [this](int row, int threadIndex) {
+        BinRow(row, threadIndex);
+    });
+
+    // Rows are joined in order, so the lists don't depend on which thread binned them
+    indices.clear();
+    for (int row = 0; row < CLUSTERS_Y * CLUSTERS_Z; ++row) {
+        GLuint first = static_cast<GLuint>(indices.size());
+        for (int x = 0; x < CLUSTERS_X; ++x) {
+            int cluster = row * CLUSTERS_X + x;
+            clusterRanges[cluster * 2] = first;
+            clusterRanges[cluster * 2 + 1] = rowCounts[cluster];
+            first += rowCounts[cluster];
+        }
+        indices.insert(indices.end(), rowIndices[row].begin(), rowIndices[row].end());
+    }
+}
+
+void ClusteredLights::BinRow(int row, int threadIndex) {
+    int z = row / CLUSTERS_Y;
+    int y = row % CLUSTERS_Y;
+    RowScratch& rowLights = scratch[threadIndex];
+    rowLights.x.clear();
+    rowLights.y.clear();
+    rowLights.z.clear();
+    rowLights.radiusSquared.clear();
+    rowLights.tileMin.clear();
+    rowLights.tileMax.clear();
+    rowLights.lightIndices.clear();
+
+    for (int i = 0; i < static_cast<int>(viewLights.size()); ++i) {
+        if (z < lightMins[i].z || z > lightMaxs[i].z || y < lightMins[i].y || y > lightMaxs[i].y) {
+            continue;
+        }
+        const glm::vec4& light = viewLights[i];
+        rowLights.x.push_back(light.x);
+        rowLights.y.push_back(light.y);
+        rowLights.z.push_back(light.z);
+        rowLights.radiusSquared.push_back(light.w * light.w);
+        rowLights.tileMin.push_back(lightMins[i].x);
+        rowLights.tileMax.push_back(lightMaxs[i].x);
+        rowLights.lightIndices.push_back(static_cast<GLuint>(i));
+    }
+    // Padding lanes have a negative radius and an empty tile range
+    int count = static_cast<int>(rowLights.lightIndices.size());
+    while (rowLights.x.size() % 4 != 0) {
+        rowLights.x.push_back(0.0f);
+        rowLights.y.push_back(0.0f);
+        rowLights.z.push_back(0.0f);
+        rowLights.radiusSquared.push_back(-1.0f);
+        rowLights.tileMin.push_back(1);
+        rowLights.tileMax.push_back(0);
+    }
+
+    std::vector<GLuint>& out = rowIndices[row];
+    out.clear();
+    const __m128 zero = _mm_setzero_ps();
+    for (int x = 0; x < CLUSTERS_X; ++x) {
+        int cluster = row * CLUSTERS_X + x;
+        size_t before = out.size();
+        const glm::vec3& mins = clusterMins[cluster];
+        const glm::vec3& maxs = clusterMaxs[cluster];
+        __m128 minX = _mm_set1_ps(mins.x), minY = _mm_set1_ps(mins.y), minZ = _mm_set1_ps(mins.z);
+        __m128 maxX = _mm_set1_ps(maxs.x), maxY = _mm_set1_ps(maxs.y), maxZ = _mm_set1_ps(maxs.z);
+        __m128i tile = _mm_set1_epi32(x);
+
+        for (int i = 0; i < count; i += 4) {
+            // Squared distance from each sphere center to the cluster box
+            __m128 cx = _mm_loadu_ps(&rowLights.x[i]);
+            __m128 cy = _mm_loadu_ps(&rowLights.y[i]);
+            __m128 cz = _mm_loadu_ps(&rowLights.z[i]);
+            __m128 dx = _mm_max_ps(_mm_max_ps(_mm_sub_ps(minX, cx), _mm_sub_ps(cx, maxX)), zero);
+            __m128 dy = _mm_max_ps(_mm_max_ps(_mm_sub_ps(minY, cy), _mm_sub_ps(cy, maxY)), zero);
+            __m128 dz = _mm_max_ps(_mm_max_ps(_mm_sub_ps(minZ, cz), _mm_sub_ps(cz, maxZ)), zero);
+            __m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+            __m128 touches = _mm_cmple_ps(distance, _mm_loadu_ps(&rowLights.radiusSquared[i]));
+
+            __m128i tileMin = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&rowLights.tileMin[i]));
+            __m128i tileMax = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&rowLights.tileMax[i]));
+            __m128i outside = _mm_or_si128(_mm_cmpgt_epi32(tileMin, tile), _mm_cmpgt_epi32(tile, tileMax));
+            int mask = _mm_movemask_ps(_mm_andnot_ps(_mm_castsi128_ps(outside), touches));
+            for (int lane = 0; mask != 0; ++lane, mask >>= 1) {
+                if (mask & 1) {
+                    out.push_back(rowLights.lightIndices[i + lane]);
+                }
+            }
+        }
+        rowCounts[cluster] = static_cast<GLuint>(out.size() - before);
+    }
+}
+
+void ClusteredLights::Upload() {
+    if (!lightBuffer) {
+        glGenBuffers(1, &lightBuffer);
+        glGenBuffers(1, &clusterBuffer);
+        glGenBuffers(1, &indexBuffer);
+        glGenTextures(1, &lightTexture);
+        glGenTextures(1, &clusterTexture);
+        glGenTextures(1, &indexTexture);
+
+        // Buffer textures follow their buffer when it is reallocated, so they are attached once
+        glBindTexture(GL_TEXTURE_BUFFER, lightTexture);
+        glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, lightBuffer);
+        glBindTexture(GL_TEXTURE_BUFFER, clusterTexture);
+        glTexBuffer(GL_TEXTURE_BUFFER, GL_RG32UI, clusterBuffer);
+        glBindTexture(GL_TEXTURE_BUFFER, indexTexture);
+        glTexBuffer(GL_TEXTURE_BUFFER, GL_R32UI, indexBuffer);
+        glBindTexture(GL_TEXTURE_BUFFER, 0);
+    }
+
+    // Two texels per light, the origin and radius then the color and shadow. Buffers never go empty, a zero sized buffer
+    // texture is not allowed everywhere.
+    std::vector<glm::vec4> lightData(std::max(lights.size(), static_cast<size_t>(1)) * 2, glm::vec4(0.0f));
+    for (size_t i = 0; i < lights.size(); ++i) {
+        lightData[i * 2] = glm::vec4(lights[i].origin, lights[i].radius);
+        lightData[i * 2 + 1] = glm::vec4(lights[i].color, static_cast<float>(lights[i].shadow));
+    }
+    GLuint emptyIndex = 0;
+
+    glBindBuffer(GL_TEXTURE_BUFFER, lightBuffer);
+    glBufferData(GL_TEXTURE_BUFFER, lightData.size() * sizeof(glm::vec4), lightData.data(), GL_STREAM_DRAW);
+    glBindBuffer(GL_TEXTURE_BUFFER, clusterBuffer);
+    glBufferData(GL_TEXTURE_BUFFER, clusterRanges.size() * sizeof(GLuint), clusterRanges.data(), GL_STREAM_DRAW);
+    glBindBuffer(GL_TEXTURE_BUFFER, indexBuffer);
+    glBufferData(GL_TEXTURE_BUFFER, std::max(indices.size(), static_cast<size_t>(1)) * sizeof(GLuint), indices.empty() ? &emptyIndex : indices.data(), GL_STREAM_DRAW);
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+}
+
+void ClusteredLights::Bind(const Shader& shader, int firstUnit) const {
+    glActiveTexture(GL_TEXTURE0 + firstUnit);
+    glBindTexture(GL_TEXTURE_BUFFER, lightTexture);
+    glActiveTexture(GL_TEXTURE0 + firstUnit + 1);
+    glBindTexture(GL_TEXTURE_BUFFER, clusterTexture);
+    glActiveTexture(GL_TEXTURE0 + firstUnit + 2);
+    glBindTexture(GL_TEXTURE_BUFFER, indexTexture);
+    glActiveTexture(GL_TEXTURE0);
+
+    GLint viewport[4];
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    shader.setInt("dynamicLights", firstUnit);
+    shader.setInt("lightClusters", firstUnit + 1);
+    shader.setInt("lightIndices", firstUnit + 2);
+    shader.setInt("dynamicLightCount", lightTexture ? GetLightCount() : 0);
+    shader.setVec3("clusterGrid", glm::vec3(CLUSTERS_X, CLUSTERS_Y, CLUSTERS_Z));
+    shader.setVec2("clusterDepth", glm::vec2(depthScale, depthBias));
+    shader.setVec2("viewportSize", glm::vec2(static_cast<float>(viewport[2]), static_cast<float>(viewport[3])));
+}
@@ -0,0 +1,94 @@
+#ifndef CLUSTEREDLIGHTS_H
+#define CLUSTEREDLIGHTS_H
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <vector>
+#include "Shader.h"
+#include "ThreadPool.h"
+
+/*
+Culls dynamic point lights for forward shading. The view frustum is cut into CLUSTERS_X x CLUSTERS_Y screen tiles
+and CLUSTERS_Z depth slices spaced exponentially between the near and far planes, and every cluster gets the list
+of lights whose sphere touches its view space box. The world shaders find the cluster of each fragment from its
+screen position and depth and only walk that list, so a pixel pays for the lights near it and not for every
+light in the map.
+
+Binning runs one row of clusters per pool task and tests four lights at a time against each cluster with SSE.
+Lights, cluster ranges and the index list go to the shaders through buffer textures, which GL 3.3 has.
+*/
+
+struct DynamicLight {
+    glm::vec3 origin;   // Map space
+    float radius;       // Light fades to nothing at this distance
+    glm::vec3 color;    // Added to the baked light at full strength
+    int id = -1;        // Stays the same from frame to frame so ShadowAtlas can keep its shadow, -1 casts none
+    int shadow = -1;    // Set by ShadowAtlas::Update, -1 when unshadowed this frame
+};
+
+class ClusteredLights {
+public:
+    static const int CLUSTERS_X = 16;
+    static const int CLUSTERS_Y = 9;
+    static const int CLUSTERS_Z = 24;
+    static const int CLUSTER_COUNT = CLUSTERS_X * CLUSTERS_Y * CLUSTERS_Z;
+
+    explicit ClusteredLights(ThreadPool& pool);
+    ~ClusteredLights();
+
+    ClusteredLights(const ClusteredLights&) = delete;
+    ClusteredLights& operator=(const ClusteredLights&) = delete;
+
+    // Bins lights into the clusters of a view. view goes from map space to camera space (BSPRenderer::GetViewMatrix)
+    // and projection must be a symmetric GL perspective. Only touches the CPU side.
+    void Build(const std::vector<DynamicLight>& lights, const glm::mat4& view, const glm::mat4& projection);
+    // Sends the last Build to the buffer textures
+    void Upload();
+    // Binds the buffer textures to three units from firstUnit and sets the shader's uniforms, the shader must be in use
+    void Bind(const Shader& shader, int firstUnit) const;
+
+    int GetLightCount() const { return static_cast<int>(lights.size()); }
+    int GetIndexCount() const { return static_cast<int>(indices.size()); }
+    // First index and count of a cluster, clusters are numbered x first, then y, then depth
+    const GLuint* GetCluster(int cluster) const { return &clusterRanges[cluster * 2]; }
+    const std::vector<GLuint>& GetIndices() const { return indices; }
+
+private:
+    // Lights that reach one row of clusters, four at a time with unused lanes never touching anything
+    struct RowScratch {
+        std::vector<float> x, y, z, radiusSquared;
+        std::vector<int> tileMin, tileMax;
+        std::vector<GLuint> lightIndices;
+    };
+
+    void BuildClusterBounds(const glm::mat4& projection);
+    void BinRow(int row, int threadIndex);
+
+    ThreadPool& pool;
+    std::vector<RowScratch> scratch;  // One per pool thread
+
+    // View space boxes of every cluster, rebuilt when the projection changes
+    glm::mat4 clusterProjection = glm::mat4(0.0f);
+    std::vector<glm::vec3> clusterMins;
+    std::vector<glm::vec3> clusterMaxs;
+    float nearPlane = 1.0f;
+    float farPlane = 2.0f;
+    float depthScale = 0.0f;  // slice = log(depth) * depthScale + depthBias
+    float depthBias = 0.0f;
+
+    // Lights of the last Build in view space, with the range of slices and tiles each one can reach
+    std::vector<DynamicLight> lights;
+    std::vector<glm::vec4> viewLights;  // Center and radius
+    std::vector<glm::ivec3> lightMins;
+    std::vector<glm::ivec3> lightMaxs;
+
+    std::vector<std::vector<GLuint>> rowIndices; // Light lists of every row of clusters, joined after binning
+    std::vector<GLuint> rowCounts;               // Light count of every cluster, filled by the rows
+    std::vector<GLuint> clusterRanges;           // First index and count of every cluster
+    std::vector<GLuint> indices;
+
+    GLuint lightBuffer = 0, clusterBuffer = 0, indexBuffer = 0;
+    GLuint lightTexture = 0, clusterTexture = 0, indexTexture = 0;
+};
+
+#endif // CLUSTEREDLIGHTS_H
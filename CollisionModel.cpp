@@ -0,0 +1,848 @@
+#include "CollisionModel.h"
+#include "Winding.h"
+#include <immintrin.h>
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+// Traces stop this far in front of surfaces so the next move doesn't start inside them, same as Q3
+static const float SURFACE_CLIP_EPSILON = 0.125f;
+
+// A plane is only a bevel if no corner of the brush is further than this in front of it, same as q3map
+static const float BEVEL_EPSILON = 0.1f;
+static const float BEVEL_NORMAL_EPSILON = 0.00001f;
+static const float BEVEL_DIST_EPSILON = 0.01f;
+
+// Brush bounds come from float windings, sweeps also stop SURFACE_CLIP_EPSILON short of a brush
+static const float BRUSH_BOUNDS_EPSILON = 1.0f;
+
+// Padding plane of a brush, everything is behind it
+static const float PAD_PLANE_DIST = 1e30f;
+
+CollisionModel::CollisionModel(const BSPMap& map) : map(map) {
+    for (const Plane& plane : map.GetPlanes()) {
+        CollisionPlane collisionPlane;
+        collisionPlane.normal = glm::vec3(plane.normal[0], plane.normal[1], plane.normal[2]);
+        collisionPlane.dist = plane.distance;
+        collisionPlane.type = 3;
+        for (int i = 0; i < 3; ++i) {
+            if (plane.normal[i] == 1.0f) {
+                collisionPlane.type = i;
+            }
+        }
+        planes.push_back(collisionPlane);
+    }
+
+    LoadBrushes();
+
+    const std::vector<int>& leafBrushes = map.GetLeafBrushes();
+    for (const Leaf& leaf : map.GetLeafs()) {
+        int contents = 0;
+        for (int i = 0; i < leaf.numLeafBrushes; ++i) {
+            contents |= brushes[leafBrushes[leaf.firstLeafBrush + i]].contents;
+        }
+        leafContents.push_back(contents);
+    }
+
+    LoadPatches();
+
+    context.brushChecks.assign(brushes.size(), 0);
+    context.patchChecks.assign(patches.size(), 0);
+}
+
+void CollisionModel::LoadBrushes() {
+    const std::vector<Brush>& mapBrushes = map.GetBrushes();
+    const std::vector<BrushSide>& mapSides = map.GetBrushSides();
+    const std::vector<TextureInfo>& textures = map.GetTextures();
+
+    std::vector<glm::vec4> brushPlanes;
+    std::vector<int> planeFlags;
+    std::vector<Winding> windings;
+
+    for (size_t i = 0; i < mapBrushes.size(); ++i) {
+        const Brush& brush = mapBrushes[i];
+        bool validTexture = brush.texture >= 0 && brush.texture < static_cast<int>(textures.size());
+        CollisionBrush collisionBrush;
+        collisionBrush.contents = validTexture ? textures[brush.texture].contents : 0;
+        collisionBrush.mins = glm::vec3(MAX_WORLD_COORD);
+        collisionBrush.maxs = glm::vec3(-MAX_WORLD_COORD);
+
+        brushPlanes.clear();
+        planeFlags.clear();
+        if (brush.brushSide < 0 || brush.numSides < 0 || brush.brushSide + brush.numSides > static_cast<int>(mapSides.size())) {
+            std::cerr << "CollisionModel: brush " << i << " has bad sides" << std::endl;
+        }
+        else {
+            for (int j = 0; j < brush.numSides; ++j) {
+                const BrushSide& side = mapSides[brush.brushSide + j];
+                const CollisionPlane& plane = planes[side.plane];
+                bool validSideTexture = side.texture >= 0 && side.texture < static_cast<int>(textures.size());
+                brushPlanes.push_back(glm::vec4(plane.normal, plane.dist));
+                planeFlags.push_back(validSideTexture ? textures[side.texture].flags : 0);
+            }
+        }
+
+        // The face of every side is what is left of its plane behind all the other sides
+        const int numSides = static_cast<int>(brushPlanes.size());
+        windings.assign(numSides, Winding());
+        for (int j = 0; j < numSides; ++j) {
+            glm::vec3 normal(brushPlanes[j]);
+            windings[j] = BaseWindingForPlane(normal, brushPlanes[j].w);
+            for (int k = 0; k < numSides && !windings[j].empty(); ++k) {
+                if (k != j) {
+                    ChopWinding(windings[j], -glm::vec3(brushPlanes[k]), -brushPlanes[k].w, 0.0f);
+                }
+            }
+            for (const glm::vec3& point : windings[j]) {
+                collisionBrush.mins = glm::min(collisionBrush.mins, point);
+                collisionBrush.maxs = glm::max(collisionBrush.maxs, point);
+            }
+        }
+        // Axial sides give exact bounds
+        const bool hasVolume = collisionBrush.mins.x <= collisionBrush.maxs.x;
+        for (int j = 0; j < numSides && hasVolume; ++j) {
+            for (int axis = 0; axis < 3; ++axis) {
+                if (brushPlanes[j][axis] == 1.0f) {
+                    collisionBrush.maxs[axis] = brushPlanes[j].w;
+                }
+                else if (brushPlanes[j][axis] == -1.0f) {
+                    collisionBrush.mins[axis] = -brushPlanes[j].w;
+                }
+            }
+        }
+
+        if (hasVolume) {
+            // Axial bevels
+            for (int axis = 0; axis < 3; ++axis) {
+                for (int dir = -1; dir <= 1; dir += 2) {
+                    bool found = false;
+                    for (const glm::vec4& plane : brushPlanes) {
+                        found = found || plane[axis] == static_cast<float>(dir);
+                    }
+                    if (!found) {
+                        glm::vec4 bevel(0.0f);
+                        bevel[axis] = static_cast<float>(dir);
+                        bevel.w = dir > 0 ? collisionBrush.maxs[axis] : -collisionBrush.mins[axis];
+                        brushPlanes.push_back(bevel);
+                        planeFlags.push_back(0);
+                    }
+                }
+            }
+
+            // Edge bevels, the planes through each non axial edge that contain an axis and have the whole brush behind them
+            for (int j = 0; j < numSides; ++j) {
+                const Winding& winding = windings[j];
+                const int count = static_cast<int>(winding.size());
+                for (int k = 0; k < count; ++k) {
+                    glm::vec3 edge = winding[(k + 1) % count] - winding[k];
+                    if (glm::length(edge) < 0.5f) {
+                        continue;
+                    }
+                    edge = glm::normalize(edge);
+                    SnapVector(edge);
+                    if (edge.x == 1.0f || edge.x == -1.0f || edge.y == 1.0f || edge.y == -1.0f || edge.z == 1.0f || edge.z == -1.0f) {
+                        continue; // Axial bevels cover it
+                    }
+
+                    for (int axis = 0; axis < 3; ++axis) {
+                        for (int dir = -1; dir <= 1; dir += 2) {
+                            glm::vec3 axisDir(0.0f);
+                            axisDir[axis] = static_cast<float>(dir);
+                            glm::vec3 normal = glm::cross(edge, axisDir);
+                            if (glm::length(normal) < 0.5f) {
+                                continue;
+                            }
+                            normal = glm::normalize(normal);
+                            float dist = glm::dot(winding[k], normal);
+
+                            bool skip = false;
+                            for (size_t p = 0; p < brushPlanes.size() && !skip; ++p) {
+                                const glm::vec4& plane = brushPlanes[p];
+                                skip = std::fabs(plane.x - normal.x) < BEVEL_NORMAL_EPSILON && std::fabs(plane.y - normal.y) < BEVEL_NORMAL_EPSILON &&
+                                    std::fabs(plane.z - normal.z) < BEVEL_NORMAL_EPSILON && std::fabs(plane.w - dist) < BEVEL_DIST_EPSILON;
+                            }
+                            for (int w = 0; w < numSides && !skip; ++w) {
+                                for (const glm::vec3& point : windings[w]) {
+                                    if (glm::dot(point, normal) - dist > BEVEL_EPSILON) {
+                                        skip = true; // Cuts into the brush
+                                        break;
+                                    }
+                                }
+                            }
+                            if (!skip) {
+                                brushPlanes.push_back(glm::vec4(normal, dist));
+                                planeFlags.push_back(0);
+                            }
+                        }
+                    }
+                }
+            }
+        }
+
+        collisionBrush.firstPlane = static_cast<int>(brushPlaneDist.size());
+        collisionBrush.numPlanes = static_cast<int>(brushPlanes.size());
+        for (size_t j = 0; j < brushPlanes.size(); ++j) {
+            brushPlaneX.push_back(brushPlanes[j].x);
+            brushPlaneY.push_back(brushPlanes[j].y);
+            brushPlaneZ.push_back(brushPlanes[j].z);
+            brushPlaneDist.push_back(brushPlanes[j].w);
+            brushPlaneFlags.push_back(planeFlags[j]);
+        }
+        while (brushPlaneDist.size() % 4 != 0) {
+            brushPlaneX.push_back(0.0f);
+            brushPlaneY.push_back(0.0f);
+            brushPlaneZ.push_back(0.0f);
+            brushPlaneDist.push_back(PAD_PLANE_DIST);
+            brushPlaneFlags.push_back(0);
+        }
+        brushes.push_back(collisionBrush);
+    }
+}
+
+void CollisionModel::LoadPatches() {
+    const std::vector<Face>& faces = map.GetFaces();
+    const std::vector<Vertex>& vertices = map.GetVertex();
+    const std::vector<TextureInfo>& textures = map.GetTextures();
+
+    std::vector<int> facePatches(faces.size(), -1);
+    std::vector<glm::vec3> points;
+    for (size_t i = 0; i < faces.size(); ++i) {
+        const Face& face = faces[i];
+        if (face.type != 2) {
+            continue;
+        }
+        int width = face.size[0];
+        int height = face.size[1];
+        if (width * height != face.numVertices || face.vertex < 0 || face.vertex + face.numVertices > static_cast<int>(vertices.size())) {
+            std::cerr << "CollisionModel: patch " << i << " has bad vertices" << std::endl;
+            continue;
+        }
+        bool validTexture = face.texture >= 0 && face.texture < static_cast<int>(textures.size());
+        int contents = validTexture ? textures[face.texture].contents : 0;
+        if (!contents) {
+            continue; // Nothing can collide with it
+        }
+
+        points.clear();
+        for (int j = 0; j < face.numVertices; ++j) {
+            const Vertex& vertex = vertices[face.vertex + j];
+            points.push_back(glm::vec3(vertex.position[0], vertex.position[1], vertex.position[2]));
+        }
+        PatchCollide collide(width, height, points.data());
+        if (collide.GetFacets().empty()) {
+            continue;
+        }
+
+        CollisionPatch patch;
+        patch.mins = collide.GetMins();
+        patch.maxs = collide.GetMaxs();
+        patch.firstFacet = static_cast<int>(facets.size());
+        patch.numFacets = static_cast<int>(collide.GetFacets().size());
+        patch.contents = contents;
+        patch.surfaceFlags = textures[face.texture].flags;
+
+        int planeOffset = static_cast<int>(facetPlanes.size());
+        for (PatchFacet facet : collide.GetFacets()) {
+            facet.firstPlane += planeOffset;
+            facets.push_back(facet);
+        }
+        facetPlanes.insert(facetPlanes.end(), collide.GetPlanes().begin(), collide.GetPlanes().end());
+
+        facePatches[i] = static_cast<int>(patches.size());
+        patches.push_back(patch);
+    }
+
+    const std::vector<int>& leafFaces = map.GetLeafFaces();
+    for (const Leaf& leaf : map.GetLeafs()) {
+        firstLeafPatch.push_back(static_cast<int>(leafPatches.size()));
+        for (int i = 0; i < leaf.numLeafFaces; ++i) {
+            int patch = facePatches[leafFaces[leaf.firstLeafFace + i]];
+            if (patch >= 0) {
+                leafPatches.push_back(patch);
+            }
+        }
+    }
+    firstLeafPatch.push_back(static_cast<int>(leafPatches.size()));
+}
+
+TraceResult CollisionModel::TraceBox(const glm::vec3& start, const glm::vec3& end, const glm::vec3& mins, const glm::vec3& maxs, int contentMask) {
+    return TraceBox(context, start, end, mins, maxs, contentMask);
+}
+
+TraceResult CollisionModel::TraceRay(const glm::vec3& start, const glm::vec3& end, int contentMask) {
+    return TraceBox(context, start, end, glm::vec3(0.0f), glm::vec3(0.0f), contentMask);
+}
+
+TraceResult CollisionModel::TraceBox(TraceContext& traceContext, const glm::vec3& start, const glm::vec3& end, const glm::vec3& mins, const glm::vec3& maxs, int contentMask) const {
+    traceContext.brushTests = 0;
+    traceContext.leafVisits = 0;
+
+    TraceWork work;
+    BeginTrace(work, traceContext, start, end, mins, maxs, contentMask);
+    if (!map.GetNodes().empty()) {
+        TraceThroughTree(work, 0, 0.0f, 1.0f, work.start, work.end);
+    }
+    return FinishTrace(work, start, end);
+}
+
+void CollisionModel::TracePacket(TraceContext& traceContext, const RayQuery* rays, const int* indices, int count, TraceResult* results) const {
+    if (count > PACKET_SIZE) {
+        count = PACKET_SIZE;
+    }
+    if (count <= 0) {
+        return;
+    }
+
+    TraceWork works[PACKET_SIZE];
+    alignas(16) float starts[3][PACKET_SIZE];
+    alignas(16) float ends[3][PACKET_SIZE];
+    for (int i = 0; i < PACKET_SIZE; ++i) {
+        // Short packets repeat their last ray, a copy can't change which way the packet goes
+        const RayQuery& ray = rays[indices[i < count ? i : count - 1]];
+        if (i < count) {
+            BeginTrace(works[i], traceContext, ray.start, ray.end, glm::vec3(0.0f), glm::vec3(0.0f), ray.contentMask);
+        }
+        for (int axis = 0; axis < 3; ++axis) {
+            starts[axis][i] = ray.start[axis];
+            ends[axis][i] = ray.end[axis];
+        }
+    }
+
+    // Walk down while all rays are clear of the node plane on the same side, the same test a single trace makes
+    const std::vector<Node>& nodes = map.GetNodes();
+    int num = nodes.empty() ? -1 : 0;
+    const __m128 sx = _mm_load_ps(starts[0]), sy = _mm_load_ps(starts[1]), sz = _mm_load_ps(starts[2]);
+    const __m128 ex = _mm_load_ps(ends[0]), ey = _mm_load_ps(ends[1]), ez = _mm_load_ps(ends[2]);
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 minusOne = _mm_set1_ps(-1.0f);
+    while (num >= 0) {
+        const Node& node = nodes[num];
+        const CollisionPlane& plane = planes[node.plane];
+        __m128 nx = _mm_set1_ps(plane.normal.x), ny = _mm_set1_ps(plane.normal.y), nz = _mm_set1_ps(plane.normal.z);
+        __m128 dist = _mm_set1_ps(plane.dist);
+        __m128 t1 = _mm_sub_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(sx, nx), _mm_mul_ps(sy, ny)), _mm_mul_ps(sz, nz)), dist);
+        __m128 t2 = _mm_sub_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(ex, nx), _mm_mul_ps(ey, ny)), _mm_mul_ps(ez, nz)), dist);
+
+        int front = _mm_movemask_ps(_mm_and_ps(_mm_cmpge_ps(t1, one), _mm_cmpge_ps(t2, one)));
+        if (front == 0xF) {
+            num = node.children[0];
+            continue;
+        }
+        int back = _mm_movemask_ps(_mm_and_ps(_mm_cmplt_ps(t1, minusOne), _mm_cmplt_ps(t2, minusOne)));
+        if (back == 0xF) {
+            num = node.children[1];
+            continue;
+        }
+        break; // The rays split up here
+    }
+
+    // Every segment lies in the subtree of num, so the rest of each trace can start from there
+    for (int i = 0; i < count; ++i) {
+        if (!nodes.empty()) {
+            TraceThroughTree(works[i], num, 0.0f, 1.0f, works[i].start, works[i].end);
+        }
+        const RayQuery& ray = rays[indices[i]];
+        results[indices[i]] = FinishTrace(works[i], ray.start, ray.end);
+    }
+}
+
+void CollisionModel::BeginTrace(TraceWork& work, TraceContext& traceContext, const glm::vec3& start, const glm::vec3& end, const glm::vec3& mins, const glm::vec3& maxs, int contentMask) const {
+    if (traceContext.brushChecks.size() != brushes.size() || traceContext.patchChecks.size() != patches.size()) {
+        traceContext.brushChecks.assign(brushes.size(), 0);
+        traceContext.patchChecks.assign(patches.size(), 0);
+        traceContext.checkCount = 0;
+    }
+
+    // Move the box so it is symmetric around the traced point, then only its extents matter
+    work.offset = (mins + maxs) * 0.5f;
+    work.extents = maxs - work.offset;
+    work.start = start + work.offset;
+    work.end = end + work.offset;
+    work.isPoint = work.extents == glm::vec3(0.0f);
+    work.mins = glm::min(work.start, work.end) - work.extents;
+    work.maxs = glm::max(work.start, work.end) + work.extents;
+    work.contentMask = contentMask;
+    work.checkCount = ++traceContext.checkCount;
+    work.result = TraceResult();
+    work.context = &traceContext;
+}
+
+TraceResult CollisionModel::FinishTrace(TraceWork& work, const glm::vec3& start, const glm::vec3& end) const {
+    TraceResult& result = work.result;
+    if (result.fraction == 1.0f) {
+        result.endPos = end;
+    }
+    else {
+        result.endPos = start + result.fraction * (end - start);
+    }
+    return result;
+}
+
+void CollisionModel::TraceThroughTree(TraceWork& work, int num, float startFraction, float endFraction, const glm::vec3& start, const glm::vec3& end) const {
+    // Already hit something nearer
+    if (work.result.fraction <= startFraction) {
+        return;
+    }
+    if (num < 0) {
+        TraceThroughLeaf(work, -num - 1);
+        return;
+    }
+
+    const Node& node = map.GetNodes()[num];
+    const CollisionPlane& plane = planes[node.plane];
+
+    // The plane is widened by how far the box reaches along its normal
+    float t1, t2, offset;
+    if (plane.type < 3) {
+        t1 = start[plane.type] - plane.dist;
+        t2 = end[plane.type] - plane.dist;
+        offset = work.extents[plane.type];
+    }
+    else {
+        t1 = glm::dot(plane.normal, start) - plane.dist;
+        t2 = glm::dot(plane.normal, end) - plane.dist;
+        offset = work.isPoint ? 0.0f : std::fabs(work.extents.x * plane.normal.x) + std::fabs(work.extents.y * plane.normal.y) + std::fabs(work.extents.z * plane.normal.z);
+    }
+
+    // Entirely on one side
+    if (t1 >= offset + 1.0f && t2 >= offset + 1.0f) {
+        TraceThroughTree(work, node.children[0], startFraction, endFraction, start, end);
+        return;
+    }
+    if (t1 < -offset - 1.0f && t2 < -offset - 1.0f) {
+        TraceThroughTree(work, node.children[1], startFraction, endFraction, start, end);
+        return;
+    }
+
+    // Split the move, the near part runs slightly past the plane and the far part starts slightly before it
+    int side;
+    float frac, frac2;
+    if (t1 < t2) {
+        float idist = 1.0f / (t1 - t2);
+        side = 1;
+        frac2 = (t1 + offset + SURFACE_CLIP_EPSILON) * idist;
+        frac = (t1 - offset + SURFACE_CLIP_EPSILON) * idist;
+    }
+    else if (t1 > t2) {
+        float idist = 1.0f / (t1 - t2);
+        side = 0;
+        frac2 = (t1 - offset - SURFACE_CLIP_EPSILON) * idist;
+        frac = (t1 + offset + SURFACE_CLIP_EPSILON) * idist;
+    }
+    else {
+        side = 0;
+        frac = 1.0f;
+        frac2 = 0.0f;
+    }
+
+    frac = std::min(std::max(frac, 0.0f), 1.0f);
+    float midFraction = startFraction + (endFraction - startFraction) * frac;
+    glm::vec3 mid = start + frac * (end - start);
+    TraceThroughTree(work, node.children[side], startFraction, midFraction, start, mid);
+
+    frac2 = std::min(std::max(frac2, 0.0f), 1.0f);
+    midFraction = startFraction + (endFraction - startFraction) * frac2;
+    mid = start + frac2 * (end - start);
+    TraceThroughTree(work, node.children[side ^ 1], midFraction, endFraction, mid, end);
+}
+
+void CollisionModel::TraceThroughLeaf(TraceWork& work, int leaf) const {
+    const Leaf& data = map.GetLeafs()[leaf];
+    const std::vector<int>& leafBrushes = map.GetLeafBrushes();
+    TraceContext& traceContext = *work.context;
+    ++traceContext.leafVisits;
+
+    for (int i = 0; i < data.numLeafBrushes; ++i) {
+        int brushIndex = leafBrushes[data.firstLeafBrush + i];
+        if (traceContext.brushChecks[brushIndex] == work.checkCount) {
+            continue; // Already tested through another leaf
+        }
+        traceContext.brushChecks[brushIndex] = work.checkCount;
+
+        const CollisionBrush& brush = brushes[brushIndex];
+        if (!(brush.contents & work.contentMask)) {
+            continue;
+        }
+        if (work.maxs.x < brush.mins.x - BRUSH_BOUNDS_EPSILON || work.maxs.y < brush.mins.y - BRUSH_BOUNDS_EPSILON || work.maxs.z < brush.mins.z - BRUSH_BOUNDS_EPSILON ||
+            work.mins.x > brush.maxs.x + BRUSH_BOUNDS_EPSILON || work.mins.y > brush.maxs.y + BRUSH_BOUNDS_EPSILON || work.mins.z > brush.maxs.z + BRUSH_BOUNDS_EPSILON) {
+            continue;
+        }
+        TraceThroughBrush(work, brush);
+        if (work.result.fraction == 0.0f) {
+            return;
+        }
+    }
+
+    for (int i = firstLeafPatch[leaf]; i < firstLeafPatch[leaf + 1]; ++i) {
+        int patchIndex = leafPatches[i];
+        if (traceContext.patchChecks[patchIndex] == work.checkCount) {
+            continue;
+        }
+        traceContext.patchChecks[patchIndex] = work.checkCount;
+
+        const CollisionPatch& patch = patches[patchIndex];
+        if (!(patch.contents & work.contentMask)) {
+            continue;
+        }
+        // Most sweeps are nowhere near the patch
+        if (work.maxs.x < patch.mins.x || work.maxs.y < patch.mins.y || work.maxs.z < patch.mins.z ||
+            work.mins.x > patch.maxs.x || work.mins.y > patch.maxs.y || work.mins.z > patch.maxs.z) {
+            continue;
+        }
+
+        if (work.start == work.end) {
+            if (TestInPatch(work, patch)) {
+                work.result.startSolid = true;
+                work.result.allSolid = true;
+                work.result.fraction = 0.0f;
+                work.result.contents = patch.contents;
+                return;
+            }
+            continue;
+        }
+
+        float oldFraction = work.result.fraction;
+        TraceThroughPatch(work, patch);
+        if (work.result.fraction < oldFraction) {
+            work.result.surfaceFlags = patch.surfaceFlags;
+            work.result.contents = patch.contents;
+        }
+        if (work.result.fraction == 0.0f) {
+            return;
+        }
+    }
+}
+
+void CollisionModel::TraceThroughBrush(TraceWork& work, const CollisionBrush& brush) const {
+    if (brush.numPlanes <= 0) {
+        return;
+    }
+    ++work.context->brushTests;
+
+    float enterFraction = -1.0f;
+    float leaveFraction = 1.0f;
+    int clipPlane = -1;
+    bool getOut = false;
+    bool startOut = false;
+
+    const float* planeX = &brushPlaneX[brush.firstPlane];
+    const float* planeY = &brushPlaneY[brush.firstPlane];
+    const float* planeZ = &brushPlaneZ[brush.firstPlane];
+    const float* planeDist = &brushPlaneDist[brush.firstPlane];
+    const __m128 signMask = _mm_set1_ps(-0.0f);
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 clipEpsilon = _mm_set1_ps(SURFACE_CLIP_EPSILON);
+    const __m128 extentsX = _mm_set1_ps(work.extents.x);
+    const __m128 extentsY = _mm_set1_ps(work.extents.y);
+    const __m128 extentsZ = _mm_set1_ps(work.extents.z);
+    const __m128 startX = _mm_set1_ps(work.start.x);
+    const __m128 startY = _mm_set1_ps(work.start.y);
+    const __m128 startZ = _mm_set1_ps(work.start.z);
+    const __m128 endX = _mm_set1_ps(work.end.x);
+    const __m128 endY = _mm_set1_ps(work.end.y);
+    const __m128 endZ = _mm_set1_ps(work.end.z);
+    alignas(16) float d1s[4];
+    alignas(16) float d2s[4];
+
+    // The box is inside the brush only while its center is behind every plane pushed out by the extents.
+    // Four planes at a time, in the same order of operations as one at a time so results don't change.
+    for (int i = 0; i < brush.numPlanes; i += 4) {
+        __m128 normalX = _mm_loadu_ps(planeX + i);
+        __m128 normalY = _mm_loadu_ps(planeY + i);
+        __m128 normalZ = _mm_loadu_ps(planeZ + i);
+        __m128 dist = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_loadu_ps(planeDist + i),
+            _mm_andnot_ps(signMask, _mm_mul_ps(extentsX, normalX))),
+            _mm_andnot_ps(signMask, _mm_mul_ps(extentsY, normalY))),
+            _mm_andnot_ps(signMask, _mm_mul_ps(extentsZ, normalZ)));
+        __m128 d1 = _mm_sub_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(startX, normalX), _mm_mul_ps(startY, normalY)), _mm_mul_ps(startZ, normalZ)), dist);
+        __m128 d2 = _mm_sub_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(endX, normalX), _mm_mul_ps(endY, normalY)), _mm_mul_ps(endZ, normalZ)), dist);
+
+        __m128 startFront = _mm_cmpgt_ps(d1, zero);
+        __m128 endFront = _mm_cmpgt_ps(d2, zero);
+        // Completely in front of one plane, so it misses the whole brush
+        __m128 miss = _mm_and_ps(startFront, _mm_or_ps(_mm_cmpge_ps(d2, clipEpsilon), _mm_cmpge_ps(d2, d1)));
+        if (_mm_movemask_ps(miss)) {
+            return;
+        }
+        int startMask = _mm_movemask_ps(startFront);
+        int endMask = _mm_movemask_ps(endFront);
+        startOut = startOut || startMask;
+        getOut = getOut || endMask;
+
+        // Planes with both ends behind them don't clip anything
+        int crossMask = startMask | endMask;
+        if (!crossMask) {
+            continue;
+        }
+        _mm_store_ps(d1s, d1);
+        _mm_store_ps(d2s, d2);
+        for (int lane = 0; lane < 4; ++lane) {
+            if (!(crossMask & (1 << lane))) {
+                continue;
+            }
+            float planeD1 = d1s[lane];
+            float planeD2 = d2s[lane];
+            if (planeD1 > planeD2) {
+                // Entering
+                float f = std::max((planeD1 - SURFACE_CLIP_EPSILON) / (planeD1 - planeD2), 0.0f);
+                if (f > enterFraction) {
+                    enterFraction = f;
+                    clipPlane = brush.firstPlane + i + lane;
+                }
+            }
+            else {
+                // Leaving
+                float f = std::min((planeD1 + SURFACE_CLIP_EPSILON) / (planeD1 - planeD2), 1.0f);
+                if (f < leaveFraction) {
+                    leaveFraction = f;
+                }
+            }
+        }
+    }
+
+    TraceResult& result = work.result;
+    if (!startOut) {
+        result.startSolid = true;
+        if (!getOut) {
+            result.allSolid = true;
+            result.fraction = 0.0f;
+            result.contents = brush.contents;
+        }
+        return;
+    }
+
+    if (enterFraction < leaveFraction && enterFraction > -1.0f && enterFraction < result.fraction && clipPlane >= 0) {
+        result.fraction = std::max(enterFraction, 0.0f);
+        result.normal = glm::vec3(brushPlaneX[clipPlane], brushPlaneY[clipPlane], brushPlaneZ[clipPlane]);
+        result.dist = brushPlaneDist[clipPlane];
+        result.surfaceFlags = brushPlaneFlags[clipPlane];
+        result.contents = brush.contents;
+    }
+}
+
+void CollisionModel::TraceThroughPatch(TraceWork& work, const CollisionPatch& patch) const {
+    if (work.isPoint) {
+        TracePointThroughPatch(work, patch);
+        return;
+    }
+
+    for (int i = 0; i < patch.numFacets; ++i) {
+        const PatchFacet& facet = facets[patch.firstFacet + i];
+        float enterFraction = -1.0f;
+        float leaveFraction = 1.0f;
+        int hitPlane = -1;
+        bool missed = false;
+
+        // Same clipping as a brush, the first plane is the surface and the rest face out of the facet
+        for (int j = 0; j < facet.numPlanes && !missed; ++j) {
+            const glm::vec4& plane = facetPlanes[facet.firstPlane + j];
+            glm::vec3 normal(plane);
+            float dist = plane.w + std::fabs(work.extents.x * normal.x) + std::fabs(work.extents.y * normal.y) + std::fabs(work.extents.z * normal.z);
+            float d1 = glm::dot(work.start, normal) - dist;
+            float d2 = glm::dot(work.end, normal) - dist;
+
+            if (d1 > 0.0f && (d2 >= SURFACE_CLIP_EPSILON || d2 >= d1)) {
+                missed = true;
+            }
+            else if (d1 <= 0.0f && d2 <= 0.0f) {
+                continue;
+            }
+            else if (d1 > d2) {
+                // Earlier planes win ties, so the surface is preferred over its borders
+                float f = std::max((d1 - SURFACE_CLIP_EPSILON) / (d1 - d2), 0.0f);
+                if (f > enterFraction) {
+                    enterFraction = f;
+                    hitPlane = j;
+                }
+            }
+            else {
+                leaveFraction = std::min(leaveFraction, std::min((d1 + SURFACE_CLIP_EPSILON) / (d1 - d2), 1.0f));
+            }
+        }
+        // Never clip against the back of the surface
+        if (missed || hitPlane == facet.numPlanes - 1) {
+            continue;
+        }
+
+        if (enterFraction < leaveFraction && enterFraction >= 0.0f && enterFraction < work.result.fraction) {
+            const glm::vec4& plane = facetPlanes[facet.firstPlane + hitPlane];
+            work.result.fraction = enterFraction;
+            work.result.normal = glm::vec3(plane);
+            work.result.dist = plane.w;
+        }
+    }
+}
+
+void CollisionModel::TracePointThroughPatch(TraceWork& work, const CollisionPatch& patch) const {
+    // A point sees the facet slab with no thickness, so the surface crossing is found first and then checked
+    // against the borders instead of clipping the move against every plane
+    for (int i = 0; i < patch.numFacets; ++i) {
+        const PatchFacet& facet = facets[patch.firstFacet + i];
+        const glm::vec4& surface = facetPlanes[facet.firstPlane];
+        glm::vec3 surfaceNormal(surface);
+        float d1 = glm::dot(work.start, surfaceNormal) - surface.w;
+        float d2 = glm::dot(work.end, surfaceNormal) - surface.w;
+        if (d1 <= 0.0f || d2 >= d1) {
+            continue; // Starts behind the surface or moves away from it
+        }
+        float intersect = d1 / (d1 - d2);
+        if (intersect > work.result.fraction) {
+            continue;
+        }
+
+        // Where the move crosses the surface has to be inside every border
+        int j = 1;
+        for (; j < facet.numPlanes; ++j) {
+            const glm::vec4& plane = facetPlanes[facet.firstPlane + j];
+            glm::vec3 normal(plane);
+            float b1 = glm::dot(work.start, normal) - plane.w;
+            float b2 = glm::dot(work.end, normal) - plane.w;
+            float crossing = 99999.0f;
+            if (b1 != b2) {
+                crossing = b1 / (b1 - b2);
+                if (crossing <= 0.0f) {
+                    crossing = 99999.0f;
+                }
+            }
+            if (b1 > 0.0f ? crossing > intersect : crossing < intersect) {
+                break;
+            }
+        }
+        if (j < facet.numPlanes) {
+            continue;
+        }
+
+        work.result.fraction = std::max((d1 - SURFACE_CLIP_EPSILON) / (d1 - d2), 0.0f);
+        work.result.normal = surfaceNormal;
+        work.result.dist = surface.w;
+    }
+}
+
+bool CollisionModel::TestInPatch(const TraceWork& work, const CollisionPatch& patch) const {
+    for (int i = 0; i < patch.numFacets; ++i) {
+        const PatchFacet& facet = facets[patch.firstFacet + i];
+        int j = 0;
+        for (; j < facet.numPlanes; ++j) {
+            const glm::vec4& plane = facetPlanes[facet.firstPlane + j];
+            glm::vec3 normal(plane);
+            float dist = plane.w + std::fabs(work.extents.x * normal.x) + std::fabs(work.extents.y * normal.y) + std::fabs(work.extents.z * normal.z);
+            if (glm::dot(work.start, normal) - dist > 0.0f) {
+                break;
+            }
+        }
+        if (j == facet.numPlanes) {
+            return true;
+        }
+    }
+    return false;
+}
+
+int CollisionModel::LeafForPoint(const glm::vec3& point) const {
+    const std::vector<Node>& nodes = map.GetNodes();
+    if (nodes.empty()) {
+        return 0;
+    }
+    int num = 0;
+    while (num >= 0) {
+        const Node& node = nodes[num];
+        const CollisionPlane& plane = planes[node.plane];
+        float d = plane.type < 3 ? point[plane.type] - plane.dist : glm::dot(plane.normal, point) - plane.dist;
+        num = d >= 0.0f ? node.children[0] : node.children[1];
+    }
+    return -num - 1;
+}
+
+int CollisionModel::PointContents(const glm::vec3& point) const {
+    if (map.GetLeafs().empty()) {
+        return 0;
+    }
+    return LeafContents(LeafForPoint(point), point);
+}
+
+int CollisionModel::PointContents(const glm::vec3& point, PointCache& cache) const {
+    if (map.GetLeafs().empty()) {
+        return 0;
+    }
+    return LeafContents(PointLeaf(point, cache), point);
+}
+
+int CollisionModel::PointLeaf(const glm::vec3& point, PointCache& cache) const {
+    const std::vector<Node>& nodes = map.GetNodes();
+    if (nodes.empty()) {
+        return 0;
+    }
+
+    // Keep the part of the old path whose regions the point can't have left, and how much room is left in them
+    int depth = 0;
+    if (cache.leaf >= 0) {
+        float moved = glm::length(point - cache.point);
+        if (moved < cache.radii[cache.depth]) {
+            cache.point = point;
+            for (int i = 0; i <= cache.depth; ++i) {
+                cache.radii[i] -= moved;
+            }
+            return cache.leaf;
+        }
+        while (depth + 1 < cache.depth && moved < cache.radii[depth + 1]) {
+            ++depth;
+        }
+        for (int i = 0; i <= depth; ++i) {
+            cache.radii[i] -= moved;
+        }
+    }
+    else {
+        cache.nodes[0] = 0;
+        cache.radii[0] = 1e30f;
+    }
+
+    // Walk down from there, recording the path for the next lookup
+    int num = cache.nodes[depth];
+    float radius = cache.radii[depth];
+    while (num >= 0) {
+        const Node& node = nodes[num];
+        const CollisionPlane& plane = planes[node.plane];
+        float d = plane.type < 3 ? point[plane.type] - plane.dist : glm::dot(plane.normal, point) - plane.dist;
+        num = d >= 0.0f ? node.children[0] : node.children[1];
+        radius = std::min(radius, std::fabs(d));
+
+        if (++depth > PointCache::MAX_DEPTH) {
+            cache.leaf = -1;
+            return LeafForPoint(point);
+        }
+        cache.radii[depth] = radius;
+        if (num >= 0 && depth < PointCache::MAX_DEPTH) {
+            cache.nodes[depth] = num;
+        }
+    }
+
+    cache.point = point;
+    cache.leaf = -num - 1;
+    cache.depth = depth;
+    return cache.leaf;
+}
+
+int CollisionModel::LeafContents(int leafIndex, const glm::vec3& point) const {
+    // Most leafs touch no brushes at all
+    if (leafContents[leafIndex] == 0) {
+        return 0;
+    }
+
+    const Leaf& leaf = map.GetLeafs()[leafIndex];
+    const std::vector<int>& leafBrushes = map.GetLeafBrushes();
+    int contents = 0;
+    for (int i = 0; i < leaf.numLeafBrushes; ++i) {
+        const CollisionBrush& brush = brushes[leafBrushes[leaf.firstLeafBrush + i]];
+        if ((contents | brush.contents) == contents) {
+            continue; // Can't add anything
+        }
+        bool inside = point.x >= brush.mins.x - BRUSH_BOUNDS_EPSILON && point.y >= brush.mins.y - BRUSH_BOUNDS_EPSILON && point.z >= brush.mins.z - BRUSH_BOUNDS_EPSILON &&
+            point.x <= brush.maxs.x + BRUSH_BOUNDS_EPSILON && point.y <= brush.maxs.y + BRUSH_BOUNDS_EPSILON && point.z <= brush.maxs.z + BRUSH_BOUNDS_EPSILON;
+        for (int j = brush.firstPlane; j < brush.firstPlane + brush.numPlanes && inside; ++j) {
+            inside = point.x * brushPlaneX[j] + point.y * brushPlaneY[j] + point.z * brushPlaneZ[j] - brushPlaneDist[j] <= 0.0f;
+        }
+        if (inside) {
+            contents |= brush.contents;
+        }
+    }
+    return contents;
+}
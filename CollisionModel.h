@@ -0,0 +1,170 @@
+#ifndef COLLISIONMODEL_H
+#define COLLISIONMODEL_H
+
+#include <glm/glm.hpp>
+#include <vector>
+#include "BSPMap.h"
+#include "PatchCollide.h"
+
+/*
+Collision against the brushes of a BSPMap, in map space, working like Q3's CM_Trace. A sweep walks down the node
+tree, splitting the move where it crosses a node plane (widened by the box extents), and in each leaf it reaches
+the move is clipped against the leaf's brushes and curved patches. Brush and facet planes are pushed out by the box
+so every test is a ray test. Rays are boxes of zero size, and a start equal to the end tests whether the box fits
+at that point. Patches are turned into facets at load and only tested when the sweep's bounds touch theirs.
+
+Brushes get bounds and bevel planes at load like q3map adds them: every missing axial plane and every edge plane
+the brush lies behind. Without them a box passing the corner of an angled brush is stopped by a side plane pushed
+out well past the brush and snags on empty space. Sweeps skip every brush whose bounds they don't touch.
+*/
+
+// Content masks for traces
+enum ContentMasks {
+    MASK_SOLID = CONTENTS_SOLID,
+    MASK_PLAYERSOLID = CONTENTS_SOLID | CONTENTS_PLAYERCLIP | CONTENTS_BODY,
+    MASK_SHOT = CONTENTS_SOLID | CONTENTS_BODY | CONTENTS_CORPSE,
+    MASK_WATER = CONTENTS_WATER | CONTENTS_LAVA | CONTENTS_SLIME
+};
+
+struct TraceResult {
+    float fraction = 1.0f;    // Part of the move done before hitting anything, 1 if nothing was hit
+    glm::vec3 endPos;         // Where the box stopped
+    glm::vec3 normal;         // Normal of the plane that was hit
+    float dist = 0.0f;        // Distance of that plane
+    int surfaceFlags = 0;     // Surface flags of the brush side that was hit
+    int contents = 0;         // Contents of the brush that was hit
+    bool startSolid = false;  // Started inside a brush
+    bool allSolid = false;    // Never left the brush it started in
+};
+
+// Per caller scratch state, one per thread lets traces run at the same time
+struct TraceContext {
+    std::vector<int> brushChecks; // Trace a brush was last tested by, brushes shared by leafs are tested once
+    std::vector<int> patchChecks; // Same for patches
+    int checkCount = 0;
+    int brushTests = 0;           // Brushes tested since the counters were cleared, TraceBox clears them
+    int leafVisits = 0;           // Leafs reached since the counters were cleared
+};
+
+// A caller's last point lookup. Moving less than a region's safe radius can't have crossed any of its planes,
+// so the lookup only has to walk down from the deepest node the point is certainly still inside.
+struct PointCache {
+    static const int MAX_DEPTH = 64;   // Deeper paths are not cached
+
+    glm::vec3 point;
+    int leaf = -1;                     // Leaf of point, -1 when nothing is cached
+    int depth = 0;                     // Nodes on the path from the root to leaf
+    int nodes[MAX_DEPTH];
+    float radii[MAX_DEPTH + 1];        // radii[i] is how far point is from the planes above nodes[i], the last is the leaf's
+};
+
+struct RayQuery {
+    glm::vec3 start;
+    glm::vec3 end;
+    int contentMask;
+};
+
+class CollisionModel {
+public:
+    CollisionModel(const BSPMap& map);
+
+    // Sweeps the box mins/maxs (relative to the moving point) from start to end against brushes matching contentMask
+    TraceResult TraceBox(const glm::vec3& start, const glm::vec3& end, const glm::vec3& mins, const glm::vec3& maxs, int contentMask);
+    TraceResult TraceBox(TraceContext& context, const glm::vec3& start, const glm::vec3& end, const glm::vec3& mins, const glm::vec3& maxs, int contentMask) const;
+    TraceResult TraceRay(const glm::vec3& start, const glm::vec3& end, int contentMask);
+
+    // Traces up to PACKET_SIZE rays, rays[indices[i]] writes results[indices[i]]. The rays go down the tree
+    // together while every one of them is on the same side of the node planes, then each finishes on its own.
+    // Counters in context are not cleared.
+    void TracePacket(TraceContext& context, const RayQuery* rays, const int* indices, int count, TraceResult* results) const;
+
+    static const int PACKET_SIZE = 4;
+
+    // Contents of all brushes containing point
+    int PointContents(const glm::vec3& point) const;
+    int PointContents(const glm::vec3& point, PointCache& cache) const;
+
+    // Leaf containing point, starting from the caller's last lookup
+    int PointLeaf(const glm::vec3& point, PointCache& cache) const;
+
+    // Contents of every brush touching the leaf, 0 means nothing in it can contain a point
+    int GetLeafContents(int leaf) const { return leafContents[leaf]; }
+
+    const TraceContext& GetContext() const { return context; }
+
+private:
+    struct CollisionPlane {
+        glm::vec3 normal;
+        float dist;
+        int type; // 0-2 when the normal is along that axis, 3 otherwise
+    };
+
+    // Planes of a brush are brushPlane*[firstPlane] up to numPlanes, padded with planes nothing is in front of
+    // so they can always be tested four at a time
+    struct CollisionBrush {
+        glm::vec3 mins;
+        glm::vec3 maxs;
+        int firstPlane;
+        int numPlanes;
+        int contents;
+    };
+
+    struct CollisionPatch {
+        glm::vec3 mins;
+        glm::vec3 maxs;
+        int firstFacet;
+        int numFacets;
+        int contents;
+        int surfaceFlags;
+    };
+
+    // State of one sweep, the box is made symmetric around the moving point
+    struct TraceWork {
+        glm::vec3 start;
+        glm::vec3 end;
+        glm::vec3 extents;
+        glm::vec3 offset;   // Center of the box relative to the point the caller moves
+        glm::vec3 mins;     // Bounds of the whole sweep
+        glm::vec3 maxs;
+        bool isPoint;
+        int contentMask;
+        int checkCount;     // Marks the brushes this trace has tested
+        TraceResult result;
+        TraceContext* context;
+    };
+
+    void BeginTrace(TraceWork& work, TraceContext& context, const glm::vec3& start, const glm::vec3& end, const glm::vec3& mins, const glm::vec3& maxs, int contentMask) const;
+    TraceResult FinishTrace(TraceWork& work, const glm::vec3& start, const glm::vec3& end) const;
+    void TraceThroughTree(TraceWork& work, int num, float startFraction, float endFraction, const glm::vec3& start, const glm::vec3& end) const;
+    void TraceThroughLeaf(TraceWork& work, int leaf) const;
+    void TraceThroughBrush(TraceWork& work, const CollisionBrush& brush) const;
+    void TraceThroughPatch(TraceWork& work, const CollisionPatch& patch) const;
+    void TracePointThroughPatch(TraceWork& work, const CollisionPatch& patch) const;
+    bool TestInPatch(const TraceWork& work, const CollisionPatch& patch) const;
+    void LoadBrushes();
+    void LoadPatches();
+    int LeafForPoint(const glm::vec3& point) const;
+    int LeafContents(int leaf, const glm::vec3& point) const;
+
+    const BSPMap& map;
+    std::vector<CollisionPlane> planes;
+    std::vector<CollisionBrush> brushes;
+
+    // Sides and bevels of every brush, one array per component so SSE can load four planes at once
+    std::vector<float> brushPlaneX;
+    std::vector<float> brushPlaneY;
+    std::vector<float> brushPlaneZ;
+    std::vector<float> brushPlaneDist;
+    std::vector<int> brushPlaneFlags;
+    std::vector<int> leafContents;
+
+    // Patches with their facets and facet planes in flat arrays, and the patches each leaf touches
+    std::vector<CollisionPatch> patches;
+    std::vector<PatchFacet> facets;
+    std::vector<glm::vec4> facetPlanes;
+    std::vector<int> leafPatches;
+    std::vector<int> firstLeafPatch; // Patches of leaf i are leafPatches[firstLeafPatch[i]] up to firstLeafPatch[i + 1]
+    TraceContext context;
+};
+
+#endif // COLLISIONMODEL_H
@@ -0,0 +1,71 @@
+#include "ColorShift.h"
+#include "BSPMap.h"
+#include <immintrin.h>
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+void ColorShiftLighting(unsigned char* rgb, int count, int overbrightBits, float gamma) {
+    unsigned char gammaTable[256];
+    for (int i = 0; i < 256; ++i) {
+        float value = gamma == 1.0f ? static_cast<float>(i) : 255.0f * std::pow(i / 255.0f, 1.0f / gamma) + 0.5f;
+        gammaTable[i] = static_cast<unsigned char>(value > 255.0f ? 255.0f : value);
+    }
+
+    const __m128 scale = _mm_set1_ps(static_cast<float>(1 << overbrightBits));
+    const __m128 maxValue = _mm_set1_ps(255.0f);
+    alignas(16) int shifted[3][4];
+
+    int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        unsigned char* color = rgb + i * 3;
+        __m128 r = _mm_mul_ps(_mm_setr_ps(color[0], color[3], color[6], color[9]), scale);
+        __m128 g = _mm_mul_ps(_mm_setr_ps(color[1], color[4], color[7], color[10]), scale);
+        __m128 b = _mm_mul_ps(_mm_setr_ps(color[2], color[5], color[8], color[11]), scale);
+
+        // Colors over 255 become channel * 255 / max, truncated like Q3's integer math. The others are divided by
+        // 255 instead, which is exact. The quotient of these small integers is never close enough to the next
+        // integer for float rounding to change the truncated result.
+        __m128 max = _mm_max_ps(_mm_max_ps(r, g), b);
+        __m128 over = _mm_cmpgt_ps(max, maxValue);
+        __m128 divisor = _mm_or_ps(_mm_and_ps(over, max), _mm_andnot_ps(over, maxValue));
+        _mm_store_si128(reinterpret_cast<__m128i*>(shifted[0]), _mm_cvttps_epi32(_mm_div_ps(_mm_mul_ps(r, maxValue), divisor)));
+        _mm_store_si128(reinterpret_cast<__m128i*>(shifted[1]), _mm_cvttps_epi32(_mm_div_ps(_mm_mul_ps(g, maxValue), divisor)));
+        _mm_store_si128(reinterpret_cast<__m128i*>(shifted[2]), _mm_cvttps_epi32(_mm_div_ps(_mm_mul_ps(b, maxValue), divisor)));
+
+        for (int j = 0; j < 4; ++j) {
+            color[j * 3] = gammaTable[shifted[0][j]];
+            color[j * 3 + 1] = gammaTable[shifted[1][j]];
+            color[j * 3 + 2] = gammaTable[shifted[2][j]];
+        }
+    }
+
+    // The last few colors one at a time
+    for (; i < count; ++i) {
+        unsigned char* color = rgb + i * 3;
+        int r = color[0] << overbrightBits;
+        int g = color[1] << overbrightBits;
+        int b = color[2] << overbrightBits;
+        if ((r | g | b) > 255) {
+            int max = r > g ? r : g;
+            max = max > b ? max : b;
+            r = r * 255 / max;
+            g = g * 255 / max;
+            b = b * 255 / max;
+        }
+        color[0] = gammaTable[r];
+        color[1] = gammaTable[g];
+        color[2] = gammaTable[b];
+    }
+}
+
+void ColorShiftVertexColors(Vertex* vertices, int count, int overbrightBits, float gamma) {
+    std::vector<unsigned char> colors(static_cast<size_t>(count) * 3);
+    for (int i = 0; i < count; ++i) {
+        std::copy(vertices[i].color, vertices[i].color + 3, &colors[i * 3]);
+    }
+    ColorShiftLighting(colors.data(), count, overbrightBits, gamma);
+    for (int i = 0; i < count; ++i) {
+        std::copy(&colors[i * 3], &colors[i * 3] + 3, vertices[i].color);
+    }
+}
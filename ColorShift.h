@@ -0,0 +1,24 @@
+#ifndef COLORSHIFT_H
+#define COLORSHIFT_H
+
+/*
+Brightens baked lighting the way Q3's R_ColorShiftLightingBytes does. The map compiler stores lighting at a
+quarter of its brightness so it has room for overbright light, the renderer shifts it back up. A color that goes
+over 255 on any channel is scaled down as a whole so it keeps its hue instead of turning white.
+*/
+
+// Game defaults, r_mapOverBrightBits 2 with no hardware gamma and r_gamma 1
+static const int MAP_OVERBRIGHT_BITS = 2;
+static const float LIGHTING_GAMMA = 1.0f;
+
+// Shifts count RGB colors up by overbrightBits in place, then applies gamma through a table like r_gamma does
+// without hardware gamma. Four colors at a time with SSE2.
+void ColorShiftLighting(unsigned char* rgb, int count, int overbrightBits, float gamma);
+
+struct Vertex;
+
+// Shifts the colors of count map vertices the same way, alpha is left alone. Vertex colors are baked at the same
+// quarter brightness as the lightmaps.
+void ColorShiftVertexColors(Vertex* vertices, int count, int overbrightBits, float gamma);
+
+#endif // COLORSHIFT_H
@@ -0,0 +1,50 @@
+#include "Frustum.h"
+#include <cmath>
+
+void Frustum::Extract(const glm::mat4& m) {
+    // Gribb/Hartmann: each plane is the sum or difference of the last row with one of the others.
+    // glm is column major, so row i is (m[0][i], m[1][i], m[2][i], m[3][i]).
+    glm::vec4 row0(m[0][0], m[1][0], m[2][0], m[3][0]);
+    glm::vec4 row1(m[0][1], m[1][1], m[2][1], m[3][1]);
+    glm::vec4 row2(m[0][2], m[1][2], m[2][2], m[3][2]);
+    glm::vec4 row3(m[0][3], m[1][3], m[2][3], m[3][3]);
+
+    planes[FRUSTUM_LEFT] = row3 + row0;
+    planes[FRUSTUM_RIGHT] = row3 - row0;
+    planes[FRUSTUM_BOTTOM] = row3 + row1;
+    planes[FRUSTUM_TOP] = row3 - row1;
+    planes[FRUSTUM_NEAR] = row3 + row2;
+    planes[FRUSTUM_FAR] = row3 - row2;
+
+    for (int i = 0; i < FRUSTUM_PLANE_COUNT; ++i) {
+        float length = std::sqrt(planes[i].x * planes[i].x + planes[i].y * planes[i].y + planes[i].z * planes[i].z);
+        planes[i] = planes[i] / length;
+    }
+}
+
+bool Frustum::IntersectsBox(const glm::vec3& mins, const glm::vec3& maxs) const {
+    for (int i = 0; i < FRUSTUM_PLANE_COUNT; ++i) {
+        const glm::vec4& p = planes[i];
+        // Test the corner furthest along the plane normal, if it is outside the whole box is
+        glm::vec3 corner(p.x >= 0.0f ? maxs.x : mins.x,
+            p.y >= 0.0f ? maxs.y : mins.y,
+            p.z >= 0.0f ? maxs.z : mins.z);
+        if (p.x * corner.x + p.y * corner.y + p.z * corner.z + p.w < 0.0f) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void TransformBounds(const glm::mat4& m, const glm::vec3& mins, const glm::vec3& maxs, glm::vec3& outMins, glm::vec3& outMaxs) {
+    // Arvo's method: start at the translation and add the min/max contribution of every matrix element
+    for (int i = 0; i < 3; ++i) {
+        outMins[i] = outMaxs[i] = m[3][i];
+        for (int j = 0; j < 3; ++j) {
+            float a = m[j][i] * mins[j];
+            float b = m[j][i] * maxs[j];
+            outMins[i] += a < b ? a : b;
+            outMaxs[i] += a < b ? b : a;
+        }
+    }
+}
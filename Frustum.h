@@ -0,0 +1,33 @@
+#ifndef FRUSTUM_H
+#define FRUSTUM_H
+
+#include <glm/glm.hpp>
+
+/*
+View frustum described by six planes. Planes are extracted from a combined projection * view (* model) matrix,
+so passing projection * view * Camera::GetMapMatrix() gives planes directly in map space.
+*/
+
+enum FrustumPlane {
+    FRUSTUM_LEFT = 0,
+    FRUSTUM_RIGHT,
+    FRUSTUM_BOTTOM,
+    FRUSTUM_TOP,
+    FRUSTUM_NEAR,
+    FRUSTUM_FAR,
+    FRUSTUM_PLANE_COUNT
+};
+
+struct Frustum {
+    glm::vec4 planes[FRUSTUM_PLANE_COUNT]; // xyz = inward facing normal, w = distance. Inside when dot(n, p) + w >= 0
+
+    void Extract(const glm::mat4& matrix);
+
+    // True if the box is at least partially inside the frustum
+    bool IntersectsBox(const glm::vec3& mins, const glm::vec3& maxs) const;
+};
+
+// Computes the axis aligned bounds of a box after transformation by matrix
+void TransformBounds(const glm::mat4& matrix, const glm::vec3& mins, const glm::vec3& maxs, glm::vec3& outMins, glm::vec3& outMaxs);
+
+#endif // FRUSTUM_H
@@ -0,0 +1,492 @@
+#include "FrustumCuller.h"
+#include <immintrin.h>
+#include <algorithm>
+#include <cmath>
+
+static const int ALL_PLANES = (1 << FRUSTUM_PLANE_COUNT) - 1;
+static const int VIEW_LIVE = 1 << 8;   // Lane mask bit of CullViews for a view that hasn't rejected the box
+
+#if defined(__AVX__)
+static const int BATCH_SIZE = 8;
+#else
+static const int BATCH_SIZE = 4;
+#endif
+
+FrustumCuller::FrustumCuller(const BSPMap& map) : map(map) {
+    const std::vector<Node>& nodes = map.GetNodes();
+    const std::vector<Leaf>& leafs = map.GetLeafs();
+
+    for (int i = 0; i < 6; ++i) {
+        nodeBounds[i].resize(nodes.size());
+        leafBounds[i].resize(leafs.size());
+    }
+    for (size_t n = 0; n < nodes.size(); ++n) {
+        for (int i = 0; i < 3; ++i) {
+            nodeBounds[i][n] = static_cast<float>(nodes[n].mins[i]);
+            nodeBounds[i + 3][n] = static_cast<float>(nodes[n].maxs[i]);
+        }
+    }
+    for (size_t l = 0; l < leafs.size(); ++l) {
+        for (int i = 0; i < 3; ++i) {
+            leafBounds[i][l] = static_cast<float>(leafs[l].mins[i]);
+            leafBounds[i + 3][l] = static_cast<float>(leafs[l].maxs[i]);
+        }
+    }
+
+    nodeParents.assign(nodes.size(), -1);
+    leafParents.assign(leafs.size(), -1);
+    for (int n = 0; n < static_cast<int>(nodes.size()); ++n) {
+        for (int c = 0; c < 2; ++c) {
+            int child = nodes[n].children[c];
+            if (child >= 0) {
+                nodeParents[child] = n;
+            }
+            else {
+                leafParents[-child - 1] = n;
+            }
+        }
+    }
+
+    nodeMarks.assign(nodes.size(), 0);
+    leafMarks.assign(leafs.size(), 0);
+    viewNodeMarks.assign(nodes.size(), 0);
+    viewLeafMarks.assign(leafs.size(), 0);
+
+    nodeCache.assign(nodes.size(), CacheEntry{ CACHE_NONE, 0, 0.0 });
+    leafCache.assign(leafs.size(), CacheEntry{ CACHE_NONE, 0, 0.0 });
+
+    // The root box holds everything, it bounds how far any point can move relative to a plane
+    if (!nodes.empty()) {
+        glm::vec3 mins(nodeBounds[0][0], nodeBounds[1][0], nodeBounds[2][0]);
+        glm::vec3 maxs(nodeBounds[3][0], nodeBounds[4][0], nodeBounds[5][0]);
+        worldCenter = (mins + maxs) * 0.5f;
+        worldExtents = (maxs - mins) * 0.5f;
+    }
+}
+
+void FrustumCuller::UpdateDrift(const Frustum& frustum) {
+    if (!havePreviousFrustum) {
+        previousFrustum = frustum;
+        havePreviousFrustum = true;
+        return;
+    }
+
+    // Largest change of the signed distance to each plane over any point of the world box
+    double worst = 0.0;
+    for (int p = 0; p < FRUSTUM_PLANE_COUNT; ++p) {
+        glm::vec4 delta = frustum.planes[p] - previousFrustum.planes[p];
+        double drift = std::fabs(delta.x * worldCenter.x + delta.y * worldCenter.y + delta.z * worldCenter.z + delta.w)
+            + std::fabs(delta.x) * worldExtents.x + std::fabs(delta.y) * worldExtents.y + std::fabs(delta.z) * worldExtents.z;
+        planeDrift[p] += drift;
+        worst = std::max(worst, drift);
+    }
+    maxDrift += worst;
+    previousFrustum = frustum;
+}
+
+void FrustumCuller::MarkLeafs(const std::vector<int>& pvsLeafs, std::vector<int>& nodeMarkList, std::vector<int>& leafMarkList, int frame) {
+    // Like Q3's R_MarkLeaves, mark every PVS leaf and the nodes above it so the traversal can skip the rest
+    for (int leaf : pvsLeafs) {
+        leafMarkList[leaf] = frame;
+        int node = leafParents[leaf];
+        while (node >= 0 && nodeMarkList[node] != frame) {
+            nodeMarkList[node] = frame;
+            node = nodeParents[node];
+        }
+    }
+}
+
+float FrustumCuller::BoxValue(int child, int component) const {
+    return child >= 0 ? nodeBounds[component][child] : leafBounds[component][-child - 1];
+}
+
+void FrustumCuller::TestBatch(const Frustum& frustum, const WorkItem* items, int count, int* outside, int* newMasks) {
+    // Gather up to BATCH_SIZE boxes into SIMD lanes, unused lanes repeat the first box
+    alignas(32) float bounds[6][BATCH_SIZE];
+    int batchMask = 0;
+    for (int lane = 0; lane < count; ++lane) {
+        batchMask |= items[lane].planeMask;
+    }
+    for (int lane = 0; lane < BATCH_SIZE; ++lane) {
+        int child = items[lane < count ? lane : 0].child;
+        for (int i = 0; i < 6; ++i) {
+            bounds[i][lane] = BoxValue(child, i);
+        }
+    }
+
+    alignas(32) float farDistances[FRUSTUM_PLANE_COUNT][BATCH_SIZE];
+    alignas(32) float nearDistances[FRUSTUM_PLANE_COUNT][BATCH_SIZE];
+
+#if defined(__AVX__)
+    __m256 minX = _mm256_load_ps(bounds[0]), minY = _mm256_load_ps(bounds[1]), minZ = _mm256_load_ps(bounds[2]);
+    __m256 maxX = _mm256_load_ps(bounds[3]), maxY = _mm256_load_ps(bounds[4]), maxZ = _mm256_load_ps(bounds[5]);
+    for (int p = 0; p < FRUSTUM_PLANE_COUNT; ++p) {
+        if (!(batchMask & (1 << p))) {
+            continue;
+        }
+        const glm::vec4& plane = frustum.planes[p];
+        __m256 nx = _mm256_set1_ps(plane.x), ny = _mm256_set1_ps(plane.y), nz = _mm256_set1_ps(plane.z);
+        __m256 ax = _mm256_mul_ps(nx, minX), bx = _mm256_mul_ps(nx, maxX);
+        __m256 ay = _mm256_mul_ps(ny, minY), by = _mm256_mul_ps(ny, maxY);
+        __m256 az = _mm256_mul_ps(nz, minZ), bz = _mm256_mul_ps(nz, maxZ);
+        __m256 w = _mm256_set1_ps(plane.w);
+        // Furthest corner along the normal decides outside, nearest corner decides inside
+        __m256 farDist = _mm256_add_ps(_mm256_add_ps(_mm256_max_ps(ax, bx), _mm256_max_ps(ay, by)), _mm256_add_ps(_mm256_max_ps(az, bz), w));
+        __m256 nearDist = _mm256_add_ps(_mm256_add_ps(_mm256_min_ps(ax, bx), _mm256_min_ps(ay, by)), _mm256_add_ps(_mm256_min_ps(az, bz), w));
+        _mm256_store_ps(farDistances[p], farDist);
+        _mm256_store_ps(nearDistances[p], nearDist);
+    }
+#else
+    __m128 minX = _mm_load_ps(bounds[0]), minY = _mm_load_ps(bounds[1]), minZ = _mm_load_ps(bounds[2]);
+    __m128 maxX = _mm_load_ps(bounds[3]), maxY = _mm_load_ps(bounds[4]), maxZ = _mm_load_ps(bounds[5]);
+    for (int p = 0; p < FRUSTUM_PLANE_COUNT; ++p) {
+        if (!(batchMask & (1 << p))) {
+            continue;
+        }
+        const glm::vec4& plane = frustum.planes[p];
+        __m128 nx = _mm_set1_ps(plane.x), ny = _mm_set1_ps(plane.y), nz = _mm_set1_ps(plane.z);
+        __m128 ax = _mm_mul_ps(nx, minX), bx = _mm_mul_ps(nx, maxX);
+        __m128 ay = _mm_mul_ps(ny, minY), by = _mm_mul_ps(ny, maxY);
+        __m128 az = _mm_mul_ps(nz, minZ), bz = _mm_mul_ps(nz, maxZ);
+        __m128 w = _mm_set1_ps(plane.w);
+        // Furthest corner along the normal decides outside, nearest corner decides inside
+        __m128 farDist = _mm_add_ps(_mm_add_ps(_mm_max_ps(ax, bx), _mm_max_ps(ay, by)), _mm_add_ps(_mm_max_ps(az, bz), w));
+        __m128 nearDist = _mm_add_ps(_mm_add_ps(_mm_min_ps(ax, bx), _mm_min_ps(ay, by)), _mm_add_ps(_mm_min_ps(az, bz), w));
+        _mm_store_ps(farDistances[p], farDist);
+        _mm_store_ps(nearDistances[p], nearDist);
+    }
+#endif
+
+    // Planes no lane straddles were skipped, every box is inside them since its parent was. The other planes
+    // are known for all lanes, so any of them can reject a box
+    for (int lane = 0; lane < count; ++lane) {
+        int mask = items[lane].planeMask;
+        int worstPlane = -1;
+        float minNear = 0.0f;
+        for (int p = 0; p < FRUSTUM_PLANE_COUNT; ++p) {
+            if (!(batchMask & (1 << p))) {
+                continue;
+            }
+            if (worstPlane < 0) {
+                worstPlane = p;
+                minNear = nearDistances[p][lane];
+                continue;
+            }
+            if (farDistances[p][lane] < farDistances[worstPlane][lane]) {
+                worstPlane = p;
+            }
+            minNear = std::min(minNear, nearDistances[p][lane]);
+        }
+
+        CacheEntry& cache = CacheFor(items[lane].child);
+        outside[lane] = farDistances[worstPlane][lane] < 0.0f;
+        newMasks[lane] = mask;
+        if (outside[lane]) {
+            cache.state = CACHE_OUTSIDE;
+            cache.plane = static_cast<unsigned char>(worstPlane);
+            cache.threshold = planeDrift[worstPlane] - farDistances[worstPlane][lane];
+            continue;
+        }
+
+        // The margin to a skipped plane is unknown, only a box tested against all six can be cached as inside
+        if (minNear >= 0.0f && batchMask == ALL_PLANES) {
+            cache.state = CACHE_INSIDE;
+            cache.threshold = maxDrift + minNear;
+        }
+        else {
+            cache.state = CACHE_NONE;
+        }
+        for (int p = 0; p < FRUSTUM_PLANE_COUNT; ++p) {
+            if ((batchMask & (1 << p)) && nearDistances[p][lane] >= 0.0f) {
+                newMasks[lane] &= ~(1 << p);
+            }
+        }
+    }
+    boxTests += count;
+}
+
+void FrustumCuller::Cull(const Frustum& frustum, const std::vector<int>& pvsLeafs, bool pvsChanged, std::vector<int>& visibleLeafs) {
+    const std::vector<Node>& nodes = map.GetNodes();
+    visibleLeafs.clear();
+    boxTests = 0;
+    cacheHits = 0;
+    if (nodes.empty()) {
+        visibleLeafs = pvsLeafs;
+        return;
+    }
+
+    if (pvsChanged || markFrame == 0) {
+        MarkLeafs(pvsLeafs, nodeMarks, leafMarks, ++markFrame);
+    }
+    UpdateDrift(frustum);
+
+    current.clear();
+    if (nodeMarks[0] == markFrame) {
+        current.push_back(WorkItem{ 0, ALL_PLANES });
+    }
+
+    int outside[BATCH_SIZE];
+    int newMasks[BATCH_SIZE];
+
+    while (!current.empty()) {
+        next.clear();
+        pending.clear();
+
+        // Items whose ancestors were fully inside need no test at all
+        for (WorkItem item : current) {
+            if (item.planeMask != 0) {
+                // A cached result whose margin hasn't been used up by the drift is still right
+                const CacheEntry& cache = CacheFor(item.child);
+                if (cache.state == CACHE_OUTSIDE && planeDrift[cache.plane] < cache.threshold) {
+                    ++cacheHits;
+                    continue;
+                }
+                if (cache.state == CACHE_INSIDE && maxDrift < cache.threshold) {
+                    ++cacheHits;
+                    item.planeMask = 0;
+                }
+                else {
+                    pending.push_back(item);
+                    continue;
+                }
+            }
+            if (item.child < 0) {
+                visibleLeafs.push_back(-item.child - 1);
+                continue;
+            }
+            for (int c = 0; c < 2; ++c) {
+                int child = nodes[item.child].children[c];
+                bool marked = child >= 0 ? nodeMarks[child] == markFrame : leafMarks[-child - 1] == markFrame;
+                if (marked) {
+                    next.push_back(WorkItem{ child, 0 });
+                }
+            }
+        }
+
+        for (size_t start = 0; start < pending.size(); start += BATCH_SIZE) {
+            int count = static_cast<int>(pending.size() - start);
+            if (count > BATCH_SIZE) {
+                count = BATCH_SIZE;
+            }
+            TestBatch(frustum, &pending[start], count, outside, newMasks);
+
+            for (int lane = 0; lane < count; ++lane) {
+                if (outside[lane]) {
+                    continue;
+                }
+                int item = pending[start + lane].child;
+                if (item < 0) {
+                    visibleLeafs.push_back(-item - 1);
+                    continue;
+                }
+                for (int c = 0; c < 2; ++c) {
+                    int child = nodes[item].children[c];
+                    bool marked = child >= 0 ? nodeMarks[child] == markFrame : leafMarks[-child - 1] == markFrame;
+                    if (marked) {
+                        next.push_back(WorkItem{ child, newMasks[lane] });
+                    }
+                }
+            }
+        }
+
+        current.swap(next);
+    }
+}
+
+void FrustumCuller::TestViewsOfBox(int child, int* masks, int groups) {
+    const __m128 zero = _mm_setzero_ps();
+    __m128 minX = _mm_set1_ps(BoxValue(child, 0)), minY = _mm_set1_ps(BoxValue(child, 1)), minZ = _mm_set1_ps(BoxValue(child, 2));
+    __m128 maxX = _mm_set1_ps(BoxValue(child, 3)), maxY = _mm_set1_ps(BoxValue(child, 4)), maxZ = _mm_set1_ps(BoxValue(child, 5));
+    for (int g = 0; g < groups; ++g) {
+        // Planes that no view of the group straddles any more can't reject the box in any of them
+        int straddled = (masks[g * 4] | masks[g * 4 + 1] | masks[g * 4 + 2] | masks[g * 4 + 3]) & ALL_PLANES;
+        if (!straddled) {
+            continue;
+        }
+        __m128 outside = zero;
+        __m128i keep = _mm_set1_epi32(VIEW_LIVE);
+        for (int p = 0; p < FRUSTUM_PLANE_COUNT; ++p) {
+            if (!((straddled >> p) & 1)) {
+                continue;
+            }
+            __m128 nx = _mm_load_ps(viewPlanes[g][p][0]), ny = _mm_load_ps(viewPlanes[g][p][1]), nz = _mm_load_ps(viewPlanes[g][p][2]);
+            __m128 w = _mm_load_ps(viewPlanes[g][p][3]);
+            __m128 ax = _mm_mul_ps(nx, minX), bx = _mm_mul_ps(nx, maxX);
+            __m128 ay = _mm_mul_ps(ny, minY), by = _mm_mul_ps(ny, maxY);
+            __m128 az = _mm_mul_ps(nz, minZ), bz = _mm_mul_ps(nz, maxZ);
+            __m128 farDist = _mm_add_ps(_mm_add_ps(_mm_max_ps(ax, bx), _mm_max_ps(ay, by)), _mm_add_ps(_mm_max_ps(az, bz), w));
+            __m128 nearDist = _mm_add_ps(_mm_add_ps(_mm_min_ps(ax, bx), _mm_min_ps(ay, by)), _mm_add_ps(_mm_min_ps(az, bz), w));
+            outside = _mm_or_ps(outside, _mm_cmplt_ps(farDist, zero));
+            keep = _mm_or_si128(keep, _mm_and_si128(_mm_castps_si128(_mm_cmplt_ps(nearDist, zero)), _mm_set1_epi32(1 << p)));
+        }
+        // Planes the box is inside of are dropped, views it is outside of are cleared altogether
+        __m128i mask = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&masks[g * 4]));
+        mask = _mm_andnot_si128(_mm_castps_si128(outside), _mm_and_si128(mask, keep));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(&masks[g * 4]), mask);
+        ++viewBoxTests;
+    }
+}
+
+void FrustumCuller::TestBoxesOfView(const Frustum& frustum, int view, const int* items, int count, int laneCount) {
+    // Up to four boxes in the lanes like Cull's batches, unused lanes repeat the first box
+    alignas(16) float bounds[6][4];
+    alignas(16) int masks[4];
+    int straddled = 0;
+    for (int lane = 0; lane < 4; ++lane) {
+        int item = items[lane < count ? lane : 0];
+        int child = viewCurrent[item];
+        for (int i = 0; i < 6; ++i) {
+            bounds[i][lane] = BoxValue(child, i);
+        }
+        masks[lane] = viewCurrentMasks[item * laneCount + view];
+        straddled |= masks[lane];
+    }
+    straddled &= ALL_PLANES;
+
+    const __m128 zero = _mm_setzero_ps();
+    __m128 minX = _mm_load_ps(bounds[0]), minY = _mm_load_ps(bounds[1]), minZ = _mm_load_ps(bounds[2]);
+    __m128 maxX = _mm_load_ps(bounds[3]), maxY = _mm_load_ps(bounds[4]), maxZ = _mm_load_ps(bounds[5]);
+    __m128 outside = zero;
+    __m128i keep = _mm_set1_epi32(VIEW_LIVE);
+    for (int p = 0; p < FRUSTUM_PLANE_COUNT; ++p) {
+        if (!((straddled >> p) & 1)) {
+            continue;
+        }
+        const glm::vec4& plane = frustum.planes[p];
+        __m128 nx = _mm_set1_ps(plane.x), ny = _mm_set1_ps(plane.y), nz = _mm_set1_ps(plane.z);
+        __m128 ax = _mm_mul_ps(nx, minX), bx = _mm_mul_ps(nx, maxX);
+        __m128 ay = _mm_mul_ps(ny, minY), by = _mm_mul_ps(ny, maxY);
+        __m128 az = _mm_mul_ps(nz, minZ), bz = _mm_mul_ps(nz, maxZ);
+        __m128 w = _mm_set1_ps(plane.w);
+        __m128 farDist = _mm_add_ps(_mm_add_ps(_mm_max_ps(ax, bx), _mm_max_ps(ay, by)), _mm_add_ps(_mm_max_ps(az, bz), w));
+        __m128 nearDist = _mm_add_ps(_mm_add_ps(_mm_min_ps(ax, bx), _mm_min_ps(ay, by)), _mm_add_ps(_mm_min_ps(az, bz), w));
+        outside = _mm_or_ps(outside, _mm_cmplt_ps(farDist, zero));
+        keep = _mm_or_si128(keep, _mm_and_si128(_mm_castps_si128(_mm_cmplt_ps(nearDist, zero)), _mm_set1_epi32(1 << p)));
+    }
+    __m128i mask = _mm_load_si128(reinterpret_cast<const __m128i*>(masks));
+    mask = _mm_andnot_si128(_mm_castps_si128(outside), _mm_and_si128(mask, keep));
+    _mm_store_si128(reinterpret_cast<__m128i*>(masks), mask);
+    for (int lane = 0; lane < count; ++lane) {
+        viewCurrentMasks[items[lane] * laneCount + view] = masks[lane];
+    }
+    ++viewBoxTests;
+}
+
+void FrustumCuller::CullViews(const Frustum* frusta, int viewCount, const std::vector<int>& leafs, bool pvsChanged, std::vector<int>* visibleLeafs) {
+    const std::vector<Node>& nodes = map.GetNodes();
+    if (viewCount > MAX_VIEWS) {
+        viewCount = MAX_VIEWS;
+    }
+    viewBoxTests = 0;
+    for (int v = 0; v < viewCount; ++v) {
+        visibleLeafs[v].clear();
+    }
+    if (viewCount <= 0) {
+        return;
+    }
+    if (nodes.empty()) {
+        for (int v = 0; v < viewCount; ++v) {
+            visibleLeafs[v] = leafs;
+        }
+        return;
+    }
+
+    if (pvsChanged || viewMarkFrame == 0) {
+        MarkLeafs(leafs, viewNodeMarks, viewLeafMarks, ++viewMarkFrame);
+    }
+    if (viewNodeMarks[0] != viewMarkFrame) {
+        return;
+    }
+
+    // Plane components of four views per register, missing views get a plane everything is inside of
+    const int groups = (viewCount + 3) / 4;
+    const int laneCount = groups * 4;
+    for (int g = 0; g < groups; ++g) {
+        for (int p = 0; p < FRUSTUM_PLANE_COUNT; ++p) {
+            for (int lane = 0; lane < 4; ++lane) {
+                int view = g * 4 + lane;
+                glm::vec4 plane = view < viewCount ? frusta[view].planes[p] : glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+                viewPlanes[g][p][0][lane] = plane.x;
+                viewPlanes[g][p][1][lane] = plane.y;
+                viewPlanes[g][p][2][lane] = plane.z;
+                viewPlanes[g][p][3][lane] = plane.w;
+            }
+        }
+    }
+
+    // Every item is a node or leaf with one lane mask per view: the planes its box still straddles in that view,
+    // and VIEW_LIVE while the view hasn't rejected it. Missing views start out dead.
+    viewCurrent.clear();
+    viewCurrentMasks.clear();
+    viewCurrent.push_back(0);
+    for (int lane = 0; lane < laneCount; ++lane) {
+        viewCurrentMasks.push_back(lane < viewCount ? ALL_PLANES | VIEW_LIVE : 0);
+    }
+
+    while (!viewCurrent.empty()) {
+        // A box straddling several views is tested against all of them at once. Where the views part, most boxes
+        // straddle only one and are tested four to a register like Cull does.
+        for (int v = 0; v < viewCount; ++v) {
+            viewPending[v].clear();
+        }
+        for (int i = 0; i < static_cast<int>(viewCurrent.size()); ++i) {
+            int* masks = &viewCurrentMasks[i * laneCount];
+            int straddling = 0;
+            for (int g = 0; g < groups; ++g) {
+                __m128i mask = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&masks[g * 4]));
+                __m128i planesLeft = _mm_and_si128(mask, _mm_set1_epi32(ALL_PLANES));
+                straddling |= _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(planesLeft, _mm_setzero_si128()))) << (g * 4);
+            }
+            if (straddling & (straddling - 1)) {
+                TestViewsOfBox(viewCurrent[i], masks, groups);
+            }
+            else if (straddling) {
+                int view = 0;
+                while (!((straddling >> view) & 1)) {
+                    ++view;
+                }
+                viewPending[view].push_back(i);
+            }
+        }
+        for (int v = 0; v < viewCount; ++v) {
+            for (size_t start = 0; start < viewPending[v].size(); start += 4) {
+                int count = static_cast<int>(std::min(viewPending[v].size() - start, static_cast<size_t>(4)));
+                TestBoxesOfView(frusta[v], v, &viewPending[v][start], count, laneCount);
+            }
+        }
+
+        viewNext.clear();
+        viewNextMasks.clear();
+        for (int i = 0; i < static_cast<int>(viewCurrent.size()); ++i) {
+            const int* masks = &viewCurrentMasks[i * laneCount];
+            int liveViews = 0;
+            for (int g = 0; g < groups; ++g) {
+                __m128i mask = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&masks[g * 4]));
+                liveViews |= _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(mask, _mm_setzero_si128()))) << (g * 4);
+            }
+            if (!liveViews) {
+                continue;
+            }
+            int item = viewCurrent[i];
+            if (item < 0) {
+                int leaf = -item - 1;
+                for (int v = 0; v < viewCount; ++v) {
+                    if ((liveViews >> v) & 1) {
+                        visibleLeafs[v].push_back(leaf);
+                    }
+                }
+                continue;
+            }
+            for (int c = 0; c < 2; ++c) {
+                int child = nodes[item].children[c];
+                bool marked = child >= 0 ? viewNodeMarks[child] == viewMarkFrame : viewLeafMarks[-child - 1] == viewMarkFrame;
+                if (marked) {
+                    viewNext.push_back(child);
+                    viewNextMasks.insert(viewNextMasks.end(), masks, masks + laneCount);
+                }
+            }
+        }
+        viewCurrent.swap(viewNext);
+        viewCurrentMasks.swap(viewNextMasks);
+    }
+}
@@ -0,0 +1,114 @@
+#ifndef FRUSTUMCULLER_H
+#define FRUSTUMCULLER_H
+
+#include <vector>
+#include "BSPMap.h"
+#include "Frustum.h"
+
+/*
+Hierarchical frustum culling of the BSP tree. Nodes are visited breadth first, each carrying a mask of the
+frustum planes its box still straddles. Children inherit that mask, so once a subtree is fully inside it is
+accepted without any further tests. Boxes are tested in batches with SSE (4 at a time) or AVX (8 at a time)
+when the build enables it, against only the planes some box of the batch still straddles. Only subtrees containing leafs from the PVS are visited.
+
+Results are reused between frames. Every box remembers by how much it was outside a plane, or fully inside
+all of them, and how far the frustum planes had drifted at that point. The drift of each plane between two
+frames is bounded over the whole world box, so a cached result is trusted until the accumulated drift could
+have used up its margin. A slowly moving camera only re-tests boxes near the frustum boundary.
+
+CullViews handles several views (shadow cascades, mirrors, split screen) in one traversal, breadth first like
+Cull. Each item carries a plane mask per view and is dropped once every view rejected it. A box that several views
+still straddle is tested against four views per register, a box only one view straddles waits for three more and
+goes four boxes per register like Cull's batches. Views that look at the same part of the world cost about as much
+as one, views that look apart about as much as one Cull each (see -cullbench). It keeps no box cache.
+*/
+
+class FrustumCuller {
+public:
+    FrustumCuller(const BSPMap& map);
+
+    // Writes the leafs from pvsLeafs that intersect the frustum into visibleLeafs.
+    // pvsChanged can be false when pvsLeafs is the same as the previous call, the node marks are then reused.
+    void Cull(const Frustum& frustum, const std::vector<int>& pvsLeafs, bool pvsChanged, std::vector<int>& visibleLeafs);
+
+    static const int MAX_VIEWS = 16;
+
+    // Culls leafs against viewCount frusta at once, visibleLeafs[v] receives the leafs intersecting frusta[v].
+    // pvsChanged works like Cull's, with marks of their own. No box results are cached between calls, the single
+    // view cache of Cull is left alone.
+    void CullViews(const Frustum* frusta, int viewCount, const std::vector<int>& leafs, bool pvsChanged, std::vector<int>* visibleLeafs);
+
+    // Counts of the last Cull
+    int GetBoxTestCount() const { return boxTests; }
+    int GetCacheHitCount() const { return cacheHits; }
+    // Box tests of the last CullViews, four views of one box or four boxes of one view count once
+    int GetViewBoxTestCount() const { return viewBoxTests; }
+
+private:
+    // Child references use the BSP convention, negative values are leafs stored as -(leaf + 1)
+    struct WorkItem {
+        int child;
+        int planeMask;
+    };
+
+    enum CacheState : unsigned char {
+        CACHE_NONE,
+        CACHE_OUTSIDE,
+        CACHE_INSIDE
+    };
+
+    // Last classification of a box, valid while the drift stays below threshold
+    struct CacheEntry {
+        CacheState state;
+        unsigned char plane; // Rejecting plane for CACHE_OUTSIDE
+        double threshold;
+    };
+
+    void MarkLeafs(const std::vector<int>& pvsLeafs, std::vector<int>& nodeMarkList, std::vector<int>& leafMarkList, int frame);
+    void UpdateDrift(const Frustum& frustum);
+    void TestBatch(const Frustum& frustum, const WorkItem* items, int count, int* outside, int* newMasks);
+    void TestViewsOfBox(int child, int* masks, int groups);
+    void TestBoxesOfView(const Frustum& frustum, int view, const int* items, int count, int laneCount);
+    float BoxValue(int child, int component) const;
+    CacheEntry& CacheFor(int child) { return child >= 0 ? nodeCache[child] : leafCache[-child - 1]; }
+
+    const BSPMap& map;
+
+    // Node and leaf boxes as floats in structure of arrays layout, min xyz then max xyz
+    std::vector<float> nodeBounds[6];
+    std::vector<float> leafBounds[6];
+    std::vector<int> nodeParents; // -1 for the root
+    std::vector<int> leafParents;
+
+    std::vector<int> nodeMarks; // Frame a node was marked as leading to a PVS leaf
+    std::vector<int> leafMarks;
+    int markFrame = 0;
+    std::vector<int> viewNodeMarks; // Same for CullViews, kept apart so Cull's marks stay valid
+    std::vector<int> viewLeafMarks;
+    int viewMarkFrame = 0;
+    // CullViews works breadth first like Cull. Items are children with laneCount lane masks each (see CullViews).
+    alignas(16) float viewPlanes[MAX_VIEWS / 4][FRUSTUM_PLANE_COUNT][4][4];  // Plane components of four views each
+    std::vector<int> viewCurrent;
+    std::vector<int> viewCurrentMasks;
+    std::vector<int> viewNext;
+    std::vector<int> viewNextMasks;
+    std::vector<int> viewPending[MAX_VIEWS];  // Items of viewCurrent only one view still has to test
+    int viewBoxTests = 0;
+
+    std::vector<WorkItem> current;
+    std::vector<WorkItem> next;
+    std::vector<WorkItem> pending; // Items that still need a box test
+    int boxTests = 0;
+    int cacheHits = 0;
+
+    std::vector<CacheEntry> nodeCache;
+    std::vector<CacheEntry> leafCache;
+    Frustum previousFrustum;
+    bool havePreviousFrustum = false;
+    double planeDrift[FRUSTUM_PLANE_COUNT] = {}; // Accumulated movement bound of each plane
+    double maxDrift = 0.0;                       // Accumulated movement bound of the worst plane
+    glm::vec3 worldCenter;
+    glm::vec3 worldExtents;
+};
+
+#endif // FRUSTUMCULLER_H
@@ -0,0 +1,174 @@
+#include "GPUCuller.h"
+#include <algorithm>
+
+bool GPUCuller::IsSupported() {
+    // Compute shaders, storage buffers and multi draw indirect all came with 4.3
+    return GLEW_VERSION_4_3 != 0;
+}
+
+GPUCuller::GPUCuller(const BSPMap& map, const std::vector<GLuint>& firstIndices, const std::vector<GLsizei>& indexCounts, const char* computePath)
+    : cullShader(computePath) {
+    const std::vector<Face>& faces = map.GetFaces();
+    const std::vector<Vertex>& vertices = map.GetVertex();
+    const std::vector<Leaf>& leafs = map.GetLeafs();
+    const std::vector<int>& leafFaces = map.GetLeafFaces();
+
+    // Clusters each face can be seen from, faces are shared by every leaf they cross
+    std::vector<std::vector<GLuint>> faceClusters(faces.size());
+    for (const Leaf& leaf : leafs) {
+        if (leaf.cluster < 0) {
+            continue;
+        }
+        numClusters = std::max(numClusters, leaf.cluster + 1);
+        for (int i = 0; i < leaf.numLeafFaces; ++i) {
+            std::vector<GLuint>& clusters = faceClusters[leafFaces[leaf.firstLeafFace + i]];
+            if (std::find(clusters.begin(), clusters.end(), static_cast<GLuint>(leaf.cluster)) == clusters.end()) {
+                clusters.push_back(static_cast<GLuint>(leaf.cluster));
+            }
+        }
+    }
+
+    std::vector<glm::vec4> clusterBounds(numClusters * 2);
+    for (int i = 0; i < numClusters; ++i) {
+        clusterBounds[i * 2] = glm::vec4(1e30f);
+        clusterBounds[i * 2 + 1] = glm::vec4(-1e30f);
+    }
+    for (const Leaf& leaf : leafs) {
+        if (leaf.cluster < 0) {
+            continue;
+        }
+        glm::vec4 mins(leaf.mins[0], leaf.mins[1], leaf.mins[2], 0.0f);
+        glm::vec4 maxs(leaf.maxs[0], leaf.maxs[1], leaf.maxs[2], 0.0f);
+        clusterBounds[leaf.cluster * 2] = glm::min(clusterBounds[leaf.cluster * 2], mins);
+        clusterBounds[leaf.cluster * 2 + 1] = glm::max(clusterBounds[leaf.cluster * 2 + 1], maxs);
+    }
+
+    // The shader appends survivors through an atomic counter, so the commands come out in no particular order
+    std::vector<DrawItem> items;
+    std::vector<GLuint> itemClusters;
+    for (size_t i = 0; i < faces.size(); ++i) {
+        if (indexCounts[i] == 0 || faceClusters[i].empty()) {
+            continue;
+        }
+        const Face& face = faces[i];
+        glm::vec3 mins(1e30f), maxs(-1e30f);
+        for (int j = 0; j < face.numVertices; ++j) {
+            const Vertex& vertex = vertices[face.vertex + j];
+            glm::vec3 position(vertex.position[0], vertex.position[1], vertex.position[2]);
+            mins = glm::min(mins, position);
+            maxs = glm::max(maxs, position);
+        }
+
+        DrawItem item;
+        item.mins = glm::vec4(mins, 0.0f);
+        item.maxs = glm::vec4(maxs, 0.0f);
+        item.firstIndex = firstIndices[i];
+        item.count = static_cast<GLuint>(indexCounts[i]);
+        item.firstCluster = static_cast<GLuint>(itemClusters.size());
+        item.numClusters = static_cast<GLuint>(faceClusters[i].size());
+        itemClusters.insert(itemClusters.end(), faceClusters[i].begin(), faceClusters[i].end());
+        items.push_back(item);
+    }
+    itemCount = static_cast<int>(items.size());
+    maskWords = (numClusters + 31) / 32;
+
+    // Zero sized storage buffers are not allowed, every buffer gets at least one element
+    itemClusters.resize(std::max<size_t>(itemClusters.size(), 1));
+    clusterBounds.resize(std::max<size_t>(clusterBounds.size(), 2));
+
+    glGenBuffers(1, &itemBuffer);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, itemBuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, std::max(itemCount, 1) * sizeof(DrawItem), items.empty() ? nullptr : items.data(), GL_STATIC_DRAW);
+
+    glGenBuffers(1, &itemClusterBuffer);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, itemClusterBuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, itemClusters.size() * sizeof(GLuint), itemClusters.data(), GL_STATIC_DRAW);
+
+    glGenBuffers(1, &clusterBoundsBuffer);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, clusterBoundsBuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, clusterBounds.size() * sizeof(glm::vec4), clusterBounds.data(), GL_STATIC_DRAW);
+
+    glGenBuffers(1, &visibleBuffer);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, visibleBuffer);
+    std::vector<GLuint> noClusters(std::max(maskWords, 1), 0);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, noClusters.size() * sizeof(GLuint), noClusters.data(), GL_DYNAMIC_DRAW);
+
+    glGenBuffers(1, &commandBuffer);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, commandBuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, std::max(itemCount, 1) * sizeof(DrawCommand), nullptr, GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+    glGenBuffers(1, &counterBuffer);
+    glBindBuffer(GL_ATOMIC_COUNTER_BUFFER, counterBuffer);
+    glBufferData(GL_ATOMIC_COUNTER_BUFFER, sizeof(GLuint), nullptr, GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_ATOMIC_COUNTER_BUFFER, 0);
+
+    drawCountSupported = GLEW_ARB_indirect_parameters != 0;
+}
+
+GPUCuller::~GPUCuller() {
+    glDeleteBuffers(1, &itemBuffer);
+    glDeleteBuffers(1, &itemClusterBuffer);
+    glDeleteBuffers(1, &clusterBoundsBuffer);
+    glDeleteBuffers(1, &visibleBuffer);
+    glDeleteBuffers(1, &commandBuffer);
+    glDeleteBuffers(1, &counterBuffer);
+    glDeleteProgram(cullShader.ID);
+}
+
+void GPUCuller::Cull(const Frustum& frustum, const std::vector<GLuint>& clusterMask) {
+    if (itemCount == 0) {
+        return;
+    }
+
+    if (maskWords > 0) {
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, visibleBuffer);
+        // Words the mask doesn't cover mean no cluster of theirs is visible, not whatever the last frame left
+        if (clusterMask.size() < static_cast<size_t>(maskWords)) {
+            glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, nullptr);
+        }
+        glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, std::min<size_t>(clusterMask.size(), maskWords) * sizeof(GLuint), clusterMask.data());
+    }
+
+    // Culled slots must be empty draws when the whole buffer is submitted
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, commandBuffer);
+    glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, nullptr);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+    const GLuint zero = 0;
+    glBindBuffer(GL_ATOMIC_COUNTER_BUFFER, counterBuffer);
+    glBufferSubData(GL_ATOMIC_COUNTER_BUFFER, 0, sizeof(GLuint), &zero);
+    glBindBuffer(GL_ATOMIC_COUNTER_BUFFER, 0);
+
+    cullShader.use();
+    cullShader.setVec4Array("planes", frustum.planes, FRUSTUM_PLANE_COUNT);
+    cullShader.setInt("itemCount", itemCount);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, itemBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, itemClusterBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, clusterBoundsBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, visibleBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, commandBuffer);
+    glBindBufferBase(GL_ATOMIC_COUNTER_BUFFER, 0, counterBuffer);
+    glDispatchCompute((itemCount + 63) / 64, 1, 1);
+
+    // The commands and the counter are read by the draw as indirect arguments
+    glMemoryBarrier(GL_COMMAND_BARRIER_BIT);
+}
+
+void GPUCuller::Draw() const {
+    if (itemCount == 0) {
+        return;
+    }
+
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBuffer);
+    if (drawCountSupported) {
+        // The counter holds how many commands were written, the draw stops there
+        glBindBuffer(GL_PARAMETER_BUFFER_ARB, counterBuffer);
+        glMultiDrawElementsIndirectCountARB(GL_TRIANGLES, GL_UNSIGNED_INT, nullptr, 0, itemCount, 0);
+        glBindBuffer(GL_PARAMETER_BUFFER_ARB, 0);
+    }
+    else {
+        glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, nullptr, itemCount, 0);
+    }
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+}
@@ -0,0 +1,68 @@
+#ifndef GPUCULLER_H
+#define GPUCULLER_H
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <vector>
+#include "BSPMap.h"
+#include "Frustum.h"
+#include "Shader.h"
+
+/*
+GPU driven culling of the static world. Face bounds, index ranges and the clusters each face sits in are uploaded
+once into shader storage buffers. Every frame the CPU only uploads which clusters are in the PVS, a compute shader
+tests every face against it and the frustum and appends a draw command for each survivor through an atomic counter.
+The whole world is then drawn with a single glMultiDrawElementsIndirect, so the CPU cost does not grow with the map.
+Needs GL 4.3, the renderer keeps its CPU path when it is missing.
+*/
+
+class GPUCuller {
+public:
+    static bool IsSupported();
+
+    // firstIndices and indexCounts give the index buffer range of every face, faces with no indices are skipped
+    GPUCuller(const BSPMap& map, const std::vector<GLuint>& firstIndices, const std::vector<GLsizei>& indexCounts, const char* computePath);
+    ~GPUCuller();
+
+    GPUCuller(const GPUCuller&) = delete;
+    GPUCuller& operator=(const GPUCuller&) = delete;
+
+    // Writes the draw commands for this frame. clusterMask has one bit per cluster, frustum is in map space.
+    void Cull(const Frustum& frustum, const std::vector<GLuint>& clusterMask);
+
+    // Submits the commands written by Cull, the world VAO and shader must be bound
+    void Draw() const;
+
+    int GetItemCount() const { return itemCount; }
+    int GetClusterCount() const { return numClusters; }
+
+private:
+    // std430 layout shared with cull.comp
+    struct DrawItem {
+        glm::vec4 mins;
+        glm::vec4 maxs;
+        GLuint firstIndex;
+        GLuint count;
+        GLuint firstCluster;
+        GLuint numClusters;
+    };
+
+    struct DrawCommand {
+        GLuint count;
+        GLuint instanceCount;
+        GLuint firstIndex;
+        GLuint baseVertex;
+        GLuint baseInstance;
+    };
+
+    Shader cullShader;
+    int itemCount = 0;
+    int numClusters = 0;
+    int maskWords = 0;
+    bool drawCountSupported = false; // ARB_indirect_parameters lets the draw stop at the counter
+
+    GLuint itemBuffer = 0, itemClusterBuffer = 0, clusterBoundsBuffer = 0, visibleBuffer = 0;
+    GLuint commandBuffer = 0, counterBuffer = 0;
+};
+
+#endif // GPUCULLER_H
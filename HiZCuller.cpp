@@ -0,0 +1,189 @@
+#include "HiZCuller.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+static const int MAX_DEPTH_AGE = 4;       // Frames before the depth is too old to trust
+static const float MAX_EYE_MOVE = 24.0f;  // Map units the eye may move before parallax could uncover a box
+
+HiZCuller::HiZCuller() {
+    for (Readback& readback : ring) {
+        glGenBuffers(1, &readback.buffer);
+    }
+}
+
+HiZCuller::~HiZCuller() {
+    for (Readback& readback : ring) {
+        if (readback.fence) {
+            glDeleteSync(readback.fence);
+        }
+        glDeleteBuffers(1, &readback.buffer);
+    }
+}
+
+void HiZCuller::CollectFinished() {
+    // Only the newest finished copy is worth reducing, older finished ones are dropped
+    Readback* newest = nullptr;
+    for (Readback& readback : ring) {
+        if (!readback.fence) {
+            continue;
+        }
+        GLenum status = glClientWaitSync(readback.fence, 0, 0);
+        if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED) {
+            continue;
+        }
+        glDeleteSync(readback.fence);
+        readback.fence = nullptr;
+        if (!newest || readback.frame > newest->frame) {
+            newest = &readback;
+        }
+    }
+    if (!newest || newest->frame <= depthFrame) {
+        return;
+    }
+
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, newest->buffer);
+    GLsizeiptr size = static_cast<GLsizeiptr>(newest->width) * newest->height * sizeof(float);
+    const float* depth = static_cast<const float*>(glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, size, GL_MAP_READ_BIT));
+    if (depth) {
+        BuildPyramid(depth, newest->width, newest->height);
+        depthViewProjection = newest->viewProjection;
+        depthEye = newest->eye;
+        depthFrame = newest->frame;
+    }
+    glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+}
+
+void HiZCuller::BuildPyramid(const float* depth, int width, int height) {
+    levels.resize(1);
+    levelWidths.assign(1, width);
+    levelHeights.assign(1, height);
+    levels[0].assign(depth, depth + static_cast<size_t>(width) * height);
+
+    // Odd sizes round up, the last row or column then only has itself to take the max of
+    while (width > 1 || height > 1) {
+        int nextWidth = (width + 1) / 2;
+        int nextHeight = (height + 1) / 2;
+        const std::vector<float>& source = levels.back();
+        std::vector<float> level(static_cast<size_t>(nextWidth) * nextHeight);
+        for (int y = 0; y < nextHeight; ++y) {
+            int y0 = y * 2;
+            int y1 = std::min(y0 + 1, height - 1);
+            for (int x = 0; x < nextWidth; ++x) {
+                int x0 = x * 2;
+                int x1 = std::min(x0 + 1, width - 1);
+                level[y * nextWidth + x] = std::max(std::max(source[y0 * width + x0], source[y0 * width + x1]),
+                    std::max(source[y1 * width + x0], source[y1 * width + x1]));
+            }
+        }
+        levels.push_back(std::move(level));
+        levelWidths.push_back(nextWidth);
+        levelHeights.push_back(nextHeight);
+        width = nextWidth;
+        height = nextHeight;
+    }
+}
+
+void HiZCuller::Capture(const glm::mat4& viewProjection, const glm::vec3& eye) {
+    ++frame;
+    currentEye = eye;
+    CollectFinished();
+
+    // Every slot still in flight means the GPU is behind, skip this frame's copy rather than wait
+    Readback* slot = nullptr;
+    for (Readback& readback : ring) {
+        if (!readback.fence) {
+            slot = &readback;
+            break;
+        }
+    }
+    if (!slot) {
+        return;
+    }
+
+    GLint viewport[4];
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    if (viewport[2] <= 0 || viewport[3] <= 0) {
+        return;
+    }
+
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, slot->buffer);
+    GLsizeiptr size = static_cast<GLsizeiptr>(viewport[2]) * viewport[3] * sizeof(float);
+    if (size > slot->capacity) {
+        glBufferData(GL_PIXEL_PACK_BUFFER, size, nullptr, GL_STREAM_READ);
+        slot->capacity = size;
+    }
+    // With a pack buffer bound the read only queues a copy and returns
+    glReadPixels(viewport[0], viewport[1], viewport[2], viewport[3], GL_DEPTH_COMPONENT, GL_FLOAT, nullptr);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    slot->fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    slot->width = viewport[2];
+    slot->height = viewport[3];
+    slot->viewProjection = viewProjection;
+    slot->eye = eye;
+    slot->frame = frame;
+}
+
+bool HiZCuller::IsBoxVisible(const glm::vec3& mins, const glm::vec3& maxs) const {
+    // Disocclusion fallback, old depth or a moved eye can't be trusted to hide anything
+    if (depthFrame < 0 || frame - depthFrame > MAX_DEPTH_AGE) {
+        return true;
+    }
+    glm::vec3 moved = currentEye - depthEye;
+    if (glm::dot(moved, moved) > MAX_EYE_MOVE * MAX_EYE_MOVE) {
+        return true;
+    }
+
+    // Screen rectangle and nearest depth of the box in the frame the depth came from
+    float minX = 1e30f, minY = 1e30f, maxX = -1e30f, maxY = -1e30f;
+    float nearest = 1.0f;
+    for (int i = 0; i < 8; ++i) {
+        glm::vec4 corner((i & 1) ? maxs.x : mins.x, (i & 2) ? maxs.y : mins.y, (i & 4) ? maxs.z : mins.z, 1.0f);
+        glm::vec4 clip = depthViewProjection * corner;
+        if (clip.w <= 1e-3f) {
+            return true; // Crosses the near plane
+        }
+        float x = clip.x / clip.w;
+        float y = clip.y / clip.w;
+        float z = clip.z / clip.w * 0.5f + 0.5f;
+        minX = std::min(minX, x);
+        maxX = std::max(maxX, x);
+        minY = std::min(minY, y);
+        maxY = std::max(maxY, y);
+        nearest = std::min(nearest, z);
+    }
+    if (nearest <= 0.0f) {
+        return true;
+    }
+
+    // Texels covered at level 0, grown by one so rasterization differences can't uncover an edge
+    const int width = levelWidths[0];
+    const int height = levelHeights[0];
+    int x0 = static_cast<int>(std::floor((minX * 0.5f + 0.5f) * width)) - 1;
+    int x1 = static_cast<int>(std::floor((maxX * 0.5f + 0.5f) * width)) + 1;
+    int y0 = static_cast<int>(std::floor((minY * 0.5f + 0.5f) * height)) - 1;
+    int y1 = static_cast<int>(std::floor((maxY * 0.5f + 0.5f) * height)) + 1;
+    // Off screen, the frustum test decides those. A box only partly on screen has no depth for the rest of it,
+    // which a turned camera may be looking at now.
+    if (x0 < 0 || y0 < 0 || x1 >= width || y1 >= height) {
+        return true;
+    }
+
+    // Coarsest level where the rectangle still spans at most 2x2 texels
+    int level = 0;
+    while (level + 1 < static_cast<int>(levels.size()) && ((x1 >> level) - (x0 >> level) > 1 || (y1 >> level) - (y0 >> level) > 1)) {
+        ++level;
+    }
+
+    float furthest = 0.0f;
+    const std::vector<float>& depth = levels[level];
+    const int levelWidth = levelWidths[level];
+    for (int y = y0 >> level; y <= (y1 >> level); ++y) {
+        for (int x = x0 >> level; x <= (x1 >> level); ++x) {
+            furthest = std::max(furthest, depth[y * levelWidth + x]);
+        }
+    }
+    return nearest <= furthest;
+}
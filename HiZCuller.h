@@ -0,0 +1,67 @@
+#ifndef HIZCULLER_H
+#define HIZCULLER_H
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <vector>
+
+/*
+Occlusion test against the depth of earlier frames. After the world is drawn its depth buffer is copied into one
+of a ring of pixel buffers, and a fence tells when the copy is done. Finished copies are mapped without ever
+waiting and reduced into a max depth pyramid on the CPU. Boxes are projected with the view projection the depth was
+rendered with, and a box is hidden when its nearest depth is behind the furthest depth under its screen rectangle.
+
+The depth is a few frames old, so the answer is only trusted while it is recent and the eye hasn't moved far
+from where it was rendered. Anything else, including boxes crossing the near plane, counts as visible.
+Only world geometry goes into the depth, so moving models can't hide themselves.
+*/
+
+class HiZCuller {
+public:
+    HiZCuller();
+    ~HiZCuller();
+
+    HiZCuller(const HiZCuller&) = delete;
+    HiZCuller& operator=(const HiZCuller&) = delete;
+
+    // Picks up finished copies and starts copying the bound depth buffer, drawn with viewProjection from eye (map space)
+    void Capture(const glm::mat4& viewProjection, const glm::vec3& eye);
+
+    // Box in map space, false only if it is certainly behind the captured depth
+    bool IsBoxVisible(const glm::vec3& mins, const glm::vec3& maxs) const;
+
+    bool HasDepth() const { return depthFrame >= 0; }
+    int GetDepthAge() const { return depthFrame >= 0 ? frame - depthFrame : -1; }
+
+private:
+    struct Readback {
+        GLuint buffer = 0;
+        GLsync fence = nullptr;
+        GLsizeiptr capacity = 0;
+        int width = 0;
+        int height = 0;
+        glm::mat4 viewProjection;
+        glm::vec3 eye;
+        int frame = 0;
+    };
+
+    void CollectFinished();
+    void BuildPyramid(const float* depth, int width, int height);
+
+    static const int RING_SIZE = 3;
+
+    Readback ring[RING_SIZE];
+
+    // Level 0 is the full depth buffer, every level above keeps the furthest of 2x2 texels
+    std::vector<std::vector<float>> levels;
+    std::vector<int> levelWidths;
+    std::vector<int> levelHeights;
+    glm::mat4 depthViewProjection;
+    glm::vec3 depthEye;
+    int depthFrame = -1;
+
+    glm::vec3 currentEye;
+    int frame = 0;
+};
+
+#endif // HIZCULLER_H
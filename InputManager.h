@@ -3,6 +3,8 @@
 
 #include <GLFW/glfw3.h>
 #include "Camera.h"
+#include "CollisionModel.h"
+#include "PlayerMove.h"
 #include <string>
 #include <fstream>
 #include <sstream>
@@ -16,26 +18,56 @@ public:
 
     InputManager(Camera* camera) : camera(camera), firstMouse(true), lastX(400), lastY(300) {}
 
+    // With a collision model the camera slides along the map's brushes instead of flying through them
+    void SetCollision(CollisionModel* model) { collision = model; }
+
     void ProcessKeyboard(GLFWwindow* window, float deltaTime) {
         float velocity = camera->MovementSpeed * deltaTime;
+        glm::vec3 move(0.0f);
         if (glfwGetKey(window, GLFW_KEY_W) == GLFW_PRESS)
-            camera->Position += camera->Front * velocity;
+            move += camera->Front * velocity;
         if (glfwGetKey(window, GLFW_KEY_S) == GLFW_PRESS)
-            camera->Position -= camera->Front * velocity;
+            move -= camera->Front * velocity;
         if (glfwGetKey(window, GLFW_KEY_A) == GLFW_PRESS)
-            camera->Position -= camera->Right * velocity;
+            move -= camera->Right * velocity;
         if (glfwGetKey(window, GLFW_KEY_D) == GLFW_PRESS)
-            camera->Position += camera->Right * velocity;
+            move += camera->Right * velocity;
         if (glfwGetKey(window, GLFW_KEY_SPACE) == GLFW_PRESS)
-            camera->Position += camera->Up * velocity;
+            move += camera->Up * velocity;
+        if (glfwGetKey(window, GLFW_KEY_LEFT_CONTROL) == GLFW_PRESS)
+            move -= camera->Up * velocity;
+        MoveCamera(move);
         if (glfwGetKey(window, GLFW_KEY_LEFT_CONTROL) == GLFW_PRESS)
         {
-            camera->Position -= camera->Up * velocity;
             std::cout << camera->Position.s << std::endl;
             //Confirming that the camera is actually moving
         }
     }
 
+    // Movement keys and the current view as one player command
+    PlayerInput SampleInput(GLFWwindow* window) const {
+        PlayerInput input;
+        int forward = 0, right = 0, up = 0;
+        if (glfwGetKey(window, GLFW_KEY_W) == GLFW_PRESS)
+            forward += 127;
+        if (glfwGetKey(window, GLFW_KEY_S) == GLFW_PRESS)
+            forward -= 127;
+        if (glfwGetKey(window, GLFW_KEY_A) == GLFW_PRESS)
+            right -= 127;
+        if (glfwGetKey(window, GLFW_KEY_D) == GLFW_PRESS)
+            right += 127;
+        if (glfwGetKey(window, GLFW_KEY_SPACE) == GLFW_PRESS)
+            up += 127;
+        if (glfwGetKey(window, GLFW_KEY_LEFT_CONTROL) == GLFW_PRESS)
+            up -= 127;
+        input.forwardMove = static_cast<int8_t>(forward);
+        input.rightMove = static_cast<int8_t>(right);
+        input.upMove = static_cast<int8_t>(up);
+        input.yaw = PlayerInput::AngleToShort(camera->Yaw);
+        input.pitch = PlayerInput::AngleToShort(camera->Pitch);
+        return input;
+    }
+
     void ProcessMouseMovement(GLFWwindow* window, double xpos, double ypos) {
         if (firstMouse) {
             lastX = xpos;
@@ -85,6 +117,35 @@ public:
         }
     }
 
+    void MoveCamera(const glm::vec3& move) {
+        if (!collision) {
+            camera->Position += move;
+            return;
+        }
+
+        // Q3 player box around the eye, which sits 26 units above the player origin
+        const glm::vec3 mins(-15.0f, -15.0f, -50.0f);
+        const glm::vec3 maxs(15.0f, 15.0f, 6.0f);
+        glm::vec3 position = camera->GetMapPosition();
+        glm::vec3 remaining = Camera::ToMapSpace(move);
+        for (int bump = 0; bump < 4 && glm::dot(remaining, remaining) > 1e-6f; ++bump) {
+            TraceResult trace = collision->TraceBox(position, position + remaining, mins, maxs, MASK_PLAYERSOLID);
+            if (trace.allSolid) {
+                // Stuck inside a brush, move freely until out of it
+                position += remaining;
+                break;
+            }
+            position = trace.endPos;
+            if (trace.fraction == 1.0f) {
+                break;
+            }
+            // Slide along what was hit with the rest of the move
+            remaining *= 1.0f - trace.fraction;
+            remaining -= trace.normal * glm::dot(remaining, trace.normal);
+        }
+        camera->Position = Camera::FromMapSpace(position);
+    }
+
     // Call this function in your main program after creating the InputManager instance
     void SetupCallbacks(GLFWwindow* window) {
         glfwSetWindowUserPointer(window, this);
@@ -92,6 +153,9 @@ public:
         glfwSetScrollCallback(window, InputManager::ScrollCallback);
         glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_NORMAL);
     }
+
+private:
+    CollisionModel* collision = nullptr;
 };
 
 #endif
@@ -0,0 +1,127 @@
+#include "InputRecording.h"
+#include <cstring>
+#include <iostream>
+
+static const char RECORDING_MAGIC[5] = { 'W', 'V', 'R', 'E', 'C' };
+static const int32_t RECORDING_VERSION = 1;
+
+template <typename T>
+static void WriteValue(std::ofstream& file, const T& value) {
+    file.write(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+template <typename T>
+static bool ReadValue(std::ifstream& file, T& value) {
+    return static_cast<bool>(file.read(reinterpret_cast<char*>(&value), sizeof(T)));
+}
+
+InputRecording::~InputRecording() {
+    Stop();
+}
+
+bool InputRecording::StartRecording(const std::string& filename, const PlayerState& start) {
+    Stop();
+    output.open(filename, std::ios::binary);
+    if (!output) {
+        std::cerr << "Failed to open recording " << filename << std::endl;
+        return false;
+    }
+
+    output.write(RECORDING_MAGIC, sizeof(RECORDING_MAGIC));
+    WriteValue(output, RECORDING_VERSION);
+    WriteValue(output, static_cast<int32_t>(PlayerMove::TICK_RATE));
+    WriteValue(output, start.origin.x);
+    WriteValue(output, start.origin.y);
+    WriteValue(output, start.origin.z);
+    recording = true;
+    tick = 0;
+    return true;
+}
+
+bool InputRecording::StartReplay(const std::string& filename, PlayerState& start) {
+    Stop();
+    input.open(filename, std::ios::binary);
+    if (!input) {
+        std::cerr << "Failed to open recording " << filename << std::endl;
+        return false;
+    }
+
+    char magic[sizeof(RECORDING_MAGIC)];
+    int32_t version = 0;
+    int32_t tickRate = 0;
+    glm::vec3 origin;
+    if (!input.read(magic, sizeof(magic)) || std::memcmp(magic, RECORDING_MAGIC, sizeof(magic)) != 0 ||
+        !ReadValue(input, version) || !ReadValue(input, tickRate) ||
+        !ReadValue(input, origin.x) || !ReadValue(input, origin.y) || !ReadValue(input, origin.z)) {
+        std::cerr << filename << " is not an input recording" << std::endl;
+        input.close();
+        return false;
+    }
+    if (version != RECORDING_VERSION || tickRate != PlayerMove::TICK_RATE) {
+        std::cerr << filename << " was recorded with version " << version << " at " << tickRate << " ticks per second" << std::endl;
+        input.close();
+        return false;
+    }
+
+    start = PlayerState();
+    start.origin = origin;
+    replaying = true;
+    tick = 0;
+    firstMismatch = -1;
+    return true;
+}
+
+void InputRecording::Write(const PlayerInput& command, const PlayerState& state) {
+    if (!recording) {
+        return;
+    }
+    WriteValue(output, command.forwardMove);
+    WriteValue(output, command.rightMove);
+    WriteValue(output, command.upMove);
+    WriteValue(output, command.buttons);
+    WriteValue(output, command.yaw);
+    WriteValue(output, command.pitch);
+    WriteValue(output, state.Hash());
+    ++tick;
+}
+
+bool InputRecording::Read(PlayerInput& command) {
+    if (!replaying) {
+        return false;
+    }
+    if (!ReadValue(input, command.forwardMove) || !ReadValue(input, command.rightMove) || !ReadValue(input, command.upMove) ||
+        !ReadValue(input, command.buttons) || !ReadValue(input, command.yaw) || !ReadValue(input, command.pitch) ||
+        !ReadValue(input, expectedHash)) {
+        Stop();
+        return false;
+    }
+    return true;
+}
+
+bool InputRecording::Verify(const PlayerState& state) {
+    bool matches = state.Hash() == expectedHash;
+    if (!matches && firstMismatch < 0) {
+        firstMismatch = tick;
+        std::cerr << "Replay: state differs from the recording at tick " << tick << std::endl;
+    }
+    ++tick;
+    return matches;
+}
+
+void InputRecording::Stop() {
+    if (recording) {
+        output.close();
+        std::cout << "Recording: wrote " << tick << " ticks" << std::endl;
+    }
+    if (replaying) {
+        input.close();
+        if (firstMismatch < 0) {
+            std::cout << "Replay: " << tick << " ticks, every state matched" << std::endl;
+        }
+        else {
+            std::cout << "Replay: " << tick << " ticks, first difference at tick " << firstMismatch << std::endl;
+        }
+    }
+    recording = false;
+    replaying = false;
+}
@@ -0,0 +1,47 @@
+#ifndef INPUTRECORDING_H
+#define INPUTRECORDING_H
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include "PlayerMove.h"
+
+/*
+Records the player's input commands tick by tick so a run can be played back exactly, e.g. to time the same
+walk through a map after every change. Each tick stores the command and a hash of the player state it produced.
+On playback the hashes are compared and the first tick that turns out different is reported.
+
+The file starts with "WVREC", a version, the tick rate and the start state, then one fixed size record per tick.
+*/
+
+class InputRecording {
+public:
+    ~InputRecording();
+
+    bool StartRecording(const std::string& filename, const PlayerState& start);
+    bool StartReplay(const std::string& filename, PlayerState& start);
+
+    bool IsRecording() const { return recording; }
+    bool IsReplaying() const { return replaying; }
+
+    void Write(const PlayerInput& input, const PlayerState& state);
+
+    // Next recorded command, false once the recording has ended
+    bool Read(PlayerInput& input);
+
+    // Checks the state the last read command produced against the recorded one
+    bool Verify(const PlayerState& state);
+
+    void Stop();
+
+private:
+    std::ofstream output;
+    std::ifstream input;
+    bool recording = false;
+    bool replaying = false;
+    uint32_t expectedHash = 0;
+    int tick = 0;
+    int firstMismatch = -1;
+};
+
+#endif // INPUTRECORDING_H
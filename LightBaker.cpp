@@ -0,0 +1,683 @@
+#include "LightBaker.h"
+#include "LightGrid.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <sstream>
+
+// Same light model as q3map: photons = intensity * POINT_SCALE, divided by the squared distance but never by less
+// than MIN_DISTANCE squared. Spotlights fade out over the last SPOT_FADE units of their cone.
+static const float POINT_SCALE = 7500.0f;
+static const float DEFAULT_INTENSITY = 300.0f;
+static const float DEFAULT_SPOT_RADIUS = 64.0f;
+static const float MIN_DISTANCE = 16.0f;
+static const float SPOT_FADE = 32.0f;
+// Lights adding less than this to a texel aren't traced
+static const float MIN_CONTRIBUTION = 0.1f;
+
+// Rays start this far off the surface so they don't hit the triangle they start on
+static const float SAMPLE_OFFSET = 1.0f;
+static const float MAX_BOUNCE_DISTANCE = 8192.0f;
+// There are no texture colors to reflect, every surface reflects this much of each channel
+static const float ALBEDO = 0.5f;
+// Patches are cut into this many quads along each side of every 3x3 section
+static const int PATCH_TESSELLATION = 4;
+static const float PI = 3.14159265f;
+
+// Small xorshift generator, each texel and bounce seeds its own so no two threads share one
+static uint32_t NextRandom(uint32_t& state) {
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+}
+
+static float RandomFloat(uint32_t& state) {
+    return (NextRandom(state) >> 8) * (1.0f / 16777216.0f);
+}
+
+// Like q3map, colors over 255 are scaled down as a whole so they keep their hue
+static glm::vec3 ClampColor(const glm::vec3& color) {
+    glm::vec3 sample = glm::max(color, glm::vec3(0.0f));
+    float max = std::max(sample.r, std::max(sample.g, sample.b));
+    if (max > 255.0f) {
+        sample *= 255.0f / max;
+    }
+    return sample;
+}
+
+static void ColorToBytes(const glm::vec3& color, unsigned char* bytes) {
+    glm::vec3 sample = ClampColor(color);
+    for (int i = 0; i < 3; ++i) {
+        bytes[i] = static_cast<unsigned char>(std::min(sample[i], 255.0f));
+    }
+}
+
+static glm::vec3 ParseVector(const std::string& text) {
+    glm::vec3 value(0.0f);
+    std::istringstream(text) >> value.x >> value.y >> value.z;
+    return value;
+}
+
+// Light a point gets from light per unit of its color, ignoring the angle to the surface and shadows
+static float Attenuation(const glm::vec3& lightOrigin, bool spot, const glm::vec3& spotNormal, float radiusByDist, const glm::vec3& point) {
+    glm::vec3 toPoint = point - lightOrigin;
+    float distance = std::max(glm::length(toPoint), MIN_DISTANCE);
+    float attenuation = 1.0f / (distance * distance);
+    if (spot) {
+        float along = glm::dot(toPoint, spotNormal);
+        if (along <= 0.0f) {
+            return 0.0f;
+        }
+        float radiusAtDist = along * radiusByDist;
+        float sampleRadius = glm::length(toPoint - spotNormal * along);
+        if (sampleRadius >= radiusAtDist) {
+            return 0.0f;
+        }
+        if (sampleRadius > radiusAtDist - SPOT_FADE) {
+            attenuation *= (radiusAtDist - sampleRadius) / SPOT_FADE;
+        }
+    }
+    return attenuation;
+}
+
+LightBaker::LightBaker(const BSPMap& map, ThreadPool& pool) : map(map), pool(pool), collision(map) {
+}
+
+int LightBaker::GetTexelCount() const {
+    int count = 0;
+    for (const BakeFace& bakeFace : bakeFaces) {
+        count += bakeFace.width * bakeFace.height;
+    }
+    return count;
+}
+
+bool LightBaker::Prepare() {
+    const std::vector<Face>& faces = map.GetFaces();
+    int pageCount = map.GetLightmapCount();
+
+    ReadLights();
+
+    // Faces with a lightmap on one of the map's pages, nothing else is rebaked. q3map2 leaves lm_start and lm_size
+    // empty, so the rectangle is taken from the lightmap coordinates, which are at texel centers.
+    bakeFaces.clear();
+    const std::vector<Vertex>& vertices = map.GetVertex();
+    int badFaces = 0;
+    for (int i = 0; i < static_cast<int>(faces.size()); ++i) {
+        const Face& face = faces[i];
+        if (face.type < 1 || face.type > 3 || face.lm_index < 0 || face.numVertices <= 0) {
+            continue;
+        }
+        if (face.lm_index >= pageCount || face.vertex < 0 || face.vertex + face.numVertices > static_cast<int>(vertices.size())) {
+            ++badFaces;
+            continue;
+        }
+        glm::vec2 mins(1e30f);
+        glm::vec2 maxs(-1e30f);
+        for (int j = 0; j < face.numVertices; ++j) {
+            const Vertex& vertex = vertices[face.vertex + j];
+            for (int axis = 0; axis < 2; ++axis) {
+                mins[axis] = std::min(mins[axis], vertex.lmCoord[axis] * LIGHTMAP_SIZE);
+                maxs[axis] = std::max(maxs[axis], vertex.lmCoord[axis] * LIGHTMAP_SIZE);
+            }
+        }
+        int x = std::max(static_cast<int>(std::floor(mins.x)), 0);
+        int y = std::max(static_cast<int>(std::floor(mins.y)), 0);
+        int lastX = std::min(static_cast<int>(std::ceil(maxs.x)) - 1, LIGHTMAP_SIZE - 1);
+        int lastY = std::min(static_cast<int>(std::ceil(maxs.y)) - 1, LIGHTMAP_SIZE - 1);
+        if (lastX < x || lastY < y) {
+            ++badFaces;
+            continue;
+        }
+        bakeFaces.push_back(BakeFace{ i, face.lm_index, x, y, lastX - x + 1, lastY - y + 1 });
+    }
+    if (badFaces > 0) {
+        std::cerr << "LightBaker: " << badFaces << " faces have lightmaps outside the map's pages, they are skipped" << std::endl;
+    }
+
+    glm::vec3 gridOrigin;
+    glm::vec3 gridSize;
+    int gridBounds[3];
+    if (bakeFaces.empty() && !LightGrid::GetLayout(map, gridOrigin, gridSize, gridBounds)) {
+        std::cerr << "LightBaker: map has no lightmaps or light grid to bake" << std::endl;
+        return false;
+    }
+
+    int texelCount = pageCount * LIGHTMAP_SIZE * LIGHTMAP_SIZE;
+    texels.assign(texelCount, Texel{ glm::vec3(0.0f), glm::vec3(0.0f) });
+    sources.assign(texelCount, -1);
+    texelLevels.assign(texelCount, -1);
+    direct.assign(texelCount, glm::vec3(0.0f));
+    bounceLight.clear();
+    lightmapBytes = map.GetLightmaps();
+    gridBytes.clear();
+
+    BuildBVH();
+    pool.ParallelFor(static_cast<int>(bakeFaces.size()), [this](int index, int) {
+        MapTexels(index);
+    });
+
+    rows.clear();
+    for (int i = 0; i < static_cast<int>(bakeFaces.size()); ++i) {
+        for (int y = 0; y < bakeFaces[i].height; ++y) {
+            rows.push_back(std::make_pair(i, y));
+        }
+    }
+
+    std::cout << "LightBaker: " << lights.size() << " lights, " << bakeFaces.size() << " faces, " << GetTexelCount() << " texels, "
+        << bvh.GetTriangleCount() << " triangles" << std::endl;
+    return true;
+}
+
+void LightBaker::ReadLights() {
+    lights.clear();
+    ambient = glm::vec3(0.0f);
+    const std::vector<Entity>& entities = map.GetEntities();
+    for (const Entity& entity : entities) {
+        std::string classname = entity.Get("classname");
+        if (classname == "worldspawn") {
+            float value = 0.0f;
+            std::istringstream(entity.Get("_ambient", entity.Get("ambient", "0"))) >> value;
+            ambient = glm::vec3(value);
+            continue;
+        }
+        if (classname != "light") {
+            continue;
+        }
+
+        Light light;
+        light.origin = ParseVector(entity.Get("origin", "0 0 0"));
+        float intensity = 0.0f;
+        std::istringstream(entity.Get("light", entity.Get("_light", "0"))) >> intensity;
+        if (intensity == 0.0f) {
+            intensity = DEFAULT_INTENSITY;
+        }
+
+        // Colors are normalized so the brightest channel is 1, the intensity alone sets the brightness
+        glm::vec3 color = ParseVector(entity.Get("_color", "1 1 1"));
+        float max = std::max(color.r, std::max(color.g, color.b));
+        color = max > 0.0f ? color / max : glm::vec3(1.0f);
+        light.photons = color * (intensity * POINT_SCALE);
+
+        // A light aimed at a target is a spotlight whose cone is "radius" wide at the target
+        light.spot = false;
+        light.spotNormal = glm::vec3(0.0f, 0.0f, -1.0f);
+        light.radiusByDist = 0.0f;
+        std::string target = entity.Get("target");
+        if (!target.empty()) {
+            for (const Entity& other : entities) {
+                if (other.Get("targetname") != target) {
+                    continue;
+                }
+                glm::vec3 toTarget = ParseVector(other.Get("origin", "0 0 0")) - light.origin;
+                float distance = glm::length(toTarget);
+                if (distance > 0.0f) {
+                    float radius = DEFAULT_SPOT_RADIUS;
+                    std::istringstream(entity.Get("radius", "64")) >> radius;
+                    light.spot = true;
+                    light.spotNormal = toTarget / distance;
+                    light.radiusByDist = (radius + MIN_DISTANCE) / distance;
+                }
+                break;
+            }
+        }
+        lights.push_back(light);
+    }
+}
+
+void LightBaker::FaceTriangles(const Face& face, std::vector<SurfaceVertex>& surfaceVertices, std::vector<int>& indices) const {
+    const std::vector<Vertex>& vertices = map.GetVertex();
+    const std::vector<int>& meshVerts = map.GetMeshVerts();
+    surfaceVertices.clear();
+    indices.clear();
+    if (face.vertex < 0 || face.numVertices <= 0 || face.vertex + face.numVertices > static_cast<int>(vertices.size())) {
+        return;
+    }
+
+    auto toSurface = [](const Vertex& vertex) {
+        return SurfaceVertex{ glm::vec3(vertex.position[0], vertex.position[1], vertex.position[2]),
+            glm::vec2(vertex.lmCoord[0], vertex.lmCoord[1]) * static_cast<float>(LIGHTMAP_SIZE),
+            glm::vec3(vertex.normal[0], vertex.normal[1], vertex.normal[2]) };
+    };
+
+    if (face.type == 1 || face.type == 3) {
+        for (int i = 0; i < face.numVertices; ++i) {
+            surfaceVertices.push_back(toSurface(vertices[face.vertex + i]));
+        }
+        if (face.meshVertex < 0 || face.meshVertex + face.numMeshVertices > static_cast<int>(meshVerts.size())) {
+            return;
+        }
+        for (int i = 0; i + 2 < face.numMeshVertices; i += 3) {
+            int a = meshVerts[face.meshVertex + i];
+            int b = meshVerts[face.meshVertex + i + 1];
+            int c = meshVerts[face.meshVertex + i + 2];
+            if (a < 0 || b < 0 || c < 0 || a >= face.numVertices || b >= face.numVertices || c >= face.numVertices) {
+                continue;
+            }
+            indices.push_back(a);
+            indices.push_back(b);
+            indices.push_back(c);
+        }
+        return;
+    }
+
+    // Patches are grids of 3x3 biquadratic sections sharing their border rows, each is cut into a grid of quads
+    int width = face.size[0];
+    int height = face.size[1];
+    if (width < 3 || height < 3 || width % 2 == 0 || height % 2 == 0 || width * height != face.numVertices) {
+        return;
+    }
+    for (int sectionY = 0; sectionY + 2 < height; sectionY += 2) {
+        for (int sectionX = 0; sectionX + 2 < width; sectionX += 2) {
+            SurfaceVertex controls[9];
+            for (int row = 0; row < 3; ++row) {
+                for (int column = 0; column < 3; ++column) {
+                    controls[row * 3 + column] = toSurface(vertices[face.vertex + (sectionY + row) * width + sectionX + column]);
+                }
+            }
+
+            int first = static_cast<int>(surfaceVertices.size());
+            for (int j = 0; j <= PATCH_TESSELLATION; ++j) {
+                float t = static_cast<float>(j) / PATCH_TESSELLATION;
+                float rowWeights[3] = { (1.0f - t) * (1.0f - t), 2.0f * t * (1.0f - t), t * t };
+                for (int i = 0; i <= PATCH_TESSELLATION; ++i) {
+                    float s = static_cast<float>(i) / PATCH_TESSELLATION;
+                    float columnWeights[3] = { (1.0f - s) * (1.0f - s), 2.0f * s * (1.0f - s), s * s };
+                    SurfaceVertex vertex{ glm::vec3(0.0f), glm::vec2(0.0f), glm::vec3(0.0f) };
+                    for (int row = 0; row < 3; ++row) {
+                        for (int column = 0; column < 3; ++column) {
+                            float weight = rowWeights[row] * columnWeights[column];
+                            const SurfaceVertex& control = controls[row * 3 + column];
+                            vertex.position += control.position * weight;
+                            vertex.lightmap += control.lightmap * weight;
+                            vertex.normal += control.normal * weight;
+                        }
+                    }
+                    surfaceVertices.push_back(vertex);
+                }
+            }
+
+            int stride = PATCH_TESSELLATION + 1;
+            for (int j = 0; j < PATCH_TESSELLATION; ++j) {
+                for (int i = 0; i < PATCH_TESSELLATION; ++i) {
+                    int corner = first + j * stride + i;
+                    indices.push_back(corner);
+                    indices.push_back(corner + stride);
+                    indices.push_back(corner + 1);
+                    indices.push_back(corner + 1);
+                    indices.push_back(corner + stride);
+                    indices.push_back(corner + stride + 1);
+                }
+            }
+        }
+    }
+}
+
+void LightBaker::BuildBVH() {
+    const std::vector<Face>& faces = map.GetFaces();
+    const std::vector<TextureInfo>& textures = map.GetTextures();
+    const std::vector<Model>& models = map.GetModels();
+
+    std::vector<int> faceToBake(faces.size(), -1);
+    for (int i = 0; i < static_cast<int>(bakeFaces.size()); ++i) {
+        faceToBake[bakeFaces[i].face] = i;
+    }
+
+    // Only the world casts shadows, submodels like doors move. Water and other see through surfaces let light pass.
+    bvh = TriangleBVH();
+    surfaceTriangles.clear();
+    int firstFace = models.empty() ? 0 : std::max(models[0].firstFace, 0);
+    int lastFace = models.empty() ? static_cast<int>(faces.size()) : std::min(models[0].firstFace + models[0].numFaces, static_cast<int>(faces.size()));
+    std::vector<SurfaceVertex> surfaceVertices;
+    std::vector<int> indices;
+    for (int i = firstFace; i < lastFace; ++i) {
+        const Face& face = faces[i];
+        if (face.texture >= 0 && face.texture < static_cast<int>(textures.size()) &&
+            (textures[face.texture].twoSided || (textures[face.texture].flags & SURF_NODRAW))) {
+            continue;
+        }
+        FaceTriangles(face, surfaceVertices, indices);
+        int bakeFace = faceToBake[i];
+        for (size_t j = 0; j + 2 < indices.size(); j += 3) {
+            const SurfaceVertex& a = surfaceVertices[indices[j]];
+            const SurfaceVertex& b = surfaceVertices[indices[j + 1]];
+            const SurfaceVertex& c = surfaceVertices[indices[j + 2]];
+            glm::vec3 normal = glm::cross(b.position - a.position, c.position - a.position);
+            float length = glm::length(normal);
+            if (length <= 0.0f) {
+                continue;
+            }
+            // The winding of the triangles isn't trusted, the vertex normals say which side is the front
+            normal /= length;
+            if (glm::dot(normal, a.normal + b.normal + c.normal) < 0.0f) {
+                normal = -normal;
+            }
+
+            SurfaceTriangle triangle;
+            triangle.bakeFace = bakeFace;
+            triangle.page = bakeFace >= 0 ? bakeFaces[bakeFace].page : -1;
+            triangle.lightmap[0] = a.lightmap;
+            triangle.lightmap[1] = b.lightmap;
+            triangle.lightmap[2] = c.lightmap;
+            triangle.normal = normal;
+            bvh.AddTriangle(a.position, b.position, c.position, static_cast<int>(surfaceTriangles.size()));
+            surfaceTriangles.push_back(triangle);
+        }
+    }
+    bvh.Build();
+}
+
+void LightBaker::MapTexels(int bakeFaceIndex) {
+    const BakeFace& bakeFace = bakeFaces[bakeFaceIndex];
+    std::vector<SurfaceVertex> surfaceVertices;
+    std::vector<int> indices;
+    FaceTriangles(map.GetFaces()[bakeFace.face], surfaceVertices, indices);
+    if (indices.empty()) {
+        return;
+    }
+    glm::vec3 faceCenter(0.0f);
+    for (const SurfaceVertex& vertex : surfaceVertices) {
+        faceCenter += vertex.position;
+    }
+    faceCenter /= static_cast<float>(surfaceVertices.size());
+
+    for (int y = bakeFace.y; y < bakeFace.y + bakeFace.height; ++y) {
+        for (int x = bakeFace.x; x < bakeFace.x + bakeFace.width; ++x) {
+            // The triangle covering the texel center, or the one it is least outside of. Texels on the border
+            // of the rectangle are often just off the face, they are moved onto its nearest edge.
+            glm::vec2 center(x + 0.5f, y + 0.5f);
+            float bestScore = -1e30f;
+            int bestTriangle = -1;
+            glm::vec3 bestWeights(0.0f);
+            for (size_t i = 0; i + 2 < indices.size(); i += 3) {
+                glm::vec2 l0 = surfaceVertices[indices[i]].lightmap;
+                glm::vec2 edge1 = surfaceVertices[indices[i + 1]].lightmap - l0;
+                glm::vec2 edge2 = surfaceVertices[indices[i + 2]].lightmap - l0;
+                glm::vec2 offset = center - l0;
+                float area = edge1.x * edge2.y - edge2.x * edge1.y;
+                if (std::fabs(area) < 1e-6f) {
+                    continue;
+                }
+                float u = (offset.x * edge2.y - edge2.x * offset.y) / area;
+                float v = (edge1.x * offset.y - offset.x * edge1.y) / area;
+                glm::vec3 weights(1.0f - u - v, u, v);
+                float score = std::min(weights.x, std::min(weights.y, weights.z));
+                if (score > bestScore) {
+                    bestScore = score;
+                    bestTriangle = static_cast<int>(i);
+                    bestWeights = weights;
+                }
+            }
+            if (bestTriangle < 0) {
+                continue;
+            }
+
+            bestWeights = glm::max(bestWeights, glm::vec3(0.0f));
+            bestWeights /= bestWeights.x + bestWeights.y + bestWeights.z;
+            const SurfaceVertex& a = surfaceVertices[indices[bestTriangle]];
+            const SurfaceVertex& b = surfaceVertices[indices[bestTriangle + 1]];
+            const SurfaceVertex& c = surfaceVertices[indices[bestTriangle + 2]];
+            Texel& texel = texels[TexelIndex(bakeFace.page, x, y)];
+            texel.position = a.position * bestWeights.x + b.position * bestWeights.y + c.position * bestWeights.z;
+            // Texels on the edge of a face touch the walls around it, they are pulled towards the middle so their
+            // rays don't start on the other side of a wall
+            glm::vec3 toCenter = faceCenter - texel.position;
+            float toCenterLength = glm::length(toCenter);
+            texel.position += toCenterLength > SAMPLE_OFFSET ? toCenter * (SAMPLE_OFFSET / toCenterLength) : toCenter;
+            glm::vec3 normal = a.normal * bestWeights.x + b.normal * bestWeights.y + c.normal * bestWeights.z;
+            if (glm::dot(normal, normal) <= 0.0f) {
+                normal = glm::cross(b.position - a.position, c.position - a.position);
+            }
+            float length = glm::length(normal);
+            texel.normal = length > 0.0f ? normal / length : glm::vec3(0.0f, 0.0f, 1.0f);
+            sources[TexelIndex(bakeFace.page, x, y)] = TexelIndex(bakeFace.page, x, y);
+        }
+    }
+}
+
+bool LightBaker::IsKeyTexel(const BakeFace& bakeFace, int x, int y, int step) const {
+    // Every step-th texel from the corner and the last row and column, so no texel copies one far away
+    int dx = x - bakeFace.x;
+    int dy = y - bakeFace.y;
+    return (dx % step == 0 || dx == bakeFace.width - 1) && (dy % step == 0 || dy == bakeFace.height - 1);
+}
+
+void LightBaker::UpdateSources(int bakeFaceIndex, int step) {
+    const BakeFace& bakeFace = bakeFaces[bakeFaceIndex];
+    auto nearestKey = [step](int offset, int size) {
+        int key = std::min((offset + step / 2) / step * step, size - 1);
+        return (size - 1 - offset < std::abs(offset - key)) ? size - 1 : key;
+    };
+    for (int y = bakeFace.y; y < bakeFace.y + bakeFace.height; ++y) {
+        int keyY = bakeFace.y + nearestKey(y - bakeFace.y, bakeFace.height);
+        for (int x = bakeFace.x; x < bakeFace.x + bakeFace.width; ++x) {
+            int index = TexelIndex(bakeFace.page, x, y);
+            if (sources[index] < 0) {
+                continue;
+            }
+            sources[index] = TexelIndex(bakeFace.page, bakeFace.x + nearestKey(x - bakeFace.x, bakeFace.width), keyY);
+        }
+    }
+}
+
+glm::vec3 LightBaker::DirectLight(const glm::vec3& position, const glm::vec3& normal) const {
+    glm::vec3 light = ambient;
+    glm::vec3 origin = position + normal * SAMPLE_OFFSET;
+    for (const Light& source : lights) {
+        glm::vec3 toLight = source.origin - position;
+        float distance = glm::length(toLight);
+        if (distance <= 0.0f) {
+            continue;
+        }
+        float angle = glm::dot(toLight / distance, normal);
+        if (angle <= 0.0f) {
+            continue;
+        }
+        glm::vec3 add = source.photons * (Attenuation(source.origin, source.spot, source.spotNormal, source.radiusByDist, position) * angle);
+        if (std::max(std::fabs(add.r), std::max(std::fabs(add.g), std::fabs(add.b))) < MIN_CONTRIBUTION) {
+            continue;
+        }
+        if (!bvh.Occluded(origin, source.origin)) {
+            light += add;
+        }
+    }
+    return light;
+}
+
+glm::vec3 LightBaker::GatherBounce(int texelIndex, int level, int samples) const {
+    const Texel& texel = texels[texelIndex];
+    const glm::vec3& normal = texel.normal;
+    glm::vec3 tangent = glm::normalize(glm::cross(std::fabs(normal.z) < 0.9f ? glm::vec3(0.0f, 0.0f, 1.0f) : glm::vec3(1.0f, 0.0f, 0.0f), normal));
+    glm::vec3 bitangent = glm::cross(normal, tangent);
+    glm::vec3 origin = texel.position + normal * SAMPLE_OFFSET;
+    const std::vector<glm::vec3>& previous = level == 1 ? direct : bounceLight[level - 2];
+
+    uint32_t state = static_cast<uint32_t>(texelIndex + 1) * 2654435761u ^ static_cast<uint32_t>(level) * 40503u;
+    state = state ? state : 1u;
+    NextRandom(state);
+
+    glm::vec3 gathered(0.0f);
+    for (int i = 0; i < samples; ++i) {
+        // Cosine weighted, so the average of what the rays see is the light arriving at the texel
+        float phi = 2.0f * PI * RandomFloat(state);
+        float r2 = RandomFloat(state);
+        float r = std::sqrt(r2);
+        glm::vec3 direction = tangent * (r * std::cos(phi)) + bitangent * (r * std::sin(phi)) + normal * std::sqrt(1.0f - r2);
+
+        TriangleHit hit;
+        if (!bvh.Intersect(origin, direction, MAX_BOUNCE_DISTANCE, hit)) {
+            continue;
+        }
+        const SurfaceTriangle& triangle = surfaceTriangles[bvh.GetOwner(hit.triangle)];
+        if (triangle.page < 0 || glm::dot(direction, triangle.normal) >= 0.0f) {
+            continue; // No lightmap to read, or the back of a surface
+        }
+        const BakeFace& bakeFace = bakeFaces[triangle.bakeFace];
+        glm::vec2 lightmap = triangle.lightmap[0] * (1.0f - hit.u - hit.v) + triangle.lightmap[1] * hit.u + triangle.lightmap[2] * hit.v;
+        int x = std::min(std::max(static_cast<int>(std::floor(lightmap.x)), bakeFace.x), bakeFace.x + bakeFace.width - 1);
+        int y = std::min(std::max(static_cast<int>(std::floor(lightmap.y)), bakeFace.y), bakeFace.y + bakeFace.height - 1);
+        // Surfaces reflect what ends up in their lightmap, so texels right next to a light don't turn into
+        // bright spots on everything that sees them
+        int source = sources[TexelIndex(bakeFace.page, x, y)];
+        if (source >= 0) {
+            gathered += ClampColor(previous[source]);
+        }
+    }
+    return gathered * (ALBEDO / samples);
+}
+
+void LightBaker::Bake(const BakeSettings& settings) {
+    int step = std::max(settings.texelStep, 1);
+    int bounces = std::max(settings.bounces, 0);
+    int samples = std::max(settings.samples, 1);
+
+    pool.ParallelFor(static_cast<int>(bakeFaces.size()), [this, step](int index, int) {
+        UpdateSources(index, step);
+    });
+
+    // Texels lit by an earlier pass are kept, only the new ones are traced
+    pool.ParallelFor(static_cast<int>(rows.size()), [this, step](int index, int) {
+        const BakeFace& bakeFace = bakeFaces[rows[index].first];
+        int y = bakeFace.y + rows[index].second;
+        for (int x = bakeFace.x; x < bakeFace.x + bakeFace.width; ++x) {
+            int texel = TexelIndex(bakeFace.page, x, y);
+            if (sources[texel] < 0 || texelLevels[texel] >= 0 || !IsKeyTexel(bakeFace, x, y, step)) {
+                continue;
+            }
+            direct[texel] = DirectLight(texels[texel].position, texels[texel].normal);
+            texelLevels[texel] = 0;
+        }
+    });
+
+    // Each bounce reads the one before it, so every texel finishes a bounce before the next one starts
+    while (static_cast<int>(bounceLight.size()) < bounces) {
+        bounceLight.push_back(std::vector<glm::vec3>(texels.size(), glm::vec3(0.0f)));
+    }
+    for (int level = 1; level <= bounces; ++level) {
+        pool.ParallelFor(static_cast<int>(rows.size()), [this, step, level, samples](int index, int) {
+            const BakeFace& bakeFace = bakeFaces[rows[index].first];
+            int y = bakeFace.y + rows[index].second;
+            for (int x = bakeFace.x; x < bakeFace.x + bakeFace.width; ++x) {
+                int texel = TexelIndex(bakeFace.page, x, y);
+                if (sources[texel] < 0 || texelLevels[texel] >= level || !IsKeyTexel(bakeFace, x, y, step)) {
+                    continue;
+                }
+                bounceLight[level - 1][texel] = GatherBounce(texel, level, samples);
+                texelLevels[texel] = static_cast<signed char>(level);
+            }
+        });
+    }
+
+    if (gridBytes.empty()) {
+        BakeGrid();
+    }
+
+    pool.ParallelFor(static_cast<int>(bakeFaces.size()), [this, bounces](int index, int) {
+        WriteLightmaps(index, bounces);
+    });
+}
+
+void LightBaker::WriteLightmaps(int bakeFaceIndex, int bounces) {
+    const BakeFace& bakeFace = bakeFaces[bakeFaceIndex];
+    for (int y = bakeFace.y; y < bakeFace.y + bakeFace.height; ++y) {
+        for (int x = bakeFace.x; x < bakeFace.x + bakeFace.width; ++x) {
+            int texel = TexelIndex(bakeFace.page, x, y);
+            int source = sources[texel];
+            if (source < 0) {
+                continue;
+            }
+            glm::vec3 light = direct[source];
+            for (int level = 0; level < bounces; ++level) {
+                light += bounceLight[level][source];
+            }
+            ColorToBytes(light, &lightmapBytes[texel * 3]);
+        }
+    }
+}
+
+void LightBaker::BakeGrid() {
+    glm::vec3 origin;
+    glm::vec3 size;
+    int bounds[3];
+    if (!LightGrid::GetLayout(map, origin, size, bounds) || bounds[0] * bounds[1] * bounds[2] <= 0) {
+        return;
+    }
+    gridBytes.assign(bounds[0] * bounds[1] * bounds[2] * 8, 0);
+
+    pool.ParallelFor(bounds[1] * bounds[2], [this, &origin, &size, &bounds](int row, int) {
+        for (int x = 0; x < bounds[0]; ++x) {
+            glm::vec3 position = origin + size * glm::vec3(x, row % bounds[1], row / bounds[1]);
+            unsigned char* cell = &gridBytes[(row * bounds[0] + x) * 8];
+            if (collision.PointContents(position) & CONTENTS_SOLID) {
+                continue; // Black cells are skipped when sampling
+            }
+
+            // The light seen from the cell is split into the part coming from the main direction and the rest
+            glm::vec3 colors(0.0f);
+            glm::vec3 weightedDirection(0.0f);
+            std::vector<std::pair<glm::vec3, glm::vec3>> contributions;
+            for (const Light& light : lights) {
+                glm::vec3 toLight = light.origin - position;
+                float distance = glm::length(toLight);
+                if (distance <= 0.0f) {
+                    continue;
+                }
+                glm::vec3 add = light.photons * Attenuation(light.origin, light.spot, light.spotNormal, light.radiusByDist, position);
+                if (std::max(std::fabs(add.r), std::max(std::fabs(add.g), std::fabs(add.b))) < MIN_CONTRIBUTION || bvh.Occluded(position, light.origin)) {
+                    continue;
+                }
+                glm::vec3 direction = toLight / distance;
+                contributions.push_back(std::make_pair(add, direction));
+                colors += add;
+                weightedDirection += direction * (add.r + add.g + add.b);
+            }
+
+            glm::vec3 direction(0.0f, 0.0f, 1.0f);
+            float length = glm::length(weightedDirection);
+            if (length > 0.0f) {
+                direction = weightedDirection / length;
+            }
+            glm::vec3 directed(0.0f);
+            for (const std::pair<glm::vec3, glm::vec3>& contribution : contributions) {
+                directed += contribution.first * std::max(glm::dot(contribution.second, direction), 0.0f);
+            }
+            ColorToBytes(ambient + colors - directed, cell);
+            ColorToBytes(directed, cell + 3);
+            // Open cells need some ambient, the renderer takes all black ones for cells inside walls
+            if (cell[0] + cell[1] + cell[2] == 0) {
+                cell[0] = cell[1] = cell[2] = 1;
+            }
+
+            // Byte angles the way LightGrid decodes them, straight up is 0 0
+            float longitude = std::acos(std::min(std::max(direction.z, -1.0f), 1.0f));
+            float latitude = std::atan2(direction.y, direction.x);
+            cell[6] = static_cast<unsigned char>(static_cast<int>(std::floor(longitude * (128.0f / PI) + 0.5f)) & 255);
+            cell[7] = static_cast<unsigned char>(static_cast<int>(std::floor(latitude * (128.0f / PI) + 0.5f)) & 255);
+        }
+    });
+}
+
+std::map<LumpType, std::vector<char>> LightBaker::BuildLumps() const {
+    std::map<LumpType, std::vector<char>> lumps;
+    lumps[LumpType::Lightmaps].assign(lightmapBytes.begin(), lightmapBytes.end());
+    if (!gridBytes.empty()) {
+        lumps[LumpType::LightVolumes].assign(gridBytes.begin(), gridBytes.end());
+    }
+
+    // The vertex lit renderer shows the vertex colors, every vertex of a baked face takes the texel under it
+    std::vector<Vertex> vertices(map.GetVertex());
+    for (const BakeFace& bakeFace : bakeFaces) {
+        const Face& face = map.GetFaces()[bakeFace.face];
+        for (int i = face.vertex; i < face.vertex + face.numVertices; ++i) {
+            int x = static_cast<int>(std::floor(vertices[i].lmCoord[0] * LIGHTMAP_SIZE));
+            int y = static_cast<int>(std::floor(vertices[i].lmCoord[1] * LIGHTMAP_SIZE));
+            x = std::min(std::max(x, bakeFace.x), bakeFace.x + bakeFace.width - 1);
+            y = std::min(std::max(y, bakeFace.y), bakeFace.y + bakeFace.height - 1);
+            std::copy_n(&lightmapBytes[TexelIndex(bakeFace.page, x, y) * 3], 3, vertices[i].color);
+        }
+    }
+    const char* vertexBytes = reinterpret_cast<const char*>(vertices.data());
+    lumps[LumpType::Vertices].assign(vertexBytes, vertexBytes + vertices.size() * sizeof(Vertex));
+    return lumps;
+}
@@ -0,0 +1,121 @@
+#ifndef LIGHTBAKER_H
+#define LIGHTBAKER_H
+
+#include <glm/glm.hpp>
+#include <map>
+#include <vector>
+#include "BSPMap.h"
+#include "CollisionModel.h"
+#include "ThreadPool.h"
+#include "TriangleBVH.h"
+
+/*
+Relights a compiled map without q3map. Point lights and spotlights come from the "light" entities, with the same
+falloff q3map uses, and shadows are traced against a BVH over the world's drawn triangles. Every lightmap texel
+gets a position and normal by rasterizing its face's triangles in lightmap space, so the map must already have
+lightmap coordinates from the compiler. Bounced light is gathered with cosine weighted rays that pick up what
+earlier passes left on the surfaces they hit. The light grid for moving objects is lit the same way, direct only.
+
+Texels are split into rows of faces and baked on the thread pool. Every random number comes from the texel and
+bounce, so the result doesn't depend on the number of threads. A bake with texelStep above 1 only lights every
+step-th texel and copies it to its neighbours, a later bake with a smaller step keeps what was already lit and
+fills in the rest, so quick previews can be refined without starting over. Vertex colors are taken from the
+lightmaps afterwards, so the vertex lit renderer shows the same light.
+*/
+
+struct BakeSettings {
+    int texelStep = 1;  // Lights one texel in step x step, 1 lights them all
+    int bounces = 1;    // Bounced light passes, 0 is direct light only
+    int samples = 32;   // Gather rays per texel for each bounce
+};
+
+class LightBaker {
+public:
+    LightBaker(const BSPMap& map, ThreadPool& pool);
+
+    // Reads the lights and maps every lightmap texel to the surface, false when there is nothing to bake
+    bool Prepare();
+    void Bake(const BakeSettings& settings);
+
+    // Lumps to pass to BSPMap::Save
+    std::map<LumpType, std::vector<char>> BuildLumps() const;
+
+    int GetLightCount() const { return static_cast<int>(lights.size()); }
+    int GetTexelCount() const;
+
+private:
+    struct Light {
+        glm::vec3 origin;
+        glm::vec3 photons;       // Color times intensity times the point scale
+        bool spot;
+        glm::vec3 spotNormal;    // Towards the target
+        float radiusByDist;      // Cone radius at one unit from the light
+    };
+
+    // A face's rectangle on a lightmap page
+    struct BakeFace {
+        int face;
+        int page;
+        int x;
+        int y;
+        int width;
+        int height;
+    };
+
+    // What a BVH triangle was made from, page -1 for faces without a lightmap
+    struct SurfaceTriangle {
+        int bakeFace;
+        int page;
+        glm::vec2 lightmap[3];   // In texels
+        glm::vec3 normal;
+    };
+
+    // Where a lightmap texel is on its surface
+    struct Texel {
+        glm::vec3 position;
+        glm::vec3 normal;
+    };
+
+    struct SurfaceVertex {
+        glm::vec3 position;
+        glm::vec2 lightmap;
+        glm::vec3 normal;
+    };
+
+    void ReadLights();
+    void BuildBVH();
+    void MapTexels(int bakeFace);
+    void FaceTriangles(const Face& face, std::vector<SurfaceVertex>& surfaceVertices, std::vector<int>& indices) const;
+
+    bool IsKeyTexel(const BakeFace& bakeFace, int x, int y, int step) const;
+    void UpdateSources(int bakeFace, int step);
+    glm::vec3 DirectLight(const glm::vec3& position, const glm::vec3& normal) const;
+    glm::vec3 GatherBounce(int texel, int level, int samples) const;
+    void BakeGrid();
+    void WriteLightmaps(int bakeFace, int bounces);
+
+    int TexelIndex(int page, int x, int y) const { return (page * LIGHTMAP_SIZE + y) * LIGHTMAP_SIZE + x; }
+
+    const BSPMap& map;
+    ThreadPool& pool;
+    CollisionModel collision;
+    TriangleBVH bvh;
+    std::vector<Light> lights;
+    glm::vec3 ambient = glm::vec3(0.0f);
+
+    std::vector<BakeFace> bakeFaces;
+    std::vector<SurfaceTriangle> surfaceTriangles;
+    std::vector<std::pair<int, int>> rows;   // Bake face and row, one task each
+
+    // Per texel of every page
+    std::vector<Texel> texels;
+    std::vector<int> sources;                        // Lit texel whose light this texel shows, -1 if unused
+    std::vector<signed char> texelLevels;            // -1 before direct light, then the number of bounces done
+    std::vector<glm::vec3> direct;
+    std::vector<std::vector<glm::vec3>> bounceLight; // Light added by each bounce
+
+    std::vector<unsigned char> lightmapBytes;
+    std::vector<unsigned char> gridBytes;
+};
+
+#endif // LIGHTBAKER_H
@@ -0,0 +1,214 @@
+#include "LightGrid.h"
+#include "ColorShift.h"
+#include <immintrin.h>
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <sstream>
+
+// Q3's r_ambientScale and r_directedScale
+static const float AMBIENT_SCALE = 0.6f;
+static const float DIRECTED_SCALE = 1.0f;
+static const float PI = 3.14159265f;
+
+bool LightGrid::GetLayout(const BSPMap& map, glm::vec3& origin, glm::vec3& size, int bounds[3]) {
+    const std::vector<Model>& models = map.GetModels();
+    if (models.empty()) {
+        return false;
+    }
+
+    size = glm::vec3(64.0f, 64.0f, 128.0f);
+    for (const Entity& entity : map.GetEntities()) {
+        if (entity.Get("classname") == "worldspawn" && !entity.Get("gridsize").empty()) {
+            std::istringstream(entity.Get("gridsize")) >> size.x >> size.y >> size.z;
+        }
+    }
+    if (size.x <= 0.0f || size.y <= 0.0f || size.z <= 0.0f) {
+        std::cerr << "LightGrid: bad gridsize" << std::endl;
+        return false;
+    }
+
+    // Cells start on the first grid point inside the world bounds, like the compiler lays them out
+    const Model& world = models[0];
+    for (int i = 0; i < 3; ++i) {
+        origin[i] = size[i] * std::ceil(world.mins[i] / size[i]);
+        float maxs = size[i] * std::floor(world.maxs[i] / size[i]);
+        bounds[i] = std::max(static_cast<int>((maxs - origin[i]) / size[i]) + 1, 0);
+    }
+    return true;
+}
+
+bool LightGrid::Load(const BSPMap& map) {
+    cells.clear();
+    const std::vector<unsigned char>& data = map.GetLightVolumes();
+    if (data.empty()) {
+        return false;
+    }
+
+    glm::vec3 size;
+    if (!GetLayout(map, origin, size, bounds)) {
+        return false;
+    }
+    int cellCount = bounds[0] * bounds[1] * bounds[2];
+    inverseSize = 1.0f / size;
+    if (cellCount <= 0 || static_cast<int>(data.size()) != cellCount * 8) {
+        std::cerr << "LightGrid: " << data.size() << " bytes of light grid don't match " << bounds[0] << "x" << bounds[1] << "x" << bounds[2] << " cells" << std::endl;
+        return false;
+    }
+
+    // Both colors of every cell go through the same color shift as the lightmaps
+    std::vector<unsigned char> colors(cellCount * 6);
+    for (int i = 0; i < cellCount; ++i) {
+        std::copy(data.begin() + i * 8, data.begin() + i * 8 + 6, colors.begin() + i * 6);
+    }
+    ColorShiftLighting(colors.data(), cellCount * 2, MAP_OVERBRIGHT_BITS, LIGHTING_GAMMA);
+
+    cells.resize(cellCount);
+    for (int i = 0; i < cellCount; ++i) {
+        const unsigned char* cell = &data[i * 8];
+        GridCell& gridCell = cells[i];
+        bool lit = cell[0] + cell[1] + cell[2] != 0;
+        for (int j = 0; j < 3; ++j) {
+            gridCell.ambient[j] = lit ? colors[i * 6 + j] : 0.0f;
+            gridCell.directed[j] = lit ? colors[i * 6 + 3 + j] : 0.0f;
+        }
+        gridCell.ambient[3] = lit ? 1.0f : 0.0f;
+        gridCell.directed[3] = 0.0f;
+
+        // Byte angles, 256 is a full turn. Byte 6 is the longitude from the up axis, byte 7 the latitude around it.
+        float lat = cell[7] * (2.0f * PI / 256.0f);
+        float lng = cell[6] * (2.0f * PI / 256.0f);
+        gridCell.direction[0] = lit ? std::cos(lat) * std::sin(lng) : 0.0f;
+        gridCell.direction[1] = lit ? std::sin(lat) * std::sin(lng) : 0.0f;
+        gridCell.direction[2] = lit ? std::cos(lng) : 0.0f;
+        gridCell.direction[3] = 0.0f;
+    }
+
+    std::cout << "LightGrid: " << bounds[0] << "x" << bounds[1] << "x" << bounds[2] << " cells" << std::endl;
+    return true;
+}
+
+LightSample LightGrid::Sample(const glm::vec3& position) const {
+    LightSample sample;
+    SampleBatch(&position, 1, &sample);
+    return sample;
+}
+
+void LightGrid::SampleBatch(const glm::vec3* positions, int count, LightSample* samples) const {
+    if (cells.empty()) {
+        for (int i = 0; i < count; ++i) {
+            samples[i] = LightSample();
+        }
+        return;
+    }
+
+    const int steps[3] = { 1, bounds[0], bounds[0] * bounds[1] };
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 one = _mm_set1_ps(1.0f);
+    alignas(16) int cellIndex[4];
+    alignas(16) float frac[3][4];
+    alignas(16) float out[9][4];
+    int canStep[3][4];
+
+    for (int first = 0; first < count; first += 4) {
+        // The last group repeats its last point to fill the lanes
+        int lanes = std::min(count - first, 4);
+        const glm::vec3* lane[4];
+        for (int i = 0; i < 4; ++i) {
+            lane[i] = &positions[first + std::min(i, lanes - 1)];
+        }
+
+        // Points outside the grid use its border cells, so the position is clamped before splitting it into a
+        // cell and a fraction. Clamped values are never negative, so truncating floors them.
+        for (int axis = 0; axis < 3; ++axis) {
+            __m128 v = _mm_mul_ps(_mm_sub_ps(_mm_setr_ps((*lane[0])[axis], (*lane[1])[axis], (*lane[2])[axis], (*lane[3])[axis]), _mm_set1_ps(origin[axis])),
+                _mm_set1_ps(inverseSize[axis]));
+            v = _mm_min_ps(_mm_max_ps(v, zero), _mm_set1_ps(static_cast<float>(bounds[axis] - 1)));
+            __m128i cell = _mm_cvttps_epi32(v);
+            _mm_store_ps(frac[axis], _mm_sub_ps(v, _mm_cvtepi32_ps(cell)));
+
+            alignas(16) int cells4[4];
+            _mm_store_si128(reinterpret_cast<__m128i*>(cells4), cell);
+            for (int i = 0; i < 4; ++i) {
+                cellIndex[i] = (axis == 0 ? 0 : cellIndex[i]) + cells4[i] * steps[axis];
+                canStep[axis][i] = cells4[i] + 1 < bounds[axis];
+            }
+        }
+        __m128 fracX = _mm_load_ps(frac[0]);
+        __m128 fracY = _mm_load_ps(frac[1]);
+        __m128 fracZ = _mm_load_ps(frac[2]);
+
+        __m128 ambientR = zero, ambientG = zero, ambientB = zero, totalFactor = zero;
+        __m128 directedR = zero, directedG = zero, directedB = zero;
+        __m128 directionX = zero, directionY = zero, directionZ = zero;
+        for (int corner = 0; corner < 8; ++corner) {
+            __m128 factor = _mm_mul_ps(_mm_mul_ps((corner & 1) ? fracX : _mm_sub_ps(one, fracX), (corner & 2) ? fracY : _mm_sub_ps(one, fracY)),
+                (corner & 4) ? fracZ : _mm_sub_ps(one, fracZ));
+
+            // Corners past the last cell add nothing, their lanes read the base cell with no weight
+            const GridCell* cornerCells[4];
+            alignas(16) float inside[4];
+            for (int i = 0; i < 4; ++i) {
+                int index = cellIndex[i];
+                bool valid = true;
+                for (int axis = 0; axis < 3; ++axis) {
+                    if (corner & (1 << axis)) {
+                        valid = valid && canStep[axis][i];
+                        index += steps[axis];
+                    }
+                }
+                cornerCells[i] = &cells[valid ? index : cellIndex[i]];
+                inside[i] = valid ? 1.0f : 0.0f;
+            }
+            factor = _mm_mul_ps(factor, _mm_load_ps(inside));
+
+            __m128 a0 = _mm_load_ps(cornerCells[0]->ambient), a1 = _mm_load_ps(cornerCells[1]->ambient);
+            __m128 a2 = _mm_load_ps(cornerCells[2]->ambient), a3 = _mm_load_ps(cornerCells[3]->ambient);
+            _MM_TRANSPOSE4_PS(a0, a1, a2, a3);
+            __m128 d0 = _mm_load_ps(cornerCells[0]->directed), d1 = _mm_load_ps(cornerCells[1]->directed);
+            __m128 d2 = _mm_load_ps(cornerCells[2]->directed), d3 = _mm_load_ps(cornerCells[3]->directed);
+            _MM_TRANSPOSE4_PS(d0, d1, d2, d3);
+            __m128 n0 = _mm_load_ps(cornerCells[0]->direction), n1 = _mm_load_ps(cornerCells[1]->direction);
+            __m128 n2 = _mm_load_ps(cornerCells[2]->direction), n3 = _mm_load_ps(cornerCells[3]->direction);
+            _MM_TRANSPOSE4_PS(n0, n1, n2, n3);
+
+            // a3 is 1 for lit cells and 0 inside walls, so solid cells drop out of the blend
+            __m128 weight = _mm_mul_ps(factor, a3);
+            totalFactor = _mm_add_ps(totalFactor, weight);
+            ambientR = _mm_add_ps(ambientR, _mm_mul_ps(weight, a0));
+            ambientG = _mm_add_ps(ambientG, _mm_mul_ps(weight, a1));
+            ambientB = _mm_add_ps(ambientB, _mm_mul_ps(weight, a2));
+            directedR = _mm_add_ps(directedR, _mm_mul_ps(weight, d0));
+            directedG = _mm_add_ps(directedG, _mm_mul_ps(weight, d1));
+            directedB = _mm_add_ps(directedB, _mm_mul_ps(weight, d2));
+            directionX = _mm_add_ps(directionX, _mm_mul_ps(weight, n0));
+            directionY = _mm_add_ps(directionY, _mm_mul_ps(weight, n1));
+            directionZ = _mm_add_ps(directionZ, _mm_mul_ps(weight, n2));
+        }
+
+        // Like Q3, light from fewer than all eight cells is scaled back up to full strength
+        __m128 partial = _mm_and_ps(_mm_cmpgt_ps(totalFactor, zero), _mm_cmplt_ps(totalFactor, _mm_set1_ps(0.99f)));
+        __m128 scale = _mm_or_ps(_mm_and_ps(partial, _mm_div_ps(one, _mm_max_ps(totalFactor, _mm_set1_ps(1e-6f)))), _mm_andnot_ps(partial, one));
+        __m128 ambientScale = _mm_mul_ps(scale, _mm_set1_ps(AMBIENT_SCALE));
+        __m128 directedScale = _mm_mul_ps(scale, _mm_set1_ps(DIRECTED_SCALE));
+        __m128 length = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(directionX, directionX), _mm_mul_ps(directionY, directionY)), _mm_mul_ps(directionZ, directionZ)));
+        __m128 hasDirection = _mm_cmpgt_ps(length, zero);
+        __m128 inverseLength = _mm_and_ps(hasDirection, _mm_div_ps(one, _mm_max_ps(length, _mm_set1_ps(1e-6f))));
+
+        _mm_store_ps(out[0], _mm_mul_ps(ambientR, ambientScale));
+        _mm_store_ps(out[1], _mm_mul_ps(ambientG, ambientScale));
+        _mm_store_ps(out[2], _mm_mul_ps(ambientB, ambientScale));
+        _mm_store_ps(out[3], _mm_mul_ps(directedR, directedScale));
+        _mm_store_ps(out[4], _mm_mul_ps(directedG, directedScale));
+        _mm_store_ps(out[5], _mm_mul_ps(directedB, directedScale));
+        _mm_store_ps(out[6], _mm_mul_ps(directionX, inverseLength));
+        _mm_store_ps(out[7], _mm_mul_ps(directionY, inverseLength));
+        _mm_store_ps(out[8], _mm_mul_ps(directionZ, inverseLength));
+        for (int i = 0; i < lanes; ++i) {
+            LightSample& sample = samples[first + i];
+            sample.ambient = glm::vec3(out[0][i], out[1][i], out[2][i]);
+            sample.directed = glm::vec3(out[3][i], out[4][i], out[5][i]);
+            sample.direction = glm::vec3(out[6][i], out[7][i], out[8][i]);
+        }
+    }
+}
@@ -0,0 +1,48 @@
+#ifndef LIGHTGRID_H
+#define LIGHTGRID_H
+
+#include <glm/glm.hpp>
+#include <vector>
+#include "BSPMap.h"
+
+/*
+Baked lighting for things that move, read from the map's light grid (the LightVolumes lump) the way Q3's
+R_SetupEntityLightingGrid does. The grid covers the world model with a cell every gridsize units (64 64 128 unless
+worldspawn sets "gridsize"). Each cell holds an ambient color, a directed color and the direction that light
+comes from. A sample blends the eight cells around a point, cells inside walls are stored black and skipped.
+
+Cells are decoded and color shifted at load, so SampleBatch blends four points at a time with SSE.
+*/
+
+struct LightSample {
+    glm::vec3 ambient = glm::vec3(0.0f);   // 0-255 like Q3, already scaled by the ambient scale
+    glm::vec3 directed = glm::vec3(0.0f);
+    glm::vec3 direction = glm::vec3(0.0f); // Unit vector pointing towards the light, zero when nothing was lit
+};
+
+class LightGrid {
+public:
+    bool Load(const BSPMap& map);
+    bool IsLoaded() const { return !cells.empty(); }
+
+    LightSample Sample(const glm::vec3& position) const;
+    void SampleBatch(const glm::vec3* positions, int count, LightSample* samples) const;
+
+    // Where the compiler puts the grid of map: the first cell at origin, then one every size units, bounds cells
+    // along each axis. Shared with the light baker so both agree on the lump layout.
+    static bool GetLayout(const BSPMap& map, glm::vec3& origin, glm::vec3& size, int bounds[3]);
+
+private:
+    struct alignas(16) GridCell {
+        float ambient[4];    // RGB and 1, or all 0 for cells inside walls so they add no weight
+        float directed[4];
+        float direction[4];
+    };
+
+    std::vector<GridCell> cells;
+    glm::vec3 origin;
+    glm::vec3 inverseSize;
+    int bounds[3] = { 0, 0, 0 };
+};
+
+#endif // LIGHTGRID_H
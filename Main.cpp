@@ -8,9 +8,184 @@
 #include "InputManager.h"
 #include "BSPMap.h"
 #include "NewRenderer.h"
+#include "BSPRenderer.h"
+#include "Movers.h"
+#include "Simulation.h"
+#include "Visibility.h"
+#include "ThreadPool.h"
+#include "OcclusionCuller.h"
+#include "AreaPortals.h"
+#include "BackfaceCuller.h"
+#include "ClusteredLights.h"
+#include "ShadowAtlas.h"
+#include "VisCompiler.h"
+#include "LightBaker.h"
+#include "CollisionModel.h"
+#include "PlayerMove.h"
+#include "InputRecording.h"
+#include "Benchmark.h"
+#include "SelfTest.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
 
+// Bots carry a dynamic light each, in one of these colors
+static const glm::vec3 BOT_LIGHT_COLORS[] = {
+    glm::vec3(1.0f, 0.5f, 0.2f), glm::vec3(0.3f, 0.6f, 1.0f), glm::vec3(0.4f, 1.0f, 0.4f), glm::vec3(1.0f, 0.3f, 0.8f)
+};
+static const float BOT_LIGHT_RADIUS = 192.0f;
+
+// Vis tool mode: Waves4 -vis [-fast] [-threads n] map.bsp [output.bsp]
+// Computes the PVS of a map built without one and writes it back, no window is opened
+static int RunVisTool(int argc, char** argv) {
+    bool fastOnly = false;
+    unsigned int threads = 0;
+    std::string input;
+    std::string output;
+    for (int i = 2; i < argc; ++i) {
+        if (std::strcmp(argv[i], "-fast") == 0) {
+            fastOnly = true;
+        }
+        else if (std::strcmp(argv[i], "-threads") == 0 && i + 1 < argc) {
+            threads = static_cast<unsigned int>(std::atoi(argv[++i]));
+        }
+        else if (input.empty()) {
+            input = argv[i];
+        }
+        else {
+            output = argv[i];
+        }
+    }
+    if (input.empty()) {
+        std::cerr << "Usage: -vis [-fast] [-threads n] map.bsp [output.bsp]" << std::endl;
+        return -1;
+    }
+    if (output.empty()) {
+        output = input;
+    }
+
+    BSPMap map;
+    if (!map.LoadAllLumps(input)) {
+        return -1;
+    }
+
+    ThreadPool pool(threads);
+    std::cout << "Vis: " << pool.GetThreadCount() << " threads, " << (fastOnly ? "fast" : "full") << " pass" << std::endl;
+    VisCompiler compiler(map, pool);
+    if (!compiler.Compile(fastOnly)) {
+        return -1;
+    }
+    if (!map.Save(output, compiler.BuildLumps())) {
+        return -1;
+    }
+    std::cout << "Vis: wrote " << output << std::endl;
+    return 0;
+}
+
+// Light tool mode: Waves4 -light [-preview] [-progressive] [-bounce n] [-samples n] [-threads n] map.bsp [output.bsp]
+// Relights the lightmaps and light grid from the map's light entities, no window is opened. -preview only lights
+// every fourth texel with direct light, -progressive saves a preview first and then refines it, saving every pass.
+static int RunLightTool(int argc, char** argv) {
+    bool preview = false;
+    bool progressive = false;
+    BakeSettings settings;
+    unsigned int threads = 0;
+    std::string input;
+    std::string output;
+    for (int i = 2; i < argc; ++i) {
+        if (std::strcmp(argv[i], "-preview") == 0) {
+            preview = true;
+        }
+        else if (std::strcmp(argv[i], "-progressive") == 0) {
+            progressive = true;
+        }
+        else if (std::strcmp(argv[i], "-bounce") == 0 && i + 1 < argc) {
+            settings.bounces = std::max(std::atoi(argv[++i]), 0);
+        }
+        else if (std::strcmp(argv[i], "-samples") == 0 && i + 1 < argc) {
+            settings.samples = std::max(std::atoi(argv[++i]), 1);
+        }
+        else if (std::strcmp(argv[i], "-threads") == 0 && i + 1 < argc) {
+            threads = static_cast<unsigned int>(std::atoi(argv[++i]));
+        }
+        else if (input.empty()) {
+            input = argv[i];
+        }
+        else {
+            output = argv[i];
+        }
+    }
+    if (input.empty()) {
+        std::cerr << "Usage: -light [-preview] [-progressive] [-bounce n] [-samples n] [-threads n] map.bsp [output.bsp]" << std::endl;
+        return -1;
+    }
+    if (output.empty()) {
+        output = input;
+    }
+
+    BSPMap map;
+    if (!map.LoadAllLumps(input)) {
+        return -1;
+    }
+
+    ThreadPool pool(threads);
+    std::cout << "Light: " << pool.GetThreadCount() << " threads" << std::endl;
+    LightBaker baker(map, pool);
+    if (!baker.Prepare()) {
+        return -1;
+    }
+
+    // Previews light every fourth texel without bounces, progressive bakes refine one down to every texel
+    std::vector<BakeSettings> passes;
+    BakeSettings quick = settings;
+    quick.texelStep = 4;
+    quick.bounces = 0;
+    if (preview) {
+        passes.push_back(quick);
+    }
+    else if (progressive) {
+        passes.push_back(quick);
+        BakeSettings half = settings;
+        half.texelStep = 2;
+        passes.push_back(half);
+        passes.push_back(settings);
+    }
+    else {
+        passes.push_back(settings);
+    }
+
+    for (const BakeSettings& pass : passes) {
+        auto start = std::chrono::steady_clock::now();
+        baker.Bake(pass);
+        auto end = std::chrono::steady_clock::now();
+        if (!map.Save(output, baker.BuildLumps())) {
+            return -1;
+        }
+        std::cout << "Light: texel step " << pass.texelStep << ", " << pass.bounces << " bounces in "
+            << std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count() << " ms, wrote " << output << std::endl;
+    }
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    if (argc > 1 && std::strcmp(argv[1], "-vis") == 0) {
+        return RunVisTool(argc, argv);
+    }
+    if (argc > 1 && std::strcmp(argv[1], "-light") == 0) {
+        return RunLightTool(argc, argv);
+    }
+    if (argc > 1 && std::strcmp(argv[1], "-cullbench") == 0) {
+        return RunCullBenchmark(argc, argv);
+    }
+    if (argc > 1 && std::strcmp(argv[1], "-tracebench") == 0) {
+        return RunTraceBenchmark(argc, argv);
+    }
+    if (argc > 1 && std::strcmp(argv[1], "-selftest") == 0) {
+        return RunSelfTest(argc, argv);
+    }
 
-int main(void) {
     GLFWwindow* window;
 
     // Initialize GLFW
@@ -53,6 +228,121 @@ int main(void) {
 
     BSPMap myMap;
     myMap.LoadAllLumps("MYFIRSTMAP.bsp");
+    CollisionModel collisionModel(myMap);
+
+    // Start at the first spawn point if the map has one
+    PlayerState player;
+    player.origin = myCamera.GetMapPosition() - glm::vec3(0.0f, 0.0f, PlayerMove::VIEW_HEIGHT);
+    for (const Entity& entity : myMap.GetEntities()) {
+        std::string classname = entity.Get("classname");
+        if (classname == "info_player_deathmatch" || classname == "info_player_start") {
+            glm::vec3 origin;
+            std::istringstream(entity.Get("origin", "0 0 0")) >> origin.x >> origin.y >> origin.z;
+            origin.z += 9.0f; // Q3 spawns the player a little above the spot so it drops onto the floor
+            player.origin = origin;
+            myCamera.Position = Camera::FromMapSpace(origin + glm::vec3(0.0f, 0.0f, PlayerMove::VIEW_HEIGHT));
+            myCamera.MovementSpeed = 320.0f;
+            break;
+        }
+    }
+
+    // The player walks the map at a fixed tick unless -noclip asks for the free flying camera.
+    // -record file saves every tick's input, -replay file plays one back instead of reading the keyboard.
+    // -bots N adds wandering entities around the spawn point, replays need the same count.
+    bool noclip = myMap.GetNodes().empty();
+    InputRecording inputRecording;
+    int botCount = 0;
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "-noclip") == 0) {
+            noclip = true;
+        }
+        else if (std::strcmp(argv[i], "-bots") == 0 && i + 1 < argc) {
+            botCount = std::max(std::atoi(argv[++i]), 0);
+        }
+        else if (std::strcmp(argv[i], "-record") == 0 && i + 1 < argc) {
+            inputRecording.StartRecording(argv[++i], player);
+        }
+        else if (std::strcmp(argv[i], "-replay") == 0 && i + 1 < argc) {
+            inputRecording.StartReplay(argv[++i], player);
+        }
+    }
+    if (noclip) {
+        inputRecording.Stop(); // The keyboard camera gets no collision model, so it flies through walls
+    }
+    glm::vec3 previousOrigin = player.origin;
+    double tickAccumulator = 0.0;
+
+    // -vertexlight lights the map with vertex colors only and never loads the lightmaps, for weak machines and
+    // software GL benchmark runs. Maps with more lightmaps than the driver's array texture layers fall back to it too.
+    bool vertexLight = false;
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "-vertexlight") == 0) {
+            vertexLight = true;
+        }
+    }
+    if (!vertexLight && !BSPRenderer::LightmapsFit(myMap)) {
+        vertexLight = true;
+    }
+    const char* lightingDefines = vertexLight ? "#define VERTEX_LIT\n" : nullptr;
+    Shader worldShader("bsp.vert", "bsp.frag", lightingDefines);
+    Shader modelShader("bspmodel.vert", "bsp.frag", lightingDefines);
+    BSPRenderer mapRenderer(myMap, worldShader, modelShader, &myCamera, vertexLight);
+
+    // -gpucull moves world culling to a compute shader when the driver has GL 4.3
+    bool gpuCulling = false;
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "-gpucull") == 0) {
+            gpuCulling = mapRenderer.EnableGPUCulling("cull.comp");
+        }
+    }
+
+    ThreadPool threadPool;
+    OcclusionCuller occlusionCuller(threadPool);
+    occlusionCuller.SetOccluders(myMap);
+
+    Visibility visibility(myMap);
+    BackfaceCuller backfaceCuller(myMap);
+    std::vector<int> frontFaces;
+    visibility.SetOcclusionCuller(&occlusionCuller);
+    mapRenderer.SetOcclusionCuller(&occlusionCuller);
+    HiZCuller hiZCuller;
+    mapRenderer.SetHiZCuller(&hiZCuller);
+    ClusteredLights clusteredLights(threadPool);
+    mapRenderer.SetClusteredLights(&clusteredLights);
+    ShadowAtlas shadowAtlas(myMap);
+    mapRenderer.EnableShadows(&shadowAtlas, "bsp.vert", "shadow.frag");
+    std::vector<DynamicLight> dynamicLights;
+
+    // Dynamic entities are linked into a grid over the world model's bounds
+    glm::vec3 worldMins(-4096.0f);
+    glm::vec3 worldMaxs(4096.0f);
+    if (!myMap.GetModels().empty()) {
+        const Model& world = myMap.GetModels()[0];
+        worldMins = glm::vec3(world.mins[0], world.mins[1], world.mins[2]);
+        worldMaxs = glm::vec3(world.maxs[0], world.maxs[1], world.maxs[2]);
+    }
+    Broadphase broadphase(worldMins, worldMaxs);
+
+    MoverSystem movers;
+    movers.Spawn(myMap);
+    movers.SetBroadphase(&broadphase);
+
+    // The player is entity 0, bots go on a grid around it wherever they fit
+    Simulation simulation(collisionModel, threadPool, worldMins, worldMaxs);
+    simulation.AddEntity(player);
+    for (int i = 0; i < botCount * 4 && simulation.GetEntityCount() <= botCount; ++i) {
+        PlayerState bot = player;
+        bot.origin += glm::vec3(static_cast<float>((i % 16) - 8), static_cast<float>((i / 16) % 16 - 8), static_cast<float>(i / 256)) * 40.0f;
+        if (!collisionModel.TraceBox(bot.origin, bot.origin, PlayerMove::MINS, PlayerMove::MAXS, MASK_PLAYERSOLID).startSolid) {
+            simulation.AddEntity(bot);
+        }
+    }
+    const PlayerState& playerState = simulation.GetState(0);
+
+    AreaPortals areaPortals;
+    areaPortals.Build(myMap, movers);
+    visibility.SetAreaPortals(&areaPortals);
+    std::vector<ModelInstance> modelInstances;
 
     float lastFrame = 0.0f; // Time of last frame
     float deltaTime = 0.0f; // Time between current frame and last frame
@@ -65,10 +355,90 @@ int main(void) {
         deltaTime = currentFrame - lastFrame; // Calculate deltaTime
         lastFrame = currentFrame; // Update lastFrame with the current time for the next iteration
 
-        inputManager.ProcessKeyboard(window, deltaTime);
+        if (noclip) {
+            inputManager.ProcessKeyboard(window, deltaTime);
+            movers.ActivateTouched(myCamera.GetMapPosition());
+            movers.Update(deltaTime);
+        }
+        else {
+            // Run as many whole ticks as the time since the last frame covers, a long stall doesn't pile up ticks
+            tickAccumulator += std::min(deltaTime, 0.25f);
+            while (tickAccumulator >= PlayerMove::TICK_SECONDS) {
+                PlayerInput input;
+                if (inputRecording.IsReplaying()) {
+                    if (!inputRecording.Read(input)) {
+                        glfwSetWindowShouldClose(window, GLFW_TRUE);
+                        break;
+                    }
+                    myCamera.Yaw = PlayerInput::ShortToAngle(input.yaw);
+                    myCamera.Pitch = PlayerInput::ShortToAngle(input.pitch);
+                    myCamera.updateCameraVectors();
+                }
+                else {
+                    input = inputManager.SampleInput(window);
+                }
+
+                previousOrigin = playerState.origin;
+                simulation.SetInput(0, input);
+                for (int bot = 1; bot < simulation.GetEntityCount(); ++bot) {
+                    simulation.SetInput(bot, simulation.WanderInput(bot));
+                }
+                simulation.Tick(&movers);
+                if (inputRecording.IsReplaying()) {
+                    inputRecording.Verify(playerState);
+                }
+                inputRecording.Write(input, playerState);
+
+                movers.Update(PlayerMove::TICK_SECONDS);
+                tickAccumulator -= PlayerMove::TICK_SECONDS;
+            }
+
+            // Draw between the last two ticks so the view moves smoothly at any frame rate
+            float alpha = static_cast<float>(tickAccumulator / PlayerMove::TICK_SECONDS);
+            glm::vec3 eye = previousOrigin + (playerState.origin - previousOrigin) * alpha;
+            myCamera.Position = Camera::FromMapSpace(eye + glm::vec3(0.0f, 0.0f, PlayerMove::VIEW_HEIGHT));
+        }
+        movers.GetInstances(modelInstances);
+
+        // The window can be resized, the viewport and projection follow the framebuffer
+        int framebufferWidth, framebufferHeight;
+        glfwGetFramebufferSize(window, &framebufferWidth, &framebufferHeight);
+        glViewport(0, 0, framebufferWidth, framebufferHeight);
+        mapRenderer.SetViewportSize(framebufferWidth, framebufferHeight);
+
+        // -bots N gives the clustered lighting N lights to cull every frame
+        dynamicLights.clear();
+        for (int bot = 1; bot < simulation.GetEntityCount(); ++bot) {
+            const glm::vec3& color = BOT_LIGHT_COLORS[bot % (sizeof(BOT_LIGHT_COLORS) / sizeof(BOT_LIGHT_COLORS[0]))];
+            dynamicLights.push_back(DynamicLight{ simulation.GetState(bot).origin + glm::vec3(0.0f, 0.0f, PlayerMove::VIEW_HEIGHT), BOT_LIGHT_RADIUS, color });
+            dynamicLights.back().id = bot;
+        }
+        shadowAtlas.Update(dynamicLights, modelInstances, mapRenderer.GetViewMatrix(), mapRenderer.GetProjectionMatrix(), static_cast<float>(framebufferHeight));
+        clusteredLights.Build(dynamicLights, mapRenderer.GetViewMatrix(), mapRenderer.GetProjectionMatrix());
+        clusteredLights.Upload();
+        int cameraLeaf = visibility.FindLeaf(myCamera.GetMapPosition());
+        areaPortals.Update(movers, myMap.GetLeafs().empty() ? -1 : myMap.GetLeafs()[cameraLeaf].area);
+        glm::mat4 viewProjection = mapRenderer.GetProjectionMatrix() * mapRenderer.GetViewMatrix();
+        Frustum viewFrustum;
+        viewFrustum.Extract(viewProjection);
+        occlusionCuller.Render(viewProjection);
+        if (gpuCulling) {
+            visibility.UpdatePVS(myCamera.GetMapPosition());
+        }
+        else {
+            visibility.Update(myCamera.GetMapPosition(), viewFrustum);
+            backfaceCuller.Update(myCamera.GetMapPosition());
+            backfaceCuller.Filter(visibility.GetVisibleFaces(), frontFaces);
+        }
         // Clear the color buffer
         glClearColor(0.2f, 0.5f, 0.7f, 1.0f);
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        if (gpuCulling) {
+            mapRenderer.RenderGPUCulled(visibility.GetClusterMask(), modelInstances);
+        }
+        else {
+            mapRenderer.Render(frontFaces, modelInstances);
+        }
         myRenderer.Render();
 
         glfwSwapBuffers(window);
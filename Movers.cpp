@@ -0,0 +1,276 @@
+#include "Movers.h"
+#include <glm/gtc/matrix_transform.hpp>
+#include <cmath>
+#include <cstdlib>
+#include <sstream>
+#include <iostream>
+
+static glm::vec3 ParseVector(const std::string& value) {
+    glm::vec3 v(0.0f);
+    std::istringstream stream(value);
+    stream >> v.x >> v.y >> v.z;
+    return v;
+}
+
+static float ParseFloat(const Entity& entity, const std::string& key, float defaultValue) {
+    std::string value = entity.Get(key);
+    return value.empty() ? defaultValue : static_cast<float>(std::atof(value.c_str()));
+}
+
+// Same convention as Q3's G_SetMovedir: -1 is up, -2 is down, anything else is a yaw angle
+static glm::vec3 MoveDirFromAngle(float angle) {
+    if (angle == -1.0f) {
+        return glm::vec3(0.0f, 0.0f, 1.0f);
+    }
+    if (angle == -2.0f) {
+        return glm::vec3(0.0f, 0.0f, -1.0f);
+    }
+    float radians = glm::radians(angle);
+    return glm::vec3(std::cos(radians), std::sin(radians), 0.0f);
+}
+
+void MoverSystem::Spawn(const BSPMap& map) {
+    for (const Mover& mover : movers) {
+        if (broadphase && mover.broadphaseEntity >= 0) {
+            broadphase->Remove(mover.broadphaseEntity);
+        }
+    }
+    movers.clear();
+    const std::vector<Model>& models = map.GetModels();
+
+    for (const Entity& entity : map.GetEntities()) {
+        std::string modelName = entity.Get("model");
+        if (modelName.size() < 2 || modelName[0] != '*') {
+            continue; // Not a brush entity
+        }
+
+        int modelIndex = std::atoi(modelName.c_str() + 1);
+        if (modelIndex <= 0 || modelIndex >= static_cast<int>(models.size())) {
+            std::cerr << "Entity references invalid model " << modelName << std::endl;
+            continue;
+        }
+
+        const Model& model = models[modelIndex];
+        std::string classname = entity.Get("classname");
+
+        Mover mover = {};
+        mover.type = MoverType::Static;
+        mover.classname = classname;
+        mover.target = entity.Get("target");
+        mover.targetname = entity.Get("targetname");
+        mover.model = modelIndex;
+        mover.origin = ParseVector(entity.Get("origin", "0 0 0"));
+        mover.mins = glm::vec3(model.mins[0], model.mins[1], model.mins[2]);
+        mover.maxs = glm::vec3(model.maxs[0], model.maxs[1], model.maxs[2]);
+        mover.state = MoverState::Closed;
+        mover.closedOffset = glm::vec3(0.0f);
+        mover.openOffset = glm::vec3(0.0f);
+        mover.axis = glm::vec3(0.0f, 0.0f, 1.0f);
+        mover.broadphaseEntity = -1;
+        glm::vec3 size = mover.maxs - mover.mins;
+        int spawnflags = std::atoi(entity.Get("spawnflags", "0").c_str());
+
+        if (classname == "func_door") {
+            mover.type = MoverType::Door;
+            float lip = ParseFloat(entity, "lip", 8.0f);
+            glm::vec3 moveDir = MoveDirFromAngle(ParseFloat(entity, "angle", 0.0f));
+            glm::vec3 absDir = glm::abs(moveDir);
+            mover.distance = absDir.x * size.x + absDir.y * size.y + absDir.z * size.z - lip;
+            mover.openOffset = moveDir * mover.distance;
+            mover.speed = ParseFloat(entity, "speed", 400.0f);
+            mover.wait = ParseFloat(entity, "wait", 2.0f);
+
+            // Like Q3's spawned door trigger, expand the thinnest axis by 120 units. Hatches that slide
+            // sideways are thinnest along z and get their trigger above and below.
+            mover.triggerMins = mover.mins;
+            mover.triggerMaxs = mover.maxs;
+            int best = 0;
+            for (int i = 1; i < 3; ++i) {
+                if (size[i] < size[best]) {
+                    best = i;
+                }
+            }
+            mover.triggerMins[best] -= 120.0f;
+            mover.triggerMaxs[best] += 120.0f;
+        }
+        else if (classname == "func_plat") {
+            // Plats rest at the bottom, "open" is the raised position
+            mover.type = MoverType::Plat;
+            float lip = ParseFloat(entity, "lip", 8.0f);
+            mover.distance = ParseFloat(entity, "height", size.z - lip);
+            mover.closedOffset = glm::vec3(0.0f, 0.0f, -mover.distance);
+            mover.speed = ParseFloat(entity, "speed", 200.0f);
+            mover.wait = ParseFloat(entity, "wait", 1.0f);
+
+            mover.triggerMins = mover.mins + mover.closedOffset;
+            mover.triggerMaxs = mover.maxs + mover.closedOffset;
+            mover.triggerMaxs.z += 64.0f;
+        }
+        else if (classname == "func_rotating") {
+            mover.type = MoverType::Rotating;
+            mover.speed = ParseFloat(entity, "speed", 100.0f);
+            if (spawnflags & 4) {
+                mover.axis = glm::vec3(1.0f, 0.0f, 0.0f);
+            }
+            else if (spawnflags & 8) {
+                mover.axis = glm::vec3(0.0f, 1.0f, 0.0f);
+            }
+        }
+        else if (classname == "func_bobbing") {
+            mover.type = MoverType::Bobbing;
+            mover.speed = ParseFloat(entity, "speed", 4.0f);
+            mover.height = ParseFloat(entity, "height", 32.0f);
+            mover.phase = ParseFloat(entity, "phase", 0.0f);
+            if (spawnflags & 1) {
+                mover.axis = glm::vec3(1.0f, 0.0f, 0.0f);
+            }
+            else if (spawnflags & 2) {
+                mover.axis = glm::vec3(0.0f, 1.0f, 0.0f);
+            }
+        }
+
+        UpdateTransform(mover);
+        movers.push_back(mover);
+    }
+    SetBroadphase(broadphase);
+}
+
+void MoverSystem::SetBroadphase(Broadphase* newBroadphase) {
+    broadphase = newBroadphase;
+    if (!broadphase) {
+        return;
+    }
+    for (Mover& mover : movers) {
+        if (mover.broadphaseEntity < 0) {
+            mover.broadphaseEntity = broadphase->Add(mover.absMins, mover.absMaxs, CONTENTS_SOLID);
+        }
+    }
+}
+
+void MoverSystem::Activate(int index) {
+    Mover& mover = movers[index];
+    if (mover.state == MoverState::Closed || mover.state == MoverState::Closing) {
+        mover.state = MoverState::Opening;
+    }
+    else if (mover.state == MoverState::Open) {
+        mover.timer = mover.wait; // Keep it open while it is being used
+    }
+}
+
+bool MoverSystem::Touches(const Mover& mover, const glm::vec3& point) {
+    if (mover.type != MoverType::Door && mover.type != MoverType::Plat) {
+        return false;
+    }
+    return point.x >= mover.triggerMins.x && point.x <= mover.triggerMaxs.x &&
+        point.y >= mover.triggerMins.y && point.y <= mover.triggerMaxs.y &&
+        point.z >= mover.triggerMins.z && point.z <= mover.triggerMaxs.z;
+}
+
+void MoverSystem::FindTouched(const glm::vec3& point, std::vector<int>& touched) const {
+    for (size_t i = 0; i < movers.size(); ++i) {
+        if (Touches(movers[i], point)) {
+            touched.push_back(static_cast<int>(i));
+        }
+    }
+}
+
+void MoverSystem::ActivateTouched(const glm::vec3& point) {
+    for (size_t i = 0; i < movers.size(); ++i) {
+        if (Touches(movers[i], point)) {
+            Activate(static_cast<int>(i));
+        }
+    }
+}
+
+void MoverSystem::Update(float deltaTime) {
+    time += deltaTime;
+
+    for (size_t i = 0; i < movers.size(); ++i) {
+        Mover& mover = movers[i];
+
+        if (mover.type == MoverType::Door || mover.type == MoverType::Plat) {
+            float step = mover.distance > 0.0f ? mover.speed * deltaTime / mover.distance : 1.0f;
+            switch (mover.state) {
+            case MoverState::Opening:
+                mover.fraction += step;
+                if (mover.fraction >= 1.0f) {
+                    mover.fraction = 1.0f;
+                    mover.state = MoverState::Open;
+                    mover.timer = mover.wait;
+                }
+                break;
+            case MoverState::Open:
+                if (mover.wait >= 0.0f) {
+                    mover.timer -= deltaTime;
+                    if (mover.timer <= 0.0f) {
+                        mover.state = MoverState::Closing;
+                    }
+                }
+                break;
+            case MoverState::Closing:
+                mover.fraction -= step;
+                if (mover.fraction <= 0.0f) {
+                    mover.fraction = 0.0f;
+                    mover.state = MoverState::Closed;
+                }
+                break;
+            default:
+                break;
+            }
+        }
+        else if (mover.type == MoverType::Rotating) {
+            mover.angle = std::fmod(mover.angle + mover.speed * deltaTime, 360.0f);
+        }
+
+        UpdateTransform(mover);
+    }
+}
+
+void MoverSystem::UpdateTransform(Mover& mover) {
+    glm::vec3 offset(0.0f);
+    glm::mat4 rotation(1.0f);
+
+    switch (mover.type) {
+    case MoverType::Door:
+    case MoverType::Plat:
+        offset = glm::mix(mover.closedOffset, mover.openOffset, mover.fraction);
+        break;
+    case MoverType::Rotating:
+        rotation = glm::rotate(glm::mat4(1.0f), glm::radians(mover.angle), mover.axis);
+        break;
+    case MoverType::Bobbing:
+        if (mover.speed > 0.0f) {
+            float cycle = time / mover.speed + mover.phase;
+            offset = mover.axis * (std::sin(cycle * 2.0f * 3.14159265f) * mover.height);
+        }
+        break;
+    default:
+        break;
+    }
+
+    mover.transform = glm::translate(glm::mat4(1.0f), mover.origin + offset) * rotation;
+
+    // Bounds of the transformed corners, rotating movers grow and shrink as they turn
+    mover.absMins = glm::vec3(1e30f);
+    mover.absMaxs = glm::vec3(-1e30f);
+    for (int i = 0; i < 8; ++i) {
+        glm::vec3 corner((i & 1) ? mover.maxs.x : mover.mins.x, (i & 2) ? mover.maxs.y : mover.mins.y, (i & 4) ? mover.maxs.z : mover.mins.z);
+        glm::vec3 point = glm::vec3(mover.transform * glm::vec4(corner, 1.0f));
+        mover.absMins = glm::min(mover.absMins, point);
+        mover.absMaxs = glm::max(mover.absMaxs, point);
+    }
+    if (broadphase && mover.broadphaseEntity >= 0) {
+        broadphase->Move(mover.broadphaseEntity, mover.absMins, mover.absMaxs);
+    }
+}
+
+void MoverSystem::GetInstances(std::vector<ModelInstance>& instances) const {
+    instances.clear();
+    for (const Mover& mover : movers) {
+        instances.push_back(ModelInstance{ mover.model, mover.transform });
+    }
+}
+
+const std::vector<Mover>& MoverSystem::GetMovers() const {
+    return movers;
+}
@@ -0,0 +1,91 @@
+#ifndef MOVERS_H
+#define MOVERS_H
+
+#include <glm/glm.hpp>
+#include <vector>
+#include <string>
+#include "BSPMap.h"
+#include "Broadphase.h"
+
+/*
+Brush entities that move (doors, platforms, rotating and bobbing models). Each mover owns one submodel
+of the BSP and produces a transform every frame, the geometry itself is never touched.
+*/
+
+enum class MoverType {
+    Static,   // func_static and anything we don't animate yet
+    Door,     // func_door
+    Plat,     // func_plat
+    Rotating, // func_rotating
+    Bobbing   // func_bobbing
+};
+
+enum class MoverState {
+    Closed,
+    Opening,
+    Open,
+    Closing
+};
+
+struct Mover {
+    MoverType type;
+    std::string classname;
+    std::string target;     // Entity this one triggers, e.g. a door targeting its func_areaportal
+    std::string targetname;
+    int model;            // Submodel index ("*N" in the entity)
+    glm::vec3 origin;     // Entity origin, submodels with an origin brush are stored relative to it
+    glm::vec3 mins;       // Submodel bounds at spawn
+    glm::vec3 maxs;
+
+    // Door and plat movement
+    glm::vec3 closedOffset;
+    glm::vec3 openOffset;
+    float distance;       // Distance between the closed and open positions
+    float speed;          // Units per second (degrees for rotating, seconds per cycle for bobbing)
+    float wait;           // Seconds to stay open, -1 stays open forever
+    float fraction;       // 0 closed, 1 open
+    float timer;          // Time left in the open state
+    MoverState state;
+    glm::vec3 triggerMins; // Box that opens the mover when the viewer is inside it
+    glm::vec3 triggerMaxs;
+
+    // Rotating and bobbing movement
+    glm::vec3 axis;
+    float height;
+    float phase;
+    float angle;
+
+    glm::mat4 transform;  // Current model to map space transform
+    glm::vec3 absMins;    // Current bounds in map space
+    glm::vec3 absMaxs;
+    int broadphaseEntity; // Handle in the broadphase, -1 when not linked
+};
+
+class MoverSystem {
+public:
+    void Spawn(const BSPMap& map);
+    // Moves every mover by deltaTime, doors and plats only start moving through Activate
+    void Update(float deltaTime);
+    void Activate(int mover);
+    // Activates the doors and plats whose triggers contain point
+    void ActivateTouched(const glm::vec3& point);
+
+    // Appends the doors and plats whose triggers contain point, safe to call from several threads
+    void FindTouched(const glm::vec3& point, std::vector<int>& touched) const;
+
+    // Links every mover's current bounds into broadphase and keeps them updated as they move
+    void SetBroadphase(Broadphase* broadphase);
+
+    void GetInstances(std::vector<ModelInstance>& instances) const;
+    const std::vector<Mover>& GetMovers() const;
+
+private:
+    void UpdateTransform(Mover& mover);
+    static bool Touches(const Mover& mover, const glm::vec3& point);
+
+    std::vector<Mover> movers;
+    float time = 0.0f;
+    Broadphase* broadphase = nullptr;
+};
+
+#endif // MOVERS_H
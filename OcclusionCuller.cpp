@@ -0,0 +1,342 @@
+#include "OcclusionCuller.h"
+#include <emmintrin.h>
+#include <algorithm>
+#include <cmath>
+
+OcclusionCuller::OcclusionCuller(ThreadPool& pool, int width, int height) : pool(pool), viewProjection(1.0f) {
+    // Rows are processed 4 pixels at a time, keep the width a multiple of 4
+    this->width = (std::max(width, 4) + 3) & ~3;
+    this->height = std::max(height, 1);
+    tilesX = (this->width + TILE_WIDTH - 1) / TILE_WIDTH;
+    tilesY = (this->height + TILE_HEIGHT - 1) / TILE_HEIGHT;
+    depth.assign(this->width * this->height, 1.0f);
+    tileMaxDepth.assign(tilesX * tilesY, 1.0f);
+}
+
+void OcclusionCuller::SetOccluders(const BSPMap& map, float minArea) {
+    const std::vector<Face>& faces = map.GetFaces();
+    const std::vector<Vertex>& vertices = map.GetVertex();
+    const std::vector<int>& meshVerts = map.GetMeshVerts();
+    const std::vector<Model>& models = map.GetModels();
+    const std::vector<TextureInfo>& textures = map.GetTextures();
+
+    std::vector<glm::vec3> triangles;
+    int worldFaces = models.empty() ? static_cast<int>(faces.size()) : models[0].firstFace + models[0].numFaces;
+    for (int f = models.empty() ? 0 : models[0].firstFace; f < worldFaces; ++f) {
+        const Face& face = faces[f];
+        if (face.type != 1) {
+            continue; // Only planar polygons make reliable occluders
+        }
+        if (face.texture >= 0 && face.texture < static_cast<int>(textures.size())) {
+            // Glass, liquids and fog can be seen through, sky and nodraw faces are never drawn
+            const TextureInfo& texture = textures[face.texture];
+            if ((texture.contents & (CONTENTS_TRANSLUCENT | CONTENTS_WATER | CONTENTS_SLIME | CONTENTS_LAVA | CONTENTS_FOG)) != 0 ||
+                (texture.flags & (SURF_SKY | SURF_NODRAW)) != 0) {
+                continue;
+            }
+        }
+
+        size_t start = triangles.size();
+        float area = 0.0f;
+        for (int i = 0; i + 2 < face.numMeshVertices; i += 3) {
+            glm::vec3 v[3];
+            for (int j = 0; j < 3; ++j) {
+                const float* p = vertices[face.vertex + meshVerts[face.meshVertex + i + j]].position;
+                v[j] = glm::vec3(p[0], p[1], p[2]);
+                triangles.push_back(v[j]);
+            }
+            area += 0.5f * glm::length(glm::cross(v[1] - v[0], v[2] - v[0]));
+        }
+        if (area < minArea) {
+            triangles.resize(start);
+        }
+    }
+
+    SetOccluders(triangles);
+}
+
+void OcclusionCuller::SetOccluders(const std::vector<glm::vec3>& triangleVertices) {
+    occluders = triangleVertices;
+    depthValid = false;
+}
+
+void OcclusionCuller::ClipAndSetup(const glm::vec4 clip[3], std::vector<ScreenTriangle>& out) const {
+    // Trivially reject triangles entirely outside one of the side planes
+    for (int axis = 0; axis < 2; ++axis) {
+        if (clip[0][axis] > clip[0].w && clip[1][axis] > clip[1].w && clip[2][axis] > clip[2].w) {
+            return;
+        }
+        if (clip[0][axis] < -clip[0].w && clip[1][axis] < -clip[1].w && clip[2][axis] < -clip[2].w) {
+            return;
+        }
+    }
+
+    // Clip against the near plane (z >= -w), a triangle becomes at most a quad
+    glm::vec4 polygon[4];
+    int count = 0;
+    for (int i = 0; i < 3; ++i) {
+        const glm::vec4& a = clip[i];
+        const glm::vec4& b = clip[(i + 1) % 3];
+        float da = a.z + a.w;
+        float db = b.z + b.w;
+        if (da >= 0.0f) {
+            polygon[count++] = a;
+        }
+        if ((da >= 0.0f) != (db >= 0.0f)) {
+            float t = da / (da - db);
+            polygon[count++] = a + (b - a) * t;
+        }
+    }
+    if (count < 3) {
+        return;
+    }
+
+    float sx[4], sy[4], sz[4];
+    for (int i = 0; i < count; ++i) {
+        float w = std::max(polygon[i].w, 1e-6f);
+        sx[i] = (polygon[i].x / w * 0.5f + 0.5f) * width;
+        sy[i] = (polygon[i].y / w * 0.5f + 0.5f) * height;
+        sz[i] = std::min(std::max(polygon[i].z / w * 0.5f + 0.5f, 0.0f), 1.0f);
+    }
+
+    for (int i = 1; i + 1 < count; ++i) {
+        int index[3] = { 0, i, i + 1 };
+        ScreenTriangle triangle;
+        for (int j = 0; j < 3; ++j) {
+            triangle.x[j] = sx[index[j]];
+            triangle.y[j] = sy[index[j]];
+            triangle.z[j] = sz[index[j]];
+        }
+        out.push_back(triangle);
+    }
+}
+
+void OcclusionCuller::Render(const glm::mat4& matrix) {
+    if (depthValid && matrix == viewProjection) {
+        return;
+    }
+    viewProjection = matrix;
+    depthValid = true;
+    std::fill(depth.begin(), depth.end(), 1.0f);
+    std::fill(tileMaxDepth.begin(), tileMaxDepth.end(), 1.0f);
+
+    int numTriangles = static_cast<int>(occluders.size() / 3);
+    int numTiles = tilesX * tilesY;
+    int numChunks = std::max(1, std::min(pool.GetThreadCount() * 2, (numTriangles + 63) / 64));
+    chunkTriangles.resize(numChunks);
+    chunkBins.resize(numChunks);
+
+    // Transform, clip and bin. Every chunk writes only its own lists, so no locking is needed
+    pool.ParallelFor(numChunks, [&](int chunk, int) {
+        std::vector<ScreenTriangle>& triangles = chunkTriangles[chunk];
+        std::vector<std::vector<int>>& bins = chunkBins[chunk];
+        triangles.clear();
+        bins.resize(numTiles);
+        for (std::vector<int>& bin : bins) {
+            bin.clear();
+        }
+
+        int first = static_cast<int>(static_cast<long long>(numTriangles) * chunk / numChunks);
+        int last = static_cast<int>(static_cast<long long>(numTriangles) * (chunk + 1) / numChunks);
+        for (int t = first; t < last; ++t) {
+            glm::vec4 clip[3];
+            for (int j = 0; j < 3; ++j) {
+                clip[j] = viewProjection * glm::vec4(occluders[t * 3 + j], 1.0f);
+            }
+
+            size_t before = triangles.size();
+            ClipAndSetup(clip, triangles);
+            for (size_t i = before; i < triangles.size(); ++i) {
+                const ScreenTriangle& tri = triangles[i];
+                int minX = static_cast<int>(std::floor(std::min(tri.x[0], std::min(tri.x[1], tri.x[2]))));
+                int maxX = static_cast<int>(std::ceil(std::max(tri.x[0], std::max(tri.x[1], tri.x[2])))) - 1;
+                int minY = static_cast<int>(std::floor(std::min(tri.y[0], std::min(tri.y[1], tri.y[2]))));
+                int maxY = static_cast<int>(std::ceil(std::max(tri.y[0], std::max(tri.y[1], tri.y[2])))) - 1;
+                minX = std::max(minX, 0);
+                minY = std::max(minY, 0);
+                maxX = std::min(maxX, width - 1);
+                maxY = std::min(maxY, height - 1);
+                if (minX > maxX || minY > maxY) {
+                    continue;
+                }
+                for (int ty = minY / TILE_HEIGHT; ty <= maxY / TILE_HEIGHT; ++ty) {
+                    for (int tx = minX / TILE_WIDTH; tx <= maxX / TILE_WIDTH; ++tx) {
+                        bins[ty * tilesX + tx].push_back(static_cast<int>(i));
+                    }
+                }
+            }
+        }
+    });
+
+    rasterizedTriangles = 0;
+    for (const std::vector<ScreenTriangle>& triangles : chunkTriangles) {
+        rasterizedTriangles += static_cast<int>(triangles.size());
+    }
+
+    // Each tile is owned by one thread
+    pool.ParallelFor(numTiles, [&](int tile, int) {
+        RasterizeTile(tile);
+    });
+}
+
+void OcclusionCuller::RasterizeTile(int tile) {
+    int tileX0 = (tile % tilesX) * TILE_WIDTH;
+    int tileY0 = (tile / tilesX) * TILE_HEIGHT;
+    int tileX1 = std::min(tileX0 + TILE_WIDTH, width);
+    int tileY1 = std::min(tileY0 + TILE_HEIGHT, height);
+
+    const __m128 laneOffsets = _mm_set_ps(3.5f, 2.5f, 1.5f, 0.5f);
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 one = _mm_set1_ps(1.0f);
+
+    for (size_t chunk = 0; chunk < chunkBins.size(); ++chunk) {
+        const std::vector<ScreenTriangle>& triangles = chunkTriangles[chunk];
+        for (int index : chunkBins[chunk][tile]) {
+            ScreenTriangle tri = triangles[index];
+
+            float area = (tri.x[1] - tri.x[0]) * (tri.y[2] - tri.y[0]) - (tri.x[2] - tri.x[0]) * (tri.y[1] - tri.y[0]);
+            if (std::fabs(area) < 1e-6f) {
+                continue;
+            }
+            // Occluders are treated as two sided, flip clockwise triangles
+            if (area < 0.0f) {
+                std::swap(tri.x[1], tri.x[2]);
+                std::swap(tri.y[1], tri.y[2]);
+                std::swap(tri.z[1], tri.z[2]);
+                area = -area;
+            }
+
+            // Edge functions E(p) = A * x + B * y + C, inside when all three are >= 0
+            float edgeA[3], edgeB[3], edgeC[3];
+            for (int e = 0; e < 3; ++e) {
+                int a = e;
+                int b = (e + 1) % 3;
+                edgeA[e] = -(tri.y[b] - tri.y[a]);
+                edgeB[e] = tri.x[b] - tri.x[a];
+                edgeC[e] = -(edgeA[e] * tri.x[a] + edgeB[e] * tri.y[a]);
+            }
+
+            // Depth is linear in screen space after the perspective divide
+            float dzdx = ((tri.z[1] - tri.z[0]) * (tri.y[2] - tri.y[0]) - (tri.z[2] - tri.z[0]) * (tri.y[1] - tri.y[0])) / area;
+            float dzdy = ((tri.z[2] - tri.z[0]) * (tri.x[1] - tri.x[0]) - (tri.z[1] - tri.z[0]) * (tri.x[2] - tri.x[0])) / area;
+
+            int minX = std::max(tileX0, static_cast<int>(std::floor(std::min(tri.x[0], std::min(tri.x[1], tri.x[2])))));
+            int maxX = std::min(tileX1, static_cast<int>(std::ceil(std::max(tri.x[0], std::max(tri.x[1], tri.x[2])))));
+            int minY = std::max(tileY0, static_cast<int>(std::floor(std::min(tri.y[0], std::min(tri.y[1], tri.y[2])))));
+            int maxY = std::min(tileY1, static_cast<int>(std::ceil(std::max(tri.y[0], std::max(tri.y[1], tri.y[2])))));
+            minX &= ~3;
+            maxX = std::min((maxX + 3) & ~3, tileX1);
+
+            __m128 a0 = _mm_set1_ps(edgeA[0]), a1 = _mm_set1_ps(edgeA[1]), a2 = _mm_set1_ps(edgeA[2]);
+            __m128 zdx = _mm_set1_ps(dzdx);
+
+            for (int y = minY; y < maxY; ++y) {
+                float py = y + 0.5f;
+                __m128 b0 = _mm_set1_ps(edgeB[0] * py + edgeC[0]);
+                __m128 b1 = _mm_set1_ps(edgeB[1] * py + edgeC[1]);
+                __m128 b2 = _mm_set1_ps(edgeB[2] * py + edgeC[2]);
+                __m128 zRow = _mm_set1_ps(tri.z[0] + dzdy * (py - tri.y[0]) - dzdx * tri.x[0]);
+                float* row = &depth[y * width];
+
+                for (int x = minX; x < maxX; x += 4) {
+                    __m128 px = _mm_add_ps(_mm_set1_ps(static_cast<float>(x)), laneOffsets);
+                    __m128 e0 = _mm_add_ps(_mm_mul_ps(a0, px), b0);
+                    __m128 e1 = _mm_add_ps(_mm_mul_ps(a1, px), b1);
+                    __m128 e2 = _mm_add_ps(_mm_mul_ps(a2, px), b2);
+                    __m128 inside = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(e0, zero), _mm_cmpge_ps(e1, zero)), _mm_cmpge_ps(e2, zero));
+                    if (_mm_movemask_ps(inside) == 0) {
+                        continue;
+                    }
+                    __m128 z = _mm_min_ps(_mm_max_ps(_mm_add_ps(zRow, _mm_mul_ps(zdx, px)), zero), one);
+                    __m128 current = _mm_loadu_ps(row + x);
+                    __m128 nearest = _mm_min_ps(current, z);
+                    _mm_storeu_ps(row + x, _mm_or_ps(_mm_and_ps(inside, nearest), _mm_andnot_ps(inside, current)));
+                }
+            }
+        }
+    }
+
+    // The farthest depth in the tile lets box tests skip the pixels entirely
+    __m128 farthest = zero;
+    for (int y = tileY0; y < tileY1; ++y) {
+        const float* row = &depth[y * width];
+        for (int x = tileX0; x < tileX1; x += 4) {
+            farthest = _mm_max_ps(farthest, _mm_loadu_ps(row + x));
+        }
+    }
+    alignas(16) float lanes[4];
+    _mm_store_ps(lanes, farthest);
+    tileMaxDepth[tile] = std::max(std::max(lanes[0], lanes[1]), std::max(lanes[2], lanes[3]));
+}
+
+bool OcclusionCuller::IsBoxVisible(const glm::vec3& mins, const glm::vec3& maxs) const {
+    float minX = 1e30f, minY = 1e30f, maxX = -1e30f, maxY = -1e30f, minZ = 1e30f;
+    for (int i = 0; i < 8; ++i) {
+        glm::vec4 corner((i & 1) ? maxs.x : mins.x, (i & 2) ? maxs.y : mins.y, (i & 4) ? maxs.z : mins.z, 1.0f);
+        glm::vec4 clip = viewProjection * corner;
+        if (clip.z + clip.w < 0.0f || clip.w <= 1e-6f) {
+            return true; // Crosses the near plane, can't be projected conservatively
+        }
+        float x = (clip.x / clip.w * 0.5f + 0.5f) * width;
+        float y = (clip.y / clip.w * 0.5f + 0.5f) * height;
+        float z = clip.z / clip.w * 0.5f + 0.5f;
+        minX = std::min(minX, x);
+        maxX = std::max(maxX, x);
+        minY = std::min(minY, y);
+        maxY = std::max(maxY, y);
+        minZ = std::min(minZ, z);
+    }
+
+    int x0 = std::max(static_cast<int>(std::floor(minX)), 0);
+    int x1 = std::min(static_cast<int>(std::ceil(maxX)), width) - 1;
+    int y0 = std::max(static_cast<int>(std::floor(minY)), 0);
+    int y1 = std::min(static_cast<int>(std::ceil(maxY)), height) - 1;
+    if (x0 > x1 || y0 > y1) {
+        return false; // Entirely off screen
+    }
+
+    __m128 boxDepth = _mm_set1_ps(std::max(minZ, 0.0f));
+    const __m128i laneIndex = _mm_set_epi32(3, 2, 1, 0);
+
+    for (int ty = y0 / TILE_HEIGHT; ty <= y1 / TILE_HEIGHT; ++ty) {
+        for (int tx = x0 / TILE_WIDTH; tx <= x1 / TILE_WIDTH; ++tx) {
+            // Every occluder pixel in the tile is nearer than the box
+            if (minZ > tileMaxDepth[ty * tilesX + tx]) {
+                continue;
+            }
+
+            int rx0 = std::max(x0, tx * TILE_WIDTH);
+            int rx1 = std::min(x1, tx * TILE_WIDTH + TILE_WIDTH - 1);
+            int ry0 = std::max(y0, ty * TILE_HEIGHT);
+            int ry1 = std::min(y1, ty * TILE_HEIGHT + TILE_HEIGHT - 1);
+            __m128i first = _mm_set1_epi32(rx0);
+            __m128i last = _mm_set1_epi32(rx1);
+
+            for (int y = ry0; y <= ry1; ++y) {
+                const float* row = &depth[y * width];
+                for (int x = rx0 & ~3; x <= rx1; x += 4) {
+                    // Mask off lanes left of rx0 or right of rx1
+                    __m128i pixel = _mm_add_epi32(_mm_set1_epi32(x), laneIndex);
+                    __m128i outsideRect = _mm_or_si128(_mm_cmplt_epi32(pixel, first), _mm_cmpgt_epi32(pixel, last));
+                    __m128 inFront = _mm_cmple_ps(boxDepth, _mm_loadu_ps(row + x));
+                    if (_mm_movemask_ps(_mm_andnot_ps(_mm_castsi128_ps(outsideRect), inFront)) != 0) {
+                        return true;
+                    }
+                }
+            }
+        }
+    }
+    return false;
+}
+
+void OcclusionCuller::TestBoxes(const std::vector<glm::vec3>& mins, const std::vector<glm::vec3>& maxs, std::vector<unsigned char>& visible) {
+    int count = static_cast<int>(mins.size());
+    visible.resize(count);
+    const int batch = 64;
+    pool.ParallelFor((count + batch - 1) / batch, [&](int b, int) {
+        int end = std::min(count, (b + 1) * batch);
+        for (int i = b * batch; i < end; ++i) {
+            visible[i] = IsBoxVisible(mins[i], maxs[i]) ? 1 : 0;
+        }
+    });
+}
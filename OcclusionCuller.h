@@ -0,0 +1,70 @@
+#ifndef OCCLUSIONCULLER_H
+#define OCCLUSIONCULLER_H
+
+#include <glm/glm.hpp>
+#include <vector>
+#include "BSPMap.h"
+#include "ThreadPool.h"
+
+/*
+Software occlusion culling. A small set of large world faces is rasterized on the CPU into a low resolution
+depth buffer, then bounding boxes are tested against it before anything is sent to OpenGL.
+The screen is split into tiles: triangles are binned per tile in parallel, each tile is rasterized by one
+thread with SSE (4 pixels at a time), and every tile keeps its farthest depth so most boxes are rejected
+or accepted without touching pixels. Nothing here uses OpenGL, so it runs headless.
+*/
+
+class OcclusionCuller {
+public:
+    OcclusionCuller(ThreadPool& pool, int width = 256, int height = 192);
+
+    // Picks opaque world faces (model 0, planar, not sky or nodraw) with at least minArea square units as occluders
+    void SetOccluders(const BSPMap& map, float minArea = 128.0f * 128.0f);
+    // Occluder triangles in map space, three vertices per triangle
+    void SetOccluders(const std::vector<glm::vec3>& triangleVertices);
+
+    // Rasterizes the occluders with the given map space to clip space matrix. Nothing is done
+    // when the matrix and occluders are the same as the last call, the depth buffer is still valid.
+    void Render(const glm::mat4& viewProjection);
+
+    // True if any part of the box could be visible. Boxes crossing the near plane are always visible.
+    bool IsBoxVisible(const glm::vec3& mins, const glm::vec3& maxs) const;
+    // Tests many boxes at once across the pool, writes 1 (visible) or 0 per box
+    void TestBoxes(const std::vector<glm::vec3>& mins, const std::vector<glm::vec3>& maxs, std::vector<unsigned char>& visible);
+
+    int GetWidth() const { return width; }
+    int GetHeight() const { return height; }
+    const std::vector<float>& GetDepthBuffer() const { return depth; } // 0 near, 1 far, row major
+    int GetOccluderTriangleCount() const { return static_cast<int>(occluders.size() / 3); }
+    int GetRasterizedTriangleCount() const { return rasterizedTriangles; }
+
+private:
+    struct ScreenTriangle {
+        float x[3], y[3];   // Pixel coordinates
+        float z[3];         // Depth in [0, 1]
+    };
+
+    void RasterizeTile(int tile);
+    void ClipAndSetup(const glm::vec4 clip[3], std::vector<ScreenTriangle>& out) const;
+
+    static const int TILE_WIDTH = 64;
+    static const int TILE_HEIGHT = 32;
+
+    ThreadPool& pool;
+    int width, height;
+    int tilesX, tilesY;
+
+    std::vector<glm::vec3> occluders;
+    std::vector<float> depth;
+    std::vector<float> tileMaxDepth; // Farthest depth written in each tile
+
+    // Per chunk of input triangles: screen triangles and the tile bins that reference them
+    std::vector<std::vector<ScreenTriangle>> chunkTriangles;
+    std::vector<std::vector<std::vector<int>>> chunkBins;
+
+    glm::mat4 viewProjection;
+    bool depthValid = false;
+    int rasterizedTriangles = 0;
+};
+
+#endif // OCCLUSIONCULLER_H
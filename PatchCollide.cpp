@@ -0,0 +1,616 @@
+#include "PatchCollide.h"
+#include "Winding.h"
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+static const float SUBDIVIDE_DISTANCE = 16.0f; // Curves bending further than this from straight get subdivided
+static const float PLANE_TRI_EPSILON = 0.1f;
+static const float WRAP_POINT_EPSILON = 0.1f;
+static const float POINT_EPSILON = 0.1f;
+static const float NORMAL_EPSILON = 0.0001f;
+static const float DIST_EPSILON = 0.02f;
+static const float CHOP_EPSILON = 0.1f;
+
+enum EdgeName {
+    EN_TOP,
+    EN_RIGHT,
+    EN_BOTTOM,
+    EN_LEFT
+};
+
+enum PlaneSide {
+    SIDE_FRONT,
+    SIDE_BACK,
+    SIDE_ON
+};
+
+static bool NeedsSubdivision(const glm::vec3& a, const glm::vec3& b, const glm::vec3& c) {
+    // Distance between the linear midpoint and the curve's midpoint
+    glm::vec3 linearMid = (a + c) * 0.5f;
+    glm::vec3 curveMid = ((a + b) * 0.5f + (b + c) * 0.5f) * 0.5f;
+    return glm::length(curveMid - linearMid) >= SUBDIVIDE_DISTANCE;
+}
+
+static bool ComparePoints(const glm::vec3& a, const glm::vec3& b) {
+    for (int i = 0; i < 3; ++i) {
+        if (std::fabs(a[i] - b[i]) > POINT_EPSILON) {
+            return false;
+        }
+    }
+    return true;
+}
+
+PatchCollide::PatchCollide(int width, int height, const glm::vec3* points) {
+    if (width <= 2 || height <= 2 || width > MAX_GRID_SIZE || height > MAX_GRID_SIZE) {
+        std::cerr << "PatchCollide: bad patch size " << width << "x" << height << std::endl;
+        mins = maxs = glm::vec3(0.0f);
+        return;
+    }
+
+    Grid grid;
+    grid.width = width;
+    grid.height = height;
+    grid.points.resize(MAX_GRID_SIZE * MAX_GRID_SIZE);
+    for (int i = 0; i < width; ++i) {
+        for (int j = 0; j < height; ++j) {
+            grid.At(i, j) = points[j * width + i];
+        }
+    }
+
+    // Subdivide the columns, then the rows by doing the same on the transposed grid
+    SetGridWrapWidth(grid);
+    SubdivideGridColumns(grid);
+    RemoveDegenerateColumns(grid);
+    TransposeGrid(grid);
+    SetGridWrapWidth(grid);
+    SubdivideGridColumns(grid);
+    RemoveDegenerateColumns(grid);
+
+    mins = glm::vec3(1e30f);
+    maxs = glm::vec3(-1e30f);
+    for (int i = 0; i < grid.width; ++i) {
+        for (int j = 0; j < grid.height; ++j) {
+            mins = glm::min(mins, grid.At(i, j));
+            maxs = glm::max(maxs, grid.At(i, j));
+        }
+    }
+    // Room for the surface clip epsilon
+    mins -= glm::vec3(1.0f);
+    maxs += glm::vec3(1.0f);
+
+    FromGrid(grid);
+}
+
+void PatchCollide::SetGridWrapWidth(Grid& grid) {
+    int j = 0;
+    for (; j < grid.height; ++j) {
+        glm::vec3 delta = grid.At(0, j) - grid.At(grid.width - 1, j);
+        if (std::fabs(delta.x) > WRAP_POINT_EPSILON || std::fabs(delta.y) > WRAP_POINT_EPSILON || std::fabs(delta.z) > WRAP_POINT_EPSILON) {
+            break;
+        }
+    }
+    grid.wrapWidth = j == grid.height;
+}
+
+void PatchCollide::SubdivideGridColumns(Grid& grid) {
+    // Column i and i + 2 are on the curve, column i + 1 is the control point between them
+    for (int i = 0; i < grid.width - 2;) {
+        int j = 0;
+        for (; j < grid.height; ++j) {
+            if (NeedsSubdivision(grid.At(i, j), grid.At(i + 1, j), grid.At(i + 2, j))) {
+                break;
+            }
+        }
+
+        if (j == grid.height || grid.width + 2 > MAX_GRID_SIZE) {
+            // Close enough to straight everywhere, the control column can go
+            for (j = 0; j < grid.height; ++j) {
+                for (int k = i + 2; k < grid.width; ++k) {
+                    grid.At(k - 1, j) = grid.At(k, j);
+                }
+            }
+            --grid.width;
+            ++i;
+            continue;
+        }
+
+        // Split the curve in two, columns i + 1 to i + 3 are the new points and i + 2 moves to i + 4
+        for (j = 0; j < grid.height; ++j) {
+            glm::vec3 prev = grid.At(i, j);
+            glm::vec3 mid = grid.At(i + 1, j);
+            glm::vec3 next = grid.At(i + 2, j);
+            for (int k = grid.width - 1; k > i + 1; --k) {
+                grid.At(k + 2, j) = grid.At(k, j);
+            }
+            grid.At(i + 1, j) = (prev + mid) * 0.5f;
+            grid.At(i + 3, j) = (mid + next) * 0.5f;
+            grid.At(i + 2, j) = (grid.At(i + 1, j) + grid.At(i + 3, j)) * 0.5f;
+        }
+        grid.width += 2;
+        // The new control column may need subdividing again, so i stays
+    }
+}
+
+void PatchCollide::RemoveDegenerateColumns(Grid& grid) {
+    for (int i = 0; i < grid.width - 1; ++i) {
+        int j = 0;
+        for (; j < grid.height; ++j) {
+            if (!ComparePoints(grid.At(i, j), grid.At(i + 1, j))) {
+                break;
+            }
+        }
+        if (j != grid.height) {
+            continue;
+        }
+
+        for (j = 0; j < grid.height; ++j) {
+            for (int k = i + 2; k < grid.width; ++k) {
+                grid.At(k - 1, j) = grid.At(k, j);
+            }
+        }
+        --grid.width;
+        --i; // Check against the next column
+    }
+}
+
+void PatchCollide::TransposeGrid(Grid& grid) {
+    int size = std::max(grid.width, grid.height);
+    for (int i = 0; i < size; ++i) {
+        for (int j = i + 1; j < size; ++j) {
+            std::swap(grid.At(i, j), grid.At(j, i));
+        }
+    }
+    std::swap(grid.width, grid.height);
+    std::swap(grid.wrapWidth, grid.wrapHeight);
+}
+
+int PatchCollide::FindPlane(const glm::vec3& p1, const glm::vec3& p2, const glm::vec3& p3) {
+    glm::vec3 normal = glm::cross(p3 - p1, p2 - p1);
+    float length = glm::length(normal);
+    if (length == 0.0f) {
+        return -1;
+    }
+    normal /= length;
+    glm::vec4 plane(normal, glm::dot(p1, normal));
+
+    // Reuse a plane facing the same way that all three points are close to
+    for (size_t i = 0; i < planes.size(); ++i) {
+        const glm::vec4& other = planes[i];
+        glm::vec3 otherNormal(other);
+        if (glm::dot(normal, otherNormal) < 0.0f) {
+            continue;
+        }
+        if (std::fabs(glm::dot(p1, otherNormal) - other.w) > PLANE_TRI_EPSILON ||
+            std::fabs(glm::dot(p2, otherNormal) - other.w) > PLANE_TRI_EPSILON ||
+            std::fabs(glm::dot(p3, otherNormal) - other.w) > PLANE_TRI_EPSILON) {
+            continue;
+        }
+        return static_cast<int>(i);
+    }
+
+    planes.push_back(plane);
+    return static_cast<int>(planes.size()) - 1;
+}
+
+int PatchCollide::FindPlane(const glm::vec4& plane, bool& flipped) {
+    for (size_t i = 0; i < planes.size(); ++i) {
+        if (PlaneEqual(static_cast<int>(i), plane, flipped)) {
+            return static_cast<int>(i);
+        }
+    }
+    planes.push_back(plane);
+    flipped = false;
+    return static_cast<int>(planes.size()) - 1;
+}
+
+bool PatchCollide::PlaneEqual(int index, const glm::vec4& plane, bool& flipped) const {
+    const glm::vec4& other = planes[index];
+    for (int sign = 1; sign >= -1; sign -= 2) {
+        glm::vec4 test = plane * static_cast<float>(sign);
+        if (std::fabs(other.x - test.x) < NORMAL_EPSILON && std::fabs(other.y - test.y) < NORMAL_EPSILON &&
+            std::fabs(other.z - test.z) < NORMAL_EPSILON && std::fabs(other.w - test.w) < DIST_EPSILON) {
+            flipped = sign < 0;
+            return true;
+        }
+    }
+    return false;
+}
+
+int PatchCollide::GridPlane(const std::vector<int>& gridPlanes, int i, int j, int tri) const {
+    int plane = gridPlanes[(i * MAX_GRID_SIZE + j) * 2 + tri];
+    if (plane != -1) {
+        return plane;
+    }
+    return gridPlanes[(i * MAX_GRID_SIZE + j) * 2 + (tri ^ 1)];
+}
+
+int PatchCollide::EdgePlaneNum(Grid& grid, const std::vector<int>& gridPlanes, int i, int j, int k) {
+    // A plane through the edge standing up from the facet
+    glm::vec3 p1, p2;
+    int tri = 0;
+    bool reversed = false;
+    switch (k) {
+    case 0: // Top
+        p1 = grid.At(i, j);
+        p2 = grid.At(i + 1, j);
+        break;
+    case 2: // Bottom
+        p1 = grid.At(i, j + 1);
+        p2 = grid.At(i + 1, j + 1);
+        tri = 1;
+        reversed = true;
+        break;
+    case 3: // Left
+        p1 = grid.At(i, j);
+        p2 = grid.At(i, j + 1);
+        tri = 1;
+        reversed = true;
+        break;
+    case 1: // Right
+        p1 = grid.At(i + 1, j);
+        p2 = grid.At(i + 1, j + 1);
+        break;
+    case 4: // Diagonal out of triangle 0
+        p1 = grid.At(i + 1, j + 1);
+        p2 = grid.At(i, j);
+        break;
+    default: // Diagonal out of triangle 1
+        p1 = grid.At(i, j);
+        p2 = grid.At(i + 1, j + 1);
+        tri = 1;
+        break;
+    }
+
+    int plane = GridPlane(gridPlanes, i, j, tri);
+    if (plane == -1) {
+        return -1;
+    }
+    glm::vec3 up = p1 + 4.0f * glm::vec3(planes[plane]);
+    return reversed ? FindPlane(p2, p1, up) : FindPlane(p1, p2, up);
+}
+
+int PatchCollide::PointOnPlaneSide(const glm::vec3& point, int plane) const {
+    if (plane == -1) {
+        return SIDE_ON;
+    }
+    float d = glm::dot(point, glm::vec3(planes[plane])) - planes[plane].w;
+    if (d > PLANE_TRI_EPSILON) {
+        return SIDE_FRONT;
+    }
+    if (d < -PLANE_TRI_EPSILON) {
+        return SIDE_BACK;
+    }
+    return SIDE_ON;
+}
+
+void PatchCollide::SetBorderInward(Facet& facet, Grid& grid, int i, int j, int which) const {
+    glm::vec3 points[4];
+    int numPoints;
+    if (which == -1) {
+        points[0] = grid.At(i, j);
+        points[1] = grid.At(i + 1, j);
+        points[2] = grid.At(i + 1, j + 1);
+        points[3] = grid.At(i, j + 1);
+        numPoints = 4;
+    }
+    else if (which == 0) {
+        points[0] = grid.At(i, j);
+        points[1] = grid.At(i + 1, j);
+        points[2] = grid.At(i + 1, j + 1);
+        numPoints = 3;
+    }
+    else {
+        points[0] = grid.At(i + 1, j + 1);
+        points[1] = grid.At(i, j + 1);
+        points[2] = grid.At(i, j);
+        numPoints = 3;
+    }
+
+    // The facet's own corners tell which side of each border is inside
+    for (int k = 0; k < facet.numBorders; ++k) {
+        int front = 0, back = 0;
+        for (int l = 0; l < numPoints; ++l) {
+            int side = PointOnPlaneSide(points[l], facet.borderPlanes[k]);
+            if (side == SIDE_FRONT) {
+                ++front;
+            }
+            else if (side == SIDE_BACK) {
+                ++back;
+            }
+        }
+        if (front && !back) {
+            facet.borderInward[k] = true;
+        }
+        else if (back && !front) {
+            facet.borderInward[k] = false;
+        }
+        else if (!front && !back) {
+            facet.borderPlanes[k] = -1; // Flat against the facet
+        }
+        else {
+            facet.borderInward[k] = false; // Cuts through the facet
+        }
+    }
+}
+
+bool PatchCollide::ValidateFacet(const Facet& facet) const {
+    if (facet.surfacePlane == -1) {
+        return false;
+    }
+
+    const glm::vec4& surface = planes[facet.surfacePlane];
+    Winding winding = BaseWindingForPlane(glm::vec3(surface), surface.w);
+    for (int j = 0; j < facet.numBorders && !winding.empty(); ++j) {
+        if (facet.borderPlanes[j] == -1) {
+            return false;
+        }
+        glm::vec4 plane = planes[facet.borderPlanes[j]];
+        if (!facet.borderInward[j]) {
+            plane = -plane;
+        }
+        ChopWinding(winding, glm::vec3(plane), plane.w, CHOP_EPSILON);
+    }
+    if (winding.empty()) {
+        return false; // Chopped away completely
+    }
+
+    // A facet this large must be missing a border
+    glm::vec3 windingMins(1e30f), windingMaxs(-1e30f);
+    for (const glm::vec3& point : winding) {
+        windingMins = glm::min(windingMins, point);
+        windingMaxs = glm::max(windingMaxs, point);
+    }
+    for (int j = 0; j < 3; ++j) {
+        if (windingMaxs[j] - windingMins[j] > MAX_WORLD_COORD || windingMins[j] >= MAX_WORLD_COORD || windingMaxs[j] <= -MAX_WORLD_COORD) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void PatchCollide::AddFacetBevels(Facet& facet) {
+    const int maxBorders = static_cast<int>(sizeof(facet.borderPlanes) / sizeof(facet.borderPlanes[0]));
+
+    const glm::vec4& surface = planes[facet.surfacePlane];
+    Winding winding = BaseWindingForPlane(glm::vec3(surface), surface.w);
+    for (int j = 0; j < facet.numBorders && !winding.empty(); ++j) {
+        if (facet.borderPlanes[j] == facet.surfacePlane) {
+            continue;
+        }
+        glm::vec4 plane = planes[facet.borderPlanes[j]];
+        if (!facet.borderInward[j]) {
+            plane = -plane;
+        }
+        ChopWinding(winding, glm::vec3(plane), plane.w, CHOP_EPSILON);
+    }
+    if (winding.empty()) {
+        return;
+    }
+
+    glm::vec3 windingMins(1e30f), windingMaxs(-1e30f);
+    for (const glm::vec3& point : winding) {
+        windingMins = glm::min(windingMins, point);
+        windingMaxs = glm::max(windingMaxs, point);
+    }
+
+    bool flipped;
+    auto alreadyUsed = [&](const glm::vec4& plane) {
+        if (PlaneEqual(facet.surfacePlane, plane, flipped)) {
+            return true;
+        }
+        for (int i = 0; i < facet.numBorders; ++i) {
+            if (PlaneEqual(facet.borderPlanes[i], plane, flipped)) {
+                return true;
+            }
+        }
+        return false;
+    };
+
+    // Axial bevels around the facet's bounds
+    for (int axis = 0; axis < 3; ++axis) {
+        for (int dir = -1; dir <= 1; dir += 2) {
+            glm::vec4 plane(0.0f);
+            plane[axis] = static_cast<float>(dir);
+            plane.w = dir == 1 ? windingMaxs[axis] : -windingMins[axis];
+            if (alreadyUsed(plane) || facet.numBorders >= maxBorders - 1) {
+                continue;
+            }
+            facet.borderPlanes[facet.numBorders] = FindPlane(plane, flipped);
+            facet.borderInward[facet.numBorders] = flipped;
+            ++facet.numBorders;
+        }
+    }
+
+    // Edge bevels, the slanted axial planes through every non axial edge that keep the whole facet behind them
+    for (size_t j = 0; j < winding.size(); ++j) {
+        glm::vec3 edge = winding[j] - winding[(j + 1) % winding.size()];
+        float length = glm::length(edge);
+        if (length < 0.5f) {
+            continue; // Degenerate edge
+        }
+        edge /= length;
+        SnapVector(edge);
+        if (std::fabs(edge.x) == 1.0f || std::fabs(edge.y) == 1.0f || std::fabs(edge.z) == 1.0f) {
+            continue;
+        }
+
+        for (int axis = 0; axis < 3; ++axis) {
+            for (int dir = -1; dir <= 1; dir += 2) {
+                glm::vec3 axisVector(0.0f);
+                axisVector[axis] = static_cast<float>(dir);
+                glm::vec3 normal = glm::cross(edge, axisVector);
+                float normalLength = glm::length(normal);
+                if (normalLength < 0.5f) {
+                    continue;
+                }
+                normal /= normalLength;
+                glm::vec4 plane(normal, glm::dot(winding[j], normal));
+
+                bool behind = true;
+                for (const glm::vec3& point : winding) {
+                    if (glm::dot(point, normal) - plane.w > 0.1f) {
+                        behind = false;
+                        break;
+                    }
+                }
+                if (!behind || alreadyUsed(plane) || facet.numBorders >= maxBorders - 1) {
+                    continue;
+                }
+
+                int index = FindPlane(plane, flipped);
+                glm::vec4 chopPlane = flipped ? planes[index] : -planes[index];
+                Winding chopped = winding;
+                ChopWinding(chopped, glm::vec3(chopPlane), chopPlane.w, CHOP_EPSILON);
+                if (chopped.empty()) {
+                    continue; // Would cut the facet away
+                }
+                facet.borderPlanes[facet.numBorders] = index;
+                facet.borderInward[facet.numBorders] = flipped;
+                ++facet.numBorders;
+            }
+        }
+    }
+
+    // The back of the surface closes the slab
+    facet.borderPlanes[facet.numBorders] = facet.surfacePlane;
+    facet.borderInward[facet.numBorders] = true;
+    ++facet.numBorders;
+}
+
+void PatchCollide::AddFacet(const Facet& facet) {
+    // Borders are stored facing out of the facet
+    PatchFacet patchFacet;
+    patchFacet.firstPlane = static_cast<int>(facetPlanes.size());
+    patchFacet.numPlanes = facet.numBorders + 1;
+    facetPlanes.push_back(planes[facet.surfacePlane]);
+    for (int i = 0; i < facet.numBorders; ++i) {
+        const glm::vec4& plane = planes[facet.borderPlanes[i]];
+        facetPlanes.push_back(facet.borderInward[i] ? -plane : plane);
+    }
+    facets.push_back(patchFacet);
+}
+
+void PatchCollide::FromGrid(Grid& grid) {
+    // Planes of the two triangles of every quad, the same plane twice when the quad is flat
+    std::vector<int> gridPlanes(MAX_GRID_SIZE * MAX_GRID_SIZE * 2, -1);
+    auto gridPlane = [&](int i, int j, int tri) -> int& { return gridPlanes[(i * MAX_GRID_SIZE + j) * 2 + tri]; };
+    for (int i = 0; i < grid.width - 1; ++i) {
+        for (int j = 0; j < grid.height - 1; ++j) {
+            gridPlane(i, j, 0) = FindPlane(grid.At(i, j), grid.At(i + 1, j), grid.At(i + 1, j + 1));
+            gridPlane(i, j, 1) = FindPlane(grid.At(i + 1, j + 1), grid.At(i, j + 1), grid.At(i, j));
+        }
+    }
+
+    for (int i = 0; i < grid.width - 1; ++i) {
+        for (int j = 0; j < grid.height - 1; ++j) {
+            // Borders come from the neighbouring quads where there is one, otherwise they stand up from the edge
+            int borders[4];
+            bool noAdjust[4];
+
+            borders[EN_TOP] = -1;
+            if (j > 0) {
+                borders[EN_TOP] = gridPlane(i, j - 1, 1);
+            }
+            else if (grid.wrapHeight) {
+                borders[EN_TOP] = gridPlane(i, grid.height - 2, 1);
+            }
+            noAdjust[EN_TOP] = borders[EN_TOP] == gridPlane(i, j, 0);
+            if (borders[EN_TOP] == -1 || noAdjust[EN_TOP]) {
+                borders[EN_TOP] = EdgePlaneNum(grid, gridPlanes, i, j, 0);
+            }
+
+            borders[EN_BOTTOM] = -1;
+            if (j < grid.height - 2) {
+                borders[EN_BOTTOM] = gridPlane(i, j + 1, 0);
+            }
+            else if (grid.wrapHeight) {
+                borders[EN_BOTTOM] = gridPlane(i, 0, 0);
+            }
+            noAdjust[EN_BOTTOM] = borders[EN_BOTTOM] == gridPlane(i, j, 1);
+            if (borders[EN_BOTTOM] == -1 || noAdjust[EN_BOTTOM]) {
+                borders[EN_BOTTOM] = EdgePlaneNum(grid, gridPlanes, i, j, 2);
+            }
+
+            borders[EN_LEFT] = -1;
+            if (i > 0) {
+                borders[EN_LEFT] = gridPlane(i - 1, j, 0);
+            }
+            else if (grid.wrapWidth) {
+                borders[EN_LEFT] = gridPlane(grid.width - 2, j, 0);
+            }
+            noAdjust[EN_LEFT] = borders[EN_LEFT] == gridPlane(i, j, 1);
+            if (borders[EN_LEFT] == -1 || noAdjust[EN_LEFT]) {
+                borders[EN_LEFT] = EdgePlaneNum(grid, gridPlanes, i, j, 3);
+            }
+
+            borders[EN_RIGHT] = -1;
+            if (i < grid.width - 2) {
+                borders[EN_RIGHT] = gridPlane(i + 1, j, 1);
+            }
+            else if (grid.wrapWidth) {
+                borders[EN_RIGHT] = gridPlane(0, j, 1);
+            }
+            noAdjust[EN_RIGHT] = borders[EN_RIGHT] == gridPlane(i, j, 0);
+            if (borders[EN_RIGHT] == -1 || noAdjust[EN_RIGHT]) {
+                borders[EN_RIGHT] = EdgePlaneNum(grid, gridPlanes, i, j, 1);
+            }
+
+            if (gridPlane(i, j, 0) == gridPlane(i, j, 1)) {
+                if (gridPlane(i, j, 0) == -1) {
+                    continue; // Degenerate quad
+                }
+                Facet facet;
+                facet.surfacePlane = gridPlane(i, j, 0);
+                facet.numBorders = 4;
+                facet.borderPlanes[0] = borders[EN_TOP];
+                facet.borderPlanes[1] = borders[EN_RIGHT];
+                facet.borderPlanes[2] = borders[EN_BOTTOM];
+                facet.borderPlanes[3] = borders[EN_LEFT];
+                SetBorderInward(facet, grid, i, j, -1);
+                if (ValidateFacet(facet)) {
+                    AddFacetBevels(facet);
+                    AddFacet(facet);
+                }
+                continue;
+            }
+
+            // Two separate triangles, each bordered by the other's plane along the diagonal
+            Facet first;
+            first.surfacePlane = gridPlane(i, j, 0);
+            first.numBorders = 3;
+            first.borderPlanes[0] = borders[EN_TOP];
+            first.borderPlanes[1] = borders[EN_RIGHT];
+            first.borderPlanes[2] = gridPlane(i, j, 1);
+            if (first.borderPlanes[2] == -1) {
+                first.borderPlanes[2] = borders[EN_BOTTOM];
+                if (first.borderPlanes[2] == -1) {
+                    first.borderPlanes[2] = EdgePlaneNum(grid, gridPlanes, i, j, 4);
+                }
+            }
+            SetBorderInward(first, grid, i, j, 0);
+            if (ValidateFacet(first)) {
+                AddFacetBevels(first);
+                AddFacet(first);
+            }
+
+            Facet second;
+            second.surfacePlane = gridPlane(i, j, 1);
+            second.numBorders = 3;
+            second.borderPlanes[0] = borders[EN_BOTTOM];
+            second.borderPlanes[1] = borders[EN_LEFT];
+            second.borderPlanes[2] = gridPlane(i, j, 0);
+            if (second.borderPlanes[2] == -1) {
+                second.borderPlanes[2] = borders[EN_TOP];
+                if (second.borderPlanes[2] == -1) {
+                    second.borderPlanes[2] = EdgePlaneNum(grid, gridPlanes, i, j, 5);
+                }
+            }
+            SetBorderInward(second, grid, i, j, 1);
+            if (ValidateFacet(second)) {
+                AddFacetBevels(second);
+                AddFacet(second);
+            }
+        }
+    }
+}
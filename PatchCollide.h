@@ -0,0 +1,77 @@
+#ifndef PATCHCOLLIDE_H
+#define PATCHCOLLIDE_H
+
+#include <glm/glm.hpp>
+#include <vector>
+
+/*
+Collision shape of a curved patch face, built the way Q3's CM_GeneratePatchCollide does. The control grid is
+subdivided until every curve is within SUBDIVIDE_DISTANCE of straight, then every grid quad becomes one flat facet
+or two triangle facets. A facet is the slab between its surface plane and the same plane reversed, closed off by
+border planes along its edges and by axial and edge bevels, so boxes swept against it stop at the right place
+just like they do against brush sides.
+
+Planes are stored per facet with the surface plane first and every border already facing out of the facet.
+*/
+
+struct PatchFacet {
+    int firstPlane;
+    int numPlanes;  // The surface plane and its borders, the last border is the back of the surface
+};
+
+class PatchCollide {
+public:
+    // points is width * height control points in rows, as stored in the map
+    PatchCollide(int width, int height, const glm::vec3* points);
+
+    const std::vector<glm::vec4>& GetPlanes() const { return facetPlanes; }
+    const std::vector<PatchFacet>& GetFacets() const { return facets; }
+    const glm::vec3& GetMins() const { return mins; }
+    const glm::vec3& GetMaxs() const { return maxs; }
+
+private:
+    struct Grid {
+        int width = 0;
+        int height = 0;
+        bool wrapWidth = false;
+        bool wrapHeight = false;
+        std::vector<glm::vec3> points; // points[i * MAX_GRID_SIZE + j] is column i, row j
+
+        glm::vec3& At(int i, int j) { return points[i * MAX_GRID_SIZE + j]; }
+    };
+
+    struct Facet {
+        int surfacePlane = -1;
+        int numBorders = 0;
+        int borderPlanes[4 + 6 + 16];
+        bool borderInward[4 + 6 + 16];
+    };
+
+    static const int MAX_GRID_SIZE = 129;
+
+    static void SetGridWrapWidth(Grid& grid);
+    static void SubdivideGridColumns(Grid& grid);
+    static void RemoveDegenerateColumns(Grid& grid);
+    static void TransposeGrid(Grid& grid);
+
+    void FromGrid(Grid& grid);
+    int FindPlane(const glm::vec3& p1, const glm::vec3& p2, const glm::vec3& p3);
+    int FindPlane(const glm::vec4& plane, bool& flipped);
+    bool PlaneEqual(int index, const glm::vec4& plane, bool& flipped) const;
+    int GridPlane(const std::vector<int>& gridPlanes, int i, int j, int tri) const;
+    int EdgePlaneNum(Grid& grid, const std::vector<int>& gridPlanes, int i, int j, int k);
+    int PointOnPlaneSide(const glm::vec3& point, int plane) const;
+    void SetBorderInward(Facet& facet, Grid& grid, int i, int j, int which) const;
+    bool ValidateFacet(const Facet& facet) const;
+    void AddFacetBevels(Facet& facet);
+    void AddFacet(const Facet& facet);
+
+    std::vector<glm::vec4> planes; // Unique planes while building, xyz normal and w distance
+
+    std::vector<glm::vec4> facetPlanes;
+    std::vector<PatchFacet> facets;
+    glm::vec3 mins;
+    glm::vec3 maxs;
+};
+
+#endif // PATCHCOLLIDE_H
@@ -0,0 +1,363 @@
+#include "PlayerMove.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+
+// Q3's movement parameters
+static const float PLAYER_SPEED = 320.0f;
+static const float STOP_SPEED = 100.0f;
+static const float ACCELERATE = 10.0f;
+static const float AIR_ACCELERATE = 1.0f;
+static const float FRICTION = 6.0f;
+static const float GRAVITY = 800.0f;
+static const float JUMP_VELOCITY = 270.0f;
+static const float STEPSIZE = 18.0f;
+static const float MIN_WALK_NORMAL = 0.7f;  // Steeper ground can't be walked on
+static const float OVERCLIP = 1.001f;       // Clipped velocities point slightly away from the plane
+static const int MAX_CLIP_PLANES = 5;
+static const glm::vec3 PLAYER_MINS(-15.0f, -15.0f, -24.0f);
+static const glm::vec3 PLAYER_MAXS(15.0f, 15.0f, 32.0f);
+
+const float PlayerMove::TICK_SECONDS = 1.0f / PlayerMove::TICK_RATE;
+const float PlayerMove::VIEW_HEIGHT = 26.0f;
+const glm::vec3 PlayerMove::MINS = PLAYER_MINS;
+const glm::vec3 PlayerMove::MAXS = PLAYER_MAXS;
+
+int16_t PlayerInput::AngleToShort(float degrees) {
+    return static_cast<int16_t>(static_cast<int>(std::lround(degrees * 65536.0f / 360.0f)) & 0xFFFF);
+}
+
+float PlayerInput::ShortToAngle(int16_t angle) {
+    return angle * (360.0f / 65536.0f);
+}
+
+uint32_t PlayerState::Hash() const {
+    unsigned char bytes[sizeof(float) * 9 + 4];
+    float values[9] = { origin.x, origin.y, origin.z, velocity.x, velocity.y, velocity.z, groundNormal.x, groundNormal.y, groundNormal.z };
+    std::memcpy(bytes, values, sizeof(values));
+    bytes[sizeof(values)] = groundPlane;
+    bytes[sizeof(values) + 1] = walking;
+    bytes[sizeof(values) + 2] = jumpHeld;
+    bytes[sizeof(values) + 3] = 0;
+
+    uint32_t hash = 2166136261u;
+    for (unsigned char byte : bytes) {
+        hash = (hash ^ byte) * 16777619u;
+    }
+    return hash;
+}
+
+PlayerMove::PlayerMove(const CollisionModel& collision) : collision(collision) {
+}
+
+TraceResult PlayerMove::Trace(const glm::vec3& start, const glm::vec3& end) {
+    return collision.TraceBox(context, start, end, PLAYER_MINS, PLAYER_MAXS, MASK_PLAYERSOLID);
+}
+
+void PlayerMove::Tick(PlayerState& state, const PlayerInput& input) {
+    // Camera yaw turns the other way round map Z, see Camera::ToMapSpace
+    float yaw = glm::radians(PlayerInput::ShortToAngle(input.yaw));
+    forward = glm::vec3(std::cos(yaw), -std::sin(yaw), 0.0f);
+    right = glm::vec3(-std::sin(yaw), -std::cos(yaw), 0.0f);
+
+    if (input.upMove < 10) {
+        state.jumpHeld = false;
+    }
+
+    GroundTrace(state);
+    if (state.walking) {
+        WalkMove(state, input);
+    }
+    else {
+        AirMove(state, input);
+    }
+    GroundTrace(state);
+
+    // Whole units keep the state the same from one machine and one replay to the next
+    state.velocity = glm::vec3(std::round(state.velocity.x), std::round(state.velocity.y), std::round(state.velocity.z));
+    ++state.ticks;
+}
+
+void PlayerMove::GroundTrace(PlayerState& state) {
+    glm::vec3 point = state.origin - glm::vec3(0.0f, 0.0f, 0.25f);
+    TraceResult trace = Trace(state.origin, point);
+
+    if (trace.allSolid || trace.fraction == 1.0f) {
+        state.groundPlane = false;
+        state.walking = false;
+        return;
+    }
+    // Moving up and away from the ground, a jump shouldn't stick to it
+    if (state.velocity.z > 0.0f && glm::dot(state.velocity, trace.normal) > 10.0f) {
+        state.groundPlane = false;
+        state.walking = false;
+        return;
+    }
+
+    state.groundPlane = true;
+    state.groundNormal = trace.normal;
+    state.walking = trace.normal.z >= MIN_WALK_NORMAL;
+}
+
+bool PlayerMove::CheckJump(PlayerState& state, const PlayerInput& input) {
+    if (input.upMove < 10 || state.jumpHeld) {
+        return false;
+    }
+    state.groundPlane = false;
+    state.walking = false;
+    state.jumpHeld = true;
+    state.velocity.z = JUMP_VELOCITY;
+    return true;
+}
+
+void PlayerMove::Friction(PlayerState& state) {
+    glm::vec3 vec = state.velocity;
+    if (state.walking) {
+        vec.z = 0.0f; // Ignore slope movement
+    }
+    float speed = glm::length(vec);
+    if (speed < 1.0f) {
+        state.velocity.x = 0.0f;
+        state.velocity.y = 0.0f;
+        return;
+    }
+
+    // Only the ground slows the player down
+    float drop = 0.0f;
+    if (state.walking) {
+        float control = speed < STOP_SPEED ? STOP_SPEED : speed;
+        drop += control * FRICTION * TICK_SECONDS;
+    }
+    float newSpeed = speed - drop;
+    if (newSpeed < 0.0f) {
+        newSpeed = 0.0f;
+    }
+    state.velocity *= newSpeed / speed;
+}
+
+void PlayerMove::Accelerate(PlayerState& state, const glm::vec3& wishDir, float wishSpeed, float accel) {
+    float addSpeed = wishSpeed - glm::dot(state.velocity, wishDir);
+    if (addSpeed <= 0.0f) {
+        return;
+    }
+    float accelSpeed = accel * TICK_SECONDS * wishSpeed;
+    if (accelSpeed > addSpeed) {
+        accelSpeed = addSpeed;
+    }
+    state.velocity += accelSpeed * wishDir;
+}
+
+float PlayerMove::CmdScale(const PlayerInput& input) {
+    // Diagonal moves are no faster than straight ones
+    int max = std::abs(input.forwardMove);
+    max = std::max(max, std::abs(static_cast<int>(input.rightMove)));
+    max = std::max(max, std::abs(static_cast<int>(input.upMove)));
+    if (!max) {
+        return 0.0f;
+    }
+    float total = std::sqrt(static_cast<float>(input.forwardMove * input.forwardMove + input.rightMove * input.rightMove + input.upMove * input.upMove));
+    return PLAYER_SPEED * max / (127.0f * total);
+}
+
+glm::vec3 PlayerMove::ClipVelocity(const glm::vec3& in, const glm::vec3& normal, float overbounce) {
+    float backoff = glm::dot(in, normal);
+    if (backoff < 0.0f) {
+        backoff *= overbounce;
+    }
+    else {
+        backoff /= overbounce;
+    }
+    return in - normal * backoff;
+}
+
+void PlayerMove::WalkMove(PlayerState& state, const PlayerInput& input) {
+    if (CheckJump(state, input)) {
+        AirMove(state, input);
+        return;
+    }
+
+    Friction(state);
+    float scale = CmdScale(input);
+
+    // Project the view directions onto the ground so walking up slopes isn't slower
+    glm::vec3 groundForward = ClipVelocity(forward, state.groundNormal, OVERCLIP);
+    glm::vec3 groundRight = ClipVelocity(right, state.groundNormal, OVERCLIP);
+    groundForward = glm::normalize(groundForward);
+    groundRight = glm::normalize(groundRight);
+
+    glm::vec3 wishVel = groundForward * static_cast<float>(input.forwardMove) + groundRight * static_cast<float>(input.rightMove);
+    float wishSpeed = glm::length(wishVel);
+    glm::vec3 wishDir = wishSpeed > 0.0f ? wishVel / wishSpeed : glm::vec3(0.0f);
+    wishSpeed *= scale;
+    Accelerate(state, wishDir, wishSpeed, ACCELERATE);
+
+    // Slide along the ground without losing speed going up or down the slope
+    float speed = glm::length(state.velocity);
+    state.velocity = ClipVelocity(state.velocity, state.groundNormal, OVERCLIP);
+    float clippedSpeed = glm::length(state.velocity);
+    if (clippedSpeed > 0.0f) {
+        state.velocity *= speed / clippedSpeed;
+    }
+
+    if (state.velocity.x == 0.0f && state.velocity.y == 0.0f) {
+        return;
+    }
+    StepSlideMove(state, false);
+}
+
+void PlayerMove::AirMove(PlayerState& state, const PlayerInput& input) {
+    Friction(state);
+    float scale = CmdScale(input);
+
+    glm::vec3 wishVel = forward * static_cast<float>(input.forwardMove) + right * static_cast<float>(input.rightMove);
+    wishVel.z = 0.0f;
+    float wishSpeed = glm::length(wishVel);
+    glm::vec3 wishDir = wishSpeed > 0.0f ? wishVel / wishSpeed : glm::vec3(0.0f);
+    wishSpeed *= scale;
+    // Very little control in the air
+    Accelerate(state, wishDir, wishSpeed, AIR_ACCELERATE);
+
+    // Sliding down a slope too steep to walk on
+    if (state.groundPlane) {
+        state.velocity = ClipVelocity(state.velocity, state.groundNormal, OVERCLIP);
+    }
+    StepSlideMove(state, true);
+}
+
+bool PlayerMove::SlideMove(PlayerState& state, bool gravity) {
+    glm::vec3 endVelocity = state.velocity;
+    if (gravity) {
+        // Half of this tick's gravity is applied before the move and the rest after it
+        endVelocity.z -= GRAVITY * TICK_SECONDS;
+        state.velocity.z = (state.velocity.z + endVelocity.z) * 0.5f;
+        if (state.groundPlane) {
+            state.velocity = ClipVelocity(state.velocity, state.groundNormal, OVERCLIP);
+        }
+    }
+
+    // Never turn against the ground plane or the original direction
+    glm::vec3 planes[MAX_CLIP_PLANES];
+    int numPlanes = 0;
+    if (state.groundPlane) {
+        planes[numPlanes++] = state.groundNormal;
+    }
+    float speed = glm::length(state.velocity);
+    planes[numPlanes++] = speed > 0.0f ? state.velocity / speed : glm::vec3(0.0f);
+
+    float timeLeft = TICK_SECONDS;
+    int bump = 0;
+    for (; bump < 4; ++bump) {
+        glm::vec3 end = state.origin + state.velocity * timeLeft;
+        TraceResult trace = Trace(state.origin, end);
+        if (trace.allSolid) {
+            // Stuck in a solid, don't build up falling speed
+            state.velocity.z = 0.0f;
+            return true;
+        }
+        if (trace.fraction > 0.0f) {
+            state.origin = trace.endPos;
+        }
+        if (trace.fraction == 1.0f) {
+            break;
+        }
+        timeLeft -= timeLeft * trace.fraction;
+
+        if (numPlanes >= MAX_CLIP_PLANES) {
+            state.velocity = glm::vec3(0.0f);
+            return true;
+        }
+
+        // The same plane again, nudge out along it so the move doesn't get stuck in an epsilon
+        int i = 0;
+        for (; i < numPlanes; ++i) {
+            if (glm::dot(trace.normal, planes[i]) > 0.99f) {
+                state.velocity += trace.normal;
+                break;
+            }
+        }
+        if (i < numPlanes) {
+            continue;
+        }
+        planes[numPlanes++] = trace.normal;
+
+        // Make the velocity run along every plane it moves into
+        for (i = 0; i < numPlanes; ++i) {
+            if (glm::dot(state.velocity, planes[i]) >= 0.1f) {
+                continue; // Moving away from it
+            }
+            glm::vec3 clipVelocity = ClipVelocity(state.velocity, planes[i], OVERCLIP);
+            glm::vec3 endClipVelocity = ClipVelocity(endVelocity, planes[i], OVERCLIP);
+
+            for (int j = 0; j < numPlanes; ++j) {
+                if (j == i || glm::dot(clipVelocity, planes[j]) >= 0.1f) {
+                    continue;
+                }
+                clipVelocity = ClipVelocity(clipVelocity, planes[j], OVERCLIP);
+                endClipVelocity = ClipVelocity(endClipVelocity, planes[j], OVERCLIP);
+                if (glm::dot(clipVelocity, planes[i]) >= 0.0f) {
+                    continue;
+                }
+
+                // Pushed back into the first plane, slide along the crease of the two
+                glm::vec3 dir = glm::normalize(glm::cross(planes[i], planes[j]));
+                clipVelocity = dir * glm::dot(dir, state.velocity);
+                endClipVelocity = dir * glm::dot(dir, endVelocity);
+
+                for (int k = 0; k < numPlanes; ++k) {
+                    if (k == i || k == j || glm::dot(clipVelocity, planes[k]) >= 0.1f) {
+                        continue;
+                    }
+                    // Stop dead in a corner of three planes
+                    state.velocity = glm::vec3(0.0f);
+                    return true;
+                }
+            }
+
+            state.velocity = clipVelocity;
+            endVelocity = endClipVelocity;
+            break;
+        }
+    }
+
+    if (gravity) {
+        state.velocity = endVelocity;
+    }
+    return bump != 0;
+}
+
+void PlayerMove::StepSlideMove(PlayerState& state, bool gravity) {
+    glm::vec3 startOrigin = state.origin;
+    glm::vec3 startVelocity = state.velocity;
+    if (!SlideMove(state, gravity)) {
+        return; // Got all the way on the first try
+    }
+
+    // Never step up while still going up, unless there's walkable ground under the start
+    glm::vec3 down = startOrigin - glm::vec3(0.0f, 0.0f, STEPSIZE);
+    TraceResult trace = Trace(startOrigin, down);
+    if (state.velocity.z > 0.0f && (trace.fraction == 1.0f || trace.normal.z < MIN_WALK_NORMAL)) {
+        return;
+    }
+
+    // Try the same move from a step higher
+    glm::vec3 up = startOrigin + glm::vec3(0.0f, 0.0f, STEPSIZE);
+    trace = Trace(startOrigin, up);
+    if (trace.allSolid) {
+        return;
+    }
+    float stepSize = trace.endPos.z - startOrigin.z;
+    state.origin = trace.endPos;
+    state.velocity = startVelocity;
+    SlideMove(state, gravity);
+
+    // And back down onto whatever is there
+    down = state.origin - glm::vec3(0.0f, 0.0f, stepSize);
+    trace = Trace(state.origin, down);
+    if (!trace.allSolid) {
+        state.origin = trace.endPos;
+    }
+    if (trace.fraction < 1.0f) {
+        state.velocity = ClipVelocity(state.velocity, trace.normal, OVERCLIP);
+    }
+}
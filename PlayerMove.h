@@ -0,0 +1,75 @@
+#ifndef PLAYERMOVE_H
+#define PLAYERMOVE_H
+
+#include <glm/glm.hpp>
+#include <cstdint>
+#include "CollisionModel.h"
+
+/*
+Player movement working like Q3's Pmove, in map space. Every tick takes one input command and moves the player
+box by a fixed time step: ground check, friction, acceleration, jumping and gravity, then a slide move that clips
+the velocity against up to five planes and steps up ledges of STEPSIZE units.
+
+Nothing here depends on the frame rate. The step is always TICK_SECONDS, view angles come in quantized, and the
+velocity is snapped to whole units after each tick like Q3 does, so the same commands from the same start
+give bit identical states on the same build.
+*/
+
+// One tick of input. Moves are -127 to 127, angles are the camera's Yaw and Pitch in 65536ths of a turn.
+struct PlayerInput {
+    int8_t forwardMove = 0;
+    int8_t rightMove = 0;
+    int8_t upMove = 0;      // Above 10 jumps
+    int8_t buttons = 0;
+    int16_t yaw = 0;
+    int16_t pitch = 0;
+
+    static int16_t AngleToShort(float degrees);
+    static float ShortToAngle(int16_t angle);
+};
+
+struct PlayerState {
+    glm::vec3 origin;             // Player origin in map space, the eye is VIEW_HEIGHT above it
+    glm::vec3 velocity = glm::vec3(0.0f);
+    glm::vec3 groundNormal = glm::vec3(0.0f, 0.0f, 1.0f);
+    bool groundPlane = false;     // Standing on something
+    bool walking = false;         // Standing on something flat enough to walk on
+    bool jumpHeld = false;        // Jump has to be released before the next one
+    int ticks = 0;
+
+    // FNV-1a of the movement state, replays compare it tick by tick
+    uint32_t Hash() const;
+};
+
+class PlayerMove {
+public:
+    explicit PlayerMove(const CollisionModel& collision);
+
+    void Tick(PlayerState& state, const PlayerInput& input);
+
+    static const int TICK_RATE = 125;               // Ticks per second, Q3's pmove_msec 8
+    static const float TICK_SECONDS;
+    static const float VIEW_HEIGHT;
+    static const glm::vec3 MINS;                    // Player box around the origin
+    static const glm::vec3 MAXS;
+
+private:
+    TraceResult Trace(const glm::vec3& start, const glm::vec3& end);
+    void GroundTrace(PlayerState& state);
+    bool CheckJump(PlayerState& state, const PlayerInput& input);
+    void Friction(PlayerState& state);
+    void Accelerate(PlayerState& state, const glm::vec3& wishDir, float wishSpeed, float accel);
+    void WalkMove(PlayerState& state, const PlayerInput& input);
+    void AirMove(PlayerState& state, const PlayerInput& input);
+    bool SlideMove(PlayerState& state, bool gravity);
+    void StepSlideMove(PlayerState& state, bool gravity);
+    static float CmdScale(const PlayerInput& input);
+    static glm::vec3 ClipVelocity(const glm::vec3& in, const glm::vec3& normal, float overbounce);
+
+    const CollisionModel& collision;
+    TraceContext context;
+    glm::vec3 forward;  // Flat view directions of the current tick
+    glm::vec3 right;
+};
+
+#endif // PLAYERMOVE_H
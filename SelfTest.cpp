@@ -0,0 +1,64 @@
+#include "SelfTest.h"
+#include "SelfTestCommon.h"
+#include <iostream>
+#include <sstream>
+
+// Prints the result of one check and passes it on
+bool Report(const std::string& name, bool passed) {
+    std::cout << (passed ? "  ok      " : "  FAILED  ") << name << std::endl;
+    return passed;
+}
+
+// Writes mapFile with some lumps replaced to tempFile. The map that writes it reads from the new file afterwards,
+// so it is a copy of its own and the caller's maps stay on their files.
+bool WriteSelfTestMap(const std::string& mapFile, const std::map<LumpType, std::vector<char>>& lumps, const char* tempFile) {
+    BSPMap source;
+    return source.Load(mapFile) && source.Save(tempFile, lumps);
+}
+
+// The map's entities as entity lump text
+std::string EntityText(const BSPMap& map) {
+    std::ostringstream text;
+    for (const Entity& entity : map.GetEntities()) {
+        text << "{\n";
+        for (const auto& property : entity.properties) {
+            text << "\"" << property.first << "\" \"" << property.second << "\"\n";
+        }
+        text << "}\n";
+    }
+    return text.str();
+}
+
+std::vector<char> EntityLump(const std::string& text) {
+    std::vector<char> lump(text.begin(), text.end());
+    lump.push_back('\0');
+    return lump;
+}
+
+int RunSelfTest(int argc, char** argv) {
+    if (argc > 3) {
+        std::cerr << "Usage: -selftest [map.bsp]" << std::endl;
+        return -1;
+    }
+    std::string mapFile = argc > 2 ? argv[2] : "MYFIRSTMAP.bsp";
+
+    ThreadPool pool;
+    bool passed = true;
+    passed &= CheckOcclusion(pool);
+    passed &= CheckClusteredLights();
+
+    BSPMap map;
+    if (!map.LoadAllLumps(mapFile)) {
+        std::cerr << "Self test: could not load " << mapFile << std::endl;
+        return -1;
+    }
+    passed &= CheckCullViews(map);
+    passed &= CheckTraces(map, mapFile);
+    passed &= CheckLightGrid(map);
+    passed &= CheckVertexLighting(map);
+    passed &= CheckShadowAtlas(map);
+    passed &= CheckBaker(map, mapFile, pool);
+
+    std::cout << (passed ? "Self test passed" : "Self test FAILED") << std::endl;
+    return passed ? 0 : 1;
+}
@@ -0,0 +1,15 @@
+#ifndef SELFTEST_H
+#define SELFTEST_H
+
+/*
+Checks started from the command line, no window is opened. Each one sets up a case with a known answer, or runs
+an optimized path next to a plain reference (scalar code, brute force, a single thread) and prints whether they
+agree, so a change to one of the optimized paths can be checked without eyeballing a frame.
+*/
+
+// Waves4 -selftest [map.bsp]
+// Runs every check, the ones that need a map load MYFIRSTMAP.bsp unless another is given. Returns non-zero when
+// any check fails.
+int RunSelfTest(int argc, char** argv);
+
+#endif // SELFTEST_H
@@ -0,0 +1,132 @@
+#include "SelfTestCommon.h"
+#include "LightBaker.h"
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+// The copy saved over itself and the map with the self test lights, each written next to the map under test and
+// removed again
+static const char* SAVE_MAP_FILE = "selftest_save.bsp";
+static const char* BAKE_MAP_FILE = "selftest_bake.bsp";
+
+// Copies mapFile as it is and saves the copy over itself twice, the second time with the lumps moved by a longer
+// entity lump. Compilers don't write lumps in the order Save does, so the first save already moves them and the
+// second has to read them from where they went.
+static bool CheckSaveOverItself(const BSPMap& map, const std::string& mapFile) {
+    bool passed;
+    {
+        std::ifstream in(mapFile, std::ios::binary);
+        std::ofstream out(SAVE_MAP_FILE, std::ios::binary | std::ios::trunc);
+        out << in.rdbuf();
+        passed = in && out;
+    }
+    if (passed) {
+        BSPMap copy;
+        std::map<LumpType, std::vector<char>> longer;
+        longer[LumpType::Entities] = EntityLump(EntityText(map) + "{\n\"classname\" \"info_null\"\n}\n");
+        passed = copy.LoadAllLumps(SAVE_MAP_FILE) && copy.Save(SAVE_MAP_FILE, {}) &&
+            copy.Save(SAVE_MAP_FILE, longer);
+    }
+    if (passed) {
+        BSPMap saved;
+        passed = saved.LoadAllLumps(SAVE_MAP_FILE) &&
+            saved.GetEntities().size() == map.GetEntities().size() + 1 &&
+            LumpBytes(saved.GetFaces()) == LumpBytes(map.GetFaces()) &&
+            LumpBytes(saved.GetBrushes()) == LumpBytes(map.GetBrushes()) &&
+            saved.GetLightmaps() == map.GetLightmaps() &&
+            saved.GetLightVolumes() == map.GetLightVolumes() &&
+            saved.GetVisData().bits == map.GetVisData().bits;
+    }
+    std::remove(SAVE_MAP_FILE);
+    return Report("map saved over itself twice reads back", passed);
+}
+
+// Reads back a map the baker saved, everything but the baked lumps has to match the map it was saved from
+static bool SavedBakeMatches(const BSPMap& lit, const std::map<LumpType, std::vector<char>>& baked) {
+    BSPMap saved;
+    if (!saved.LoadAllLumps(BAKE_MAP_FILE)) {
+        return false;
+    }
+    auto volumes = baked.find(LumpType::LightVolumes);
+    bool volumesMatch = volumes != baked.end() ? SameBytes(saved.GetLightVolumes(), volumes->second) :
+        saved.GetLightVolumes() == lit.GetLightVolumes();
+    return SameBytes(saved.GetLightmaps(), baked.at(LumpType::Lightmaps)) && volumesMatch &&
+        saved.GetEntities().size() == lit.GetEntities().size() &&
+        LumpBytes(saved.GetFaces()) == LumpBytes(lit.GetFaces()) &&
+        SameBytes(saved.GetVertex(), baked.at(LumpType::Vertices)) &&
+        saved.GetVisData().numClusters == lit.GetVisData().numClusters &&
+        saved.GetVisData().bits == lit.GetVisData().bits;
+}
+
+// The baker checks on the map with the self test lights
+static bool CheckBakes(BSPMap& lit, ThreadPool& pool) {
+    ThreadPool single(1);
+    ThreadPool several(SELFTEST_THREADS);
+    LightBaker singleBaker(lit, single);
+    LightBaker severalBaker(lit, several);
+    if (!Report("lights found", singleBaker.Prepare() && severalBaker.Prepare())) {
+        return false;
+    }
+    BakeSettings settings;
+    settings.samples = 8;
+    singleBaker.Bake(settings);
+    severalBaker.Bake(settings);
+    std::cout << "  " << severalBaker.GetLightCount() << " lights, " << severalBaker.GetTexelCount() << " texels" << std::endl;
+    bool passed = Report("1 and " + std::to_string(SELFTEST_THREADS) + " threads bake the same bytes",
+        singleBaker.BuildLumps() == severalBaker.BuildLumps());
+
+    // Bounces gather what earlier passes left, only direct light refines to the same bytes as a single pass
+    BakeSettings direct;
+    direct.bounces = 0;
+    LightBaker reference(lit, pool);
+    reference.Prepare();
+    reference.Bake(direct);
+    LightBaker progressive(lit, pool);
+    progressive.Prepare();
+    int savesMatching = 0;
+    for (int step : { 4, 2, 1 }) {
+        BakeSettings pass = direct;
+        pass.texelStep = step;
+        progressive.Bake(pass);
+        std::map<LumpType, std::vector<char>> baked = progressive.BuildLumps();
+        savesMatching += lit.Save(BAKE_MAP_FILE, baked) && SavedBakeMatches(lit, baked) ? 1 : 0;
+    }
+    passed &= Report("map saved over itself after every pass reads back", savesMatching == 3);
+    {
+        BSPMap saved;
+        passed &= Report("baked vertex colors match the baked lightmaps",
+            saved.LoadAllLumps(BAKE_MAP_FILE) && VertexColorsMatchLightmaps(saved));
+    }
+    passed &= Report("progressive bake ends where a single pass does", progressive.BuildLumps() == reference.BuildLumps());
+    return passed;
+}
+
+// Checks the saves the light tool makes, then adds a point light and a spotlight in the middle of the world and
+// bakes the map
+bool CheckBaker(const BSPMap& map, const std::string& mapFile, ThreadPool& pool) {
+    std::cout << "Light baker" << std::endl;
+    if (map.GetModels().empty()) {
+        return Report("map has a world model", false);
+    }
+    const Model& world = map.GetModels()[0];
+    glm::vec3 center = (glm::vec3(world.mins[0], world.mins[1], world.mins[2]) +
+        glm::vec3(world.maxs[0], world.maxs[1], world.maxs[2])) * 0.5f;
+    std::ostringstream lights;
+    lights << "{\n\"classname\" \"light\"\n\"light\" \"400\"\n\"origin\" \"" << center.x << " " << center.y << " " << center.z << "\"\n}\n";
+    lights << "{\n\"classname\" \"light\"\n\"target\" \"selftest_target\"\n\"radius\" \"64\"\n\"origin\" \""
+        << center.x << " " << center.y << " " << center.z + 32.0f << "\"\n}\n";
+    lights << "{\n\"classname\" \"info_null\"\n\"targetname\" \"selftest_target\"\n\"origin\" \""
+        << center.x << " " << center.y << " " << center.z - 64.0f << "\"\n}\n";
+    std::map<LumpType, std::vector<char>> lumps;
+    lumps[LumpType::Entities] = EntityLump(EntityText(map) + lights.str());
+
+    bool passed = CheckSaveOverItself(map, mapFile);
+    {
+        BSPMap lit;
+        bool loaded = WriteSelfTestMap(mapFile, lumps, BAKE_MAP_FILE) && lit.LoadAllLumps(BAKE_MAP_FILE);
+        passed &= Report("map with lights written and loaded", loaded) && CheckBakes(lit, pool);
+    }
+    std::remove(BAKE_MAP_FILE);
+    return passed;
+}
@@ -0,0 +1,171 @@
+#include "SelfTestCommon.h"
+#include "CollisionModel.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <random>
+
+// The bevel pillar map is written here next to the map under test and removed again
+static const char* PILLAR_MAP_FILE = "selftest_pillar.bsp";
+// Traces stop SURFACE_CLIP_EPSILON (1/8 unit) short of a brush, results within this band of a surface aren't compared
+static const float TRACE_TOLERANCE = 0.25f;
+
+// Where a ray enters one brush given by its sides (bevels left out), with every side pushed out by offset.
+// Returns the fraction, 0 when the start is inside and -1 when the ray misses.
+static float RayEnterBrush(const BSPMap& map, const Brush& brush, const glm::vec3& start, const glm::vec3& end, float offset) {
+    float enter = 0.0f;
+    float leave = 1.0f;
+    for (int i = 0; i < brush.numSides; ++i) {
+        const Plane& plane = map.GetPlanes()[map.GetBrushSides()[brush.brushSide + i].plane];
+        glm::vec3 normal(plane.normal[0], plane.normal[1], plane.normal[2]);
+        float d1 = glm::dot(normal, start) - plane.distance - offset;
+        float d2 = glm::dot(normal, end) - plane.distance - offset;
+        if (d1 > 0.0f && d2 >= d1) {
+            return -1.0f;
+        }
+        if (d1 > 0.0f) {
+            enter = std::max(enter, d1 / (d1 - d2));
+        }
+        else if (d2 > 0.0f) {
+            leave = std::min(leave, d1 / (d1 - d2));
+        }
+    }
+    return enter <= leave ? enter : -1.0f;
+}
+
+// Nearest brush a ray enters over every brush of the map matching contentMask, -1 when it hits none
+static float RayEnterWorld(const BSPMap& map, const glm::vec3& start, const glm::vec3& end, int contentMask, float offset) {
+    float nearest = -1.0f;
+    for (const Brush& brush : map.GetBrushes()) {
+        if (brush.texture < 0 || brush.texture >= static_cast<int>(map.GetTextures().size()) ||
+            !(map.GetTextures()[brush.texture].contents & contentMask)) {
+            continue;
+        }
+        float enter = RayEnterBrush(map, brush, start, end, offset);
+        if (enter >= 0.0f && (nearest < 0.0f || enter < nearest)) {
+            nearest = enter;
+        }
+    }
+    return nearest;
+}
+
+// The boxes and rays the bevel pillar map below is checked with
+static bool CheckPillarTraces(const BSPMap& pillar) {
+    CollisionModel model(pillar);
+    glm::vec3 mins(-15.0f, -15.0f, -24.0f), maxs(15.0f, 15.0f, 32.0f);
+    bool passed = true;
+    // The pillar's corner is at y = 64, the box's top edge at 84 - 15 = 69 clears it. Without bevels the box
+    // is stopped by the angled sides pushed out along their normals.
+    TraceResult past = model.TraceBox(glm::vec3(-100.0f, 84.0f, 32.0f), glm::vec3(100.0f, 84.0f, 32.0f), mins, maxs, MASK_SOLID);
+    passed &= Report("box sliding past the pillar's corner isn't stopped", past.fraction == 1.0f);
+    TraceResult into = model.TraceBox(glm::vec3(-100.0f, 0.0f, 32.0f), glm::vec3(100.0f, 0.0f, 32.0f), mins, maxs, MASK_SOLID);
+    passed &= Report("box running into the pillar stops at its corner", into.fraction < 1.0f && std::fabs(into.endPos.x + 79.0f) < TRACE_TOLERANCE);
+    TraceResult ray = model.TraceRay(glm::vec3(-100.0f, 10.0f, 32.0f), glm::vec3(100.0f, 10.0f, 32.0f), MASK_SOLID);
+    passed &= Report("ray stops on the pillar's side", std::fabs(ray.endPos.x + 54.0f) < TRACE_TOLERANCE && ray.normal.x < 0.0f && ray.normal.y > 0.0f);
+    return passed;
+}
+
+// A pillar with four sides at 45 degrees has no axial sides, boxes sliding past its corners need the bevels
+static bool CheckBevelPillar(const std::string& mapFile) {
+    const float diagonal = 0.70710678f;
+    const float sides[6][4] = {
+        { diagonal, diagonal, 0.0f, 64.0f * diagonal }, { -diagonal, diagonal, 0.0f, 64.0f * diagonal },
+        { diagonal, -diagonal, 0.0f, 64.0f * diagonal }, { -diagonal, -diagonal, 0.0f, 64.0f * diagonal },
+        { 0.0f, 0.0f, 1.0f, 64.0f }, { 0.0f, 0.0f, -1.0f, 0.0f }
+    };
+    // Plane 0 splits the only node far away from the pillar, both children are leaf 0
+    std::vector<Plane> planes(7, Plane{});
+    planes[0].normal[0] = 1.0f;
+    planes[0].distance = -10000.0f;
+    std::vector<BrushSide> brushSides(6);
+    for (int i = 0; i < 6; ++i) {
+        planes[i + 1].normal[0] = sides[i][0];
+        planes[i + 1].normal[1] = sides[i][1];
+        planes[i + 1].normal[2] = sides[i][2];
+        planes[i + 1].distance = sides[i][3];
+        brushSides[i].plane = i + 1;
+        brushSides[i].texture = 0;
+    }
+    std::vector<Node> nodes(1, Node{});
+    nodes[0].children[0] = -1;
+    nodes[0].children[1] = -1;
+    std::vector<Leaf> leafs(1, Leaf{});
+    leafs[0].numLeafBrushes = 1;
+    std::vector<BSPTexture> textures(1, BSPTexture{});
+    std::strcpy(textures[0].name, "selftest/solid");
+    textures[0].contents = CONTENTS_SOLID;
+
+    std::map<LumpType, std::vector<char>> lumps;
+    lumps[LumpType::Planes] = LumpBytes(planes);
+    lumps[LumpType::Nodes] = LumpBytes(nodes);
+    lumps[LumpType::Leafs] = LumpBytes(leafs);
+    lumps[LumpType::LeafBrushes] = LumpBytes(std::vector<int>(1, 0));
+    lumps[LumpType::Brushes] = LumpBytes(std::vector<Brush>(1, Brush{ 0, 6, 0 }));
+    lumps[LumpType::BrushSides] = LumpBytes(brushSides);
+    lumps[LumpType::Textures] = LumpBytes(textures);
+    lumps[LumpType::VisData] = std::vector<char>();
+    bool passed = false;
+    {
+        BSPMap pillar;
+        bool loaded = WriteSelfTestMap(mapFile, lumps, PILLAR_MAP_FILE) && pillar.LoadAllLumps(PILLAR_MAP_FILE);
+        passed = Report("pillar map written and loaded", loaded) && CheckPillarTraces(pillar);
+    }
+    std::remove(PILLAR_MAP_FILE);
+    return passed;
+}
+
+// Random rays through the map against clipping each one by every brush's own sides, and random box moves whose
+// end has to be a place the box fits
+bool CheckTraces(const BSPMap& map, const std::string& mapFile) {
+    std::cout << "Collision traces" << std::endl;
+    bool passed = CheckBevelPillar(mapFile);
+    if (map.GetModels().empty()) {
+        return Report("map has a world model", false);
+    }
+
+    CollisionModel model(map);
+    const Model& world = map.GetModels()[0];
+    std::mt19937 random(1);
+    std::uniform_real_distribution<float> x(world.mins[0] - 32.0f, world.maxs[0] + 32.0f);
+    std::uniform_real_distribution<float> y(world.mins[1] - 32.0f, world.maxs[1] + 32.0f);
+    std::uniform_real_distribution<float> z(world.mins[2] - 32.0f, world.maxs[2] + 32.0f);
+    int compared = 0;
+    int differing = 0;
+    for (int i = 0; i < 20000; ++i) {
+        glm::vec3 start(x(random), y(random), z(random));
+        glm::vec3 end(x(random), y(random), z(random));
+        // Rays starting or ending within the tolerance of a surface can go either way
+        float grown = RayEnterWorld(map, start, end, MASK_SOLID, TRACE_TOLERANCE);
+        float shrunk = RayEnterWorld(map, start, end, MASK_SOLID, -TRACE_TOLERANCE);
+        if ((grown < 0.0f) != (shrunk < 0.0f) || grown == 0.0f) {
+            continue;
+        }
+        TraceResult trace = model.TraceRay(start, end, MASK_SOLID);
+        bool matches = shrunk < 0.0f ? trace.fraction == 1.0f : trace.fraction < 1.0f && trace.fraction >= grown && trace.fraction <= shrunk;
+        differing += matches ? 0 : 1;
+        ++compared;
+    }
+    std::cout << "  " << compared << " rays compared" << std::endl;
+    passed &= Report("rays stop where they enter the first brush", compared > 0 && differing == 0);
+
+    glm::vec3 mins(-15.0f, -15.0f, -24.0f), maxs(15.0f, 15.0f, 32.0f);
+    int moves = 0;
+    int stuck = 0;
+    for (int i = 0; i < 20000; ++i) {
+        glm::vec3 start(x(random), y(random), z(random));
+        glm::vec3 end(x(random), y(random), z(random));
+        // A move stops at fraction 0 on the first brush it starts against, like Q3, without looking for others
+        // it may already be stuck in. Only moves from places the box fits are checked.
+        if (model.TraceBox(start, start, mins, maxs, MASK_SOLID).startSolid) {
+            continue;
+        }
+        TraceResult move = model.TraceBox(start, end, mins, maxs, MASK_SOLID);
+        stuck += model.TraceBox(move.endPos, move.endPos, mins, maxs, MASK_SOLID).startSolid ? 1 : 0;
+        ++moves;
+    }
+    std::cout << "  " << moves << " box moves" << std::endl;
+    passed &= Report("boxes always end where they fit", moves > 0 && stuck == 0);
+    return passed;
+}
@@ -0,0 +1,63 @@
+#ifndef SELFTESTCOMMON_H
+#define SELFTESTCOMMON_H
+
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+#include "BSPMap.h"
+#include "ThreadPool.h"
+
+/*
+Shared by the self test checks, which are split by subsystem over the SelfTest*.cpp files and run in turn by
+RunSelfTest. A check that writes a map writes it to a temporary file of its own, so no check can read another's.
+*/
+
+// Work split over this many threads has to give the same result as on one, even on a single core machine
+static const unsigned SELFTEST_THREADS = 5;
+
+// Prints the result of one check and passes it on
+bool Report(const std::string& name, bool passed);
+
+template <typename T>
+std::vector<char> LumpBytes(const std::vector<T>& items) {
+    std::vector<char> bytes(items.size() * sizeof(T));
+    if (!bytes.empty()) {
+        std::memcpy(bytes.data(), items.data(), bytes.size());
+    }
+    return bytes;
+}
+
+template <typename T>
+bool SameBytes(const std::vector<T>& a, const std::vector<char>& b) {
+    return LumpBytes(a) == b;
+}
+
+// Writes mapFile with some lumps replaced to tempFile, the caller removes it again
+bool WriteSelfTestMap(const std::string& mapFile, const std::map<LumpType, std::vector<char>>& lumps, const char* tempFile);
+
+// The map's entities as entity lump text, and that text as a lump
+std::string EntityText(const BSPMap& map);
+std::vector<char> EntityLump(const std::string& text);
+
+// SelfTestCulling.cpp
+bool CheckOcclusion(ThreadPool& pool);
+bool CheckCullViews(const BSPMap& map);
+
+// SelfTestCollision.cpp, mapFile is the map under test
+bool CheckTraces(const BSPMap& map, const std::string& mapFile);
+
+// SelfTestLighting.cpp
+bool CheckClusteredLights();
+bool CheckLightGrid(const BSPMap& map);
+bool CheckVertexLighting(const BSPMap& map);
+// Whether the vertex colors are about as bright as the lightmap texels under them, also used on baked maps
+bool VertexColorsMatchLightmaps(const BSPMap& map);
+
+// SelfTestShadows.cpp
+bool CheckShadowAtlas(const BSPMap& map);
+
+// SelfTestBaker.cpp
+bool CheckBaker(const BSPMap& map, const std::string& mapFile, ThreadPool& pool);
+
+#endif // SELFTESTCOMMON_H
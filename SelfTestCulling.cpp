@@ -0,0 +1,89 @@
+#include "SelfTestCommon.h"
+#include "FrustumCuller.h"
+#include "OcclusionCuller.h"
+#include "Visibility.h"
+#include <glm/gtc/matrix_transform.hpp>
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+// A 100 unit square wall 100 units in front of a camera at the origin looking down -z, boxes behind, in front
+// of, beside and across the edge of it
+bool CheckOcclusion(ThreadPool& pool) {
+    std::cout << "Occlusion culling" << std::endl;
+    OcclusionCuller culler(pool);
+    glm::mat4 viewProjection = glm::perspective(glm::radians(90.0f), 4.0f / 3.0f, 4.0f, 8192.0f);
+    bool passed = true;
+
+    culler.SetOccluders(std::vector<glm::vec3>());
+    culler.Render(viewProjection);
+    passed &= Report("nothing is hidden without occluders", culler.IsBoxVisible(glm::vec3(-5.0f, -5.0f, -300.0f), glm::vec3(5.0f, 5.0f, -290.0f)));
+
+    std::vector<glm::vec3> wall = {
+        glm::vec3(-50.0f, -50.0f, -100.0f), glm::vec3(50.0f, -50.0f, -100.0f), glm::vec3(50.0f, 50.0f, -100.0f),
+        glm::vec3(-50.0f, -50.0f, -100.0f), glm::vec3(50.0f, 50.0f, -100.0f), glm::vec3(-50.0f, 50.0f, -100.0f)
+    };
+    culler.SetOccluders(wall);
+    culler.Render(viewProjection);
+    passed &= Report("box behind the wall is hidden", !culler.IsBoxVisible(glm::vec3(-5.0f, -5.0f, -300.0f), glm::vec3(5.0f, 5.0f, -290.0f)));
+    passed &= Report("box in front of the wall is visible", culler.IsBoxVisible(glm::vec3(-5.0f, -5.0f, -60.0f), glm::vec3(5.0f, 5.0f, -50.0f)));
+    passed &= Report("box beside the wall is visible", culler.IsBoxVisible(glm::vec3(200.0f, -5.0f, -300.0f), glm::vec3(210.0f, 5.0f, -290.0f)));
+    passed &= Report("box across the wall's edge is visible", culler.IsBoxVisible(glm::vec3(40.0f, -5.0f, -300.0f), glm::vec3(200.0f, 5.0f, -290.0f)));
+    passed &= Report("box across the near plane is visible", culler.IsBoxVisible(glm::vec3(-5.0f, -5.0f, -300.0f), glm::vec3(5.0f, 5.0f, 10.0f)));
+
+    // The batched test has to give the same answer as one box at a time
+    std::vector<glm::vec3> mins;
+    std::vector<glm::vec3> maxs;
+    for (int x = -8; x <= 8; ++x) {
+        for (int y = -6; y <= 6; ++y) {
+            glm::vec3 center(x * 12.0f, y * 12.0f, -150.0f - (x + y) * 4.0f);
+            mins.push_back(center - glm::vec3(3.0f));
+            maxs.push_back(center + glm::vec3(3.0f));
+        }
+    }
+    std::vector<unsigned char> visible;
+    culler.TestBoxes(mins, maxs, visible);
+    int differing = 0;
+    for (size_t i = 0; i < mins.size(); ++i) {
+        differing += (visible[i] != 0) != culler.IsBoxVisible(mins[i], maxs[i]) ? 1 : 0;
+    }
+    passed &= Report("batched box tests match single ones", differing == 0);
+    return passed;
+}
+
+// From the middle of every leaf with a cluster, four views a quarter turn apart culled in one CullViews traversal
+// against one FrustumCuller::Cull per view over the same PVS
+bool CheckCullViews(const BSPMap& map) {
+    std::cout << "Multi view culling" << std::endl;
+    Visibility visibility(map);
+    FrustumCuller reference(map);
+    glm::mat4 projection = glm::perspective(glm::radians(90.0f), 4.0f / 3.0f, 4.0f, 8192.0f);
+    const int viewCount = 4;
+    Frustum frusta[viewCount];
+    std::vector<int> viewLeafs[viewCount];
+    std::vector<int> referenceLeafs;
+    int positions = 0;
+    int differing = 0;
+    for (const Leaf& leaf : map.GetLeafs()) {
+        if (leaf.cluster < 0) {
+            continue;
+        }
+        glm::vec3 eye = (glm::vec3(leaf.mins[0], leaf.mins[1], leaf.mins[2]) + glm::vec3(leaf.maxs[0], leaf.maxs[1], leaf.maxs[2])) * 0.5f;
+        for (int v = 0; v < viewCount; ++v) {
+            float yaw = glm::radians(90.0f) * v + 0.3f;
+            glm::vec3 forward(std::cos(yaw), std::sin(yaw), -0.2f);
+            frusta[v].Extract(projection * glm::lookAt(eye, eye + forward, glm::vec3(0.0f, 0.0f, 1.0f)));
+        }
+        visibility.Update(eye, frusta[0]);
+        visibility.CullViews(frusta, viewCount, viewLeafs);
+        for (int v = 0; v < viewCount; ++v) {
+            reference.Cull(frusta[v], visibility.GetPVSLeafs(), true, referenceLeafs);
+            std::sort(referenceLeafs.begin(), referenceLeafs.end());
+            std::sort(viewLeafs[v].begin(), viewLeafs[v].end());
+            differing += viewLeafs[v] != referenceLeafs ? 1 : 0;
+        }
+        ++positions;
+    }
+    std::cout << "  " << positions << " positions, " << positions * viewCount << " views" << std::endl;
+    return Report("CullViews matches one Cull per view", positions > 0 && differing == 0);
+}
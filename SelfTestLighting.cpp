@@ -0,0 +1,224 @@
+#include "SelfTestCommon.h"
+#include "ClusteredLights.h"
+#include "ColorShift.h"
+#include "LightGrid.h"
+#include <glm/gtc/matrix_transform.hpp>
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <random>
+
+// A thousand lights in front of a camera binned on one thread and on several, then points inside every light's
+// sphere are put in a cluster the way bsp.frag does it and that cluster has to list the light
+bool CheckClusteredLights() {
+    std::cout << "Clustered lights" << std::endl;
+    const float nearPlane = 4.0f;
+    const float farPlane = 8192.0f;
+    glm::mat4 projection = glm::perspective(glm::radians(90.0f), 4.0f / 3.0f, nearPlane, farPlane);
+    glm::vec3 eye(10.0f, -20.0f, 5.0f);
+    glm::vec3 forward = glm::normalize(glm::vec3(190.0f, 320.0f, -5.0f));
+    glm::vec3 right = glm::normalize(glm::cross(forward, glm::vec3(0.0f, 0.0f, 1.0f)));
+    glm::vec3 up = glm::cross(right, forward);
+    glm::mat4 view = glm::lookAt(eye, eye + forward, glm::vec3(0.0f, 0.0f, 1.0f));
+    std::mt19937 random(1);
+    std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+    std::vector<DynamicLight> lights;
+    for (int i = 0; i < 1000; ++i) {
+        float depth = 5.0f + (unit(random) + 1.0f) * 750.0f;
+        DynamicLight light;
+        light.origin = eye + forward * depth + right * (unit(random) * depth * 1.5f) + up * (unit(random) * depth * 1.1f);
+        light.radius = 120.0f + unit(random) * 100.0f;
+        light.color = glm::vec3(1.0f);
+        lights.push_back(light);
+    }
+
+    ThreadPool single(1);
+    ThreadPool several(SELFTEST_THREADS);
+    ClusteredLights singleClusters(single);
+    ClusteredLights clusters(several);
+    singleClusters.Build(lights, view, projection);
+    clusters.Build(lights, view, projection);
+    bool sameLists = singleClusters.GetIndices() == clusters.GetIndices();
+    for (int cluster = 0; cluster < ClusteredLights::CLUSTER_COUNT; ++cluster) {
+        sameLists &= singleClusters.GetCluster(cluster)[0] == clusters.GetCluster(cluster)[0] &&
+            singleClusters.GetCluster(cluster)[1] == clusters.GetCluster(cluster)[1];
+    }
+    bool passed = Report("1 and " + std::to_string(SELFTEST_THREADS) + " threads bin the same lists", sameLists);
+
+    // bsp.frag's tile from the pixel and slice from the view depth
+    float depthScale = ClusteredLights::CLUSTERS_Z / std::log(farPlane / nearPlane);
+    float depthBias = -std::log(nearPlane) * depthScale;
+    int checked = 0;
+    int missed = 0;
+    for (int i = 0; i < static_cast<int>(lights.size()); ++i) {
+        for (int j = 0; j < 100; ++j) {
+            glm::vec3 offset(unit(random), unit(random), unit(random));
+            if (glm::dot(offset, offset) > 1.0f) {
+                continue;
+            }
+            glm::vec4 point = view * glm::vec4(lights[i].origin + offset * lights[i].radius * 0.999f, 1.0f);
+            glm::vec4 clip = projection * point;
+            float depth = -point.z;
+            if (depth <= nearPlane || depth >= farPlane || std::fabs(clip.x) >= clip.w || std::fabs(clip.y) >= clip.w) {
+                continue;
+            }
+            int tileX = std::min(static_cast<int>((clip.x / clip.w + 1.0f) * 0.5f * ClusteredLights::CLUSTERS_X), ClusteredLights::CLUSTERS_X - 1);
+            int tileY = std::min(static_cast<int>((clip.y / clip.w + 1.0f) * 0.5f * ClusteredLights::CLUSTERS_Y), ClusteredLights::CLUSTERS_Y - 1);
+            int slice = std::min(std::max(static_cast<int>(std::log(depth) * depthScale + depthBias), 0), ClusteredLights::CLUSTERS_Z - 1);
+            const GLuint* cluster = clusters.GetCluster((slice * ClusteredLights::CLUSTERS_Y + tileY) * ClusteredLights::CLUSTERS_X + tileX);
+            const GLuint* first = clusters.GetIndices().data() + cluster[0];
+            missed += std::find(first, first + cluster[1], static_cast<GLuint>(i)) == first + cluster[1] ? 1 : 0;
+            ++checked;
+        }
+    }
+    std::cout << "  " << checked << " points in " << lights.size() << " lights, " << clusters.GetIndexCount()
+        << " cluster entries" << std::endl;
+    passed &= Report("every point in a light's sphere is in a cluster listing it", checked > 0 && missed == 0);
+    return passed;
+}
+
+// R_SetupEntityLightingGrid one point at a time straight from the lump bytes, with LightGrid's clamping of points
+// outside the grid
+static LightSample ScalarGridSample(const BSPMap& map, const glm::vec3& position) {
+    glm::vec3 origin, size;
+    int bounds[3];
+    LightGrid::GetLayout(map, origin, size, bounds);
+    const std::vector<unsigned char>& data = map.GetLightVolumes();
+
+    int cell[3];
+    float frac[3];
+    for (int axis = 0; axis < 3; ++axis) {
+        float v = std::min(std::max((position[axis] - origin[axis]) / size[axis], 0.0f), static_cast<float>(bounds[axis] - 1));
+        cell[axis] = static_cast<int>(std::floor(v));
+        frac[axis] = v - cell[axis];
+    }
+
+    LightSample sample;
+    float totalFactor = 0.0f;
+    for (int corner = 0; corner < 8; ++corner) {
+        float factor = 1.0f;
+        int index = 0;
+        int stride = 1;
+        bool inside = true;
+        for (int axis = 0; axis < 3; ++axis) {
+            int c = cell[axis];
+            if (corner & (1 << axis)) {
+                factor *= frac[axis];
+                ++c;
+            }
+            else {
+                factor *= 1.0f - frac[axis];
+            }
+            inside = inside && c < bounds[axis];
+            index += c * stride;
+            stride *= bounds[axis];
+        }
+        const unsigned char* bytes = inside ? &data[index * 8] : nullptr;
+        if (!bytes || bytes[0] + bytes[1] + bytes[2] == 0) {
+            continue; // Past the grid or inside a wall
+        }
+
+        unsigned char colors[6];
+        std::copy(bytes, bytes + 6, colors);
+        ColorShiftLighting(colors, 2, MAP_OVERBRIGHT_BITS, LIGHTING_GAMMA);
+        float lat = bytes[7] * (2.0f * 3.14159265f / 256.0f);
+        float lng = bytes[6] * (2.0f * 3.14159265f / 256.0f);
+        totalFactor += factor;
+        sample.ambient += factor * glm::vec3(colors[0], colors[1], colors[2]);
+        sample.directed += factor * glm::vec3(colors[3], colors[4], colors[5]);
+        sample.direction += factor * glm::vec3(std::cos(lat) * std::sin(lng), std::sin(lat) * std::sin(lng), std::cos(lng));
+    }
+
+    if (totalFactor > 0.0f && totalFactor < 0.99f) {
+        sample.ambient /= totalFactor;
+        sample.directed /= totalFactor;
+    }
+    sample.ambient *= 0.6f; // r_ambientScale
+    if (glm::length(sample.direction) > 0.0f) {
+        sample.direction = glm::normalize(sample.direction);
+    }
+    return sample;
+}
+
+// SampleBatch, four points per SSE register, against the scalar port at random points in and around the world
+bool CheckLightGrid(const BSPMap& map) {
+    std::cout << "Light grid" << std::endl;
+    LightGrid grid;
+    if (!grid.Load(map)) {
+        std::cout << "  map has no light grid, skipped" << std::endl;
+        return true;
+    }
+
+    const Model& world = map.GetModels()[0];
+    std::mt19937 random(1);
+    std::uniform_real_distribution<float> x(world.mins[0] - 64.0f, world.maxs[0] + 64.0f);
+    std::uniform_real_distribution<float> y(world.mins[1] - 64.0f, world.maxs[1] + 64.0f);
+    std::uniform_real_distribution<float> z(world.mins[2] - 64.0f, world.maxs[2] + 64.0f);
+    // An odd count leaves a partly filled last group
+    std::vector<glm::vec3> positions(10001);
+    for (glm::vec3& position : positions) {
+        position = glm::vec3(x(random), y(random), z(random));
+    }
+    std::vector<LightSample> samples(positions.size());
+    grid.SampleBatch(positions.data(), static_cast<int>(positions.size()), samples.data());
+
+    float colorError = 0.0f;
+    float directionError = 0.0f;
+    int lit = 0;
+    for (size_t i = 0; i < positions.size(); ++i) {
+        LightSample reference = ScalarGridSample(map, positions[i]);
+        colorError = std::max(colorError, glm::length(samples[i].ambient - reference.ambient));
+        colorError = std::max(colorError, glm::length(samples[i].directed - reference.directed));
+        directionError = std::max(directionError, glm::length(samples[i].direction - reference.direction));
+        lit += glm::length(reference.ambient) > 0.0f ? 1 : 0;
+    }
+    std::cout << "  " << lit << " of " << positions.size() << " points lit, largest color difference " << colorError
+        << ", direction " << directionError << std::endl;
+    return Report("SampleBatch matches the scalar grid sample", colorError < 0.01f && directionError < 1e-4f);
+}
+
+// Vertex lit rendering uses the vertex colors baked next to the lightmaps. After the same color shift they have to
+// be about as bright as the lightmap texel under each vertex, or the vertex lit mode shows the map brighter or
+// darker than the lightmaps do.
+bool VertexColorsMatchLightmaps(const BSPMap& map) {
+    std::vector<Vertex> vertices(map.GetVertex());
+    ColorShiftVertexColors(vertices.data(), static_cast<int>(vertices.size()), MAP_OVERBRIGHT_BITS, LIGHTING_GAMMA);
+    std::vector<unsigned char> lightmaps(map.GetLightmaps());
+    ColorShiftLighting(lightmaps.data(), static_cast<int>(lightmaps.size() / 3), MAP_OVERBRIGHT_BITS, LIGHTING_GAMMA);
+
+    double vertexSum = 0.0;
+    double texelSum = 0.0;
+    double differenceSum = 0.0;
+    int compared = 0;
+    for (const Face& face : map.GetFaces()) {
+        if ((face.type != 1 && face.type != 3) || face.lm_index < 0 || face.lm_index >= map.GetLightmapCount()) {
+            continue;
+        }
+        for (int i = face.vertex; i < face.vertex + face.numVertices; ++i) {
+            const Vertex& vertex = vertices[i];
+            int x = std::min(std::max(static_cast<int>(vertex.lmCoord[0] * LIGHTMAP_SIZE), 0), LIGHTMAP_SIZE - 1);
+            int y = std::min(std::max(static_cast<int>(vertex.lmCoord[1] * LIGHTMAP_SIZE), 0), LIGHTMAP_SIZE - 1);
+            const unsigned char* texel = &lightmaps[face.lm_index * LIGHTMAP_BYTES + (y * LIGHTMAP_SIZE + x) * 3];
+            double vertexBrightness = vertex.color[0] + vertex.color[1] + vertex.color[2];
+            double texelBrightness = texel[0] + texel[1] + texel[2];
+            vertexSum += vertexBrightness;
+            texelSum += texelBrightness;
+            differenceSum += std::fabs(vertexBrightness - texelBrightness);
+            ++compared;
+        }
+    }
+    if (compared == 0) {
+        return true;
+    }
+    double ratio = vertexSum / std::max(texelSum, 1.0);
+    double difference = differenceSum / compared / 3.0;
+    std::cout << "  " << compared << " vertices, " << ratio << " times as bright as the lightmaps, "
+        << difference << " apart per channel" << std::endl;
+    return ratio > 0.8 && ratio < 1.25 && difference < 16.0;
+}
+
+bool CheckVertexLighting(const BSPMap& map) {
+    std::cout << "Vertex lighting" << std::endl;
+    return Report("shifted vertex colors match the shifted lightmaps", VertexColorsMatchLightmaps(map));
+}
+
@@ -0,0 +1,134 @@
+#include "SelfTestCommon.h"
+#include "ShadowAtlas.h"
+#include <glm/gtc/matrix_transform.hpp>
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <random>
+
+// bsp.frag's LightShadow without the tile: the cube face toPoint falls on, where on the face and at what depth
+static int ShaderShadowFace(const glm::vec3& toPoint, float radius, glm::vec3& faceDepth) {
+    const float shadowNear = 4.0f;
+    glm::vec3 axis = glm::abs(toPoint);
+    int face;
+    float major;
+    glm::vec2 st;
+    if (axis.x >= axis.y && axis.x >= axis.z) {
+        face = toPoint.x > 0.0f ? 0 : 1;
+        major = axis.x;
+        st = glm::vec2(toPoint.x > 0.0f ? -toPoint.z : toPoint.z, -toPoint.y);
+    }
+    else if (axis.y >= axis.z) {
+        face = toPoint.y > 0.0f ? 2 : 3;
+        major = axis.y;
+        st = glm::vec2(toPoint.x, toPoint.y > 0.0f ? toPoint.z : -toPoint.z);
+    }
+    else {
+        face = toPoint.z > 0.0f ? 4 : 5;
+        major = axis.z;
+        st = glm::vec2(toPoint.z > 0.0f ? toPoint.x : -toPoint.x, -toPoint.y);
+    }
+    float farPlane = std::max(radius, shadowNear * 2.0f);
+    float depth = (farPlane + shadowNear - 2.0f * farPlane * shadowNear / std::max(major, shadowNear)) / (farPlane - shadowNear);
+    faceDepth = glm::vec3(st.x / major, st.y / major, depth) * 0.5f + glm::vec3(0.5f);
+    return major > shadowNear ? face : -1;
+}
+
+// The tiles of every shadow have to lie inside the atlas without overlapping each other
+static bool ShadowTilesFit(const ShadowAtlas& atlas) {
+    std::vector<glm::ivec3> tiles;
+    for (const ShadowAtlas::Shadow& shadow : atlas.GetShadows()) {
+        tiles.insert(tiles.end(), shadow.faces, shadow.faces + 6);
+    }
+    for (size_t i = 0; i < tiles.size(); ++i) {
+        if (tiles[i].x < 0 || tiles[i].y < 0 || tiles[i].x + tiles[i].z > ShadowAtlas::ATLAS_SIZE ||
+            tiles[i].y + tiles[i].z > ShadowAtlas::ATLAS_SIZE) {
+            return false;
+        }
+        for (size_t j = 0; j < i; ++j) {
+            if (tiles[i].x < tiles[j].x + tiles[j].z && tiles[j].x < tiles[i].x + tiles[i].z &&
+                tiles[i].y < tiles[j].y + tiles[j].z && tiles[j].y < tiles[i].y + tiles[i].z) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// Face matrices against the shader's face lookup, tiles of lights coming and going, and a light sitting on a tile
+// size threshold. Update never touches GL, the atlas's targets are left uncreated.
+bool CheckShadowAtlas(const BSPMap& map) {
+    std::cout << "Shadow atlas" << std::endl;
+    std::mt19937 random(1);
+    std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+    glm::vec3 origin(100.0f, -50.0f, 30.0f);
+    const float radius = 300.0f;
+    float largestError = 0.0f;
+    int outside = 0;
+    for (int i = 0; i < 20000; ++i) {
+        glm::vec3 toPoint = glm::vec3(unit(random), unit(random), unit(random)) * radius;
+        glm::vec3 expected;
+        int face = ShaderShadowFace(toPoint, radius, expected);
+        if (face < 0) {
+            continue;
+        }
+        glm::vec4 clip = ShadowAtlas::FaceMatrix(origin, radius, face) * glm::vec4(origin + toPoint, 1.0f);
+        glm::vec3 projected = glm::vec3(clip) / clip.w * 0.5f + glm::vec3(0.5f);
+        largestError = std::max(largestError, glm::length(projected - expected));
+        outside += projected.x < 0.0f || projected.x > 1.0f || projected.y < 0.0f || projected.y > 1.0f ? 1 : 0;
+    }
+    std::cout << "  largest face matrix difference " << largestError << std::endl;
+    bool passed = Report("face matrices put points where bsp.frag looks for them", largestError < 1e-4f && outside == 0);
+
+    ShadowAtlas atlas(map);
+    const float screenHeight = 600.0f;
+    glm::mat4 projection = glm::perspective(glm::radians(90.0f), 4.0f / 3.0f, 4.0f, 8192.0f);
+    glm::mat4 view(1.0f);
+    std::vector<ModelInstance> instances;
+    bool tilesFit = true;
+    for (int frame = 0; frame < 8; ++frame) {
+        // More lights than shadows, some new every frame so old tiles are taken over
+        std::vector<DynamicLight> lights;
+        for (int i = 0; i < 40; ++i) {
+            DynamicLight light;
+            light.origin = glm::vec3((i % 8 - 4) * 60.0f, (i / 8 - 2) * 60.0f, -(100.0f + i * 40.0f + frame * 150.0f));
+            light.radius = 100.0f;
+            light.id = i + frame * 5;
+            lights.push_back(light);
+        }
+        atlas.Update(lights, instances, view, projection, screenHeight);
+        tilesFit &= atlas.GetShadows().size() == static_cast<size_t>(ShadowAtlas::MAX_SHADOWS) && ShadowTilesFit(atlas);
+    }
+    passed &= Report("tiles stay inside the atlas without overlapping", tilesFit);
+
+    // A light that stays put with the camera moving towards and away from it. The distance for a screen radius
+    // follows ShadowAtlas::Update.
+    const float lightRadius = 50.0f;
+    std::vector<DynamicLight> lights(1);
+    lights[0].origin = glm::vec3(0.0f, 0.0f, -1000.0f);
+    lights[0].radius = lightRadius;
+    lights[0].id = 1000;
+    auto viewFor = [&](float screenRadius) {
+        float tangent = lightRadius * projection[1][1] * screenHeight * 0.5f / screenRadius;
+        float distance = std::sqrt(tangent * tangent + lightRadius * lightRadius);
+        return glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, 0.0f, 1000.0f - distance));
+    };
+    int redrawn = 0;
+    int tileSize = 0;
+    for (int frame = 0; frame < 10; ++frame) {
+        // Either side of the 128 pixel threshold between 256 and 128 texel tiles, after starting above it
+        float screenRadius = frame == 0 ? 160.0f : frame % 2 ? 120.0f : 136.0f;
+        atlas.Update(lights, instances, viewFor(screenRadius), projection, screenHeight);
+        if (atlas.GetShadows().empty()) {
+            ++redrawn;
+            continue;
+        }
+        redrawn += frame > 0 && atlas.GetShadows()[0].updateCache ? 1 : 0;
+        tileSize = atlas.GetShadows()[0].faces[0].z;
+    }
+    passed &= Report("a light on a tile size threshold keeps its tiles", redrawn == 0 && tileSize == ShadowAtlas::MAX_FACE_SIZE);
+    atlas.Update(lights, instances, viewFor(90.0f), projection, screenHeight);
+    passed &= Report("a light well past the threshold gets smaller tiles", !atlas.GetShadows().empty() &&
+        atlas.GetShadows()[0].updateCache && atlas.GetShadows()[0].faces[0].z < ShadowAtlas::MAX_FACE_SIZE);
+    return passed;
+}
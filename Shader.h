@@ -13,8 +13,9 @@ class Shader {
 public:
     unsigned int ID; // Shader program ID
 
-    // Constructor reads and builds the shader
-    Shader(const char* vertexPath, const char* fragmentPath) {
+    // Constructor reads and builds the shader. defines, if given, goes right after the #version line of both
+    // stages, so one source can build several permutations ("#define VERTEX_LIT\n").
+    Shader(const char* vertexPath, const char* fragmentPath, const char* defines = nullptr) {
         // 1. Retrieve the vertex/fragment source code from filePath
         std::string vertexCode;
         std::string fragmentCode;
@@ -46,6 +47,10 @@ public:
         catch (std::ifstream::failure& e) {
             std::cout << "ERROR::SHADER::FILE_NOT_SUCCESFULLY_READ" << std::endl;
         }
+        if (defines) {
+            insertDefines(vertexCode, defines);
+            insertDefines(fragmentCode, defines);
+        }
 
         const char* vShaderCode = vertexCode.c_str();
         const char* fShaderCode = fragmentCode.c_str();
@@ -79,6 +84,35 @@ public:
         glDeleteShader(fragment);
     }
 
+    // Builds a compute-only program, needs GL 4.3
+    explicit Shader(const char* computePath) {
+        std::string computeCode;
+        std::ifstream cShaderFile;
+        cShaderFile.exceptions(std::ifstream::failbit | std::ifstream::badbit);
+        try {
+            cShaderFile.open(computePath);
+            std::stringstream cShaderStream;
+            cShaderStream << cShaderFile.rdbuf();
+            cShaderFile.close();
+            computeCode = cShaderStream.str();
+        }
+        catch (std::ifstream::failure& e) {
+            std::cout << "ERROR::SHADER::FILE_NOT_SUCCESFULLY_READ" << std::endl;
+        }
+        const char* cShaderCode = computeCode.c_str();
+
+        unsigned int compute = glCreateShader(GL_COMPUTE_SHADER);
+        glShaderSource(compute, 1, &cShaderCode, NULL);
+        glCompileShader(compute);
+        checkCompileErrors(compute, "COMPUTE");
+
+        ID = glCreateProgram();
+        glAttachShader(ID, compute);
+        glLinkProgram(ID);
+        checkCompileErrors(ID, "PROGRAM");
+        glDeleteShader(compute);
+    }
+
     // Use/activate the shader
     void use() {
         glUseProgram(ID);
@@ -93,6 +127,15 @@ public:
     void setFloat(const std::string& name, float value) const {
         glUniform1f(glGetUniformLocation(ID, name.c_str()), value);
     }
+    void setVec2(const std::string& name, const glm::vec2& value) const {
+        glUniform2f(glGetUniformLocation(ID, name.c_str()), value.x, value.y);
+    }
+    void setVec3(const std::string& name, const glm::vec3& value) const {
+        glUniform3f(glGetUniformLocation(ID, name.c_str()), value.x, value.y, value.z);
+    }
+    void setVec4Array(const std::string& name, const glm::vec4* values, int count) const {
+        glUniform4fv(glGetUniformLocation(ID, name.c_str()), count, &values[0][0]);
+    }
     // Add other uniform setters here
 
     // Method for setting a 4x4 matrix uniform
@@ -103,6 +146,12 @@ public:
     // Include implementations for setting uniforms as previously detailed
 
 private:
+    // #version has to stay the first line
+    static void insertDefines(std::string& code, const char* defines) {
+        size_t lineEnd = code.find('\n');
+        code.insert(lineEnd == std::string::npos ? code.size() : lineEnd + 1, defines);
+    }
+
     void checkCompileErrors(GLuint shader, std::string type) {
         GLint success;
         GLchar infoLog[1024];
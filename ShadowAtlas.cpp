@@ -0,0 +1,331 @@
+#include "ShadowAtlas.h"
+#include "Frustum.h"
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+static const float SHADOW_NEAR = 4.0f;        // bsp.frag uses the same near plane
+static const float SHADOW_MOVE_EPSILON = 0.5f; // A light that moves less keeps its cached world tiles
+static const float LEVEL_HYSTERESIS = 0.25f;   // How far past a tile size threshold the screen radius has to go
+
+// Major axis, then the directions that go to x and y of each cube face, in the order of GL's cube map faces
+static const glm::vec3 FACE_AXES[6][3] = {
+    { glm::vec3(1.0f, 0.0f, 0.0f), glm::vec3(0.0f, 0.0f, -1.0f), glm::vec3(0.0f, -1.0f, 0.0f) },
+    { glm::vec3(-1.0f, 0.0f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f), glm::vec3(0.0f, -1.0f, 0.0f) },
+    { glm::vec3(0.0f, 1.0f, 0.0f), glm::vec3(1.0f, 0.0f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f) },
+    { glm::vec3(0.0f, -1.0f, 0.0f), glm::vec3(1.0f, 0.0f, 0.0f), glm::vec3(0.0f, 0.0f, -1.0f) },
+    { glm::vec3(0.0f, 0.0f, 1.0f), glm::vec3(1.0f, 0.0f, 0.0f), glm::vec3(0.0f, -1.0f, 0.0f) },
+    { glm::vec3(0.0f, 0.0f, -1.0f), glm::vec3(-1.0f, 0.0f, 0.0f), glm::vec3(0.0f, -1.0f, 0.0f) }
+};
+
+static GLuint CreateDepthTexture() {
+    GLuint texture;
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, ShadowAtlas::ATLAS_SIZE, ShadowAtlas::ATLAS_SIZE, 0, GL_DEPTH_COMPONENT, GL_FLOAT, nullptr);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    // Lets the shaders filter the depth comparison of four texels
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    return texture;
+}
+
+static GLuint CreateDepthFramebuffer(GLuint texture) {
+    GLuint framebuffer;
+    glGenFramebuffers(1, &framebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, texture, 0);
+    glDrawBuffer(GL_NONE);
+    glReadBuffer(GL_NONE);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+        std::cerr << "Shadow atlas framebuffer is incomplete." << std::endl;
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    return framebuffer;
+}
+
+// Tile level whose texels are about as large as a pixel of a light screenRadius pixels across
+static int TileLevel(float screenRadius) {
+    int level = 0;
+    while (level < ShadowAtlas::TILE_LEVELS - 1 && screenRadius <= (ShadowAtlas::MAX_FACE_SIZE >> (level + 1))) {
+        ++level;
+    }
+    return level;
+}
+
+ShadowAtlas::ShadowAtlas(const BSPMap& map) : map(map), nodeStates(TILE_LEVELS) {
+    // The atlas starts as free tiles of the largest size
+    for (int level = 0; level < TILE_LEVELS; ++level) {
+        nodeStates[level].assign(LevelGridSize(level) * LevelGridSize(level), level == 0 ? NODE_FREE : NODE_COVERED);
+    }
+}
+
+ShadowAtlas::~ShadowAtlas() {
+    // Targets are only made by CreateTargets
+    if (texture) {
+        glDeleteFramebuffers(1, &staticFramebuffer);
+        glDeleteFramebuffers(1, &framebuffer);
+        glDeleteTextures(1, &staticTexture);
+        glDeleteTextures(1, &texture);
+    }
+}
+
+void ShadowAtlas::CreateTargets() {
+    if (texture) {
+        return;
+    }
+    staticTexture = CreateDepthTexture();
+    texture = CreateDepthTexture();
+    staticFramebuffer = CreateDepthFramebuffer(staticTexture);
+    framebuffer = CreateDepthFramebuffer(texture);
+}
+
+int ShadowAtlas::AllocateNode(int level) {
+    std::vector<unsigned char>& states = nodeStates[level];
+    for (size_t i = 0; i < states.size(); ++i) {
+        if (states[i] == NODE_FREE) {
+            states[i] = NODE_USED;
+            return static_cast<int>(i);
+        }
+    }
+    if (level == 0) {
+        return -1;
+    }
+
+    // Split a larger tile, the first quarter is used and the other three are free
+    int parent = AllocateNode(level - 1);
+    if (parent < 0) {
+        return -1;
+    }
+    nodeStates[level - 1][parent] = NODE_SPLIT;
+    int parentGrid = LevelGridSize(level - 1);
+    int grid = LevelGridSize(level);
+    int first = (parent / parentGrid) * 2 * grid + (parent % parentGrid) * 2;
+    states[first] = NODE_USED;
+    states[first + 1] = NODE_FREE;
+    states[first + grid] = NODE_FREE;
+    states[first + grid + 1] = NODE_FREE;
+    return first;
+}
+
+void ShadowAtlas::FreeNode(int level, int node) {
+    std::vector<unsigned char>& states = nodeStates[level];
+    states[node] = NODE_FREE;
+    if (level == 0) {
+        return;
+    }
+
+    // Four free quarters join back into one free tile
+    int grid = LevelGridSize(level);
+    int x = node % grid;
+    int y = node / grid;
+    int first = (y & ~1) * grid + (x & ~1);
+    if (states[first] == NODE_FREE && states[first + 1] == NODE_FREE && states[first + grid] == NODE_FREE &&
+        states[first + grid + 1] == NODE_FREE) {
+        states[first] = NODE_COVERED;
+        states[first + 1] = NODE_COVERED;
+        states[first + grid] = NODE_COVERED;
+        states[first + grid + 1] = NODE_COVERED;
+        FreeNode(level - 1, (y / 2) * (grid / 2) + x / 2);
+    }
+}
+
+bool ShadowAtlas::AllocateFaces(int level, int nodes[6]) {
+    for (int face = 0; face < 6; ++face) {
+        nodes[face] = AllocateNode(level);
+        if (nodes[face] < 0) {
+            for (int i = 0; i < face; ++i) {
+                FreeNode(level, nodes[i]);
+            }
+            return false;
+        }
+    }
+    return true;
+}
+
+void ShadowAtlas::FreeLight(const CachedLight& light) {
+    for (int face = 0; face < 6; ++face) {
+        FreeNode(light.level, light.nodes[face]);
+    }
+}
+
+bool ShadowAtlas::EvictOldest() {
+    // Lights already shadowed this frame keep their tiles
+    auto oldest = cache.end();
+    for (auto it = cache.begin(); it != cache.end(); ++it) {
+        if (it->second.lastFrame < frame && (oldest == cache.end() || it->second.lastFrame < oldest->second.lastFrame)) {
+            oldest = it;
+        }
+    }
+    if (oldest == cache.end()) {
+        return false;
+    }
+    FreeLight(oldest->second);
+    cache.erase(oldest);
+    return true;
+}
+
+glm::ivec3 ShadowAtlas::NodeTile(int level, int node) const {
+    int size = MAX_FACE_SIZE >> level;
+    int grid = LevelGridSize(level);
+    return glm::ivec3((node % grid) * size, (node / grid) * size, size);
+}
+
+glm::mat4 ShadowAtlas::FaceMatrix(const glm::vec3& origin, float radius, int face) {
+    // A 90 degree perspective looking down the major axis, written out row by row: x and y are the face
+    // directions, w is the distance along the axis and z maps it from SHADOW_NEAR to the radius
+    float farPlane = std::max(radius, SHADOW_NEAR * 2.0f);
+    float a = (farPlane + SHADOW_NEAR) / (farPlane - SHADOW_NEAR);
+    float b = -2.0f * farPlane * SHADOW_NEAR / (farPlane - SHADOW_NEAR);
+    const glm::vec3& major = FACE_AXES[face][0];
+    const glm::vec3& s = FACE_AXES[face][1];
+    const glm::vec3& t = FACE_AXES[face][2];
+
+    glm::mat4 matrix(0.0f);
+    for (int i = 0; i < 3; ++i) {
+        matrix[i][0] = s[i];
+        matrix[i][1] = t[i];
+        matrix[i][2] = a * major[i];
+        matrix[i][3] = major[i];
+    }
+    matrix[3][0] = -glm::dot(s, origin);
+    matrix[3][1] = -glm::dot(t, origin);
+    matrix[3][2] = -a * glm::dot(major, origin) + b;
+    matrix[3][3] = -glm::dot(major, origin);
+    return matrix;
+}
+
+void ShadowAtlas::Update(std::vector<DynamicLight>& lights, const std::vector<ModelInstance>& instances,
+    const glm::mat4& view, const glm::mat4& projection, float screenHeight) {
+    ++frame;
+    shadows.clear();
+    faceUniforms.clear();
+
+    // Only lights whose sphere is in view are worth a shadow, the ones largest on screen go first
+    Frustum frustum;
+    frustum.Extract(projection * view);
+    candidates.clear();
+    for (size_t i = 0; i < lights.size(); ++i) {
+        DynamicLight& light = lights[i];
+        light.shadow = -1;
+        if (light.id < 0 || !frustum.IntersectsBox(light.origin - glm::vec3(light.radius), light.origin + glm::vec3(light.radius))) {
+            continue;
+        }
+        glm::vec3 viewOrigin = glm::vec3(view * glm::vec4(light.origin, 1.0f));
+        float tangentSquared = glm::dot(viewOrigin, viewOrigin) - light.radius * light.radius;
+        float screenRadius = screenHeight;
+        if (tangentSquared > 1.0f) {
+            screenRadius = std::min(light.radius / std::sqrt(tangentSquared) * projection[1][1] * screenHeight * 0.5f, screenHeight);
+        }
+        candidates.push_back(std::make_pair(screenRadius, static_cast<int>(i)));
+    }
+    std::sort(candidates.begin(), candidates.end(), [](const std::pair<float, int>& a, const std::pair<float, int>& b) {
+        return a.first > b.first || (a.first == b.first && a.second < b.second);
+    });
+    if (candidates.size() > static_cast<size_t>(MAX_SHADOWS)) {
+        candidates.resize(MAX_SHADOWS);
+    }
+    if (candidates.empty()) {
+        return;
+    }
+
+    const std::vector<Model>& models = map.GetModels();
+    instanceMins.resize(instances.size());
+    instanceMaxs.resize(instances.size());
+    for (size_t i = 0; i < instances.size(); ++i) {
+        // Instances without a model get an inverted box that never touches a light
+        instanceMins[i] = glm::vec3(1.0f);
+        instanceMaxs[i] = glm::vec3(-1.0f);
+        int model = instances[i].model;
+        if (model > 0 && model < static_cast<int>(models.size())) {
+            TransformBounds(instances[i].transform, glm::vec3(models[model].mins[0], models[model].mins[1], models[model].mins[2]),
+                glm::vec3(models[model].maxs[0], models[model].maxs[1], models[model].maxs[2]), instanceMins[i], instanceMaxs[i]);
+        }
+    }
+
+    for (const std::pair<float, int>& candidate : candidates) {
+        DynamicLight& light = lights[candidate.second];
+
+        // A light with tiles keeps their size until its screen radius is well past the threshold, one that sits
+        // on it would otherwise get new tiles and redraw the world into them every frame
+        int level = TileLevel(candidate.first);
+        auto cached = cache.find(light.id);
+        if (cached != cache.end() && level > cached->second.level) {
+            level = std::max(TileLevel(candidate.first * (1.0f + LEVEL_HYSTERESIS)), cached->second.level);
+        }
+        else if (cached != cache.end() && level < cached->second.level) {
+            level = std::min(TileLevel(candidate.first / (1.0f + LEVEL_HYSTERESIS)), cached->second.level);
+        }
+
+        bool updateCache = false;
+        if (cached != cache.end() && cached->second.level != level) {
+            FreeLight(cached->second);
+            cache.erase(cached);
+            cached = cache.end();
+        }
+        if (cached == cache.end()) {
+            CachedLight newLight;
+            newLight.level = level;
+            bool allocated = false;
+            while (!(allocated = AllocateFaces(newLight.level, newLight.nodes))) {
+                if (EvictOldest()) {
+                    continue;
+                }
+                if (newLight.level + 1 >= TILE_LEVELS) {
+                    break;
+                }
+                ++newLight.level;
+            }
+            if (!allocated) {
+                continue;
+            }
+            newLight.hadCasters = false;
+            cached = cache.insert(std::make_pair(light.id, newLight)).first;
+            updateCache = true;
+        }
+
+        CachedLight& entry = cached->second;
+        if (updateCache || glm::distance(entry.origin, light.origin) > SHADOW_MOVE_EPSILON || entry.radius != light.radius) {
+            entry.origin = light.origin;
+            entry.radius = light.radius;
+            updateCache = true;
+        }
+        entry.lastFrame = frame;
+
+        Shadow shadow;
+        shadow.origin = entry.origin;
+        shadow.radius = entry.radius;
+        for (size_t i = 0; i < instances.size(); ++i) {
+            glm::vec3 closest = glm::clamp(entry.origin, instanceMins[i], instanceMaxs[i]);
+            if (instanceMins[i].x <= instanceMaxs[i].x && glm::dot(closest - entry.origin, closest - entry.origin) < entry.radius * entry.radius) {
+                shadow.casters.push_back(static_cast<int>(i));
+            }
+        }
+        // Tiles that held casters last frame need the clean copy even when nothing is near now
+        shadow.updateCache = updateCache;
+        shadow.updateAtlas = updateCache || !shadow.casters.empty() || entry.hadCasters;
+        entry.hadCasters = !shadow.casters.empty();
+
+        for (int face = 0; face < 6; ++face) {
+            shadow.faces[face] = NodeTile(entry.level, entry.nodes[face]);
+            faceUniforms.push_back(glm::vec4(glm::vec3(shadow.faces[face]) / static_cast<float>(ATLAS_SIZE), 0.5f / shadow.faces[face].z));
+        }
+        light.shadow = static_cast<int>(shadows.size());
+        shadows.push_back(shadow);
+    }
+}
+
+void ShadowAtlas::Bind(const Shader& shader, int unit) const {
+    glActiveTexture(GL_TEXTURE0 + unit);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glActiveTexture(GL_TEXTURE0);
+
+    shader.setInt("shadowAtlas", unit);
+    if (!faceUniforms.empty()) {
+        shader.setVec4Array("shadowFaces", faceUniforms.data(), static_cast<int>(faceUniforms.size()));
+    }
+}
@@ -0,0 +1,105 @@
+#ifndef SHADOWATLAS_H
+#define SHADOWATLAS_H
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <unordered_map>
+#include <vector>
+#include "BSPMap.h"
+#include "ClusteredLights.h"
+#include "Shader.h"
+
+/*
+Shadows for dynamic point lights. Every shadowed light gets six square tiles in a depth atlas, one per cube face.
+The static world only changes when the light moves, so it is drawn into a cached copy of the atlas once and kept
+there. Each frame the tiles of lights with moving models nearby are copied from the cache into the atlas the
+shaders sample, and only those models are drawn on top.
+
+Tiles come from a quadtree over the atlas, with a tile size picked from how large the light's sphere is on
+screen. Lights keep their tiles between frames while they are in view, and their tile size until the sphere is a
+quarter past the size where it would change. When the atlas is full, the tiles of the
+light that was seen longest ago are taken, and a light that still doesn't fit tries smaller tiles.
+*/
+
+class ShadowAtlas {
+public:
+    static const int ATLAS_SIZE = 2048;
+    static const int MAX_FACE_SIZE = 256;     // Tile size for lights that cover a lot of the screen
+    static const int TILE_LEVELS = 3;         // 256, 128 and 64 texel tiles
+    static const int MAX_SHADOWS = 16;        // Shadowed lights per frame, bsp.frag has the same limit
+
+    // What the renderer has to draw for one shadowed light this frame
+    struct Shadow {
+        glm::vec3 origin;
+        float radius;
+        glm::ivec3 faces[6];        // Atlas tile of each cube face, corner and size in texels
+        bool updateCache;           // The world has to be drawn into the cached tiles
+        bool updateAtlas;           // The tiles have to be copied from the cache and the casters drawn on top
+        std::vector<int> casters;   // Instances whose bounds touch the light
+    };
+
+    explicit ShadowAtlas(const BSPMap& map);
+    ~ShadowAtlas();
+
+    ShadowAtlas(const ShadowAtlas&) = delete;
+    ShadowAtlas& operator=(const ShadowAtlas&) = delete;
+
+    // Makes the depth textures and framebuffers, needs a GL context. Update works without them.
+    void CreateTargets();
+
+    // Picks the lights with an id that get a shadow this frame and sets their shadow field, -1 for the rest.
+    // view and projection are the camera's (BSPRenderer), screenHeight is in pixels.
+    void Update(std::vector<DynamicLight>& lights, const std::vector<ModelInstance>& instances,
+        const glm::mat4& view, const glm::mat4& projection, float screenHeight);
+
+    const std::vector<Shadow>& GetShadows() const { return shadows; }
+    GLuint GetStaticFramebuffer() const { return staticFramebuffer; }
+    GLuint GetFramebuffer() const { return framebuffer; }
+
+    // Binds the atlas to unit and sets the tile uniforms, the shader must be in use
+    void Bind(const Shader& shader, int unit) const;
+
+    // Map space to clip space of one cube face, laid out like GL's cube map faces so the shader can pick the face
+    // and texel from the direction alone
+    static glm::mat4 FaceMatrix(const glm::vec3& origin, float radius, int face);
+
+private:
+    enum NodeState : unsigned char {
+        NODE_COVERED,   // Part of a larger tile
+        NODE_FREE,
+        NODE_SPLIT,
+        NODE_USED
+    };
+
+    struct CachedLight {
+        int level;
+        int nodes[6];
+        glm::vec3 origin;   // Where the cached tiles were drawn from
+        float radius;
+        int lastFrame;      // Last frame the light was shadowed
+        bool hadCasters;    // The atlas tiles still hold last frame's casters
+    };
+
+    int AllocateNode(int level);
+    void FreeNode(int level, int node);
+    bool AllocateFaces(int level, int nodes[6]);
+    void FreeLight(const CachedLight& light);
+    bool EvictOldest();
+    glm::ivec3 NodeTile(int level, int node) const;
+    int LevelGridSize(int level) const { return ATLAS_SIZE / (MAX_FACE_SIZE >> level); }
+
+    const BSPMap& map;
+    int frame = 0;
+    std::vector<std::vector<unsigned char>> nodeStates;   // Per level, row by row
+    std::unordered_map<int, CachedLight> cache;           // By light id
+    std::vector<Shadow> shadows;
+    std::vector<glm::vec4> faceUniforms;                  // Tile corner and size in atlas units, half a texel in tile units
+    std::vector<std::pair<float, int>> candidates;        // Screen radius and light, scratch
+    std::vector<glm::vec3> instanceMins;                  // Map space bounds of every instance, scratch
+    std::vector<glm::vec3> instanceMaxs;
+
+    GLuint staticTexture = 0, texture = 0;
+    GLuint staticFramebuffer = 0, framebuffer = 0;
+};
+
+#endif // SHADOWATLAS_H
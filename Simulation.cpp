@@ -0,0 +1,164 @@
+#include "Simulation.h"
+#include <algorithm>
+#include <cmath>
+
+// Added to how far an entity's velocity takes it in a tick, covers acceleration and stepping up ledges
+static const float REACH_MARGIN = 32.0f;
+
+static bool BoxesOverlap(const glm::vec3& a, const glm::vec3& b) {
+    glm::vec3 size = PlayerMove::MAXS - PlayerMove::MINS;
+    return std::abs(a.x - b.x) < size.x && std::abs(a.y - b.y) < size.y && std::abs(a.z - b.z) < size.z;
+}
+
+Simulation::Simulation(const CollisionModel& collision, ThreadPool& threadPool, const glm::vec3& worldMins, const glm::vec3& worldMaxs)
+    : collision(collision), threadPool(threadPool), reachGrid(worldMins, worldMaxs) {
+    playerMoves.reserve(threadPool.GetThreadCount());
+    for (int i = 0; i < threadPool.GetThreadCount(); ++i) {
+        playerMoves.emplace_back(collision);
+    }
+    islandStarts.push_back(0);
+}
+
+int Simulation::AddEntity(const PlayerState& state) {
+    SimEntity entity;
+    entity.state = state;
+    entity.broadphaseEntity = reachGrid.Add(state.origin + PlayerMove::MINS, state.origin + PlayerMove::MAXS, CONTENTS_BODY);
+    entities.push_back(entity);
+    islandParents.push_back(0);
+    return static_cast<int>(entities.size()) - 1;
+}
+
+void Simulation::BuildIslands() {
+    const int count = static_cast<int>(entities.size());
+    for (int i = 0; i < count; ++i) {
+        SimEntity& entity = entities[i];
+        float reach = glm::length(entity.state.velocity) * PlayerMove::TICK_SECONDS + REACH_MARGIN;
+        reachGrid.Move(entity.broadphaseEntity, entity.state.origin + PlayerMove::MINS - glm::vec3(reach), entity.state.origin + PlayerMove::MAXS + glm::vec3(reach));
+        islandParents[i] = i;
+    }
+
+    // Entities are added in order and never removed, so reach grid handles are entity indices
+    auto findRoot = [this](int entity) {
+        while (islandParents[entity] != entity) {
+            islandParents[entity] = islandParents[islandParents[entity]];
+            entity = islandParents[entity];
+        }
+        return entity;
+    };
+    reachGrid.FindPairs(pairs);
+    neighborStarts.assign(count + 1, 0);
+    for (const std::pair<int, int>& pair : pairs) {
+        int first = findRoot(pair.first);
+        int second = findRoot(pair.second);
+        if (first != second) {
+            islandParents[std::max(first, second)] = std::min(first, second);
+        }
+        ++neighborStarts[pair.first + 1];
+        ++neighborStarts[pair.second + 1];
+    }
+    for (int i = 0; i < count; ++i) {
+        neighborStarts[i + 1] += neighborStarts[i];
+    }
+    neighbors.resize(pairs.size() * 2);
+    std::vector<int> nextNeighbor(neighborStarts.begin(), neighborStarts.end() - 1);
+    for (const std::pair<int, int>& pair : pairs) {
+        neighbors[nextNeighbor[pair.first]++] = pair.second;
+        neighbors[nextNeighbor[pair.second]++] = pair.first;
+    }
+
+    // The root is always the lowest entity of its island, so going through entities in order numbers the islands
+    // by their lowest entity and lists every island's entities in order
+    std::vector<int> islandOf(count);
+    islandStarts.assign(1, 0);
+    for (int i = 0; i < count; ++i) {
+        int root = findRoot(i);
+        if (root == i) {
+            islandOf[i] = static_cast<int>(islandStarts.size()) - 1;
+            islandStarts.push_back(0);
+        }
+        else {
+            islandOf[i] = islandOf[root];
+        }
+        ++islandStarts[islandOf[i] + 1];
+    }
+    for (size_t i = 1; i < islandStarts.size(); ++i) {
+        islandStarts[i] += islandStarts[i - 1];
+    }
+    islandEntities.resize(count);
+    std::vector<int> next(islandStarts.begin(), islandStarts.end() - 1);
+    for (int i = 0; i < count; ++i) {
+        islandEntities[next[islandOf[i]]++] = i;
+    }
+    if (islandTouches.size() < islandStarts.size() - 1) {
+        islandTouches.resize(islandStarts.size() - 1);
+    }
+}
+
+void Simulation::RunIsland(int island, int threadIndex, const MoverSystem* movers) {
+    PlayerMove& playerMove = playerMoves[threadIndex];
+    std::vector<int>& touches = islandTouches[island];
+    touches.clear();
+
+    for (int i = islandStarts[island]; i < islandStarts[island + 1]; ++i) {
+        int entityIndex = islandEntities[i];
+        SimEntity& entity = entities[entityIndex];
+        glm::vec3 startOrigin = entity.state.origin;
+        playerMove.Tick(entity.state, entity.input);
+
+        // Entities block each other, a move ending inside someone it wasn't already inside doesn't happen.
+        // Only entities whose reach boxes overlap can be reached.
+        for (int j = neighborStarts[entityIndex]; j < neighborStarts[entityIndex + 1]; ++j) {
+            const SimEntity& other = entities[neighbors[j]];
+            if (BoxesOverlap(entity.state.origin, other.state.origin) && !BoxesOverlap(startOrigin, other.state.origin)) {
+                entity.state.origin = startOrigin;
+                entity.state.velocity.x = 0.0f;
+                entity.state.velocity.y = 0.0f;
+                break;
+            }
+        }
+
+        if (movers) {
+            movers->FindTouched(entity.state.origin + glm::vec3(0.0f, 0.0f, PlayerMove::VIEW_HEIGHT), touches);
+        }
+    }
+}
+
+void Simulation::Tick(MoverSystem* movers) {
+    BuildIslands();
+    threadPool.ParallelFor(GetIslandCount(), [this, movers](int island, int threadIndex) {
+        RunIsland(island, threadIndex, movers);
+    });
+
+    // Merge what the islands did in island order
+    if (movers) {
+        for (int island = 0; island < GetIslandCount(); ++island) {
+            for (int mover : islandTouches[island]) {
+                movers->Activate(mover);
+            }
+        }
+    }
+    ++ticks;
+}
+
+PlayerInput Simulation::WanderInput(int entity) const {
+    // New direction every second
+    uint32_t seed = static_cast<uint32_t>(entity) * 2654435761u ^ static_cast<uint32_t>(ticks / PlayerMove::TICK_RATE) * 40503u;
+    seed ^= seed >> 15;
+    seed *= 2246822519u;
+    seed ^= seed >> 13;
+
+    PlayerInput input;
+    input.forwardMove = 127;
+    input.rightMove = static_cast<int8_t>((static_cast<int>(seed >> 16) % 3 - 1) * 127);
+    input.upMove = (seed >> 20) % 8 == 0 ? 127 : 0;
+    input.yaw = static_cast<int16_t>(seed & 0xFFFF);
+    return input;
+}
+
+uint32_t Simulation::Hash() const {
+    uint32_t hash = 2166136261u;
+    for (const SimEntity& entity : entities) {
+        hash = (hash ^ entity.state.Hash()) * 16777619u;
+    }
+    return hash;
+}
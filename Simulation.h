@@ -0,0 +1,70 @@
+#ifndef SIMULATION_H
+#define SIMULATION_H
+
+#include <glm/glm.hpp>
+#include <cstdint>
+#include <vector>
+#include "Broadphase.h"
+#include "CollisionModel.h"
+#include "Movers.h"
+#include "PlayerMove.h"
+#include "ThreadPool.h"
+
+/*
+Moves every entity by one fixed tick on the thread pool. Entities whose reach boxes (everywhere they could get to
+this tick) overlap can affect each other, so they are joined into one island and an island is always run by a
+single thread in entity order. Islands never share an entity, so they can run in any order on any thread.
+
+Everything an island does to the outside, like touching a door trigger, is collected per island and applied
+after every island is done, in island order. Islands are ordered by their lowest entity, so the result is the
+same bit for bit for any number of threads.
+*/
+
+struct SimEntity {
+    PlayerState state;
+    PlayerInput input;      // Command for the next tick
+    int broadphaseEntity;   // Handle of the reach box
+};
+
+class Simulation {
+public:
+    Simulation(const CollisionModel& collision, ThreadPool& threadPool, const glm::vec3& worldMins, const glm::vec3& worldMaxs);
+
+    // Adding entities moves the others in memory, references to states don't survive it
+    int AddEntity(const PlayerState& state);
+    void SetInput(int entity, const PlayerInput& input) { entities[entity].input = input; }
+    const PlayerState& GetState(int entity) const { return entities[entity].state; }
+    int GetEntityCount() const { return static_cast<int>(entities.size()); }
+    int GetIslandCount() const { return static_cast<int>(islandStarts.size()) - 1; }
+
+    // Runs one tick for every entity, then activates the movers entities touched. movers can be null.
+    void Tick(MoverSystem* movers);
+
+    // Input that makes a test entity wander around, the same for the same entity and tick
+    PlayerInput WanderInput(int entity) const;
+
+    // Hash of every entity's state, to compare runs
+    uint32_t Hash() const;
+
+private:
+    void BuildIslands();
+    void RunIsland(int island, int threadIndex, const MoverSystem* movers);
+
+    const CollisionModel& collision;
+    ThreadPool& threadPool;
+    Broadphase reachGrid;
+    std::vector<SimEntity> entities;
+    std::vector<PlayerMove> playerMoves;    // One per pool thread
+    int ticks = 0;
+
+    // Entities of island i are islandEntities[islandStarts[i]] up to islandStarts[i + 1], in entity order
+    std::vector<int> islandEntities;
+    std::vector<int> islandStarts;
+    std::vector<std::vector<int>> islandTouches;  // Movers each island touched this tick
+    std::vector<int> islandParents;               // Union find scratch
+    std::vector<int> neighbors;                   // Entities whose reach boxes overlap entity i's are
+    std::vector<int> neighborStarts;              // neighbors[neighborStarts[i]] up to neighborStarts[i + 1]
+    std::vector<std::pair<int, int>> pairs;
+};
+
+#endif // SIMULATION_H
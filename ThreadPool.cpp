@@ -0,0 +1,100 @@
+#include "ThreadPool.h"
+
+static thread_local bool insideTask = false;
+
+ThreadPool::ThreadPool(unsigned int threadCount) {
+    if (threadCount == 0) {
+        threadCount = std::thread::hardware_concurrency();
+    }
+    if (threadCount == 0) {
+        threadCount = 1;
+    }
+    for (unsigned int i = 1; i < threadCount; ++i) {
+        workers.emplace_back(&ThreadPool::WorkerLoop, this, static_cast<int>(i));
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wakeCondition.notify_all();
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+}
+
+void ThreadPool::RunTasks(const std::function<void(int, int)>& task, int count, int threadIndex) {
+    insideTask = true;
+    for (;;) {
+        int index = nextIndex.fetch_add(1);
+        if (index >= count) {
+            break;
+        }
+        task(index, threadIndex);
+    }
+    insideTask = false;
+}
+
+void ThreadPool::WorkerLoop(int threadIndex) {
+    unsigned int seenGeneration = 0;
+    for (;;) {
+        const std::function<void(int, int)>* task;
+        int count;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wakeCondition.wait(lock, [&] { return stopping || generation != seenGeneration; });
+            if (stopping) {
+                return;
+            }
+            seenGeneration = generation;
+            // Woke up after the job was already finished
+            if (!currentTask) {
+                continue;
+            }
+            task = currentTask;
+            count = taskCount;
+            ++activeWorkers;
+        }
+
+        RunTasks(*task, count, threadIndex);
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            --activeWorkers;
+        }
+        doneCondition.notify_one();
+    }
+}
+
+void ThreadPool::ParallelFor(int count, const std::function<void(int, int)>& task) {
+    if (count <= 0) {
+        return;
+    }
+
+    // Nested calls and single item ranges are not worth waking anyone for
+    if (insideTask || workers.empty() || count == 1) {
+        for (int i = 0; i < count; ++i) {
+            task(i, 0);
+        }
+        return;
+    }
+
+    std::lock_guard<std::mutex> submitLock(submitMutex);
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        currentTask = &task;
+        taskCount = count;
+        nextIndex.store(0);
+        ++generation;
+    }
+    wakeCondition.notify_all();
+
+    RunTasks(task, count, 0);
+
+    // Every index has been handed out, wait for workers still finishing theirs
+    std::unique_lock<std::mutex> lock(mutex);
+    doneCondition.wait(lock, [&] { return activeWorkers == 0; });
+    currentTask = nullptr;
+}
@@ -0,0 +1,50 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*
+Fixed set of worker threads for data parallel loops. ParallelFor hands out indices until the range is done
+and the calling thread works along with the pool, so it returns only when every index has been processed.
+Task indices are spread dynamically, anything that must be deterministic should write its results by index.
+*/
+
+class ThreadPool {
+public:
+    // threadCount includes the calling thread, 0 uses every hardware thread
+    explicit ThreadPool(unsigned int threadCount = 0);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    // Number of threads that can run tasks at once, threadIndex passed to tasks is below this
+    int GetThreadCount() const { return static_cast<int>(workers.size()) + 1; }
+
+    // Runs task(index, threadIndex) for every index in [0, count). Calls made from inside a task run serially.
+    void ParallelFor(int count, const std::function<void(int, int)>& task);
+
+private:
+    void WorkerLoop(int threadIndex);
+    void RunTasks(const std::function<void(int, int)>& task, int count, int threadIndex);
+
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::mutex submitMutex; // One ParallelFor at a time
+    std::condition_variable wakeCondition;
+    std::condition_variable doneCondition;
+
+    const std::function<void(int, int)>* currentTask = nullptr;
+    int taskCount = 0;
+    std::atomic<int> nextIndex{ 0 };
+    int activeWorkers = 0;
+    unsigned int generation = 0;
+    bool stopping = false;
+};
+
+#endif // THREADPOOL_H
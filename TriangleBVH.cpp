@@ -0,0 +1,173 @@
+#include "TriangleBVH.h"
+#include <algorithm>
+#include <cmath>
+
+// Triangles seen this close to edge on are missed rather than giving unstable hits
+static const float PARALLEL_EPSILON = 1e-8f;
+
+void TriangleBVH::AddTriangle(const glm::vec3& a, const glm::vec3& b, const glm::vec3& c, int owner) {
+    triangles.push_back(Triangle{ a, b - a, c - a, owner });
+}
+
+void TriangleBVH::Build() {
+    nodes.clear();
+    if (triangles.empty()) {
+        return;
+    }
+    std::vector<glm::vec3> centers(triangles.size());
+    for (size_t i = 0; i < triangles.size(); ++i) {
+        const Triangle& triangle = triangles[i];
+        centers[i] = triangle.v0 + (triangle.edge1 + triangle.edge2) / 3.0f;
+    }
+    nodes.reserve(triangles.size() * 2);
+    nodes.push_back(Node());
+    BuildNode(0, 0, static_cast<int>(triangles.size()), centers);
+}
+
+void TriangleBVH::BuildNode(int index, int first, int count, std::vector<glm::vec3>& centers) {
+    glm::vec3 mins(1e30f);
+    glm::vec3 maxs(-1e30f);
+    glm::vec3 centerMins(1e30f);
+    glm::vec3 centerMaxs(-1e30f);
+    for (int i = first; i < first + count; ++i) {
+        const Triangle& triangle = triangles[i];
+        glm::vec3 v1 = triangle.v0 + triangle.edge1;
+        glm::vec3 v2 = triangle.v0 + triangle.edge2;
+        mins = glm::min(mins, glm::min(triangle.v0, glm::min(v1, v2)));
+        maxs = glm::max(maxs, glm::max(triangle.v0, glm::max(v1, v2)));
+        centerMins = glm::min(centerMins, centers[i]);
+        centerMaxs = glm::max(centerMaxs, centers[i]);
+    }
+    nodes[index].mins = mins;
+    nodes[index].maxs = maxs;
+    if (count <= MAX_LEAF_TRIANGLES) {
+        nodes[index].first = first;
+        nodes[index].count = count;
+        return;
+    }
+
+    glm::vec3 extent = centerMaxs - centerMins;
+    int axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+
+    // Sort the triangles and their centers together around the median
+    std::vector<int> order(count);
+    for (int i = 0; i < count; ++i) {
+        order[i] = first + i;
+    }
+    int half = count / 2;
+    std::nth_element(order.begin(), order.begin() + half, order.end(),
+        [&centers, axis](int a, int b) { return centers[a][axis] < centers[b][axis]; });
+    std::vector<Triangle> sortedTriangles(count);
+    std::vector<glm::vec3> sortedCenters(count);
+    for (int i = 0; i < count; ++i) {
+        sortedTriangles[i] = triangles[order[i]];
+        sortedCenters[i] = centers[order[i]];
+    }
+    std::copy(sortedTriangles.begin(), sortedTriangles.end(), triangles.begin() + first);
+    std::copy(sortedCenters.begin(), sortedCenters.end(), centers.begin() + first);
+
+    int children = static_cast<int>(nodes.size());
+    nodes.push_back(Node());
+    nodes.push_back(Node());
+    nodes[index].first = children;
+    nodes[index].count = 0;
+    BuildNode(children, first, half, centers);
+    BuildNode(children + 1, first + half, count - half, centers);
+}
+
+bool TriangleBVH::Intersect(const glm::vec3& origin, const glm::vec3& direction, float maxDistance, TriangleHit& hit) const {
+    return Traverse(origin, direction, maxDistance, false, hit);
+}
+
+bool TriangleBVH::Occluded(const glm::vec3& start, const glm::vec3& end) const {
+    glm::vec3 delta = end - start;
+    float length = glm::length(delta);
+    if (length <= 0.0f) {
+        return false;
+    }
+    TriangleHit hit;
+    return Traverse(start, delta / length, length, true, hit);
+}
+
+bool TriangleBVH::Traverse(const glm::vec3& origin, const glm::vec3& direction, float maxDistance, bool anyHit, TriangleHit& hit) const {
+    if (nodes.empty()) {
+        return false;
+    }
+
+    glm::vec3 inverse;
+    for (int i = 0; i < 3; ++i) {
+        inverse[i] = direction[i] != 0.0f ? 1.0f / direction[i] : 1e30f;
+    }
+
+    bool found = false;
+    float closest = maxDistance;
+    int stack[64];
+    int stackSize = 0;
+    stack[stackSize++] = 0;
+    while (stackSize > 0) {
+        const Node& node = nodes[stack[--stackSize]];
+
+        // Slab test against the node bounds
+        float enter = 0.0f;
+        float leave = closest;
+        for (int i = 0; i < 3; ++i) {
+            float t0 = (node.mins[i] - origin[i]) * inverse[i];
+            float t1 = (node.maxs[i] - origin[i]) * inverse[i];
+            enter = std::max(enter, std::min(t0, t1));
+            leave = std::min(leave, std::max(t0, t1));
+        }
+        if (enter > leave) {
+            continue;
+        }
+
+        if (node.count == 0) {
+            // Visit the child on the near side of the split first
+            const Node& left = nodes[node.first];
+            const Node& right = nodes[node.first + 1];
+            glm::vec3 leftCenter = left.mins + left.maxs;
+            glm::vec3 rightCenter = right.mins + right.maxs;
+            bool leftFirst = glm::dot(leftCenter - rightCenter, direction) < 0.0f;
+            if (stackSize + 2 > 64) {
+                continue; // Can't happen with median splits, but never overflow
+            }
+            stack[stackSize++] = leftFirst ? node.first + 1 : node.first;
+            stack[stackSize++] = leftFirst ? node.first : node.first + 1;
+            continue;
+        }
+
+        // Moller-Trumbore
+        for (int i = node.first; i < node.first + node.count; ++i) {
+            const Triangle& triangle = triangles[i];
+            glm::vec3 p = glm::cross(direction, triangle.edge2);
+            float determinant = glm::dot(triangle.edge1, p);
+            if (std::fabs(determinant) < PARALLEL_EPSILON) {
+                continue;
+            }
+            float inverseDeterminant = 1.0f / determinant;
+            glm::vec3 s = origin - triangle.v0;
+            float u = glm::dot(s, p) * inverseDeterminant;
+            if (u < 0.0f || u > 1.0f) {
+                continue;
+            }
+            glm::vec3 q = glm::cross(s, triangle.edge1);
+            float v = glm::dot(direction, q) * inverseDeterminant;
+            if (v < 0.0f || u + v > 1.0f) {
+                continue;
+            }
+            float distance = glm::dot(triangle.edge2, q) * inverseDeterminant;
+            if (distance <= 0.0f || distance >= closest) {
+                continue;
+            }
+            if (anyHit) {
+                return true;
+            }
+            closest = distance;
+            hit.distance = distance;
+            hit.triangle = i;
+            hit.u = u;
+            hit.v = v;
+            found = true;
+        }
+    }
+    return found;
+}
@@ -0,0 +1,59 @@
+#ifndef TRIANGLEBVH_H
+#define TRIANGLEBVH_H
+
+#include <glm/glm.hpp>
+#include <vector>
+
+/*
+Bounding volume hierarchy over a triangle soup, for tools that need to trace rays against the drawn geometry
+instead of the collision brushes. Nodes split the triangles at the median of their centers along the widest axis
+until at most MAX_LEAF_TRIANGLES are left. A built tree is only read, so any number of threads can trace at once.
+*/
+
+struct TriangleHit {
+    float distance;  // Along the ray direction
+    int triangle;    // Index in the tree, GetOwner turns it back into what it was added for
+    float u;         // Barycentric weights of the second and third vertex
+    float v;
+};
+
+class TriangleBVH {
+public:
+    // Every triangle is three points, owner is whatever the caller wants back for it (a face index, say)
+    void AddTriangle(const glm::vec3& a, const glm::vec3& b, const glm::vec3& c, int owner);
+    void Build();
+
+    // Closest hit along direction (normalized) up to maxDistance
+    bool Intersect(const glm::vec3& origin, const glm::vec3& direction, float maxDistance, TriangleHit& hit) const;
+    // Whether anything is between start and end
+    bool Occluded(const glm::vec3& start, const glm::vec3& end) const;
+
+    int GetOwner(int triangle) const { return triangles[triangle].owner; }
+    int GetTriangleCount() const { return static_cast<int>(triangles.size()); }
+
+private:
+    struct Triangle {
+        glm::vec3 v0;
+        glm::vec3 edge1;
+        glm::vec3 edge2;
+        int owner;
+    };
+
+    // Inner nodes keep their children next to each other, a leaf has count > 0 triangles starting at first
+    struct Node {
+        glm::vec3 mins;
+        glm::vec3 maxs;
+        int first;  // First triangle of a leaf, or the left child of an inner node (the right is first + 1)
+        int count;
+    };
+
+    static const int MAX_LEAF_TRIANGLES = 4;
+
+    void BuildNode(int index, int first, int count, std::vector<glm::vec3>& centers);
+    bool Traverse(const glm::vec3& origin, const glm::vec3& direction, float maxDistance, bool anyHit, TriangleHit& hit) const;
+
+    std::vector<Triangle> triangles;
+    std::vector<Node> nodes;
+};
+
+#endif // TRIANGLEBVH_H
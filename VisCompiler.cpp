@@ -0,0 +1,834 @@
+#include "VisCompiler.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+
+// Same tolerances as q3map
+static const double ON_EPSILON = 0.1;
+static const double CLIP_EPSILON = 0.1;
+static const double SPLIT_WINDING_EPSILON = 0.001;
+static const double EDGE_LENGTH = 0.2;
+static const double MAX_WORLD_COORD = 65536.0;
+static const double SIDESPACE = 8.0;
+
+enum {
+    SIDE_FRONT,
+    SIDE_BACK,
+    SIDE_ON
+};
+
+// Small double precision helpers, windings start out very large and floats lose too much when clipping them
+
+template <typename V>
+static double Dot(const V& a, const V& b) {
+    return a.x * b.x + a.y * b.y + a.z * b.z;
+}
+
+template <typename V>
+static V Cross(const V& a, const V& b) {
+    return { a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x };
+}
+
+template <typename V>
+static V Sub(const V& a, const V& b) {
+    return { a.x - b.x, a.y - b.y, a.z - b.z };
+}
+
+template <typename V>
+static V Mad(const V& a, double scale, const V& b) {
+    return { a.x + b.x * scale, a.y + b.y * scale, a.z + b.z * scale };
+}
+
+template <typename P>
+static P Flip(const P& plane) {
+    P flipped;
+    flipped.normal = { -plane.normal.x, -plane.normal.y, -plane.normal.z };
+    flipped.dist = -plane.dist;
+    return flipped;
+}
+
+// Huge quad lying on the plane
+template <typename W, typename P>
+static W BaseWindingForPlane(const P& plane) {
+    typedef typename W::value_type V;
+    const double normal[3] = { plane.normal.x, plane.normal.y, plane.normal.z };
+    int axis = -1;
+    double max = -MAX_WORLD_COORD;
+    for (int i = 0; i < 3; ++i) {
+        if (std::fabs(normal[i]) > max) {
+            max = std::fabs(normal[i]);
+            axis = i;
+        }
+    }
+
+    V up = { 0.0, 0.0, 0.0 };
+    if (axis == 2) {
+        up.x = 1.0;
+    }
+    else {
+        up.z = 1.0;
+    }
+    up = Mad(up, -Dot(up, plane.normal), plane.normal);
+    double length = std::sqrt(Dot(up, up));
+    up = { up.x / length * MAX_WORLD_COORD, up.y / length * MAX_WORLD_COORD, up.z / length * MAX_WORLD_COORD };
+
+    V origin = { plane.normal.x * plane.dist, plane.normal.y * plane.dist, plane.normal.z * plane.dist };
+    V right = Cross(up, plane.normal);
+
+    W winding(4);
+    winding[0] = Mad(Mad(origin, -1.0, right), 1.0, up);
+    winding[1] = Mad(Mad(origin, 1.0, right), 1.0, up);
+    winding[2] = Mad(Mad(origin, 1.0, right), -1.0, up);
+    winding[3] = Mad(Mad(origin, -1.0, right), -1.0, up);
+    return winding;
+}
+
+// Splits a winding by a plane, either output is left empty when nothing is on that side
+template <typename W, typename P>
+static void ClipWinding(const W& in, const P& plane, double epsilon, W* front, W* back) {
+    typedef typename W::value_type V;
+    const size_t count = in.size();
+    std::vector<double> dists(count + 1);
+    std::vector<int> sides(count + 1);
+    int counts[3] = { 0, 0, 0 };
+
+    for (size_t i = 0; i < count; ++i) {
+        dists[i] = Dot(in[i], plane.normal) - plane.dist;
+        sides[i] = dists[i] > epsilon ? SIDE_FRONT : (dists[i] < -epsilon ? SIDE_BACK : SIDE_ON);
+        counts[sides[i]]++;
+    }
+    dists[count] = dists[0];
+    sides[count] = sides[0];
+
+    if (front) {
+        front->clear();
+    }
+    if (back) {
+        back->clear();
+    }
+    if (!counts[SIDE_FRONT]) {
+        if (back) {
+            *back = in;
+        }
+        return;
+    }
+    if (!counts[SIDE_BACK]) {
+        if (front) {
+            *front = in;
+        }
+        return;
+    }
+
+    for (size_t i = 0; i < count; ++i) {
+        const V& p1 = in[i];
+        if (sides[i] == SIDE_ON) {
+            if (front) {
+                front->push_back(p1);
+            }
+            if (back) {
+                back->push_back(p1);
+            }
+            continue;
+        }
+        if (sides[i] == SIDE_FRONT && front) {
+            front->push_back(p1);
+        }
+        if (sides[i] == SIDE_BACK && back) {
+            back->push_back(p1);
+        }
+        if (sides[i + 1] == SIDE_ON || sides[i + 1] == sides[i]) {
+            continue;
+        }
+
+        // Edge crosses the plane, snap to the plane on axial planes to avoid drift
+        const V& p2 = in[(i + 1) % count];
+        double dot = dists[i] / (dists[i] - dists[i + 1]);
+        const double normal[3] = { plane.normal.x, plane.normal.y, plane.normal.z };
+        const double a[3] = { p1.x, p1.y, p1.z };
+        const double b[3] = { p2.x, p2.y, p2.z };
+        double mid[3];
+        for (int j = 0; j < 3; ++j) {
+            if (normal[j] == 1.0) {
+                mid[j] = plane.dist;
+            }
+            else if (normal[j] == -1.0) {
+                mid[j] = -plane.dist;
+            }
+            else {
+                mid[j] = a[j] + dot * (b[j] - a[j]);
+            }
+        }
+        V point = { mid[0], mid[1], mid[2] };
+        if (front) {
+            front->push_back(point);
+        }
+        if (back) {
+            back->push_back(point);
+        }
+    }
+}
+
+// Keeps the part of the winding in front of the plane, empty when none is
+template <typename W, typename P>
+static W ChopWinding(const W& in, const P& plane, double epsilon) {
+    W front;
+    ClipWinding(in, plane, epsilon, &front, static_cast<W*>(nullptr));
+    return front;
+}
+
+// Slivers left over from splitting are dropped, q3map does the same
+template <typename W>
+static bool WindingIsTiny(const W& winding) {
+    int edges = 0;
+    for (size_t i = 0; i < winding.size(); ++i) {
+        auto delta = Sub(winding[(i + 1) % winding.size()], winding[i]);
+        if (std::sqrt(Dot(delta, delta)) > EDGE_LENGTH) {
+            if (++edges == 3) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+VisCompiler::VisCompiler(BSPMap& map, ThreadPool& pool)
+    : map(map), pool(pool) {
+}
+
+bool VisCompiler::Compile(bool fastOnly) {
+    const auto& nodes = map.GetNodes();
+    const auto& leafs = map.GetLeafs();
+    if (nodes.empty() || leafs.empty()) {
+        std::cerr << "Map has no BSP tree to generate portals from." << std::endl;
+        return false;
+    }
+
+    // Tree portals, they also bound each leaf for telling solid ones apart when clusters are assigned
+    numNodes = static_cast<int>(nodes.size());
+    outsideNode = numNodes + static_cast<int>(leafs.size());
+    nodePortals.assign(outsideNode + 1, std::vector<int>());
+    treePortals.clear();
+    MakeHeadnodePortals();
+    MakeTreePortals(0);
+
+    AssignClusters();
+    if (numClusters == 0) {
+        std::cerr << "Map has no empty leafs to compute visibility for." << std::endl;
+        return false;
+    }
+    BuildClusterPortals();
+    std::cout << "Vis: " << numClusters << " clusters, " << portals.size() / 2 << " portals" << std::endl;
+
+    // Fast pass, what every portal could possibly see
+    portalWords = (static_cast<int>(portals.size()) + 63) / 64;
+    portalFront.assign(portals.size(), std::vector<uint64_t>(portalWords, 0));
+    portalFlood.assign(portals.size(), std::vector<uint64_t>(portalWords, 0));
+    portalVis.assign(portals.size(), std::vector<uint64_t>(portalWords, 0));
+    portalStatus.reset(new std::atomic<int>[portals.size()]);
+    for (size_t i = 0; i < portals.size(); ++i) {
+        portalStatus[i].store(STATUS_NONE);
+    }
+    pool.ParallelFor(static_cast<int>(portals.size()), [this](int index, int) {
+        BasePortalVis(index);
+    });
+
+    if (fastOnly) {
+        for (size_t i = 0; i < portals.size(); ++i) {
+            portalVis[i] = portalFlood[i];
+        }
+    }
+    else {
+        // Portals that see the least finish first, later chains then prune against their exact results
+        std::vector<int> sorted(portals.size());
+        for (size_t i = 0; i < sorted.size(); ++i) {
+            sorted[i] = static_cast<int>(i);
+        }
+        std::stable_sort(sorted.begin(), sorted.end(), [this](int a, int b) {
+            return portals[a].mightSee < portals[b].mightSee;
+        });
+        pool.ParallelFor(static_cast<int>(sorted.size()), [this, &sorted](int index, int) {
+            PortalFlow(sorted[index]);
+        });
+    }
+
+    ClusterMerge();
+    map.SetVisData(visData);
+    return true;
+}
+
+std::map<LumpType, std::vector<char>> VisCompiler::BuildLumps() const {
+    std::map<LumpType, std::vector<char>> lumps;
+
+    std::vector<char>& vis = lumps[LumpType::VisData];
+    int header[2] = { visData.numClusters, visData.bytesPerCluster };
+    vis.resize(sizeof(header) + visData.bits.size());
+    std::memcpy(vis.data(), header, sizeof(header));
+    std::memcpy(vis.data() + sizeof(header), visData.bits.data(), visData.bits.size());
+
+    if (assignedClusters) {
+        const auto& leafs = map.GetLeafs();
+        std::vector<char>& leafLump = lumps[LumpType::Leafs];
+        leafLump.resize(leafs.size() * sizeof(Leaf));
+        std::memcpy(leafLump.data(), leafs.data(), leafLump.size());
+    }
+
+    return lumps;
+}
+
+void VisCompiler::AssignClusters() {
+    const auto& leafs = map.GetLeafs();
+    leafClusters.resize(leafs.size());
+    numClusters = 0;
+    assignedClusters = false;
+
+    for (size_t i = 0; i < leafs.size(); ++i) {
+        leafClusters[i] = leafs[i].cluster;
+        numClusters = std::max(numClusters, leafs[i].cluster + 1);
+    }
+    if (numClusters > 0) {
+        return;
+    }
+
+    // Procedural maps may come without clusters, every leaf that isn't solid becomes its own cluster
+    assignedClusters = true;
+    std::vector<char> solid(leafs.size());
+    for (size_t i = 0; i < leafs.size(); ++i) {
+        solid[i] = IsLeafSolid(static_cast<int>(i));
+    }
+
+    // Like q3map's outside fill, open leafs reached from outside the world are the void around the map and count
+    // as solid. q3map merges solid and void leafs, so a leaf can hold a wall and the void behind it: the flood
+    // doesn't pass portals lying in a solid brush. When the flood reaches a leaf holding an entity the map leaks,
+    // and a map without entities can't tell inside from outside, then nothing is filled.
+    std::vector<char> outside(leafs.size(), 0);
+    std::vector<int> stack(1, outsideNode);
+    int outsideLeafs = 0;
+    while (!stack.empty()) {
+        int node = stack.back();
+        stack.pop_back();
+        for (int index : nodePortals[node]) {
+            const TreePortal& portal = treePortals[index];
+            int next = portal.nodes[0] == node ? portal.nodes[1] : portal.nodes[0];
+            if (portal.winding.empty() || next < numNodes || next >= outsideNode) {
+                continue;
+            }
+            int leaf = next - numNodes;
+            if (InSolidBrush(leaf, portal.winding) || (node != outsideNode && InSolidBrush(node - numNodes, portal.winding))) {
+                continue;
+            }
+            if (!solid[leaf] && !outside[leaf]) {
+                outside[leaf] = 1;
+                ++outsideLeafs;
+                stack.push_back(next);
+            }
+        }
+    }
+    bool leaked = true;
+    for (const Entity& entity : map.GetEntities()) {
+        std::string origin = entity.Get("origin");
+        Vec point = { 0.0, 0.0, 0.0 };
+        if (origin.empty() || !(std::istringstream(origin) >> point.x >> point.y >> point.z)) {
+            continue;
+        }
+        int leaf = PointLeaf(point);
+        if (!solid[leaf]) {
+            if (outside[leaf]) {
+                leaked = true;
+                break;
+            }
+            leaked = false;
+        }
+    }
+    if (leaked && outsideLeafs > 0) {
+        std::cout << "Vis: map leaks or has no entities, the void around it gets clusters as well" << std::endl;
+    }
+
+    for (size_t i = 0; i < leafs.size(); ++i) {
+        leafClusters[i] = solid[i] || (outside[i] && !leaked) ? -1 : numClusters++;
+        map.SetLeafCluster(static_cast<int>(i), leafClusters[i]);
+    }
+}
+
+int VisCompiler::PointLeaf(const Vec& point) const {
+    const auto& nodes = map.GetNodes();
+    const auto& planes = map.GetPlanes();
+    int node = 0;
+    while (node >= 0) {
+        const ::Plane& plane = planes[nodes[node].plane];
+        Vec normal = { plane.normal[0], plane.normal[1], plane.normal[2] };
+        node = nodes[node].children[Dot(normal, point) - plane.distance >= 0.0 ? 0 : 1];
+    }
+    return -node - 1;
+}
+
+bool VisCompiler::IsLeafSolid(int leaf) const {
+    // A solid brush only touching the leaf, like a wall the leaf is built against, leaves it open. The leaf is
+    // solid when one brush holds all of it, the corners of the portals around it. Leafs without portals fall back
+    // to their bounding box, which is larger than the leaf.
+    const Leaf& data = map.GetLeafs()[leaf];
+    Winding corners;
+    for (int index : nodePortals[numNodes + leaf]) {
+        corners.insert(corners.end(), treePortals[index].winding.begin(), treePortals[index].winding.end());
+    }
+    if (corners.empty()) {
+        for (int i = 0; i < 8; ++i) {
+            corners.push_back({ static_cast<double>((i & 1) ? data.maxs[0] : data.mins[0]),
+                static_cast<double>((i & 2) ? data.maxs[1] : data.mins[1]),
+                static_cast<double>((i & 4) ? data.maxs[2] : data.mins[2]) });
+        }
+    }
+    return InSolidBrush(leaf, corners);
+}
+
+bool VisCompiler::InSolidBrush(int leaf, const Winding& points) const {
+    const Leaf& data = map.GetLeafs()[leaf];
+    const auto& leafBrushes = map.GetLeafBrushes();
+    const auto& brushes = map.GetBrushes();
+    const auto& brushSides = map.GetBrushSides();
+    const auto& planes = map.GetPlanes();
+    const auto& textures = map.GetTextures();
+    for (int i = 0; i < data.numLeafBrushes; ++i) {
+        const Brush& brush = brushes[leafBrushes[data.firstLeafBrush + i]];
+        if (brush.texture < 0 || brush.texture >= static_cast<int>(textures.size()) ||
+            !(textures[brush.texture].contents & CONTENTS_SOLID)) {
+            continue;
+        }
+
+        bool inside = brush.numSides > 0;
+        for (int side = 0; side < brush.numSides && inside; ++side) {
+            const ::Plane& source = planes[brushSides[brush.brushSide + side].plane];
+            Vec normal = { source.normal[0], source.normal[1], source.normal[2] };
+            for (const Vec& point : points) {
+                if (Dot(normal, point) - source.distance > ON_EPSILON) {
+                    inside = false;
+                    break;
+                }
+            }
+        }
+        if (inside) {
+            return true;
+        }
+    }
+    return false;
+}
+
+int VisCompiler::ChildNode(int child) const {
+    return child >= 0 ? child : numNodes + (-child - 1);
+}
+
+void VisCompiler::AddPortalToNodes(int portal, int front, int back) {
+    treePortals[portal].nodes[0] = front;
+    treePortals[portal].nodes[1] = back;
+    nodePortals[front].push_back(portal);
+    nodePortals[back].push_back(portal);
+}
+
+void VisCompiler::RemovePortalFromNode(int portal, int node) {
+    auto& list = nodePortals[node];
+    auto it = std::find(list.begin(), list.end(), portal);
+    if (it != list.end()) {
+        list.erase(it);
+    }
+}
+
+void VisCompiler::MakeHeadnodePortals() {
+    // Six portals facing into the world box, connecting the head node to the outside
+    const Node& head = map.GetNodes()[0];
+    worldMins = { head.mins[0] - SIDESPACE, head.mins[1] - SIDESPACE, head.mins[2] - SIDESPACE };
+    worldMaxs = { head.maxs[0] + SIDESPACE, head.maxs[1] + SIDESPACE, head.maxs[2] + SIDESPACE };
+    const double mins[3] = { worldMins.x, worldMins.y, worldMins.z };
+    const double maxs[3] = { worldMaxs.x, worldMaxs.y, worldMaxs.z };
+
+    Plane planes[6];
+    int first = static_cast<int>(treePortals.size());
+    for (int i = 0; i < 3; ++i) {
+        for (int j = 0; j < 2; ++j) {
+            double normal[3] = { 0.0, 0.0, 0.0 };
+            normal[i] = j ? -1.0 : 1.0;
+            Plane& plane = planes[j * 3 + i];
+            plane.normal = { normal[0], normal[1], normal[2] };
+            plane.dist = j ? -maxs[i] : mins[i];
+        }
+    }
+
+    for (int i = 0; i < 6; ++i) {
+        TreePortal portal;
+        portal.plane = planes[i];
+        portal.winding = BaseWindingForPlane<Winding>(planes[i]);
+        treePortals.push_back(portal);
+        AddPortalToNodes(first + i, 0, outsideNode);
+    }
+
+    for (int i = 0; i < 6; ++i) {
+        for (int j = 0; j < 6; ++j) {
+            if (i != j) {
+                treePortals[first + i].winding = ChopWinding(treePortals[first + i].winding, planes[j], ON_EPSILON);
+            }
+        }
+    }
+}
+
+void VisCompiler::MakeTreePortals(int node) {
+    if (node >= numNodes) {
+        return;
+    }
+    MakeNodePortal(node);
+    SplitNodePortals(node);
+
+    const Node& data = map.GetNodes()[node];
+    MakeTreePortals(ChildNode(data.children[0]));
+    MakeTreePortals(ChildNode(data.children[1]));
+}
+
+void VisCompiler::MakeNodePortal(int node) {
+    // The node plane clipped by every portal bounding the node is the opening between its children
+    const Node& data = map.GetNodes()[node];
+    const ::Plane& source = map.GetPlanes()[data.plane];
+    Plane plane;
+    plane.normal = { source.normal[0], source.normal[1], source.normal[2] };
+    plane.dist = source.distance;
+
+    Winding winding = BaseWindingForPlane<Winding>(plane);
+    for (int index : nodePortals[node]) {
+        const TreePortal& portal = treePortals[index];
+        Plane clip = portal.nodes[0] == node ? portal.plane : Flip(portal.plane);
+        winding = ChopWinding(winding, clip, CLIP_EPSILON);
+        if (winding.empty()) {
+            return;
+        }
+    }
+    if (WindingIsTiny(winding)) {
+        return;
+    }
+
+    TreePortal portal;
+    portal.plane = plane;
+    portal.winding = winding;
+    treePortals.push_back(portal);
+    AddPortalToNodes(static_cast<int>(treePortals.size()) - 1, ChildNode(data.children[0]), ChildNode(data.children[1]));
+}
+
+void VisCompiler::SplitNodePortals(int node) {
+    // Hands every portal bounding the node down to the children it touches, splitting it when it spans both
+    const Node& data = map.GetNodes()[node];
+    const ::Plane& source = map.GetPlanes()[data.plane];
+    Plane plane;
+    plane.normal = { source.normal[0], source.normal[1], source.normal[2] };
+    plane.dist = source.distance;
+    int front = ChildNode(data.children[0]);
+    int back = ChildNode(data.children[1]);
+
+    std::vector<int> list = nodePortals[node];
+    for (int index : list) {
+        int side = treePortals[index].nodes[0] == node ? 0 : 1;
+        int other = treePortals[index].nodes[!side];
+        RemovePortalFromNode(index, treePortals[index].nodes[0]);
+        RemovePortalFromNode(index, treePortals[index].nodes[1]);
+
+        Winding frontWinding, backWinding;
+        ClipWinding(treePortals[index].winding, plane, SPLIT_WINDING_EPSILON, &frontWinding, &backWinding);
+        if (!frontWinding.empty() && WindingIsTiny(frontWinding)) {
+            frontWinding.clear();
+        }
+        if (!backWinding.empty() && WindingIsTiny(backWinding)) {
+            backWinding.clear();
+        }
+        if (frontWinding.empty() && backWinding.empty()) {
+            continue;
+        }
+
+        if (frontWinding.empty() || backWinding.empty()) {
+            int child = frontWinding.empty() ? back : front;
+            if (side == 0) {
+                AddPortalToNodes(index, child, other);
+            }
+            else {
+                AddPortalToNodes(index, other, child);
+            }
+            continue;
+        }
+
+        TreePortal split = treePortals[index];
+        split.winding = backWinding;
+        treePortals[index].winding = frontWinding;
+        treePortals.push_back(split);
+        int splitIndex = static_cast<int>(treePortals.size()) - 1;
+        if (side == 0) {
+            AddPortalToNodes(index, front, other);
+            AddPortalToNodes(splitIndex, back, other);
+        }
+        else {
+            AddPortalToNodes(index, other, front);
+            AddPortalToNodes(splitIndex, other, back);
+        }
+    }
+}
+
+void VisCompiler::BuildClusterPortals() {
+    // Portals between leafs of two different clusters, once in each direction
+    portals.clear();
+    clusterPortals.assign(numClusters, std::vector<int>());
+
+    for (const TreePortal& treePortal : treePortals) {
+        if (treePortal.winding.empty() || treePortal.nodes[0] < numNodes || treePortal.nodes[1] < numNodes ||
+            treePortal.nodes[0] == outsideNode || treePortal.nodes[1] == outsideNode) {
+            continue;
+        }
+        int frontCluster = leafClusters[treePortal.nodes[0] - numNodes];
+        int backCluster = leafClusters[treePortal.nodes[1] - numNodes];
+        if (frontCluster < 0 || backCluster < 0 || frontCluster == backCluster) {
+            continue;
+        }
+
+        // Looking from the back cluster through the portal into the front one
+        Portal forward;
+        forward.plane = treePortal.plane;
+        forward.winding = treePortal.winding;
+        forward.cluster = backCluster;
+        forward.leaf = frontCluster;
+        forward.mightSee = 0;
+        clusterPortals[backCluster].push_back(static_cast<int>(portals.size()));
+        portals.push_back(forward);
+
+        Portal backward;
+        backward.plane = Flip(treePortal.plane);
+        backward.winding.assign(treePortal.winding.rbegin(), treePortal.winding.rend());
+        backward.cluster = frontCluster;
+        backward.leaf = backCluster;
+        backward.mightSee = 0;
+        clusterPortals[frontCluster].push_back(static_cast<int>(portals.size()));
+        portals.push_back(backward);
+    }
+}
+
+void VisCompiler::BasePortalVis(int index) {
+    // A portal can only be seen through this one if part of it is in front of this portal
+    // and part of this portal is behind it
+    const Portal& portal = portals[index];
+    for (size_t j = 0; j < portals.size(); ++j) {
+        if (static_cast<int>(j) == index) {
+            continue;
+        }
+        const Portal& target = portals[j];
+
+        bool inFront = false;
+        for (const Vec& point : target.winding) {
+            if (Dot(point, portal.plane.normal) - portal.plane.dist > ON_EPSILON) {
+                inFront = true;
+                break;
+            }
+        }
+        if (!inFront) {
+            continue;
+        }
+
+        bool behind = false;
+        for (const Vec& point : portal.winding) {
+            if (Dot(point, target.plane.normal) - target.plane.dist < -ON_EPSILON) {
+                behind = true;
+                break;
+            }
+        }
+        if (!behind) {
+            continue;
+        }
+
+        SetBit(portalFront[index], static_cast<int>(j));
+    }
+
+    SimpleFlood(index, portal.leaf);
+
+    int count = 0;
+    for (uint64_t word : portalFlood[index]) {
+        for (; word; word &= word - 1) {
+            ++count;
+        }
+    }
+    portals[index].mightSee = count;
+}
+
+void VisCompiler::SimpleFlood(int portal, int cluster) {
+    for (int index : clusterPortals[cluster]) {
+        if (!TestBit(portalFront[portal], index) || TestBit(portalFlood[portal], index)) {
+            continue;
+        }
+        SetBit(portalFlood[portal], index);
+        SimpleFlood(portal, portals[index].leaf);
+    }
+}
+
+void VisCompiler::PortalFlow(int index) {
+    portalStatus[index].store(STATUS_WORKING, std::memory_order_relaxed);
+
+    FlowStack head;
+    head.portalPlane = portals[index].plane;
+    head.source = portals[index].winding;
+    head.hasPass = false;
+    head.mightSee = portalFlood[index];
+    RecursiveClusterFlow(portals[index].leaf, index, head);
+
+    // Other threads only read the result once it is marked done
+    portalStatus[index].store(STATUS_DONE, std::memory_order_release);
+}
+
+// Clips target by the planes through an edge of source and a point of pass that have all of source on one side
+// and all of pass on the other, what remains of target is what can be seen from source through pass
+template <typename W, typename P>
+static W ClipToSeparators(const W& source, const W& pass, W target, bool flipClip) {
+    typedef typename W::value_type V;
+    for (size_t i = 0; i < source.size(); ++i) {
+        size_t l = (i + 1) % source.size();
+        V v1 = Sub(source[l], source[i]);
+
+        for (size_t j = 0; j < pass.size(); ++j) {
+            V v2 = Sub(pass[j], source[i]);
+            P plane;
+            plane.normal = Cross(v1, v2);
+            double length = Dot(plane.normal, plane.normal);
+            if (length < ON_EPSILON) {
+                continue;
+            }
+            length = 1.0 / std::sqrt(length);
+            plane.normal = { plane.normal.x * length, plane.normal.y * length, plane.normal.z * length };
+            plane.dist = Dot(pass[j], plane.normal);
+
+            // Find which side source is on
+            bool flipTest = false;
+            size_t k;
+            for (k = 0; k < source.size(); ++k) {
+                if (k == i || k == l) {
+                    continue;
+                }
+                double d = Dot(source[k], plane.normal) - plane.dist;
+                if (d < -ON_EPSILON) {
+                    flipTest = false;
+                    break;
+                }
+                if (d > ON_EPSILON) {
+                    flipTest = true;
+                    break;
+                }
+            }
+            if (k == source.size()) {
+                continue; // Plane lies on source
+            }
+            if (flipTest) {
+                plane = Flip(plane);
+            }
+
+            // It separates only if all of pass is on the front
+            int inFront = 0;
+            for (k = 0; k < pass.size(); ++k) {
+                if (k == j) {
+                    continue;
+                }
+                double d = Dot(pass[k], plane.normal) - plane.dist;
+                if (d < -ON_EPSILON) {
+                    break;
+                }
+                if (d > ON_EPSILON) {
+                    ++inFront;
+                }
+            }
+            if (k != pass.size() || !inFront) {
+                continue;
+            }
+
+            if (flipClip) {
+                plane = Flip(plane);
+            }
+            target = ChopWinding(target, plane, ON_EPSILON);
+            if (target.empty()) {
+                return target;
+            }
+        }
+    }
+    return target;
+}
+
+void VisCompiler::RecursiveClusterFlow(int cluster, int base, const FlowStack& prev) {
+    std::vector<uint64_t>& vis = portalVis[base];
+    const Plane& basePlane = portals[base].plane;
+
+    FlowStack stack;
+    stack.mightSee.resize(portalWords);
+
+    for (int index : clusterPortals[cluster]) {
+        if (!TestBit(prev.mightSee, index)) {
+            continue;
+        }
+
+        // Skip portals that can't show anything that isn't already visible
+        const std::vector<uint64_t>& test = portalStatus[index].load(std::memory_order_acquire) == STATUS_DONE ?
+            portalVis[index] : portalFlood[index];
+        uint64_t more = 0;
+        for (int j = 0; j < portalWords; ++j) {
+            stack.mightSee[j] = prev.mightSee[j] & test[j];
+            more |= stack.mightSee[j] & ~vis[j];
+        }
+        if (!more && TestBit(vis, index)) {
+            continue;
+        }
+
+        const Portal& portal = portals[index];
+        stack.portalPlane = portal.plane;
+
+        stack.pass = ChopWinding(portal.winding, basePlane, ON_EPSILON);
+        if (stack.pass.empty()) {
+            continue;
+        }
+        stack.source = ChopWinding(prev.source, Flip(portal.plane), ON_EPSILON);
+        if (stack.source.empty()) {
+            continue;
+        }
+
+        if (prev.hasPass) {
+            stack.pass = ChopWinding(stack.pass, prev.portalPlane, ON_EPSILON);
+            if (stack.pass.empty()) {
+                continue;
+            }
+            stack.pass = ClipToSeparators<Winding, Plane>(stack.source, prev.pass, stack.pass, false);
+            if (stack.pass.empty()) {
+                continue;
+            }
+            stack.pass = ClipToSeparators<Winding, Plane>(prev.pass, stack.source, stack.pass, true);
+            if (stack.pass.empty()) {
+                continue;
+            }
+        }
+        // The cluster right behind the base portal can only be blocked if coplanar, so no separators there
+        stack.hasPass = true;
+
+        SetBit(vis, index);
+        RecursiveClusterFlow(portal.leaf, base, stack);
+    }
+}
+
+void VisCompiler::ClusterMerge() {
+    // Every cluster sees itself, its neighbours and everything its portals see
+    visData.numClusters = numClusters;
+    visData.bytesPerCluster = ((numClusters + 63) & ~63) >> 3;
+    visData.bits.assign(static_cast<size_t>(numClusters) * visData.bytesPerCluster, 0);
+
+    std::vector<uint64_t> portalVector(portalWords);
+    for (int cluster = 0; cluster < numClusters; ++cluster) {
+        std::fill(portalVector.begin(), portalVector.end(), 0);
+        for (int index : clusterPortals[cluster]) {
+            for (int j = 0; j < portalWords; ++j) {
+                portalVector[j] |= portalVis[index][j];
+            }
+            SetBit(portalVector, index);
+        }
+
+        unsigned char* row = &visData.bits[static_cast<size_t>(cluster) * visData.bytesPerCluster];
+        row[cluster >> 3] |= 1 << (cluster & 7);
+        for (size_t j = 0; j < portals.size(); ++j) {
+            if (TestBit(portalVector, static_cast<int>(j))) {
+                int seen = portals[j].leaf;
+                row[seen >> 3] |= 1 << (seen & 7);
+            }
+        }
+    }
+}
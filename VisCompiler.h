@@ -0,0 +1,126 @@
+#ifndef VISCOMPILER_H
+#define VISCOMPILER_H
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include "BSPMap.h"
+#include "ThreadPool.h"
+
+/*
+PVS compiler for maps that were built without vis. Portals are generated by pushing a box around the world down
+the BSP tree and splitting it at every node plane, the ones that end up between two leafs of different clusters
+become cluster portals. The fast pass floods through every portal that is in front of the base portal, the full
+pass follows q3map's portal flow and clips each portal chain against the separating planes between source and pass
+windings. Both passes run one portal per task on the thread pool, the result is written as a VisData lump.
+*/
+
+class VisCompiler {
+public:
+    VisCompiler(BSPMap& map, ThreadPool& pool);
+
+    // Generates portals and computes cluster visibility, fastOnly stops after the flood pass
+    bool Compile(bool fastOnly);
+
+    const VisData& GetVisData() const { return visData; }
+    // Lumps to pass to BSPMap::Save, leafs are only included when clusters had to be assigned
+    std::map<LumpType, std::vector<char>> BuildLumps() const;
+
+    int GetClusterCount() const { return numClusters; }
+    int GetPortalCount() const { return static_cast<int>(portals.size()); }
+    bool AssignedClusters() const { return assignedClusters; }
+
+private:
+    struct Vec {
+        double x, y, z;
+    };
+
+    struct Plane {
+        Vec normal;
+        double dist;
+    };
+
+    typedef std::vector<Vec> Winding;
+
+    // Portal on the tree while it is being split, nodes[0] is on the front of the plane
+    struct TreePortal {
+        Plane plane;
+        int nodes[2];
+        Winding winding;
+    };
+
+    // One direction of a cluster portal, found in cluster's list and leading into leaf. The plane faces leaf.
+    struct Portal {
+        Plane plane;
+        Winding winding;
+        int cluster;
+        int leaf;
+        int mightSee;
+    };
+
+    // One step of a portal chain in the full pass
+    struct FlowStack {
+        Plane portalPlane;
+        Winding source;
+        Winding pass;
+        bool hasPass;
+        std::vector<uint64_t> mightSee;
+    };
+
+    enum PortalStatus {
+        STATUS_NONE,
+        STATUS_WORKING,
+        STATUS_DONE
+    };
+
+    void AssignClusters();
+    bool IsLeafSolid(int leaf) const;
+    bool InSolidBrush(int leaf, const Winding& points) const;
+    int PointLeaf(const Vec& point) const;
+
+    void MakeHeadnodePortals();
+    void MakeTreePortals(int node);
+    void MakeNodePortal(int node);
+    void SplitNodePortals(int node);
+    void AddPortalToNodes(int portal, int front, int back);
+    void RemovePortalFromNode(int portal, int node);
+    int ChildNode(int child) const;
+    void BuildClusterPortals();
+
+    void BasePortalVis(int portal);
+    void SimpleFlood(int portal, int cluster);
+    void PortalFlow(int portal);
+    void RecursiveClusterFlow(int cluster, int base, const FlowStack& prev);
+    void ClusterMerge();
+
+    bool TestBit(const std::vector<uint64_t>& bits, int index) const { return (bits[index >> 6] >> (index & 63)) & 1; }
+    void SetBit(std::vector<uint64_t>& bits, int index) const { bits[index >> 6] |= uint64_t(1) << (index & 63); }
+
+    BSPMap& map;
+    ThreadPool& pool;
+
+    std::vector<int> leafClusters;
+    int numClusters = 0;
+    bool assignedClusters = false;
+
+    // Tree nodes come first, then leafs, then the node outside the world
+    std::vector<std::vector<int>> nodePortals;
+    std::vector<TreePortal> treePortals;
+    int numNodes = 0;
+    int outsideNode = 0;
+    Vec worldMins = { 0.0, 0.0, 0.0 };
+    Vec worldMaxs = { 0.0, 0.0, 0.0 };
+
+    std::vector<Portal> portals;
+    std::vector<std::vector<int>> clusterPortals;
+    int portalWords = 0;
+    std::vector<std::vector<uint64_t>> portalFront;
+    std::vector<std::vector<uint64_t>> portalFlood;
+    std::vector<std::vector<uint64_t>> portalVis;
+    std::unique_ptr<std::atomic<int>[]> portalStatus;
+
+    VisData visData;
+};
+
+#endif // VISCOMPILER_H
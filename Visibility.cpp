@@ -0,0 +1,212 @@
+#include "Visibility.h"
+#include <algorithm>
+#include <iterator>
+
+Visibility::Visibility(const BSPMap& map) : map(map), frustumCuller(map) {
+    faceVisFrame.assign(map.GetFaces().size(), 0);
+
+    int numClusters = 0;
+    for (const Leaf& leaf : map.GetLeafs()) {
+        numClusters = std::max(numClusters, leaf.cluster + 1);
+    }
+    clusterMins.assign(numClusters, glm::vec3(1e30f));
+    clusterMaxs.assign(numClusters, glm::vec3(-1e30f));
+    for (const Leaf& leaf : map.GetLeafs()) {
+        if (leaf.cluster < 0) {
+            continue;
+        }
+        glm::vec3 mins(leaf.mins[0], leaf.mins[1], leaf.mins[2]);
+        glm::vec3 maxs(leaf.maxs[0], leaf.maxs[1], leaf.maxs[2]);
+        clusterMins[leaf.cluster] = glm::min(clusterMins[leaf.cluster], mins);
+        clusterMaxs[leaf.cluster] = glm::max(clusterMaxs[leaf.cluster], maxs);
+    }
+    clusterTestFrame.assign(numClusters, 0);
+    clusterVisible.assign(numClusters, 1);
+}
+
+int Visibility::FindLeaf(const glm::vec3& point) const {
+    const std::vector<Node>& nodes = map.GetNodes();
+    const std::vector<Plane>& planes = map.GetPlanes();
+    if (nodes.empty()) {
+        return 0;
+    }
+
+    // Negative child indices are leafs, stored as -(leaf + 1)
+    int index = 0;
+    while (index >= 0) {
+        const Node& node = nodes[index];
+        const Plane& plane = planes[node.plane];
+        float distance = plane.normal[0] * point.x + plane.normal[1] * point.y + plane.normal[2] * point.z - plane.distance;
+        index = distance >= 0.0f ? node.children[0] : node.children[1];
+    }
+    return -index - 1;
+}
+
+bool Visibility::IsClusterVisible(int from, int to) const {
+    const VisData& vis = map.GetVisData();
+    // No vis data or a camera outside the map sees everything, like Q3's novis
+    if (vis.numClusters == 0 || from < 0 || from >= vis.numClusters) {
+        return true;
+    }
+    if (to < 0 || to >= vis.numClusters) {
+        return false;
+    }
+    return (vis.bits[from * vis.bytesPerCluster + (to >> 3)] & (1 << (to & 7))) != 0;
+}
+
+const std::vector<int>& Visibility::GetClusterLeafs(int cluster) {
+    auto it = pvsCache.find(cluster);
+    if (it != pvsCache.end()) {
+        pvsLru.splice(pvsLru.begin(), pvsLru, it->second.lruPosition);
+        return it->second.leafs;
+    }
+
+    if (pvsCache.size() >= PVS_CACHE_SIZE) {
+        pvsCache.erase(pvsLru.back());
+        pvsLru.pop_back();
+    }
+
+    // Decode the cluster's row once into the list of leafs it can see
+    const std::vector<Leaf>& leafs = map.GetLeafs();
+    pvsLru.push_front(cluster);
+    CachedCluster& entry = pvsCache[cluster];
+    entry.lruPosition = pvsLru.begin();
+    for (int i = 0; i < static_cast<int>(leafs.size()); ++i) {
+        // Leafs outside every cluster are solid
+        if (leafs[i].cluster >= 0 && IsClusterVisible(cluster, leafs[i].cluster)) {
+            entry.leafs.push_back(i);
+        }
+    }
+    return entry.leafs;
+}
+
+void Visibility::BuildPVSLeafs() {
+    const std::vector<Leaf>& leafs = map.GetLeafs();
+    const std::vector<int>& clusterLeafs = GetClusterLeafs(currentCluster);
+
+    pvsLeafs.clear();
+    for (int i : clusterLeafs) {
+        if (!areaPortals || areaPortals->IsAreaReachable(leafs[i].area)) {
+            pvsLeafs.push_back(i);
+        }
+    }
+}
+
+void Visibility::GatherFaces() {
+    const std::vector<Leaf>& leafs = map.GetLeafs();
+    const std::vector<int>& leafFaces = map.GetLeafFaces();
+
+    visibleFaces.clear();
+    for (int i : visibleLeafs) {
+        const Leaf& leaf = leafs[i];
+        for (int j = 0; j < leaf.numLeafFaces; ++j) {
+            int face = leafFaces[leaf.firstLeafFace + j];
+            if (faceVisFrame[face] != visFrame) {
+                faceVisFrame[face] = visFrame;
+                visibleFaces.push_back(face);
+            }
+        }
+    }
+
+    // Sorted faces let the renderer merge neighbours into larger index ranges
+    std::sort(visibleFaces.begin(), visibleFaces.end());
+}
+
+bool Visibility::UpdatePVS(const glm::vec3& viewPosition) {
+    const std::vector<Leaf>& leafs = map.GetLeafs();
+
+    currentLeaf = FindLeaf(viewPosition);
+    currentCluster = currentLeaf < static_cast<int>(leafs.size()) ? leafs[currentLeaf].cluster : -1;
+
+    // The PVS leaf list only depends on the cluster and on which areas are reachable
+    unsigned int areaVersion = areaPortals ? areaPortals->GetVersion() : 0;
+    if (currentCluster == pvsCluster && areaVersion == pvsAreaVersion) {
+        return false;
+    }
+    pvsCluster = currentCluster;
+    pvsAreaVersion = areaVersion;
+    BuildPVSLeafs();
+
+    clusterMask.assign((clusterMins.size() + 31) / 32, 0);
+    for (int i : pvsLeafs) {
+        int cluster = leafs[i].cluster;
+        clusterMask[cluster >> 5] |= 1u << (cluster & 31);
+    }
+
+    // Update may run on a later frame, it still has to see the change
+    pvsPending = true;
+    viewsPvsPending = true;
+    return true;
+}
+
+void Visibility::Update(const glm::vec3& viewPosition, const Frustum& frustum) {
+    UpdatePVS(viewPosition);
+    bool pvsChanged = pvsPending;
+    pvsPending = false;
+
+    // Same PVS and same frustum gives the same result. The occlusion depth buffer is rendered
+    // from the same matrix, so it can't change the answer either.
+    reusedLastFrame = !pvsChanged && visFrame > 0 && std::equal(std::begin(frustum.planes), std::end(frustum.planes), std::begin(lastFrustum.planes));
+    lastFrustum = frustum;
+    if (reusedLastFrame) {
+        return;
+    }
+
+    frustumCuller.Cull(frustum, pvsLeafs, pvsChanged, visibleLeafs);
+
+    ++visFrame;
+    RejectOccludedLeafs();
+
+    // Moving inside the cluster often leaves the visible leafs untouched
+    if (visibleLeafs == previousVisibleLeafs && visFrame > 1) {
+        return;
+    }
+    previousVisibleLeafs = visibleLeafs;
+    GatherFaces();
+}
+
+void Visibility::CullViews(const Frustum* frusta, int viewCount, std::vector<int>* visibleLeafs) {
+    frustumCuller.CullViews(frusta, viewCount, pvsLeafs, viewsPvsPending, visibleLeafs);
+    viewsPvsPending = false;
+}
+
+void Visibility::RejectOccludedLeafs() {
+    occludedLeafs = 0;
+    if (!occlusionCuller) {
+        return;
+    }
+
+    const std::vector<Leaf>& leafs = map.GetLeafs();
+    size_t kept = 0;
+    for (size_t i = 0; i < visibleLeafs.size(); ++i) {
+        const Leaf& leaf = leafs[visibleLeafs[i]];
+        // The camera's own leaf is always visible
+        bool visible = visibleLeafs[i] == currentLeaf;
+
+        // Test the whole cluster once per frame, a hidden cluster hides all of its leafs
+        if (!visible && leaf.cluster >= 0) {
+            if (clusterTestFrame[leaf.cluster] != visFrame) {
+                clusterTestFrame[leaf.cluster] = visFrame;
+                clusterVisible[leaf.cluster] = occlusionCuller->IsBoxVisible(clusterMins[leaf.cluster], clusterMaxs[leaf.cluster]) ? 1 : 0;
+            }
+            visible = clusterVisible[leaf.cluster] &&
+                occlusionCuller->IsBoxVisible(glm::vec3(leaf.mins[0], leaf.mins[1], leaf.mins[2]), glm::vec3(leaf.maxs[0], leaf.maxs[1], leaf.maxs[2]));
+        }
+
+        if (visible) {
+            visibleLeafs[kept++] = visibleLeafs[i];
+        }
+        else {
+            ++occludedLeafs;
+        }
+    }
+    visibleLeafs.resize(kept);
+}
+
+const std::vector<int>& Visibility::GetVisibleLeafs() const {
+    return visibleLeafs;
+}
+
+const std::vector<int>& Visibility::GetVisibleFaces() const {
+    return visibleFaces;
+}
@@ -0,0 +1,108 @@
+#ifndef VISIBILITY_H
+#define VISIBILITY_H
+
+#include <glm/glm.hpp>
+#include <vector>
+#include <list>
+#include <unordered_map>
+#include "BSPMap.h"
+#include "Frustum.h"
+#include "FrustumCuller.h"
+#include "OcclusionCuller.h"
+#include "AreaPortals.h"
+
+/*
+Potentially visible set (PVS) culling. Every frame the camera's leaf is found by walking the node tree,
+and the vis data row of its cluster decides which leafs can be seen at all. Leafs in areas sealed off by
+closed area portals are rejected before that. Those leafs are then frustum
+culled through the node tree and, when an OcclusionCuller is set, tested against its depth buffer first
+per cluster and then per leaf. The faces of the survivors make up the visible face list.
+
+Most frames the camera stays in the same cluster, so the work is cached: decoded PVS rows are kept per
+cluster in a small LRU, the PVS leaf list is only rebuilt when the cluster or the reachable areas change,
+and a frame with the same frustum as the last one reuses the previous visible set outright.
+*/
+
+class Visibility {
+public:
+    Visibility(const BSPMap& map);
+
+    // Index of the leaf containing point (in map space)
+    int FindLeaf(const glm::vec3& point) const;
+
+    // True if anything in cluster "to" can be seen from cluster "from"
+    bool IsClusterVisible(int from, int to) const;
+
+    // Optional area connectivity, rejects leafs in areas the camera can't reach
+    void SetAreaPortals(const AreaPortals* portals) { areaPortals = portals; }
+
+    // Optional software occlusion test, its depth buffer must be rendered before Update
+    void SetOcclusionCuller(const OcclusionCuller* culler) { occlusionCuller = culler; }
+
+    // Rebuilds the visible leaf and face lists for a camera at viewPosition, frustum in map space
+    void Update(const glm::vec3& viewPosition, const Frustum& frustum);
+
+    // Only finds the camera's cluster and rebuilds the PVS, enough for GetClusterMask. True if the PVS changed.
+    bool UpdatePVS(const glm::vec3& viewPosition);
+    // Culls extra views seen from the camera's PVS (shadow cascades, mirrors) in one traversal, after Update or
+    // UpdatePVS. visibleLeafs needs viewCount lists, at most FrustumCuller::MAX_VIEWS views are culled.
+    void CullViews(const Frustum* frusta, int viewCount, std::vector<int>* visibleLeafs);
+
+    // One bit per cluster in the PVS and in a reachable area, as uploaded to the GPU culler
+    const std::vector<unsigned int>& GetClusterMask() const { return clusterMask; }
+
+    const std::vector<int>& GetPVSLeafs() const { return pvsLeafs; }
+    const std::vector<int>& GetVisibleLeafs() const;
+    const std::vector<int>& GetVisibleFaces() const; // Sorted by face index
+    int GetOccludedLeafCount() const { return occludedLeafs; }
+    bool WasReused() const { return reusedLastFrame; } // True if the last Update kept the previous visible set
+    int GetCurrentLeaf() const { return currentLeaf; }
+    int GetCurrentCluster() const { return currentCluster; }
+
+private:
+    void RejectOccludedLeafs();
+    const std::vector<int>& GetClusterLeafs(int cluster);
+    void BuildPVSLeafs();
+    void GatherFaces();
+
+    static const size_t PVS_CACHE_SIZE = 64;
+
+    const BSPMap& map;
+    FrustumCuller frustumCuller;
+    const OcclusionCuller* occlusionCuller = nullptr;
+    const AreaPortals* areaPortals = nullptr;
+
+    // Union of the leaf boxes of each cluster, and the frame each cluster was last occlusion tested
+    std::vector<glm::vec3> clusterMins;
+    std::vector<glm::vec3> clusterMaxs;
+    std::vector<int> clusterTestFrame;
+    std::vector<unsigned char> clusterVisible;
+    int occludedLeafs = 0;
+
+    // Decoded PVS rows: leafs visible from a cluster before area rejection, most recent at the front
+    struct CachedCluster {
+        std::vector<int> leafs;
+        std::list<int>::iterator lruPosition;
+    };
+    std::unordered_map<int, CachedCluster> pvsCache;
+    std::list<int> pvsLru;
+
+    std::vector<int> pvsLeafs;
+    int pvsCluster = -2;             // Cluster pvsLeafs was built for, -2 before the first update
+    unsigned int pvsAreaVersion = 0;
+    bool pvsPending = false;         // PVS changed since the last Update
+    bool viewsPvsPending = false;    // Same for CullViews
+    std::vector<unsigned int> clusterMask;
+    Frustum lastFrustum;
+    bool reusedLastFrame = false;
+    std::vector<int> previousVisibleLeafs;
+    std::vector<int> visibleLeafs;
+    std::vector<int> visibleFaces;
+    std::vector<int> faceVisFrame; // Frame a face was last added, stops faces shared by leafs being added twice
+    int visFrame = 0;
+
+    int currentLeaf = -1;
+    int currentCluster = -1;
+};
+
+#endif // VISIBILITY_H
@@ -0,0 +1,114 @@
+#include "Winding.h"
+#include <cmath>
+
+static const float SNAP_EPSILON = 0.0001f;
+
+enum WindingSide {
+    SIDE_FRONT,
+    SIDE_BACK,
+    SIDE_ON
+};
+
+Winding BaseWindingForPlane(const glm::vec3& normal, float dist) {
+    int axis = 0;
+    float best = -MAX_WORLD_COORD;
+    for (int i = 0; i < 3; ++i) {
+        if (std::fabs(normal[i]) > best) {
+            best = std::fabs(normal[i]);
+            axis = i;
+        }
+    }
+
+    glm::vec3 up(0.0f);
+    if (axis == 2) {
+        up.x = 1.0f;
+    }
+    else {
+        up.z = 1.0f;
+    }
+    up = glm::normalize(up - glm::dot(up, normal) * normal);
+    glm::vec3 right = glm::cross(up, normal);
+    glm::vec3 origin = normal * dist;
+    up *= MAX_WORLD_COORD;
+    right *= MAX_WORLD_COORD;
+
+    return Winding{ origin - right + up, origin + right + up, origin + right - up, origin - right - up };
+}
+
+void ChopWinding(Winding& winding, const glm::vec3& normal, float dist, float epsilon) {
+    const int count = static_cast<int>(winding.size());
+    std::vector<float> dists(count);
+    std::vector<int> sides(count);
+    int front = 0, back = 0;
+    for (int i = 0; i < count; ++i) {
+        dists[i] = glm::dot(winding[i], normal) - dist;
+        if (dists[i] > epsilon) {
+            sides[i] = SIDE_FRONT;
+            ++front;
+        }
+        else if (dists[i] < -epsilon) {
+            sides[i] = SIDE_BACK;
+            ++back;
+        }
+        else {
+            sides[i] = SIDE_ON;
+        }
+    }
+    if (!front) {
+        winding.clear();
+        return;
+    }
+    if (!back) {
+        return;
+    }
+
+    Winding result;
+    for (int i = 0; i < count; ++i) {
+        const glm::vec3& p1 = winding[i];
+        if (sides[i] == SIDE_ON) {
+            result.push_back(p1);
+            continue;
+        }
+        if (sides[i] == SIDE_FRONT) {
+            result.push_back(p1);
+        }
+        int next = (i + 1) % count;
+        if (sides[next] == SIDE_ON || sides[next] == sides[i]) {
+            continue;
+        }
+
+        // Split point, axial planes keep their exact distance
+        const glm::vec3& p2 = winding[next];
+        float t = dists[i] / (dists[i] - dists[next]);
+        glm::vec3 mid;
+        for (int j = 0; j < 3; ++j) {
+            if (normal[j] == 1.0f) {
+                mid[j] = dist;
+            }
+            else if (normal[j] == -1.0f) {
+                mid[j] = -dist;
+            }
+            else {
+                mid[j] = p1[j] + t * (p2[j] - p1[j]);
+            }
+        }
+        result.push_back(mid);
+    }
+    winding.swap(result);
+}
+
+void SnapVector(glm::vec3& normal) {
+    for (int i = 0; i < 3; ++i) {
+        if (std::fabs(normal[i] - 1.0f) < SNAP_EPSILON) {
+            normal = glm::vec3(0.0f);
+            normal[i] = 1.0f;
+            return;
+        }
+        if (std::fabs(normal[i] + 1.0f) < SNAP_EPSILON) {
+            normal = glm::vec3(0.0f);
+            normal[i] = -1.0f;
+            return;
+        }
+    }
+}
+
@@ -0,0 +1,26 @@
+#ifndef WINDING_H
+#define WINDING_H
+
+#include <glm/glm.hpp>
+#include <vector>
+
+/*
+Convex polygons used to find the shape of brushes and patch facets from their planes. A base winding is a
+square on a plane as large as any map, chopping it by the planes around it leaves the actual face.
+*/
+
+typedef std::vector<glm::vec3> Winding;
+
+// Largest axis aligned extent a map can have
+static const float MAX_WORLD_COORD = 65535.0f;
+
+Winding BaseWindingForPlane(const glm::vec3& normal, float dist);
+
+// Keeps the part of the winding in front of the plane, points within epsilon of it count as on it.
+// An empty winding means nothing was left.
+void ChopWinding(Winding& winding, const glm::vec3& normal, float dist, float epsilon);
+
+// Snaps vectors that are within epsilon of an axis onto it
+void SnapVector(glm::vec3& normal);
+
+#endif // WINDING_H
@@ -0,0 +1,103 @@
+#version 330 core
+out vec4 FragColor;
+
+in vec2 TexCoord;
+in vec4 Color;
+#ifndef VERTEX_LIT
+in vec3 LightmapCoord; // z is the lightmap layer, -1 for vertex lit faces
+#endif
+in vec3 MapPosition;
+in vec3 Normal;
+in float ViewDepth;
+
+// VERTEX_LIT builds the low end permutation, like Q3's r_vertexLight: every face uses its vertex colors and the
+// lightmaps are never sampled
+#ifndef VERTEX_LIT
+uniform sampler2DArray lightmaps;
+#endif
+
+// Clustered dynamic lights (see ClusteredLights). Each light is two texels, origin and radius then color.
+// A cluster holds the first index and count of its lights in lightIndices.
+uniform samplerBuffer dynamicLights;
+uniform usamplerBuffer lightClusters;
+uniform usamplerBuffer lightIndices;
+uniform int dynamicLightCount;
+uniform vec3 clusterGrid;
+uniform vec2 clusterDepth; // slice = log(depth) * x + y
+uniform vec2 viewportSize;
+
+// Shadowed lights have six tiles in the atlas (see ShadowAtlas), one per cube face. A light's color texel keeps its
+// shadow in w, -1 for none.
+const int MAX_SHADOWS = 16;
+const float SHADOW_NEAR = 4.0;
+uniform sampler2DShadow shadowAtlas;
+uniform vec4 shadowFaces[MAX_SHADOWS * 6]; // Tile corner and size in the atlas, half a texel of the tile
+
+// Fraction of a light that reaches toPoint, the faces are picked like GL picks cube map faces
+float LightShadow(int shadow, vec3 toPoint, float radius) {
+    vec3 axis = abs(toPoint);
+    int face;
+    float major;
+    vec2 st;
+    if (axis.x >= axis.y && axis.x >= axis.z) {
+        face = toPoint.x > 0.0 ? 0 : 1;
+        major = axis.x;
+        st = vec2(toPoint.x > 0.0 ? -toPoint.z : toPoint.z, -toPoint.y);
+    }
+    else if (axis.y >= axis.z) {
+        face = toPoint.y > 0.0 ? 2 : 3;
+        major = axis.y;
+        st = vec2(toPoint.x, toPoint.y > 0.0 ? toPoint.z : -toPoint.z);
+    }
+    else {
+        face = toPoint.z > 0.0 ? 4 : 5;
+        major = axis.z;
+        st = vec2(toPoint.z > 0.0 ? toPoint.x : -toPoint.x, -toPoint.y);
+    }
+    vec4 tile = shadowFaces[shadow * 6 + face];
+    // Filtering never reaches past the tile into another light's
+    vec2 uv = clamp(st / major * 0.5 + 0.5, tile.w, 1.0 - tile.w);
+
+    // Same depth as the face's perspective from SHADOW_NEAR to the radius
+    float farPlane = max(radius, SHADOW_NEAR * 2.0);
+    float depth = (farPlane + SHADOW_NEAR - 2.0 * farPlane * SHADOW_NEAR / max(major, SHADOW_NEAR)) / (farPlane - SHADOW_NEAR);
+    return texture(shadowAtlas, vec3(tile.xy + uv * tile.z, depth * 0.5 + 0.5));
+}
+
+vec3 DynamicLight() {
+    if (dynamicLightCount == 0) {
+        return vec3(0.0);
+    }
+    ivec3 grid = ivec3(clusterGrid);
+    ivec2 tile = clamp(ivec2(gl_FragCoord.xy / viewportSize * clusterGrid.xy), ivec2(0), grid.xy - 1);
+    int slice = clamp(int(log(max(ViewDepth, 0.001)) * clusterDepth.x + clusterDepth.y), 0, grid.z - 1);
+    uvec2 cluster = texelFetch(lightClusters, (slice * grid.y + tile.y) * grid.x + tile.x).rg;
+
+    vec3 normal = normalize(Normal);
+    vec3 light = vec3(0.0);
+    for (uint i = 0u; i < cluster.y; ++i) {
+        int index = int(texelFetch(lightIndices, int(cluster.x + i)).r);
+        vec4 originRadius = texelFetch(dynamicLights, index * 2);
+        vec3 toLight = originRadius.xyz - MapPosition;
+        float distance = length(toLight);
+        float falloff = clamp(1.0 - distance / originRadius.w, 0.0, 1.0);
+        vec4 colorShadow = texelFetch(dynamicLights, index * 2 + 1);
+        float lit = falloff * falloff * max(dot(normal, toLight / max(distance, 0.001)), 0.0);
+        // Pushed off the surface a little so it doesn't shadow itself
+        if (colorShadow.w >= 0.0 && lit > 0.0) {
+            lit *= LightShadow(int(colorShadow.w), MapPosition + normal - originRadius.xyz, originRadius.w);
+        }
+        light += colorShadow.rgb * lit;
+    }
+    return light;
+}
+
+void main() {
+    // Map textures are not loaded yet, the baked lighting gives a usable preview
+#ifdef VERTEX_LIT
+    vec3 light = Color.rgb;
+#else
+    vec3 light = LightmapCoord.z >= 0.0 ? texture(lightmaps, LightmapCoord).rgb : Color.rgb;
+#endif
+    FragColor = vec4(light + DynamicLight(), 1.0);
+}
@@ -0,0 +1,35 @@
+#version 330 core
+layout (location = 0) in vec3 aPos;
+layout (location = 1) in vec2 aTexCoord;
+layout (location = 2) in vec2 aLmCoord;
+layout (location = 3) in vec4 aColor;
+layout (location = 8) in float aLightmapLayer; // -1 for vertex lit faces
+layout (location = 9) in vec3 aNormal;
+
+uniform mat4 model;
+uniform mat4 view;
+uniform mat4 projection;
+
+out vec2 TexCoord;
+out vec4 Color;
+#ifndef VERTEX_LIT
+out vec3 LightmapCoord;
+#endif
+out vec3 MapPosition;
+out vec3 Normal;
+out float ViewDepth;
+
+void main() {
+    // view already contains the map to camera conversion
+    vec4 mapPosition = model * vec4(aPos, 1.0);
+    vec4 viewPosition = view * mapPosition;
+    gl_Position = projection * viewPosition;
+    TexCoord = aTexCoord;
+    Color = aColor;
+#ifndef VERTEX_LIT
+    LightmapCoord = vec3(aLmCoord, aLightmapLayer);
+#endif
+    MapPosition = mapPosition.xyz;
+    Normal = mat3(model) * aNormal;
+    ViewDepth = -viewPosition.z;
+}
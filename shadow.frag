@@ -0,0 +1,5 @@
+#version 330 core
+
+// Shadow atlas faces only need depth
+void main() {
+}